@@ -1,24 +1,10 @@
 #include "lib.h"
 
 
-struct obj_less {
-  bool operator () (OBJ obj1, OBJ obj2) {
-    return comp_objs(obj1, obj2) > 0;
-  }
-};
-
-struct obj_inline_less {
-  bool operator () (OBJ obj1, OBJ obj2) {
-    return shallow_cmp(obj1, obj2) > 0;
-  }
-};
-
-////////////////////////////////////////////////////////////////////////////////
-
 uint32 find_obj(OBJ *sorted_array, uint32 len, OBJ obj, bool &found) { // The array mustn't contain duplicates
   if (len > 0) {
     int64 low_idx = 0;
-    int64 high_idx = len - 1;
+    int64 high_idx = (int64) len - 1;
 
     while (low_idx <= high_idx) {
       int64 middle_idx = (low_idx + high_idx) / 2;
@@ -42,27 +28,119 @@ uint32 find_obj(OBJ *sorted_array, uint32 len, OBJ obj, bool &found) { // The ar
   return -1;
 }
 
+// Returns the index of the first element that is greater than or equal to <obj>,
+// which is where <obj> would have to be inserted to keep the array sorted
+uint32 lower_bound(OBJ *sorted_array, uint32 len, OBJ obj) {
+  uint32 low = 0;
+  uint32 high = len;
+  while (low < high) {
+    uint32 middle = (low + high) / 2;
+    if (comp_objs(sorted_array[middle], obj) > 0)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  return low;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Returns the length of the longest prefix of [0, len) whose elements all satisfy <eq>,
+// which must be true for an initial segment of the range and false for the rest. The
+// length of the prefix is first bracketed by doubling it, and then binary searched,
+// so that finding a prefix of length n only takes O(log n) calls to <eq>
+template <typename EQ> static uint32 equal_prefix_length(uint32 len, EQ eq) {
+  uint32 count = 0;
+  uint64 next = 1;
+  while (next <= len && eq(next - 1)) {
+    count = next;
+    next *= 2;
+  }
+
+  uint32 low = count;
+  uint32 high = next <= len ? next - 1 : len;
+  while (low < high) {
+    uint32 middle = low + (high - low) / 2;
+    if (eq(middle))
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  return low;
+}
+
+template <typename EQ> struct reversed_eq {
+  EQ eq;
+  uint32 len;
+  reversed_eq(EQ eq, uint32 len) : eq(eq), len(len) {}
+
+  bool operator () (uint32 idx) {
+    return eq(len - 1 - idx);
+  }
+};
+
+template <typename EQ> static uint32 equal_suffix_length(uint32 len, EQ eq) {
+  return equal_prefix_length(len, reversed_eq<EQ>(eq, len));
+}
+
+struct obj_eq {
+  OBJ *objs;
+  OBJ obj;
+  obj_eq(OBJ *objs, OBJ obj) : objs(objs), obj(obj) {}
+
+  bool operator () (uint32 idx) {
+    return comp_objs(obj, objs[idx]) == 0;
+  }
+};
+
+struct idx_obj_eq {
+  uint32 *index;
+  OBJ *values;
+  OBJ obj;
+  idx_obj_eq(uint32 *index, OBJ *values, OBJ obj) : index(index), values(values), obj(obj) {}
+
+  bool operator () (uint32 idx) {
+    return comp_objs(obj, values[index[idx]]) == 0;
+  }
+};
+
+struct obj_pair_eq {
+  OBJ *major_col, *minor_col;
+  OBJ major_arg, minor_arg;
+  obj_pair_eq(OBJ *major_col, OBJ *minor_col, OBJ major_arg, OBJ minor_arg) :
+    major_col(major_col), minor_col(minor_col), major_arg(major_arg), minor_arg(minor_arg) {}
+
+  bool operator () (uint32 idx) {
+    return comp_objs(major_arg, major_col[idx]) == 0 && comp_objs(minor_arg, minor_col[idx]) == 0;
+  }
+};
+
+struct idx_obj_pair_eq {
+  uint32 *index;
+  OBJ *major_col, *minor_col;
+  OBJ major_arg, minor_arg;
+  idx_obj_pair_eq(uint32 *index, OBJ *major_col, OBJ *minor_col, OBJ major_arg, OBJ minor_arg) :
+    index(index), major_col(major_col), minor_col(minor_col), major_arg(major_arg), minor_arg(minor_arg) {}
+
+  bool operator () (uint32 idx) {
+    uint32 row = index[idx];
+    return comp_objs(major_arg, major_col[row]) == 0 && comp_objs(minor_arg, minor_col[row]) == 0;
+  }
+};
+
 ////////////////////////////////////////////////////////////////////////////////
 
 uint32 count_at_start(uint32 *sorted_idx_array, OBJ *values, uint32 len, OBJ obj) {
-  //## IMPLEMENT FOR REAL...
-  int c = 0;
-  while (c < len && comp_objs(obj, values[sorted_idx_array[c]]) == 0)
-    c++;
-  return c;
+  return equal_prefix_length(len, idx_obj_eq(sorted_idx_array, values, obj));
 }
 
 uint32 count_at_end(uint32 *sorted_idx_array, OBJ *values, uint32 len, OBJ obj) {
-  //## IMPLEMENT FOR REAL...
-  int c = 0;
-  while (c < len && comp_objs(obj, values[sorted_idx_array[len-1-c]]) == 0)
-    c++;
-  return c;
+  return equal_suffix_length(len, idx_obj_eq(sorted_idx_array, values, obj));
 }
 
 uint32 find_idxs_range(uint32 *sorted_idx_array, OBJ *values, uint32 len, OBJ obj, uint32 &count) {
   int64 low_idx = 0;
-  int64 high_idx = len - 1;
+  int64 high_idx = (int64) len - 1;
 
   while (low_idx <= high_idx) {
     int64 middle_idx = (low_idx + high_idx) / 2;
@@ -71,8 +149,8 @@ uint32 find_idxs_range(uint32 *sorted_idx_array, OBJ *values, uint32 len, OBJ ob
     int cr = comp_objs(obj, middle_obj);
 
     if (cr == 0) {
-      int count_up = count_at_start(sorted_idx_array + middle_idx + 1, values, len - middle_idx - 1, obj);
-      int count_down = count_at_end(sorted_idx_array, values, middle_idx, obj);
+      uint32 count_up = count_at_start(sorted_idx_array + middle_idx + 1, values, len - middle_idx - 1, obj);
+      uint32 count_down = count_at_end(sorted_idx_array, values, middle_idx, obj);
       count = 1 + count_up + count_down;
       return middle_idx - count_down;
     }
@@ -90,24 +168,16 @@ uint32 find_idxs_range(uint32 *sorted_idx_array, OBJ *values, uint32 len, OBJ ob
 ////////////////////////////////////////////////////////////////////////////////
 
 uint32 count_at_start(OBJ *sorted_array, uint32 len, OBJ obj) {
-  //## IMPLEMENT FOR REAL...
-  int c = 0;
-  while (c < len && comp_objs(obj, sorted_array[c]) == 0)
-    c++;
-  return c;
+  return equal_prefix_length(len, obj_eq(sorted_array, obj));
 }
 
 uint32 count_at_end(OBJ *sorted_array, uint32 len, OBJ obj) {
-  //## IMPLEMENT FOR REAL...
-  int c = 0;
-  while (c < len && comp_objs(obj, sorted_array[len-1-c]) == 0)
-    c++;
-  return c;
+  return equal_suffix_length(len, obj_eq(sorted_array, obj));
 }
 
 uint32 find_objs_range(OBJ *sorted_array, uint32 len, OBJ obj, uint32 &count) {
   int64 low_idx = 0;
-  int64 high_idx = len - 1;
+  int64 high_idx = (int64) len - 1;
 
   while (low_idx <= high_idx) {
     int64 middle_idx = (low_idx + high_idx) / 2;
@@ -116,8 +186,8 @@ uint32 find_objs_range(OBJ *sorted_array, uint32 len, OBJ obj, uint32 &count) {
     int cr = comp_objs(obj, middle_obj);
 
     if (cr == 0) {
-      int count_up = count_at_start(sorted_array + middle_idx + 1, len - middle_idx - 1, obj);
-      int count_down = count_at_end(sorted_array, middle_idx, obj);
+      uint32 count_up = count_at_start(sorted_array + middle_idx + 1, len - middle_idx - 1, obj);
+      uint32 count_down = count_at_end(sorted_array, middle_idx, obj);
       count = 1 + count_up + count_down;
       return middle_idx - count_down;
     }
@@ -135,24 +205,16 @@ uint32 find_objs_range(OBJ *sorted_array, uint32 len, OBJ obj, uint32 &count) {
 ////////////////////////////////////////////////////////////////////////////////
 
 uint32 count_at_start(OBJ *major_col, OBJ *minor_col, uint32 len, OBJ major_arg, OBJ minor_arg) {
-  //## IMPLEMENT FOR REAL...
-  int c = 0;
-  while (c < len && comp_objs(major_arg, major_col[c]) == 0 && comp_objs(minor_arg, minor_col[c]) == 0)
-    c++;
-  return c;
+  return equal_prefix_length(len, obj_pair_eq(major_col, minor_col, major_arg, minor_arg));
 }
 
 uint32 count_at_end(OBJ *major_col, OBJ *minor_col, uint32 len, OBJ major_arg, OBJ minor_arg) {
-  //## IMPLEMENT FOR REAL...
-  int c = 0;
-  while (c < len && comp_objs(major_arg, major_col[len-1-c]) == 0 && comp_objs(minor_arg, minor_col[len-1-c]) == 0)
-    c++;
-  return c;
+  return equal_suffix_length(len, obj_pair_eq(major_col, minor_col, major_arg, minor_arg));
 }
 
 uint32 find_objs_range(OBJ *major_col, OBJ *minor_col, uint32 len, OBJ major_arg, OBJ minor_arg, uint32 &count) {
   int64 low_idx = 0;
-  int64 high_idx = len - 1;
+  int64 high_idx = (int64) len - 1;
 
   while (low_idx <= high_idx) {
     int64 idx = (low_idx + high_idx) / 2;
@@ -162,8 +224,8 @@ uint32 find_objs_range(OBJ *major_col, OBJ *minor_col, uint32 len, OBJ major_arg
       cr = comp_objs(minor_arg, minor_col[idx]);
 
     if (cr == 0) {
-      int count_up = count_at_start(major_col+idx+1, minor_col+idx+1, len-idx-1, major_arg, minor_arg);
-      int count_down = count_at_end(major_col, minor_col, idx, major_arg, minor_arg);
+      uint32 count_up = count_at_start(major_col+idx+1, minor_col+idx+1, len-idx-1, major_arg, minor_arg);
+      uint32 count_down = count_at_end(major_col, minor_col, idx, major_arg, minor_arg);
       count = 1 + count_up + count_down;
       return idx - count_down;
     }
@@ -181,34 +243,16 @@ uint32 find_objs_range(OBJ *major_col, OBJ *minor_col, uint32 len, OBJ major_arg
 ////////////////////////////////////////////////////////////////////////////////
 
 uint32 count_at_start(uint32 *index, OBJ *major_col, OBJ *minor_col, uint32 len, OBJ major_arg, OBJ minor_arg) {
-  //## IMPLEMENT FOR REAL...
-  int c = 0;
-  while (c < len) {
-    uint32 idx = index[c];
-    if (comp_objs(major_arg, major_col[idx]) == 0 && comp_objs(minor_arg, minor_col[idx]) == 0)
-      c++;
-    else
-      break;
-  }
-  return c;
+  return equal_prefix_length(len, idx_obj_pair_eq(index, major_col, minor_col, major_arg, minor_arg));
 }
 
 uint32 count_at_end(uint32 *index, OBJ *major_col, OBJ *minor_col, uint32 len, OBJ major_arg, OBJ minor_arg) {
-  //## IMPLEMENT FOR REAL...
-  int c = 0;
-  while (c < len) {
-    uint32 idx = index[len-c-1];
-    if (comp_objs(major_arg, major_col[idx]) == 0 and comp_objs(minor_arg, minor_col[idx]) == 0)
-      c++;
-    else
-      break;
-  }
-  return c;
+  return equal_suffix_length(len, idx_obj_pair_eq(index, major_col, minor_col, major_arg, minor_arg));
 }
 
 uint32 find_idxs_range(uint32 *index, OBJ *major_col, OBJ *minor_col, uint32 len, OBJ major_arg, OBJ minor_arg, uint32 &count) {
   int64 low_idx = 0;
-  int64 high_idx = len - 1;
+  int64 high_idx = (int64) len - 1;
 
   while (low_idx <= high_idx) {
     int64 idx = (low_idx + high_idx) / 2;
@@ -219,8 +263,8 @@ uint32 find_idxs_range(uint32 *index, OBJ *major_col, OBJ *minor_col, uint32 len
       cr = comp_objs(minor_arg, minor_col[dr_idx]);
 
     if (cr == 0) {
-      int count_up = count_at_start(index+idx+1, major_col, minor_col, len-idx-1, major_arg, minor_arg);
-      int count_down = count_at_end(index, major_col, minor_col, idx, major_arg, minor_arg);
+      uint32 count_up = count_at_start(index+idx+1, major_col, minor_col, len-idx-1, major_arg, minor_arg);
+      uint32 count_down = count_at_end(index, major_col, minor_col, idx, major_arg, minor_arg);
       count = 1 + count_up + count_down;
       return idx - count_down;
     }
@@ -264,7 +308,7 @@ uint32 sort_and_release_dups(OBJ *objs, uint32 size) {
 
   uint32 idx = 0;
   if (inline_count > 0) {
-    std::sort(objs, objs+inline_count, obj_inline_less());
+    sort_inline_obj_array(objs, inline_count);
 
     OBJ last_obj = objs[0];
     for (uint32 i=1 ; i < inline_count ; i++) {
@@ -283,7 +327,7 @@ uint32 sort_and_release_dups(OBJ *objs, uint32 size) {
       return idx;
   }
 
-  std::sort(objs+inline_count, objs+size, obj_less());
+  sort_obj_array(objs+inline_count, size-inline_count);
 
   if (idx != inline_count)
     objs[idx] = objs[inline_count];
@@ -379,10 +423,6 @@ uint32 sort_and_check_no_dups(OBJ *keys, OBJ *values, uint32 size) {
 }
 
 
-void sort_obj_array(OBJ *objs, uint32 len) {
-  std::sort(objs, objs+len, obj_less());
-}
-
 ////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -421,6 +461,12 @@ int comp_objs(OBJ obj1, OBJ obj2) {
       uint32 len2 = get_seq_length(obj2);
       if (len1 != len2)
         return len2 - len1; //## BUG BUG BUG
+      // Packed sequences are compared without materializing them
+      if (get_physical_type(obj1) == TYPE_PACKED_SEQ | get_physical_type(obj2) == TYPE_PACKED_SEQ)
+        return comp_packed_seqs(obj1, obj2);
+      // And so are tree sequences
+      if (get_physical_type(obj1) == TYPE_TREE_SEQ | get_physical_type(obj2) == TYPE_TREE_SEQ)
+        return comp_tree_seqs(obj1, obj2);
       count = len1;
       elems1 = get_seq_buffer_ptr(obj1);
       elems2 = get_seq_buffer_ptr(obj2);
@@ -441,12 +487,15 @@ int comp_objs(OBJ obj1, OBJ obj2) {
     }
 
     case TYPE_BIN_REL: {
-      BIN_REL_OBJ *rel1 = get_bin_rel_ptr(obj1);
-      BIN_REL_OBJ *rel2 = get_bin_rel_ptr(obj2);
-      uint32 size1 = rel1->size;
-      uint32 size2 = rel2->size;
+      uint32 size1 = get_size(obj1);
+      uint32 size2 = get_size(obj2);
       if (size1 != size2)
         return size2 - size1; //## BUG BUG BUG
+      // Tree maps are compared without building their array view
+      if (get_physical_type(obj1) == TYPE_TREE_MAP | get_physical_type(obj2) == TYPE_TREE_MAP)
+        return comp_tree_maps(obj1, obj2);
+      BIN_REL_OBJ *rel1 = get_bin_rel_ptr(obj1);
+      BIN_REL_OBJ *rel2 = get_bin_rel_ptr(obj2);
       count = 2 * size1;
       elems1 = rel1->buffer;
       elems2 = rel2->buffer;
@@ -1,5 +1,7 @@
 #include "lib.h"
 
+#include <atomic>
+
 
 bool inline_eq(OBJ obj1, OBJ obj2) {
   // assert(is_inline_obj(obj2) & !is_float(obj2));
@@ -32,7 +34,7 @@ bool has_elem(OBJ set, OBJ elem) {
     return false;
   SET_OBJ *s = get_set_ptr(set);
   bool found;
-  find_obj(s->buffer, s->size, elem, found);
+  find_obj(s->buffer, s->size, elem, found, &s->search_index);
   return found;
 }
 
@@ -40,6 +42,11 @@ bool has_pair(OBJ rel, OBJ arg0, OBJ arg1) {
   if (is_empty_rel(rel))
     return false;
 
+  if (get_physical_type(rel) == TYPE_TREE_MAP) {
+    OBJ value;
+    return tree_map_lookup(get_tree_map_ptr(rel), arg0, value) && comp_objs(value, arg1) == 0;
+  }
+
   BIN_REL_OBJ *ptr = get_bin_rel_ptr(rel);
   uint32 size = ptr->size;
   OBJ *left_col = get_left_col_array_ptr(ptr);
@@ -47,14 +54,14 @@ bool has_pair(OBJ rel, OBJ arg0, OBJ arg1) {
 
   if (is_ne_map(rel)) {
     bool found;
-    uint32 idx = find_obj(left_col, size, arg0, found);
+    uint32 idx = find_obj(left_col, size, arg0, found, &ptr->search_index);
     if (!found)
       return false;
     return comp_objs(right_col[idx], arg1) == 0;
   }
 
   uint32 count;
-  uint32 idx = find_objs_range(left_col, size, arg0, count);
+  uint32 idx = find_objs_range(left_col, size, arg0, count, &ptr->search_index);
   if (count == 0)
     return false;
   bool found;
@@ -66,24 +73,34 @@ bool has_key(OBJ rel, OBJ arg1) {
   if (is_empty_rel(rel))
     return false;
 
+  if (get_physical_type(rel) == TYPE_TREE_MAP) {
+    OBJ value;
+    return tree_map_lookup(get_tree_map_ptr(rel), arg1, value);
+  }
+
   BIN_REL_OBJ *ptr = get_bin_rel_ptr(rel);
   uint32 size = ptr->size;
   OBJ *left_col = get_left_col_array_ptr(ptr);
 
   if (is_ne_map(rel)) {
     bool found;
-    uint32 idx = find_obj(left_col, size, arg1, found);
+    uint32 idx = find_obj(left_col, size, arg1, found, &ptr->search_index);
     return found;
   }
 
   uint32 count;
-  uint32 idx = find_objs_range(left_col, size, arg1, count);
+  uint32 idx = find_objs_range(left_col, size, arg1, count, &ptr->search_index);
   return count > 0;
 }
 
 bool has_field(OBJ rec_or_tag_rec, uint16 field_symb_idx) {
   OBJ rec = is_tag_obj(rec_or_tag_rec) ? get_inner_obj(rec_or_tag_rec) : rec_or_tag_rec;
 
+  if (get_physical_type(rec) == TYPE_TREE_MAP) {
+    OBJ value;
+    return tree_map_lookup(get_tree_map_ptr(rec), make_symb(field_symb_idx), value);
+  }
+
   if (!is_empty_rel(rec)) {
     BIN_REL_OBJ *ptr = get_bin_rel_ptr(rec);
     uint32 size = ptr->size;
@@ -144,6 +161,9 @@ uint32 get_size(OBJ coll) {
   if (is_ne_set(coll))
     return get_set_ptr(coll)->size;
 
+  if (get_physical_type(coll) == TYPE_TREE_MAP)
+    return get_tree_map_ptr(coll)->size;
+
   if (is_ne_bin_rel(coll))
     return get_bin_rel_ptr(coll)->size;
 
@@ -174,8 +194,9 @@ int64 rand_nat(int64 max) {
   return rand() % max; //## BUG: THE FUNCTION rand() ONLY GENERATES A LIMITED RANGE OF INTEGERS
 }
 
+// Unique across all the threads of the process
 int64 unique_nat() {
-  static int64 next_val = 0;
+  static std::atomic<int64> next_val(0);
   return next_val++;
 }
 
@@ -190,6 +211,11 @@ OBJ at(OBJ seq, int64 idx) {
   assert(is_seq(seq));
   if (((uint64) idx) >= get_seq_length(seq))
     soft_fail("Invalid sequence index");
+  OBJ_TYPE type = get_physical_type(seq);
+  if (type == TYPE_TREE_SEQ)
+    return tree_seq_at(get_tree_seq_ptr(seq), idx);
+  if (type == TYPE_PACKED_SEQ)
+    return packed_seq_at(seq, idx);
   return get_seq_buffer_ptr(seq)[idx];
 }
 
@@ -199,6 +225,10 @@ OBJ get_tag(OBJ obj) {
 
 OBJ get_curr_obj(SEQ_ITER &it) {
   assert(!is_out_of_range(it));
+  if (it.packed != NULL)
+    return packed_seq_elem(it.packed, it.offset + it.idx);
+  if (it.tree_root != NULL)
+    return it.buffer[it.idx - it.leaf_first];
   return it.buffer[it.idx];
 }
 
@@ -209,12 +239,16 @@ OBJ get_curr_obj(SET_ITER &it) {
 
 OBJ get_curr_left_arg(BIN_REL_ITER &it) {
   assert(!is_out_of_range(it));
+  if (it.tree_root != NULL)
+    return it.left_col[it.idx - it.leaf_first];
   uint32 idx = it.rev_idxs != NULL ? it.rev_idxs[it.idx] : it.idx;
   return it.left_col[idx];
 }
 
 OBJ get_curr_right_arg(BIN_REL_ITER &it) {
   assert(!is_out_of_range(it));
+  if (it.tree_root != NULL)
+    return it.right_col[it.idx - it.leaf_first];
   uint32 idx = it.rev_idxs != NULL ? it.rev_idxs[it.idx] : it.idx;
   return it.right_col[idx];
 }
@@ -244,7 +278,12 @@ OBJ rand_set_elem(OBJ set) {
 }
 
 OBJ lookup(OBJ rel, OBJ key) {
-  if (!is_empty_rel(rel)) {
+  if (get_physical_type(rel) == TYPE_TREE_MAP) {
+    OBJ value;
+    if (tree_map_lookup(get_tree_map_ptr(rel), key, value))
+      return value;
+  }
+  else if (!is_empty_rel(rel)) {
     BIN_REL_OBJ *ptr = get_bin_rel_ptr(rel);
     uint32 size = ptr->size;
     OBJ *keys = ptr->buffer;
@@ -252,14 +291,14 @@ OBJ lookup(OBJ rel, OBJ key) {
     OBJ_TYPE rel_type = get_physical_type(rel);
     if (rel_type == TYPE_MAP | rel_type == TYPE_LOG_MAP) {
       bool found;
-      uint32 idx = find_obj(keys, size, key, found);
+      uint32 idx = find_obj(keys, size, key, found, &ptr->search_index);
       if (found)
         return values[idx];
     }
     else {
       assert(rel_type == TYPE_BIN_REL);
       uint32 count;
-      uint32 idx = find_objs_range(keys, size, key, count);
+      uint32 idx = find_objs_range(keys, size, key, count, &ptr->search_index);
       if (count == 1)
         return values[idx];
       if (count > 1)
@@ -284,7 +323,12 @@ OBJ lookup(OBJ rel, OBJ key) {
 OBJ lookup_field(OBJ rec_or_tag_rec, uint16 field_symb_idx) {
   OBJ rec = is_tag_obj(rec_or_tag_rec) ? get_inner_obj(rec_or_tag_rec) : rec_or_tag_rec;
 
-  if (!is_empty_rel(rec)) {
+  if (get_physical_type(rec) == TYPE_TREE_MAP) {
+    OBJ value;
+    if (tree_map_lookup(get_tree_map_ptr(rec), make_symb(field_symb_idx), value))
+      return value;
+  }
+  else if (!is_empty_rel(rec)) {
     BIN_REL_OBJ *ptr = get_bin_rel_ptr(rec);
     uint32 size = ptr->size;
     OBJ *keys = ptr->buffer;
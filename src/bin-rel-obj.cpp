@@ -1,10 +1,7 @@
 #include "lib.h"
 
 
-void build_map_right_to_left_sorted_idx_array(OBJ map) {
-  assert(get_physical_type(map) == TYPE_MAP);
-
-  BIN_REL_OBJ *ptr = get_bin_rel_ptr(map);
+void build_map_right_to_left_sorted_idx_array(BIN_REL_OBJ *ptr) {
   uint32 *rev_idxs = get_right_to_left_indexes(ptr);
   if (rev_idxs[0] != INVALID_INDEX)
     return;
@@ -170,18 +167,23 @@ void get_bin_rel_null_iter(BIN_REL_ITER &it) {
   it.rev_idxs = NULL;
   it.idx = 0;
   it.end = 0;
+  it.tree_root = NULL;
 }
 
 void get_bin_rel_iter(BIN_REL_ITER &it, OBJ rel) {
   assert(is_bin_rel(rel));
 
-  if (!is_empty_rel(rel)) {
+  if (get_physical_type(rel) == TYPE_TREE_MAP) {
+    get_tree_map_iter(it, get_tree_map_ptr(rel));
+  }
+  else if (!is_empty_rel(rel)) {
     BIN_REL_OBJ *ptr = get_bin_rel_ptr(rel);
     it.left_col = get_left_col_array_ptr(ptr);
     it.right_col = get_right_col_array_ptr(ptr);
     it.rev_idxs = NULL;
     it.idx = 0;
     it.end = ptr->size;
+    it.tree_root = NULL;
   }
   else
     get_bin_rel_null_iter(it);
@@ -190,13 +192,17 @@ void get_bin_rel_iter(BIN_REL_ITER &it, OBJ rel) {
 void get_bin_rel_iter_0(BIN_REL_ITER &it, OBJ rel, OBJ arg0) {
   assert(is_bin_rel(rel));
 
-  if (is_ne_bin_rel(rel)) {
+  if (get_physical_type(rel) == TYPE_TREE_MAP) {
+    if (get_tree_map_iter_0(it, get_tree_map_ptr(rel), arg0))
+      return;
+  }
+  else if (is_ne_bin_rel(rel)) {
     BIN_REL_OBJ *ptr = get_bin_rel_ptr(rel);
     uint32 size = ptr->size;
     OBJ *left_col = get_left_col_array_ptr(ptr);
 
     uint32 count;
-    uint32 first = find_objs_range(left_col, size, arg0, count);
+    uint32 first = find_objs_range(left_col, size, arg0, count, &ptr->search_index);
 
     if (count > 0) {
       it.left_col = left_col;
@@ -204,6 +210,7 @@ void get_bin_rel_iter_0(BIN_REL_ITER &it, OBJ rel, OBJ arg0) {
       it.rev_idxs = NULL;
       it.idx = first;
       it.end = first + count;
+      it.tree_root = NULL;
       return;
     }
   }
@@ -215,10 +222,12 @@ void get_bin_rel_iter_1(BIN_REL_ITER &it, OBJ rel, OBJ arg1) {
   assert(is_bin_rel(rel));
 
   if (is_ne_bin_rel(rel)) {
-    if (get_physical_type(rel) == TYPE_MAP)
-      build_map_right_to_left_sorted_idx_array(rel);
-
+    // This is the only iteration that needs the entries of a tree map to be stored
+    // contiguously, so it goes through its array view (see tree-map.cpp)
     BIN_REL_OBJ *ptr = get_bin_rel_ptr(rel);
+    OBJ_TYPE type = get_physical_type(rel);
+    if (type == TYPE_MAP | type == TYPE_TREE_MAP)
+      build_map_right_to_left_sorted_idx_array(ptr);
     uint32 size = ptr->size;
     OBJ *right_col = get_right_col_array_ptr(ptr);
     uint32 *rev_idxs = get_right_to_left_indexes(ptr);
@@ -232,6 +241,7 @@ void get_bin_rel_iter_1(BIN_REL_ITER &it, OBJ rel, OBJ arg1) {
       it.rev_idxs = rev_idxs;
       it.idx = first;
       it.end = first + count;
+      it.tree_root = NULL;
       return;
     }
   }
@@ -3,11 +3,13 @@
 
 
 void binary_table_init(BINARY_TABLE *table) {
-
+  index_init(table->left_to_right);
+  index_init(table->right_to_left);
 }
 
 void binary_table_cleanup(BINARY_TABLE *table) {
-
+  index_cleanup(table->left_to_right);
+  index_cleanup(table->right_to_left);
 }
 
 void binary_table_updates_init(BINARY_TABLE_UPDATES *updates) {
@@ -21,9 +23,7 @@ void binary_table_updates_cleanup(BINARY_TABLE_UPDATES *updates) {
 ////////////////////////////////////////////////////////////////////////////////
 
 bool binary_table_contains(BINARY_TABLE *table, uint32 left_val, uint32 right_val) {
-  std::set<uint64> &left_to_right = table->left_to_right;
-  std::set<uint64>::iterator it = left_to_right.find(pack(left_val, right_val));
-  return it != left_to_right.end();
+  return index_contains(table->left_to_right, pack(left_val, right_val));
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -32,7 +32,7 @@ void binary_table_delete_range_(BINARY_TABLE_ITER *iter, BINARY_TABLE_UPDATES *u
   bool reversed = iter->reversed;
   std::vector<uint64> &deletes = updates->deletes;
   while (!binary_table_iter_is_out_of_range(iter)) {
-    uint64 pair = *iter->iter;
+    uint64 pair = iter->block->elems[iter->offset];
     deletes.push_back(reversed ? swap(pair) : pair);
     binary_table_iter_next(iter);
   }
@@ -65,33 +65,48 @@ void binary_table_insert(BINARY_TABLE_UPDATES *updates, uint32 left_val, uint32
   updates->inserts.push_back(pack(left_val, right_val));
 }
 
+// Swaps the two columns of the pairs in <src>, and sorts the result into <dest>
+static void sorted_swapped(uint64 *src, uint32 count, std::vector<uint64> &dest) {
+  dest.resize(count);
+  for (uint32 i=0 ; i < count ; i++)
+    dest[i] = swap(src[i]);
+  std::sort(dest.begin(), dest.end());
+}
+
+// Both indexes are updated with a single merge pass over each block, which requires
+// the deletes and inserts to be sorted. Ineffective deletes are dropped, so that
+// binary_table_updates_finish() only releases the values of the pairs actually removed
 void binary_table_updates_apply(BINARY_TABLE *table, BINARY_TABLE_UPDATES *updates, VALUE_STORE *vs0, VALUE_STORE *vs1) {
-  std::set<uint64> &left_to_right = table->left_to_right;
-  std::set<uint64> &right_to_left = table->right_to_left;
+  SORTED_INDEX<uint64> &left_to_right = table->left_to_right;
+  SORTED_INDEX<uint64> &right_to_left = table->right_to_left;
 
-  if (!updates->deletes.empty()) {
-    uint32 count = updates->deletes.size();
-    uint64 *deletes = &updates->deletes.front();
-    for (uint32 i=0 ; i < count ; i++) {
-      uint64 pair = deletes[i];
-      if (left_to_right.erase(pair) > 0)
-        right_to_left.erase(swap(pair));
-      else
-        deletes[i] = 0xFFFFFFFFFFFFFFFFULL;
+  std::vector<uint64> swapped;
+
+  std::vector<uint64> &deletes = updates->deletes;
+  if (!deletes.empty()) {
+    sort_unique(deletes);
+    uint32 count = index_remove(left_to_right, &deletes.front(), deletes.size());
+    deletes.resize(count);
+    if (count > 0) {
+      sorted_swapped(&deletes.front(), count, swapped);
+      uint32 removed = index_remove(right_to_left, &swapped.front(), count);
+      assert(removed == count);
     }
   }
 
-  if (!updates->inserts.empty()) {
-    uint32 count = updates->inserts.size();
-    uint64 *inserts = &updates->inserts.front();
-    for (uint32 i=0 ; i < count ; i++) {
-      uint64 pair = inserts[i];
-      if (left_to_right.insert(pair).second) {
-        right_to_left.insert(swap(pair));
-        value_store_add_ref(vs0, left(pair));
-        value_store_add_ref(vs1, right(pair));
-      }
+  std::vector<uint64> &inserts = updates->inserts;
+  if (!inserts.empty()) {
+    sort_unique(inserts);
+    uint64 *elems = &inserts.front();
+    uint32 count = index_insert(left_to_right, elems, inserts.size());
+    if (count > 0) {
+      sorted_swapped(elems, count, swapped);
+      value_store_add_refs<col_0>(vs0, elems, count);
+      value_store_add_refs<col_0>(vs1, &swapped.front(), count);
+      uint32 inserted = index_insert(right_to_left, &swapped.front(), count);
+      assert(inserted == count);
     }
+    inserts.resize(count);
   }
 }
 
@@ -99,60 +114,55 @@ void binary_table_updates_finish(BINARY_TABLE_UPDATES *updates, VALUE_STORE *vs0
   if (!updates->deletes.empty()) {
     uint32 count = updates->deletes.size();
     uint64 *deletes = &updates->deletes.front();
-    for (uint32 i=0 ; i < count ; i++) {
-      uint64 pair = deletes[i];
-      if (pair != 0xFFFFFFFFFFFFFFFFULL) {
-        value_store_release(vs0, left(pair));
-        value_store_release(vs1, right(pair));
-      }
-    }
+    value_store_release_refs<col_0>(vs0, deletes, count);
+    value_store_release_refs<col_1>(vs1, deletes, count);
   }
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
-void binary_table_get_iter_by_col_0(BINARY_TABLE *table, BINARY_TABLE_ITER *iter, uint32 value) {
-  std::set<uint64> &left_to_right = table->left_to_right;
-  iter->iter = left_to_right.lower_bound(pack(value, 0));
-  iter->end = left_to_right.end();
+static void binary_table_init_iter(SORTED_INDEX<uint64> &index, BINARY_TABLE_ITER *iter, uint64 lower_bound, uint32 value, bool reversed) {
+  uint32 block_idx, offset;
+  index_lower_bound(index, lower_bound, block_idx, offset);
+  iter->block = index.blocks + block_idx;
+  iter->end_block = index.blocks + index.blocks_count;
+  iter->offset = offset;
   iter->value = value;
-  iter->reversed = false;
+  iter->reversed = reversed;
+}
+
+void binary_table_get_iter_by_col_0(BINARY_TABLE *table, BINARY_TABLE_ITER *iter, uint32 value) {
+  binary_table_init_iter(table->left_to_right, iter, pack(value, 0), value, false);
 }
 
 void binary_table_get_iter_by_col_1(BINARY_TABLE *table, BINARY_TABLE_ITER *iter, uint32 value) {
-  std::set<uint64> &right_to_left = table->right_to_left;
-  iter->iter = right_to_left.lower_bound(pack(value, 0));
-  iter->end = right_to_left.end();
-  iter->value = value;
-  iter->reversed = true;
+  binary_table_init_iter(table->right_to_left, iter, pack(value, 0), value, true);
 }
 
 void binary_table_get_iter(BINARY_TABLE *table, BINARY_TABLE_ITER *iter) {
-  std::set<uint64> &left_to_right = table->left_to_right;
-  iter->iter = left_to_right.begin();
-  iter->end = left_to_right.end();
-  iter->value = 0xFFFFFFFFU;
-  iter->reversed = false;
+  binary_table_init_iter(table->left_to_right, iter, 0, 0xFFFFFFFFU, false);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
 bool binary_table_iter_is_out_of_range(BINARY_TABLE_ITER *iter) {
-  std::set<uint64>::iterator it = iter->iter;
-  return it == iter->end || (*it >> 32) > iter->value;
+  return iter->block == iter->end_block || (iter->block->elems[iter->offset] >> 32) > iter->value;
 }
 
 uint32 binary_table_iter_get_left_field(BINARY_TABLE_ITER *iter) {
-  return *iter->iter >> (iter->reversed ? 0 : 32);
+  return iter->block->elems[iter->offset] >> (iter->reversed ? 0 : 32);
 }
 
 uint32 binary_table_iter_get_right_field(BINARY_TABLE_ITER *iter) {
-  return *iter->iter >> (iter->reversed ? 32 : 0);
+  return iter->block->elems[iter->offset] >> (iter->reversed ? 32 : 0);
 }
 
 void binary_table_iter_next(BINARY_TABLE_ITER *iter) {
   assert(!binary_table_iter_is_out_of_range(iter));
-  iter->iter++;
+  if (++iter->offset == iter->block->size) {
+    iter->block++;
+    iter->offset = 0;
+  }
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -175,11 +185,8 @@ bool binary_table_updates_check_0_1(BINARY_TABLE *table, BINARY_TABLE_UPDATES *u
 ////////////////////////////////////////////////////////////////////////////////
 
 OBJ copy_binary_table(BINARY_TABLE *table, VALUE_STORE *vs1, VALUE_STORE *vs2, bool flip_cols) {
-  OBJ *slots1 = value_store_slot_array(vs1);
-  OBJ *slots2 = value_store_slot_array(vs2);
-
-  std::set<uint64> &rows = table->left_to_right;
-  uint32 size = rows.size();
+  SORTED_INDEX<uint64> &rows = table->left_to_right;
+  uint32 size = rows.count;
 
   if (size == 0)
     return make_empty_rel();
@@ -188,16 +195,16 @@ OBJ copy_binary_table(BINARY_TABLE *table, VALUE_STORE *vs1, VALUE_STORE *vs2, b
   OBJ *col2 = col1 + size;
 
   uint32 idx = 0;
-  for (std::set<uint64>::iterator it=rows.begin(); it != rows.end() ; it++) {
-    uint64 row = *it;
-    col1[idx] = slots1[left(row)];
-    col2[idx++] = slots2[right(row)];
+  for (uint32 i=0 ; i < rows.blocks_count ; i++) {
+    INDEX_BLOCK<uint64> &block = rows.blocks[i];
+    for (uint32 j=0 ; j < block.size ; j++) {
+      uint64 row = block.elems[j];
+      col1[idx] = lookup_surrogate(vs1, left(row));
+      col2[idx++] = lookup_surrogate(vs2, right(row));
+    }
   }
   assert(idx == size);
 
-  for (int64 i=0 ; i < 2 * size ; i++)
-    add_ref(col1[i]);
-
   OBJ rel = build_bin_rel(flip_cols ? col2 : col1, flip_cols ? col1 : col2, size);
 
   delete_obj_array(col1, 2 * size);
@@ -214,26 +221,36 @@ void set_binary_table(BINARY_TABLE *table, BINARY_TABLE_UPDATES *updates, VALUE_
   if (is_empty_rel(rel))
     return;
 
-  BIN_REL_OBJ *ptr = get_bin_rel_ptr(rel);
-  uint32 size = ptr->size;
-  OBJ *col1 = flip_cols ? get_right_col_array_ptr(ptr) : get_left_col_array_ptr(ptr);
-  OBJ *col2 = flip_cols ? get_left_col_array_ptr(ptr) : get_right_col_array_ptr(ptr);
-
-  for (uint32 i=0 ; i < size ; i++) {
-    OBJ obj = col1[i];
-    uint32 ref1 = lookup_value_ex(vs1, vsu1, obj);
-    if (ref1 == -1) {
-      add_ref(obj);
-      ref1 = value_store_insert(vs1, vsu1, obj);
-    }
-
-    obj = col2[i];
-    uint32 ref2 = lookup_value_ex(vs2, vsu2, obj);
-    if (ref2 == -1) {
-      add_ref(obj);
-      ref2 = value_store_insert(vs2, vsu2, obj);
+  uint32 size = get_size(rel);
+
+  std::vector<uint32> surrs(2 * size);
+  uint32 *surrs1 = &surrs.front();
+  uint32 *surrs2 = surrs1 + size;
+
+  if (get_physical_type(rel) == TYPE_TREE_MAP) {
+    // Tree maps are looked up one leaf at a time, without building their array view
+    TREE_MAP_OBJ *map = get_tree_map_ptr(rel);
+    uint32 idx = 0;
+    while (idx < size) {
+      uint32 leaf_idx = idx;
+      TREE_MAP_NODE *leaf = get_tree_map_leaf(map, leaf_idx);
+      assert(leaf_idx == 0);
+      uint32 count = leaf->count;
+      OBJ *keys = leaf->keys;
+      OBJ *values = get_tree_map_node_values(leaf);
+      value_store_lookup_or_insert_batch(vs1, vsu1, flip_cols ? values : keys, count, surrs1 + idx);
+      value_store_lookup_or_insert_batch(vs2, vsu2, flip_cols ? keys : values, count, surrs2 + idx);
+      idx += count;
     }
-
-    binary_table_insert(updates, ref1, ref2);
   }
+  else {
+    BIN_REL_OBJ *ptr = get_bin_rel_ptr(rel);
+    OBJ *col1 = flip_cols ? get_right_col_array_ptr(ptr) : get_left_col_array_ptr(ptr);
+    OBJ *col2 = flip_cols ? get_left_col_array_ptr(ptr) : get_right_col_array_ptr(ptr);
+    value_store_lookup_or_insert_batch(vs1, vsu1, col1, size, surrs1);
+    value_store_lookup_or_insert_batch(vs2, vsu2, col2, size, surrs2);
+  }
+
+  for (uint32 i=0 ; i < size ; i++)
+    binary_table_insert(updates, surrs1[i], surrs2[i]);
 }
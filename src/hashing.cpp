@@ -8,6 +8,11 @@ const uint32 MULT_BASE_VALUE = BASE_VALUE * MULTIPLIER;
 
 ////////////////////////////////////////////////////////////////////////////////
 
+// Hash code of an integer or floating point object
+inline uint32 inline_obj_hash_code(uint64 core_data) {
+  return MULT_BASE_VALUE + (uint32) (core_data ^ (core_data >> 32));
+}
+
 uint32 combined_hash_code(uint32 start_value, OBJ *array, uint32 count) {
   uint32 hash_code = start_value;
   for (uint32 i=0 ; i < count ; i++)
@@ -15,6 +20,77 @@ uint32 combined_hash_code(uint32 start_value, OBJ *array, uint32 count) {
   return hash_code;
 }
 
+// Same as combined_hash_code() on the keys or the values of the subtree, in order
+static uint32 combined_hash_code(uint32 start_value, TREE_MAP_NODE *node, bool values) {
+  if (node->height == 0)
+    return combined_hash_code(start_value, values ? get_tree_map_node_values(node) : node->keys, node->count);
+
+  uint32 hash_code = start_value;
+  TREE_MAP_NODE **children = get_tree_map_node_children(node);
+  for (uint32 i=0 ; i < node->count ; i++)
+    hash_code = combined_hash_code(hash_code, children[i], values);
+  return hash_code;
+}
+
+// Same as combined_hash_code() on the elements of the subtree, in order
+static uint32 combined_hash_code(uint32 start_value, TREE_SEQ_NODE *node) {
+  if (node->height == 0)
+    return combined_hash_code(start_value, node->elems, node->count);
+
+  uint32 hash_code = start_value;
+  TREE_SEQ_NODE **children = get_tree_seq_node_children(node);
+  for (uint32 i=0 ; i < node->count ; i++)
+    hash_code = combined_hash_code(hash_code, children[i]);
+  return hash_code;
+}
+
+// Same as combined_hash_code() on the materialized elements of a packed sequence
+static uint32 combined_hash_code(uint32 start_value, PACKED_SEQ_OBJ *seq, uint32 offset, uint32 count) {
+  uint32 hash_code = start_value;
+
+  switch (seq->elem_type) {
+    case PACKED_UINT8: {
+      uint8 *elems = (uint8 *) seq->elems + offset;
+      for (uint32 i=0 ; i < count ; i++)
+        hash_code = MULTIPLIER * hash_code + inline_obj_hash_code(elems[i]);
+      break;
+    }
+
+    case PACKED_UINT16: {
+      uint16 *elems = (uint16 *) seq->elems + offset;
+      for (uint32 i=0 ; i < count ; i++)
+        hash_code = MULTIPLIER * hash_code + inline_obj_hash_code((int64) elems[i]);
+      break;
+    }
+
+    case PACKED_INT32: {
+      int32 *elems = (int32 *) seq->elems + offset;
+      for (uint32 i=0 ; i < count ; i++)
+        hash_code = MULTIPLIER * hash_code + inline_obj_hash_code((int64) elems[i]);
+      break;
+    }
+
+    case PACKED_INT64: {
+      int64 *elems = (int64 *) seq->elems + offset;
+      for (uint32 i=0 ; i < count ; i++)
+        hash_code = MULTIPLIER * hash_code + inline_obj_hash_code(elems[i]);
+      break;
+    }
+
+    case PACKED_FLOAT: {
+      double *elems = (double *) seq->elems + offset;
+      for (uint32 i=0 ; i < count ; i++)
+        hash_code = MULTIPLIER * hash_code + inline_obj_hash_code(make_float(elems[i]).core_data.int_);
+      break;
+    }
+
+    default:
+      internal_fail();
+  }
+
+  return hash_code;
+}
+
 uint32 compute_hash_code(OBJ obj) {
   if (is_tag_obj(obj))
     return MULTIPLIER * (MULT_BASE_VALUE + get_tag_idx(obj)) + compute_hash_code(get_inner_obj(obj));
@@ -28,10 +104,8 @@ uint32 compute_hash_code(OBJ obj) {
       return MULT_BASE_VALUE + get_symb_idx(obj);
 
     case TYPE_INTEGER:
-    case TYPE_FLOAT: {
-      uint64 core_data = obj.core_data.int_;
-      return MULT_BASE_VALUE + (uint32) (core_data ^ (core_data >> 32));
-    }
+    case TYPE_FLOAT:
+      return inline_obj_hash_code(obj.core_data.int_);
 
     case TYPE_SEQUENCE: {
       uint32 size = get_seq_length(obj);
@@ -72,6 +146,22 @@ uint32 compute_hash_code(OBJ obj) {
       uint32 size = ptr->size;
       return combined_hash_code(MULT_BASE_VALUE + size, ptr->buffer, 2 * size);
     }
+
+    case TYPE_TREE_MAP: {
+      TREE_MAP_OBJ *ptr = get_tree_map_ptr(obj);
+      uint32 hash_code = combined_hash_code(MULT_BASE_VALUE + ptr->size, ptr->root, false);
+      return combined_hash_code(hash_code, ptr->root, true);
+    }
+
+    case TYPE_TREE_SEQ: {
+      uint32 size = get_seq_length(obj);
+      return combined_hash_code(MULT_BASE_VALUE + size, get_tree_seq_ptr(obj)->root);
+    }
+
+    case TYPE_PACKED_SEQ: {
+      uint32 size = get_seq_length(obj);
+      return combined_hash_code(MULT_BASE_VALUE + size, get_packed_seq_ptr(obj), get_seq_offset(obj), size);
+    }
   }
   fail();
 }
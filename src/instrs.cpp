@@ -82,6 +82,115 @@ OBJ build_set(STREAM &s) {
   return set;
 }
 
+OBJ insert_elem(OBJ set, OBJ elem) { // Elem must be already reference counted
+  assert(is_set(set));
+
+  if (is_empty_rel(set))
+    return build_set(&elem, 1);
+
+  SET_OBJ *ptr = get_set_ptr(set);
+  uint32 size = ptr->size;
+  OBJ *elems = ptr->buffer;
+
+  uint32 idx = lower_bound(elems, size, elem);
+  if (idx < size && comp_objs(elems[idx], elem) == 0) {
+    release(elem);
+    add_ref(set);
+    return set;
+  }
+
+  SET_OBJ *new_ptr = new_set(size + 1);
+  OBJ *new_elems = new_ptr->buffer;
+  memcpy(new_elems, elems, idx * sizeof(OBJ));
+  new_elems[idx] = elem;
+  memcpy(new_elems + idx + 1, elems + idx, (size - idx) * sizeof(OBJ));
+  vec_add_ref(new_elems, idx);
+  vec_add_ref(new_elems + idx + 1, size - idx);
+
+  return make_set(new_ptr);
+}
+
+OBJ remove_elem(OBJ set, OBJ elem) {
+  assert(is_set(set));
+
+  if (is_empty_rel(set))
+    return set;
+
+  SET_OBJ *ptr = get_set_ptr(set);
+  uint32 size = ptr->size;
+  OBJ *elems = ptr->buffer;
+
+  bool found;
+  uint32 idx = find_obj(elems, size, elem, found, &ptr->search_index);
+  if (!found) {
+    add_ref(set);
+    return set;
+  }
+
+  if (size == 1)
+    return make_empty_rel();
+
+  SET_OBJ *new_ptr = new_set(size - 1);
+  OBJ *new_elems = new_ptr->buffer;
+  memcpy(new_elems, elems, idx * sizeof(OBJ));
+  memcpy(new_elems + idx, elems + idx + 1, (size - idx - 1) * sizeof(OBJ));
+  vec_add_ref(new_elems, size - 1);
+
+  return make_set(new_ptr);
+}
+
+// Same as insert_elem(), but takes over the caller's reference to the set,
+// which is updated in place if nobody else holds a reference to it
+OBJ insert_elem_unique(OBJ set, OBJ elem) { // Elem must be already reference counted
+  if (!is_unique(set)) {
+    OBJ res = insert_elem(set, elem);
+    release(set);
+    return res;
+  }
+
+  SET_OBJ *ptr = get_set_ptr(set);
+  uint32 size = ptr->size;
+  OBJ *elems = ptr->buffer;
+
+  uint32 idx = lower_bound(elems, size, elem);
+  if (idx < size && comp_objs(elems[idx], elem) == 0) {
+    release(elem);
+    return set;
+  }
+
+  ptr = expand_set(ptr, idx);
+  ptr->buffer[idx] = elem;
+  return make_set(ptr);
+}
+
+// Same as remove_elem(), but takes over the caller's reference to the set,
+// which is updated in place if nobody else holds a reference to it
+OBJ remove_elem_unique(OBJ set, OBJ elem) {
+  if (!is_unique(set)) {
+    OBJ res = remove_elem(set, elem);
+    release(set);
+    return res;
+  }
+
+  SET_OBJ *ptr = get_set_ptr(set);
+  uint32 size = ptr->size;
+  OBJ *elems = ptr->buffer;
+
+  bool found;
+  uint32 idx = find_obj(elems, size, elem, found, &ptr->search_index);
+  if (!found)
+    return set;
+
+  if (size == 1) {
+    release(set);
+    return make_empty_rel();
+  }
+
+  release(elems[idx]);
+  memmove(elems + idx, elems + idx + 1, (size - idx - 1) * sizeof(OBJ));
+  return make_set(shrink_set(ptr, size - 1));
+}
+
 OBJ build_tagged_obj(OBJ tag, OBJ obj) {
   assert(is_symb(tag));
   return make_tag_obj(get_symb_idx(tag), obj);
@@ -153,6 +262,12 @@ OBJ get_seq_slice(OBJ seq, int64 idx_first, int64 len) {
   if (len == 0)
     return make_empty_seq();
 
+  OBJ_TYPE type = get_physical_type(seq);
+  if (type == TYPE_TREE_SEQ)
+    return get_tree_seq_slice(seq, idx_first, len);
+  if (type == TYPE_PACKED_SEQ)
+    return get_packed_seq_slice(seq, idx_first, len);
+
   add_ref(seq);
 
   SEQ_OBJ *ptr = get_seq_ptr(seq);
@@ -164,39 +279,46 @@ OBJ extend_sequence(OBJ seq, OBJ *new_elems, uint32 count) {
   assert(!is_empty_seq(seq));
   assert(((uint64) get_seq_length(seq) + count <= 0xFFFFFFFF));
 
-  SEQ_OBJ *seq_ptr = get_seq_ptr(seq);
-  uint32 offset = get_seq_offset(seq);
   uint32 length = get_seq_length(seq);
-
   uint32 new_length = length + count;
 
-  uint32 size = seq_ptr->size;
-  uint32 capacity = seq_ptr->capacity;
+  OBJ_TYPE type = get_physical_type(seq);
+
+  if (type == TYPE_PACKED_SEQ && can_extend_packed_seq(seq, new_elems, count))
+    return extend_packed_seq(seq, new_elems, count);
 
-  bool ends_at_last_elem = offset + length == size;
-  bool has_needed_spare_capacity = size + count <= capacity;
-  bool can_be_extended = ends_at_last_elem & has_needed_spare_capacity;
+  if (type == TYPE_SEQUENCE | type == TYPE_SLICE) {
+    SEQ_OBJ *seq_ptr = get_seq_ptr(seq);
+    uint32 offset = get_seq_offset(seq);
 
-  if (can_be_extended) {
-    memcpy(seq_ptr->buffer+size, new_elems, sizeof(OBJ) * count);
-    seq_ptr->size = size + count;
-    vec_add_ref(new_elems, count);
-    add_ref(seq);
-    return make_slice(seq_ptr, get_mem_layout(seq), offset, new_length);
+    uint32 size = seq_ptr->size;
+    uint32 capacity = seq_ptr->capacity;
+
+    bool ends_at_last_elem = offset + length == size;
+    bool has_needed_spare_capacity = size + count <= capacity;
+    bool can_be_extended = ends_at_last_elem & has_needed_spare_capacity;
+
+    if (can_be_extended) {
+      memcpy(seq_ptr->buffer+size, new_elems, sizeof(OBJ) * count);
+      seq_ptr->size = size + count;
+      vec_add_ref(new_elems, count);
+      add_ref(seq);
+      return make_slice(seq_ptr, get_mem_layout(seq), offset, new_length);
+    }
   }
-  else {
-    OBJ *buffer = get_seq_buffer_ptr(seq);
 
-    SEQ_OBJ *new_seq_ptr = new_seq(new_length);
-    OBJ *new_buffer = new_seq_ptr->buffer;
+  if (use_tree_seq(seq, new_length))
+    return extend_tree_seq(seq, new_elems, count);
 
-    memcpy(new_buffer, buffer, sizeof(OBJ) * length);
-    memcpy(new_buffer+length, new_elems, sizeof(OBJ) * count);
+  SEQ_OBJ *new_seq_ptr = new_seq(new_length);
+  OBJ *new_buffer = new_seq_ptr->buffer;
 
-    vec_add_ref(new_buffer, new_length);
+  copy_seq_elems(seq, 0, length, new_buffer);
+  memcpy(new_buffer+length, new_elems, sizeof(OBJ) * count);
 
-    return make_seq(new_seq_ptr, new_length);
-  }
+  vec_add_ref(new_buffer, new_length);
+
+  return make_seq(new_seq_ptr, new_length);
 }
 
 OBJ append_to_seq(OBJ seq, OBJ obj) { // Obj must be reference counted already
@@ -207,6 +329,22 @@ OBJ append_to_seq(OBJ seq, OBJ obj) { // Obj must be reference counted already
   if (!(get_seq_length(seq) < 0xFFFFFFFF))
     impl_fail("Resulting sequence is too large");
 
+  // If nobody else can see the sequence, and it uses its whole buffer, the buffer can
+  // be reused even if it's full, by moving its content to a new one with twice the room.
+  // Unless the sequence has grown long enough to switch to a tree, as extend_sequence() does
+  if (get_physical_type(seq) == TYPE_SEQUENCE && is_unique(seq)) {
+    SEQ_OBJ *seq_ptr = get_seq_ptr(seq);
+    uint32 length = seq_ptr->size;
+    bool is_full = length == seq_ptr->capacity;
+    if (get_seq_length(seq) == length && !(is_full && use_tree_seq(seq, length + 1))) {
+      if (is_full)
+        seq_ptr = expand_seq(seq_ptr, length <= 0xFFFFFFF / 2 ? 2 * length : length + 1);
+      seq_ptr->buffer[length] = obj;
+      seq_ptr->size = length + 1;
+      return make_seq(seq_ptr, length + 1);
+    }
+  }
+
   OBJ res = extend_sequence(seq, &obj, 1);
   release(seq);
   release(obj);
@@ -220,20 +358,47 @@ OBJ update_seq_at(OBJ seq, OBJ idx, OBJ value) { // Value must be already refere
   if (int_idx < 0 | int_idx >= len)
     soft_fail("Invalid sequence index");
 
-  OBJ *src_ptr = get_seq_buffer_ptr(seq);
+  if (use_tree_seq(seq, len))
+    return update_tree_seq_at(seq, int_idx, value);
+
   SEQ_OBJ *new_seq_ptr = new_seq(len);
+  OBJ *buffer = new_seq_ptr->buffer;
 
-  new_seq_ptr->buffer[int_idx] = value;
-  for (uint32 i=0 ; i < len ; i++)
-    if (i != int_idx) {
-      OBJ elt = src_ptr[i];
-      add_ref(elt);
-      new_seq_ptr->buffer[i] = elt;
-    }
+  copy_seq_elems(seq, 0, len, buffer);
+  vec_add_ref(buffer, int_idx);
+  vec_add_ref(buffer + int_idx + 1, len - int_idx - 1);
+  buffer[int_idx] = value;
 
   return make_seq(new_seq_ptr, len);
 }
 
+// Same as update_seq_at(), but takes over the caller's reference to the sequence,
+// which is updated in place if nobody else holds a reference to it
+OBJ update_seq_at_unique(OBJ seq, OBJ idx, OBJ value) { // Value must be already reference counted
+  uint32 len = get_seq_length(seq);
+  int64 int_idx = get_int_val(idx);
+
+  if (int_idx < 0 | int_idx >= len)
+    soft_fail("Invalid sequence index");
+
+  OBJ_TYPE type = get_physical_type(seq);
+
+  // The elements of packed sequences are not objects, so they are always copied
+  if (!is_unique(seq) | type == TYPE_PACKED_SEQ) {
+    OBJ res = update_seq_at(seq, idx, value);
+    release(seq);
+    return res;
+  }
+
+  if (type == TYPE_TREE_SEQ)
+    return update_unique_tree_seq_at(seq, int_idx, value);
+
+  OBJ *target = get_seq_buffer_ptr(seq) + int_idx;
+  release(*target);
+  *target = value;
+  return seq;
+}
+
 OBJ join_seqs(OBJ left, OBJ right) {
   // No need to check the parameters here
 
@@ -252,6 +417,23 @@ OBJ join_seqs(OBJ left, OBJ right) {
   if (left_len + right_len > 0xFFFFFFFF)
     impl_fail("_cat_(): Resulting sequence is too large");
 
+  if (get_physical_type(right) == TYPE_TREE_SEQ && is_in_normal_state())
+    return join_tree_seqs(left, right);
+
+  if (get_physical_type(left) == TYPE_PACKED_SEQ && get_physical_type(right) == TYPE_PACKED_SEQ)
+    if (can_join_packed_seqs(left, right))
+      return join_packed_seqs(left, right);
+
+  // The elements of packed and tree sequences (the latter only outside normal
+  // state) are not stored in a single array, so they're copied into a temporary one
+  if (get_physical_type(right) == TYPE_PACKED_SEQ | get_physical_type(right) == TYPE_TREE_SEQ) {
+    OBJ *elems = new_obj_array(right_len);
+    copy_seq_elems(right, 0, right_len, elems);
+    OBJ res = extend_sequence(left, elems, right_len);
+    delete_obj_array(elems, right_len);
+    return res;
+  }
+
   return extend_sequence(left, get_seq_buffer_ptr(right), right_len);
 }
 
@@ -265,13 +447,11 @@ OBJ rev_seq(OBJ seq) {
     return seq;
   }
 
-  OBJ *elems = get_seq_buffer_ptr(seq);
-  vec_add_ref(elems, len);
-
   SEQ_OBJ *rs = new_seq(len);
   OBJ *rev_elems = rs->buffer;
-  for (uint32 i=0 ; i < len ; i++)
-    rev_elems[len-i-1] = elems[i];
+  copy_seq_elems(seq, 0, len, rev_elems);
+  vec_add_ref(rev_elems, len);
+  std::reverse(rev_elems, rev_elems + len);
 
   return make_seq(rs, len);
 }
@@ -279,6 +459,8 @@ OBJ rev_seq(OBJ seq) {
 void set_at(OBJ seq, uint32 idx, OBJ value) { // Value must be already reference counted
   // This is not called directly by the user, so asserts should be sufficient
   assert(idx < get_seq_length(seq));
+  // Only meant to be used on newly created sequences, never on trees or packed sequences
+  assert(get_physical_type(seq) != TYPE_TREE_SEQ & get_physical_type(seq) != TYPE_PACKED_SEQ);
 
   OBJ *target = get_seq_buffer_ptr(seq) + idx;
   release(*target);
@@ -345,8 +527,22 @@ void get_set_iter(SET_ITER &it, OBJ set) {
 
 void get_seq_iter(SEQ_ITER &it, OBJ seq) {
   it.idx = 0;
+  it.packed = NULL;
+  it.tree_root = NULL;
   if (!is_empty_seq(seq)) {
-    it.buffer = get_seq_buffer_ptr(seq);
+    // Packed and tree sequences are iterated without materializing them
+    OBJ_TYPE type = get_physical_type(seq);
+    if (type == TYPE_TREE_SEQ) {
+      get_tree_seq_iter(it, get_tree_seq_ptr(seq));
+      return;
+    }
+    if (type == TYPE_PACKED_SEQ) {
+      it.buffer = 0;
+      it.packed = get_packed_seq_ptr(seq);
+      it.offset = get_seq_offset(seq);
+    }
+    else
+      it.buffer = get_seq_buffer_ptr(seq);
     it.len = get_seq_length(seq);
   }
   else {
@@ -363,11 +559,15 @@ void move_forward(SET_ITER &it) {
 void move_forward(SEQ_ITER &it) {
   assert(!is_out_of_range(it));
   it.idx++;
+  if (it.tree_root != NULL && it.idx == it.leaf_end && it.idx < it.len)
+    load_tree_seq_iter_leaf(it);
 }
 
 void move_forward(BIN_REL_ITER &it) {
   assert(!is_out_of_range(it));
   it.idx++;
+  if (it.tree_root != NULL && it.idx == it.leaf_end && it.idx < it.end)
+    load_tree_map_iter_leaf(it);
 }
 
 void move_forward(TERN_REL_ITER &it) {
@@ -403,85 +603,56 @@ void runtime_check(OBJ cond) {
 ////////////////////////////////////////////////////////////////////////////////
 
 OBJ build_const_uint8_seq(const uint8* buffer, uint32 len) {
-  if (len == 0)
-    return make_empty_seq();
-
-  SEQ_OBJ *seq = new_seq(len);
-
-  for (int i=0 ; i < len ; i++)
-    seq->buffer[i] = make_int(buffer[i]);
-
-  return make_seq(seq, len);
+  return build_packed_uint8_seq(buffer, len);
 }
 
 OBJ build_const_uint16_seq(const uint16* buffer, uint32 len) {
-  if (len == 0)
-    return make_empty_seq();
-
-  SEQ_OBJ *seq = new_seq(len);
-
-  for (int i=0 ; i < len ; i++)
-    seq->buffer[i] = make_int(buffer[i]);
-
-  return make_seq(seq, len);
+  return build_packed_uint16_seq(buffer, len);
 }
 
 OBJ build_const_uint32_seq(const uint32* buffer, uint32 len) {
   if (len == 0)
     return make_empty_seq();
 
-  SEQ_OBJ *seq = new_seq(len);
+  PACKED_SEQ_OBJ *seq = new_packed_seq(PACKED_INT64, len);
+  int64 *elems = (int64 *) seq->elems;
 
-  for (int i=0 ; i < len ; i++)
-    seq->buffer[i] = make_int(buffer[i]);
+  for (uint32 i=0 ; i < len ; i++)
+    elems[i] = buffer[i];
 
-  return make_seq(seq, len);
+  return make_packed_seq(seq, len);
 }
 
 OBJ build_const_int8_seq(const int8* buffer, uint32 len) {
   if (len == 0)
     return make_empty_seq();
 
-  SEQ_OBJ *seq = new_seq(len);
+  PACKED_SEQ_OBJ *seq = new_packed_seq(PACKED_INT32, len);
+  int32 *elems = (int32 *) seq->elems;
 
-  for (int i=0 ; i < len ; i++)
-    seq->buffer[i] = make_int(buffer[i]);
+  for (uint32 i=0 ; i < len ; i++)
+    elems[i] = buffer[i];
 
-  return make_seq(seq, len);
+  return make_packed_seq(seq, len);
 }
 
 OBJ build_const_int16_seq(const int16* buffer, uint32 len) {
   if (len == 0)
     return make_empty_seq();
 
-  SEQ_OBJ *seq = new_seq(len);
+  PACKED_SEQ_OBJ *seq = new_packed_seq(PACKED_INT32, len);
+  int32 *elems = (int32 *) seq->elems;
 
-  for (int i=0 ; i < len ; i++)
-    seq->buffer[i] = make_int(buffer[i]);
+  for (uint32 i=0 ; i < len ; i++)
+    elems[i] = buffer[i];
 
-  return make_seq(seq, len);
+  return make_packed_seq(seq, len);
 }
 
 OBJ build_const_int32_seq(const int32* buffer, uint32 len) {
-  if (len == 0)
-    return make_empty_seq();
-
-  SEQ_OBJ *seq = new_seq(len);
-
-  for (int i=0 ; i < len ; i++)
-    seq->buffer[i] = make_int(buffer[i]);
-
-  return make_seq(seq, len);
+  return build_packed_int32_seq(buffer, len);
 }
 
 OBJ build_const_int64_seq(const int64* buffer, uint32 len) {
-  if (len == 0)
-    return make_empty_seq();
-
-  SEQ_OBJ *seq = new_seq(len);
-
-  for (int i=0 ; i < len ; i++)
-    seq->buffer[i] = make_int(buffer[i]);
-
-  return make_seq(seq, len);
+  return build_packed_int64_seq(buffer, len);
 }
@@ -1,115 +1,165 @@
 #include "lib.h"
 
+#include <mutex>
 
-int64 from_utf8(const char *input, OBJ *output) {
-  uint32 idx = 0;
-  for (uint32 count=0 ; ; count++) {
-    unsigned char ch = input[idx++];
-    if (ch == 0)
-      return count;
-    uint32 val;
-    int size;
-    if (ch >> 7 == 0) { // 0xxxxxxx
-      size = 0;
-      val = ch;
-    }
-    else if (ch >> 5 == 6) { // 110xxxxx  10xxxxxx
-      val = (ch & 0x1F) << 6;
-      size = 1;
-    }
-    else if (ch >> 4 == 0xE) { // 1110xxxx  10xxxxxx  10xxxxxx
-      val = (ch & 0xF) << 12;
-      size = 2;
-    }
-    else if (ch >> 3 == 0x1E) { // 11110xxx  10xxxxxx  10xxxxxx  10xxxxxx
-      val = (ch & 0xF) << 18;
-      size = 3;
-    }
-    else
-      return -idx;
 
-    for (int i=0 ; i < size ; i++) {
-      ch = input[idx++];
-      if (ch >> 6 != 2)
-        return -idx;
-      val |= (ch & 0x3F) << (6 * (size - i - 1));
-    }
+// Strings are sequences of characters tagged as <string>. The characters of strings that
+// come from outside the program are stored as packed sequences of the narrowest type that
+// can hold all of them (see packed-seq.cpp), so that an ASCII or Latin-1 string takes one
+// byte per character, and most other ones two
 
-    if (output != NULL)
-      output[count] = make_int(val);
+// Decodes the character that starts at input[idx] and moves <idx> past it.
+// Returns false if the input is not valid UTF-8
+static bool decode_utf8_char(const char *input, uint32 &idx, uint32 &code_point) {
+  unsigned char ch = input[idx++];
+  uint32 val;
+  int size;
+  if (ch >> 7 == 0) { // 0xxxxxxx
+    size = 0;
+    val = ch;
+  }
+  else if (ch >> 5 == 6) { // 110xxxxx  10xxxxxx
+    val = (ch & 0x1F) << 6;
+    size = 1;
+  }
+  else if (ch >> 4 == 0xE) { // 1110xxxx  10xxxxxx  10xxxxxx
+    val = (ch & 0xF) << 12;
+    size = 2;
   }
+  else if (ch >> 3 == 0x1E) { // 11110xxx  10xxxxxx  10xxxxxx  10xxxxxx
+    val = (ch & 0x7) << 18;
+    size = 3;
+  }
+  else
+    return false;
+
+  for (int i=0 ; i < size ; i++) {
+    ch = input[idx++];
+    if (ch >> 6 != 2)
+      return false;
+    val |= (ch & 0x3F) << (6 * (size - i - 1));
+  }
+
+  code_point = val;
+  return true;
 }
 
 OBJ str_to_obj(const char *c_str) {
-  OBJ raw_str_obj;
-
-  if (c_str[0] == 0) {
-    raw_str_obj = make_empty_seq();
+  // First pass: counting the characters and finding the one with the highest code point
+  uint32 len = 0;
+  uint32 max_code_point = 0;
+  for (uint32 idx=0 ; c_str[idx] != 0 ; len++) {
+    uint32 code_point;
+    if (!decode_utf8_char(c_str, idx, code_point))
+      impl_fail("Invalid UTF-8 string");
+    if (code_point > max_code_point)
+      max_code_point = code_point;
   }
-  else {
-    int64 size = from_utf8(c_str, NULL);
-    SEQ_OBJ *raw_str = new_seq(size);
-    from_utf8(c_str, raw_str->buffer);
-    raw_str_obj = make_seq(raw_str, size);
+
+  if (len == 0)
+    return make_tag_obj(symb_idx_string, make_empty_seq());
+
+  PACKED_ELEM_TYPE elem_type = max_code_point <= 0xFF ? PACKED_UINT8 : (max_code_point <= 0xFFFF ? PACKED_UINT16 : PACKED_INT32);
+  PACKED_SEQ_OBJ *raw_str = new_packed_seq(elem_type, len);
+
+  // Second pass: storing the characters
+  uint32 idx = 0;
+  for (uint32 i=0 ; i < len ; i++) {
+    uint32 code_point;
+    decode_utf8_char(c_str, idx, code_point);
+    if (elem_type == PACKED_UINT8)
+      ((uint8 *) raw_str->elems)[i] = code_point;
+    else if (elem_type == PACKED_UINT16)
+      ((uint16 *) raw_str->elems)[i] = code_point;
+    else
+      ((int32 *) raw_str->elems)[i] = code_point;
   }
 
-  return make_tag_obj(symb_idx_string, raw_str_obj);
+  return make_tag_obj(symb_idx_string, make_packed_seq(raw_str, len));
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
-int64 to_utf8(const OBJ *chars, uint32 len, char *output) {
-  int offset = 0;
-  for (uint32 i=0 ; i < len ; i++) {
-    int64 cp = get_int_val(chars[i]);
-    if (cp < 0x80) {
-      if (output != NULL)
-        output[offset] = cp;
-      offset++;
+// Writes the UTF-8 encoding of the character to <output>, if it's not NULL,
+// and returns the number of bytes it takes
+inline uint32 encode_utf8_char(uint32 cp, char *output) {
+  if (cp < 0x80) {
+    if (output != NULL)
+      output[0] = cp;
+    return 1;
+  }
+  else if (cp < 0x800) {
+    if (output != NULL) {
+      output[0] = 0xC0 | (cp >> 6);
+      output[1] = 0x80 | (cp & 0x3F);
     }
-    else if (cp < 0x800) {
-      if (output != NULL) {
-        output[offset]   = 0xC0 | (cp >> 6);
-        output[offset+1] = 0x80 | (cp & 0x3F);
-      }
-      offset += 2;
+    return 2;
+  }
+  else if (cp < 0x10000) {
+    if (output != NULL) {
+      output[0] = 0xE0 | (cp >> 12);
+      output[1] = 0x80 | ((cp >> 6) & 0x3F);
+      output[2] = 0x80 | (cp & 0x3F);
     }
-    else if (cp < 0x10000) {
-      if (output != NULL) {
-        output[offset]   = 0xE0 | (cp >> 12);
-        output[offset+1] = 0x80 | ((cp >> 6) & 0x3F);
-        output[offset+2] = 0x80 | (cp & 0x3F);
-      }
-      offset += 3;
+    return 3;
+  }
+  else {
+    if (output != NULL) {
+      output[0] = 0xF0 | (cp >> 18);
+      output[1] = 0x80 | ((cp >> 12) & 0x3F);
+      output[2] = 0x80 | ((cp >> 6) & 0x3F);
+      output[3] = 0x80 | (cp & 0x3F);
     }
-    else {
-      if (output != NULL) {
-        output[offset]   = 0xF0 | (cp >> 18);
-        output[offset+1] = 0x80 | ((cp >> 12) & 0x3F);
-        output[offset+2] = 0x80 | ((cp >> 6) & 0x3F);
-        output[offset+3] = 0x80 | (cp & 0x3F);
-      }
-      offset += 4;
+    return 4;
+  }
+}
+
+// Writes the UTF-8 encoding of a sequence of characters, followed by a null terminator,
+// to <output>, if it's not NULL. Returns the size of the encoding, including the terminator
+int64 seq_to_utf8(OBJ char_seq, char *output) {
+  uint32 len = get_seq_length(char_seq);
+  int64 offset = 0;
+
+  if (len > 0 && get_physical_type(char_seq) == TYPE_PACKED_SEQ) {
+    PACKED_SEQ_OBJ *ptr = get_packed_seq_ptr(char_seq);
+    uint32 first = get_seq_offset(char_seq);
+
+    if (ptr->elem_type == PACKED_UINT8) {
+      uint8 *chars = (uint8 *) ptr->elems + first;
+      for (uint32 i=0 ; i < len ; i++)
+        offset += encode_utf8_char(chars[i], output != NULL ? output + offset : NULL);
+      len = 0;
     }
+    else if (ptr->elem_type == PACKED_UINT16) {
+      uint16 *chars = (uint16 *) ptr->elems + first;
+      for (uint32 i=0 ; i < len ; i++)
+        offset += encode_utf8_char(chars[i], output != NULL ? output + offset : NULL);
+      len = 0;
+    }
+  }
+
+  if (len > 0) {
+    SEQ_ITER it;
+    get_seq_iter(it, char_seq);
+    for ( ; !is_out_of_range(it) ; move_forward(it))
+      offset += encode_utf8_char(get_int_val(get_curr_obj(it)), output != NULL ? output + offset : NULL);
   }
+
   if (output != NULL)
     output[offset] = 0;
   return offset + 1;
 }
 
+uint64 char_buffer_size(OBJ str_obj) {
+  return seq_to_utf8(get_inner_obj(str_obj), NULL);
+}
+
 void obj_to_str(OBJ str_obj, char *buffer, uint32 size) {
   OBJ raw_str_obj = get_inner_obj(str_obj);
-
-  if (!is_empty_seq(raw_str_obj)) {
-    OBJ *seq_buffer = get_seq_buffer_ptr(raw_str_obj);
-    uint32 len = get_seq_length(raw_str_obj);
-    int64 min_size = to_utf8(seq_buffer, len, NULL);
-    if (size < min_size)
-      internal_fail();
-    to_utf8(seq_buffer, len, buffer);
-  }
-  else
-    buffer[0] = '\0';
+  int64 min_size = seq_to_utf8(raw_str_obj, NULL);
+  if (size < min_size)
+    internal_fail();
+  seq_to_utf8(raw_str_obj, buffer);
 }
 
 char *obj_to_byte_array(OBJ byte_seq_obj, uint32 &size) {
@@ -119,27 +169,40 @@ char *obj_to_byte_array(OBJ byte_seq_obj, uint32 &size) {
   }
 
   uint32 len = get_seq_length(byte_seq_obj);
-  OBJ *elems = get_seq_buffer_ptr(byte_seq_obj);
   char *buffer = new_byte_array(len);
-  for (uint32 i=0 ; i < len ; i++) {
-    long long val = get_int_val(elems[i]);
+
+  if (get_physical_type(byte_seq_obj) == TYPE_PACKED_SEQ) {
+    PACKED_SEQ_OBJ *ptr = get_packed_seq_ptr(byte_seq_obj);
+    if (ptr->elem_type == PACKED_UINT8) {
+      memcpy(buffer, (uint8 *) ptr->elems + get_seq_offset(byte_seq_obj), len);
+      size = len;
+      return buffer;
+    }
+  }
+
+  SEQ_ITER it;
+  get_seq_iter(it, byte_seq_obj);
+  for ( ; !is_out_of_range(it) ; move_forward(it)) {
+    long long val = get_int_val(get_curr_obj(it));
     assert(val >= 0 && val <= 255);
-    buffer[i] = (char) val;
+    buffer[it.idx] = (char) val;
   }
   size = len;
   return buffer;
 }
 
 char *obj_to_str(OBJ str_obj) {
-  uint32 size = get_seq_length(get_inner_obj(str_obj)) + 1;
+  OBJ raw_str_obj = get_inner_obj(str_obj);
+  uint32 size = seq_to_utf8(raw_str_obj, NULL);
   char *buffer = new_byte_array(size);
-  obj_to_str(str_obj, buffer, size);
+  seq_to_utf8(raw_str_obj, buffer);
   return buffer;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
-static std::vector<OBJ> cached_objs;
+// Objects are cached by the thread that uses them
+static thread_local std::vector<OBJ> cached_objs;
 
 void add_obj_to_cache(OBJ obj) {
   if (is_ref_obj(obj))
@@ -155,57 +218,169 @@ void release_all_cached_objs() {
 
 ////////////////////////////////////////////////////////////////////////////////
 
-bool str_ord(const char *str1, const char *str2) {
-  return strcmp(str1, str2) > 0;
-}
+// Symbols are interned in an open addressing hash table, indexed by their text, which is
+// looked up as a pointer and a length, so it doesn't need to be null-terminated or copied.
+// Each slot stores the length and hash code of its symbol, computed only once, when it's
+// inserted, so growing the table and skipping most of the slots that don't match don't
+// require looking at the text. The text of the symbols created at runtime is stored in an arena.
+// Symbols are shared by all threads, so all accesses to the table are serialized
+
+// Must be a power of two. The table is kept at most half full
+const uint32 SYMB_TABLE_MIN_CAPACITY = 1024;
+
+const uint32 SYMB_ARENA_BLOCK_SIZE = 64 * 1024;
+
 
-typedef std::map<const char *, uint32, bool(*)(const char *, const char *)> str_idx_map_type;
+struct SYMB_TABLE_SLOT {
+  const char *str;  // NULL if the slot is empty
+  uint32 length;
+  uint32 hash_code;
+  uint32 symb_idx;
+};
+
+static SYMB_TABLE_SLOT *symb_table = NULL;
+static uint32 symb_table_capacity = 0;
+static uint32 symb_table_count = 0;
 
-str_idx_map_type str_to_symb_map(str_ord);
 //## THESE STRINGS ARE NEVER CLEANED UP. NOT MUCH OF A PROBLEM IN PRACTICE, BUT STILL A BUG...
 std::vector<const char *> dynamic_symbs_strs;
 
+static char *symb_arena_ptr = NULL;
+static uint32 symb_arena_space_left = 0;
+
+static std::mutex symb_table_mutex;
+
 const char *symb_repr(uint16);
 uint32 embedded_symbs_count();
 
+////////////////////////////////////////////////////////////////////////////////
+
+// FNV-1a
+inline uint32 symb_hash_code(const char *str, uint32 len) {
+  uint32 hash_code = 2166136261U;
+  for (uint32 i=0 ; i < len ; i++)
+    hash_code = (hash_code ^ (uint8) str[i]) * 16777619U;
+  return hash_code;
+}
+
+static void insert_into_symb_table(SYMB_TABLE_SLOT *table, uint32 capacity, SYMB_TABLE_SLOT slot) {
+  uint32 mask = capacity - 1;
+  for (uint32 idx = slot.hash_code & mask ; ; idx = (idx + 1) & mask)
+    if (table[idx].str == NULL) {
+      table[idx] = slot;
+      return;
+    }
+}
+
+static void add_to_symb_table(const char *str, uint32 len, uint32 hash_code, uint32 symb_idx) {
+  if (2 * (symb_table_count + 1) > symb_table_capacity) {
+    uint32 capacity = 2 * symb_table_capacity;
+    SYMB_TABLE_SLOT *table = (SYMB_TABLE_SLOT *) calloc(capacity, sizeof(SYMB_TABLE_SLOT));
+    for (uint32 i=0 ; i < symb_table_capacity ; i++)
+      if (symb_table[i].str != NULL)
+        insert_into_symb_table(table, capacity, symb_table[i]);
+    free(symb_table);
+    symb_table = table;
+    symb_table_capacity = capacity;
+  }
+
+  SYMB_TABLE_SLOT slot;
+  slot.str = str;
+  slot.length = len;
+  slot.hash_code = hash_code;
+  slot.symb_idx = symb_idx;
+  insert_into_symb_table(symb_table, symb_table_capacity, slot);
+  symb_table_count++;
+}
+
+static void add_embedded_symbs_to_symb_table() {
+  uint32 count = embedded_symbs_count();
+  for (uint32 i=0 ; i < count ; i++) {
+    const char *str = symb_repr(i);
+    uint32 len = strlen(str);
+    add_to_symb_table(str, len, symb_hash_code(str, len), i);
+  }
+}
+
+// Returns a null-terminated copy of the string, allocated in the arena
+static const char *store_symb_str(const char *str, uint32 len) {
+  if (len + 1 > symb_arena_space_left) {
+    uint32 size = len + 1 > SYMB_ARENA_BLOCK_SIZE ? len + 1 : SYMB_ARENA_BLOCK_SIZE;
+    symb_arena_ptr = (char *) malloc(size);
+    symb_arena_space_left = size;
+  }
+
+  char *copy = symb_arena_ptr;
+  memcpy(copy, str, len);
+  copy[len] = '\0';
+  symb_arena_ptr += len + 1;
+  symb_arena_space_left -= len + 1;
+  return copy;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
 const char *symb_to_raw_str(OBJ obj) {
   assert(is_symb(obj));
   uint16 idx = get_symb_idx(obj);
   uint32 count = embedded_symbs_count();
   if (idx < count)
     return symb_repr(idx);
-  else
-    return dynamic_symbs_strs[idx - count];
+
+  std::lock_guard<std::mutex> lock(symb_table_mutex);
+  return dynamic_symbs_strs[idx - count];
 }
 
 OBJ to_str(OBJ obj) {
   return str_to_obj(symb_to_raw_str(obj));
 }
 
-uint16 lookup_symb_idx(const char *str_, uint32 len) {
-  uint32 count = embedded_symbs_count();
+uint16 lookup_symb_idx(const char *str, uint32 len) {
+  std::lock_guard<std::mutex> lock(symb_table_mutex);
 
-  if (str_to_symb_map.size() == 0)
-    for (uint32 i=0 ; i < count ; i++)
-      str_to_symb_map[symb_repr(i)] = i;
+  if (symb_table == NULL) {
+    symb_table = (SYMB_TABLE_SLOT *) calloc(SYMB_TABLE_MIN_CAPACITY, sizeof(SYMB_TABLE_SLOT));
+    symb_table_capacity = SYMB_TABLE_MIN_CAPACITY;
+    add_embedded_symbs_to_symb_table();
+  }
 
-  char *str = strndup(str_, len);
+  uint32 hash_code = symb_hash_code(str, len);
+  uint32 mask = symb_table_capacity - 1;
 
-  str_idx_map_type::iterator it = str_to_symb_map.find(str);
-  if (it != str_to_symb_map.end()) {
-    free(str);
-    return it->second;
+  for (uint32 idx = hash_code & mask ; symb_table[idx].str != NULL ; idx = (idx + 1) & mask) {
+    SYMB_TABLE_SLOT &slot = symb_table[idx];
+    if (slot.hash_code == hash_code && slot.length == len && memcmp(slot.str, str, len) == 0)
+      return slot.symb_idx;
   }
 
-  uint32 next_symb_id = count + dynamic_symbs_strs.size();
+  uint32 next_symb_id = embedded_symbs_count() + dynamic_symbs_strs.size();
   if (next_symb_id > 0xFFFF)
     impl_fail("Exceeded maximum permitted number of symbols (= 2^16)");
-  dynamic_symbs_strs.push_back(str);
-  str_to_symb_map[str] = next_symb_id;
+  const char *str_copy = store_symb_str(str, len);
+  dynamic_symbs_strs.push_back(str_copy);
+  add_to_symb_table(str_copy, len, hash_code, next_symb_id);
   return next_symb_id;
 }
 
 OBJ to_symb(OBJ obj) {
+  // Symbols are plain ASCII, so characters stored as bytes can be looked up directly,
+  // as long as there are no null characters, which would end the string in obj_to_str()
+  OBJ raw_str_obj = get_inner_obj(obj);
+  if (!is_empty_seq(raw_str_obj) && get_physical_type(raw_str_obj) == TYPE_PACKED_SEQ) {
+    PACKED_SEQ_OBJ *ptr = get_packed_seq_ptr(raw_str_obj);
+    if (ptr->elem_type == PACKED_UINT8) {
+      const char *chars = (const char *) ptr->elems + get_seq_offset(raw_str_obj);
+      uint32 len = get_seq_length(raw_str_obj);
+      bool is_plain_ascii = true;
+      for (uint32 i=0 ; i < len ; i++) {
+        uint8 ch = chars[i];
+        is_plain_ascii &= ch != 0 & ch < 0x80;
+      }
+      if (is_plain_ascii)
+        return make_symb(lookup_symb_idx(chars, len));
+    }
+  }
+
   char *str = obj_to_str(obj);
   uint32 len = strlen(str);
   uint16 symb_idx = lookup_symb_idx(str, len);
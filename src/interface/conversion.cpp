@@ -16,36 +16,15 @@ OBJ convert_bool_seq(const bool *array, uint32 size) {
 }
 
 OBJ convert_int32_seq(const int32 *array, uint32 size) {
-  if (size == 0)
-    return make_empty_seq();
-  //## CHECK THAT THE INPUT ARRAY DOES NOT EXCEED THE MAXIMUM SEQUENCE SIZE
-  SEQ_OBJ *seq = new_seq(size);
-  OBJ *buffer = seq->buffer;
-  for (unsigned int i=0 ; i < size ; i++)
-    buffer[i] = make_int(array[i]);
-  return make_seq(seq, size);
+  return build_packed_int32_seq(array, size);
 }
 
 OBJ convert_int_seq(const int64 *array, uint32 size) {
-  if (size == 0)
-    return make_empty_seq();
-  //## CHECK THAT THE INPUT ARRAY DOES NOT EXCEED THE MAXIMUM SEQUENCE SIZE
-  SEQ_OBJ *seq = new_seq(size);
-  OBJ *buffer = seq->buffer;
-  for (unsigned int i=0 ; i < size ; i++)
-    buffer[i] = make_int(array[i]);
-  return make_seq(seq, size);
+  return build_packed_int64_seq(array, size);
 }
 
 OBJ convert_float_seq(const double *array, uint32 size) {
-  if (size == 0)
-    return make_empty_seq();
-  //## CHECK THAT THE INPUT ARRAY DOES NOT EXCEED THE MAXIMUM SEQUENCE SIZE
-  SEQ_OBJ *seq = new_seq(size);
-  OBJ *buffer = seq->buffer;
-  for (uint32 i=0 ; i < size ; i++)
-    buffer[i] = make_float(array[i]);
-  return make_seq(seq, size);
+  return build_packed_float_seq(array, size);
 }
 
 OBJ convert_text(const char *buffer) {
@@ -67,9 +46,10 @@ uint32 export_as_bool_array(OBJ obj, bool *array, uint32 capacity) {
   uint32 len = get_seq_length(obj);
   if (len >= capacity)
     throw (long long) len;
-  OBJ *buffer = get_seq_buffer_ptr(obj);
-  for (uint32 i=0 ; i < len ; i++)
-    array[i] = get_bool(buffer[i]);
+  SEQ_ITER it;
+  get_seq_iter(it, obj);
+  for ( ; !is_out_of_range(it) ; move_forward(it))
+    array[it.idx] = get_bool(get_curr_obj(it));
   return len;
 }
 
@@ -77,9 +57,10 @@ uint32 export_as_long_long_array(OBJ obj, int64 *array, uint32 capacity) {
   uint32 len = get_seq_length(obj);
   if (len >= capacity)
     throw (long long) len;
-  OBJ *buffer = get_seq_buffer_ptr(obj);
-  for (uint32 i=0 ; i < len ; i++)
-    array[i] = get_int(buffer[i]);
+  SEQ_ITER it;
+  get_seq_iter(it, obj);
+  for ( ; !is_out_of_range(it) ; move_forward(it))
+    array[it.idx] = get_int(get_curr_obj(it));
   return len;
 }
 
@@ -87,9 +68,10 @@ uint32 export_as_float_array(OBJ obj, double *array, uint32 capacity) {
   uint32 len = get_seq_length(obj);
   if (len >= capacity)
     throw (long long) len;
-  OBJ *buffer = get_seq_buffer_ptr(obj);
-  for (uint32 i=0 ; i < len ; i++)
-    array[i] = get_float(buffer[i]);
+  SEQ_ITER it;
+  get_seq_iter(it, obj);
+  for ( ; !is_out_of_range(it) ; move_forward(it))
+    array[it.idx] = get_float(get_curr_obj(it));
   return len;
 }
 
@@ -102,16 +84,12 @@ void export_literal_as_c_string(OBJ obj, char *buffer, uint32 capacity) {
 ////////////////////////////////////////////////////////////////////////////////
 
 string export_as_std_string(OBJ obj) {
-  string result;
+  // The characters are encoded directly into the string, with no intermediate buffer
   OBJ raw_str_obj = get_inner_obj(obj);
-  if (!is_empty_seq(raw_str_obj)) {
-    OBJ *seq_buffer = get_seq_buffer_ptr(raw_str_obj);
-    uint32 len = get_seq_length(raw_str_obj);
-    int64 size = to_utf8(seq_buffer, len, NULL);
-    char *utf8_data = new_byte_array(size+1);
-    to_utf8(seq_buffer, len, utf8_data);
-    result = utf8_data;
-  }
+  string result;
+  result.resize(seq_to_utf8(raw_str_obj, NULL));
+  seq_to_utf8(raw_str_obj, &result[0]);
+  result.resize(result.size() - 1);
   return result;
 }
 
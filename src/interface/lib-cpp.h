@@ -36,10 +36,11 @@ template <typename T> vector<typename T::type> export_as_vector(OBJ obj) {
 
   if (is_ne_seq(obj)) {
     uint32 len = get_seq_length(obj);
-    OBJ *buffer = get_seq_buffer_ptr(obj);
     result.resize(len);
-    for (uint32 i=0 ; i < len ; i++)
-      result[i] = T::get_value(buffer[i]);
+    SEQ_ITER it;
+    get_seq_iter(it, obj);
+    for ( ; !is_out_of_range(it) ; move_forward(it))
+      result[it.idx] = T::get_value(get_curr_obj(it));
     return result;
   }
   else if (is_ne_set(obj)) {
@@ -202,7 +203,7 @@ template <typename T> vector<typename T::type> get_unary_rel(UNARY_TABLE &table,
 
 template <typename T0, typename T1> vector<tuple<typename T0::type, typename T1::type> >
 get_binary_rel(BINARY_TABLE &table, VALUE_STORE &store0, VALUE_STORE &store1, bool flipped) {
-  uint32 size = table.left_to_right.size();
+  uint32 size = table.left_to_right.count;
   vector<tuple<typename T0::type, typename T1::type> > result(size);
   BINARY_TABLE_ITER iter;
   binary_table_get_iter(&table, &iter);
@@ -222,7 +223,7 @@ get_binary_rel(BINARY_TABLE &table, VALUE_STORE &store0, VALUE_STORE &store1, bo
 template <typename T0, typename T1, typename T2> vector<tuple<typename T0::type, typename T1::type, typename T2::type> >
 get_ternary_rel(TERNARY_TABLE &table, VALUE_STORE &store0, VALUE_STORE &store1, VALUE_STORE &store2,
     int idx0, int idx1, int idx2) {
-  uint32 size = table.unshifted.size();
+  uint32 size = table.unshifted.count;
   vector<tuple<typename T0::type, typename T1::type, typename T2::type> > result(size);
   TERNARY_TABLE_ITER iter;
   ternary_table_get_iter(&table, &iter);
@@ -544,12 +544,15 @@ Value *export_as_value_ptr(OBJ obj) {
 
     case TYPE_SEQUENCE:
     case TYPE_SLICE:
+    case TYPE_TREE_SEQ:
+    case TYPE_PACKED_SEQ:
       if (!is_empty_seq(obj)) {
         uint32 size = get_seq_length(obj);
-        OBJ *objs = get_seq_buffer_ptr(obj);
         Value **items = new Value *[size];
-        for (uint32 i=0 ; i < size ; i++)
-          items[i] = export_as_value_ptr(objs[i]);
+        SEQ_ITER it;
+        get_seq_iter(it, obj);
+        for ( ; !is_out_of_range(it) ; move_forward(it))
+          items[it.idx] = export_as_value_ptr(get_curr_obj(it));
         return new SeqSetValue(items, size, true);
       }
       else
@@ -570,15 +573,16 @@ Value *export_as_value_ptr(OBJ obj) {
 
     case TYPE_BIN_REL:
     case TYPE_MAP:
-    case TYPE_LOG_MAP: {
+    case TYPE_LOG_MAP:
+    case TYPE_TREE_MAP: {
       assert(!is_empty_rel(obj));
-      BIN_REL_OBJ *ptr = get_bin_rel_ptr(obj);
-      uint32 size = ptr->size;
-      OBJ *buffer = ptr->buffer;
+      uint32 size = get_size(obj);
       Value *(*entries)[2] = new Value*[size][2];
-      for (uint32 i=0 ; i < size ; i++) {
-        entries[i][0] = export_as_value_ptr(buffer[i]);
-        entries[i][1] = export_as_value_ptr(buffer[i+size]);
+      BIN_REL_ITER it;
+      get_bin_rel_iter(it, obj);
+      for ( ; !is_out_of_range(it) ; move_forward(it)) {
+        entries[it.idx][0] = export_as_value_ptr(get_curr_left_arg(it));
+        entries[it.idx][1] = export_as_value_ptr(get_curr_right_arg(it));
       }
       return new BinRelValue(entries, size, physical_type != TYPE_BIN_REL);
     }
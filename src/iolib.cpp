@@ -16,14 +16,9 @@ OBJ FileRead_P(OBJ filename, generated::ENV &) {
   if (size == -1)
     return make_symb(symb_idx_nothing);
 
-  OBJ seq_obj = make_empty_seq();
-  if (size > 0) {
-    SEQ_OBJ *seq = new_seq(size);
-    for (uint32 i=0 ; i < size ; i++)
-      seq->buffer[i] = make_int((uint8) data[i]);
+  OBJ seq_obj = build_packed_uint8_seq((uint8 *) data, size);
+  if (size > 0)
     delete_byte_array(data, size);
-    seq_obj = make_seq(seq, size);
-  }
 
   return make_tag_obj(symb_idx_just, seq_obj);
 }
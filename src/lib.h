@@ -28,11 +28,14 @@ enum OBJ_TYPE {
   TYPE_TAG_OBJ    = 9,
   TYPE_SLICE      = 10,
   TYPE_MAP        = 11,
-  TYPE_LOG_MAP    = 12
+  TYPE_LOG_MAP    = 12,
+  TYPE_TREE_MAP   = 13,
+  TYPE_TREE_SEQ   = 14,
+  TYPE_PACKED_SEQ = 15
 };
 
 // Heap object can never be of the following types: TYPE_SLICE, TYPE_LOG_MAP
-// Never returned by get_logical_type(): TYPE_SLICE, TYPE_MAP, TYPE_LOG_MAP.
+// Never returned by get_logical_type(): TYPE_SLICE, TYPE_MAP, TYPE_LOG_MAP, TYPE_TREE_MAP, TYPE_TREE_SEQ, TYPE_PACKED_SEQ.
 
 const uint32 MAX_INLINE_OBJ_TYPE_VALUE  = TYPE_FLOAT;
 const uint32 MAX_OBJ_TYPE_VALUE         = TYPE_SLICE;
@@ -101,9 +104,14 @@ struct SEQ_OBJ {
 };
 
 
+// Lazily built, see search-index.cpp
+struct SEARCH_INDEX;
+
+
 struct SET_OBJ {
   REF_OBJ ref_obj;
   uint32  size;
+  SEARCH_INDEX *search_index;
   OBJ     buffer[1];
 };
 
@@ -111,10 +119,65 @@ struct SET_OBJ {
 struct BIN_REL_OBJ {
   REF_OBJ ref_obj;
   uint32  size;
+  SEARCH_INDEX *search_index;   // Indexes the left column only
   OBJ     buffer[1];
 };
 
 
+// See tree-map.cpp
+struct TREE_MAP_NODE {
+  REF_OBJ ref_obj;
+  uint16  count;    // Number of entries in a leaf, or of children in an inner node
+  uint16  height;   // Leaves have height 0
+  uint32  size;     // Number of entries in the subtree
+  OBJ     keys[1];  // Followed by the values in a leaf, or by the pointers to the children in an inner node
+};
+
+
+struct TREE_MAP_OBJ {
+  REF_OBJ ref_obj;
+  uint32  size;
+  TREE_MAP_NODE *root;
+  BIN_REL_OBJ *array_view;  // Built lazily, doesn't hold references to the entries
+};
+
+
+// See tree-seq.cpp
+struct TREE_SEQ_NODE {
+  REF_OBJ ref_obj;
+  uint16  count;    // Number of elements in a leaf, or of children in an inner node
+  uint16  height;   // Leaves have height 0
+  uint32  size;     // Number of elements in the subtree
+  OBJ     elems[1]; // In inner nodes, replaced by the pointers to the children, followed by the end offset of each of them
+};
+
+
+struct TREE_SEQ_OBJ {
+  REF_OBJ ref_obj;
+  TREE_SEQ_NODE *root;
+};
+
+
+// See packed-seq.cpp
+// Integer types are listed in order of increasing range
+enum PACKED_ELEM_TYPE {
+  PACKED_UINT8  = 0,
+  PACKED_UINT16 = 1,
+  PACKED_INT32  = 2,
+  PACKED_INT64  = 3,
+  PACKED_FLOAT  = 4
+};
+
+
+struct PACKED_SEQ_OBJ {
+  REF_OBJ ref_obj;
+  uint32  capacity;
+  uint32  size;
+  uint32  elem_type;        // PACKED_ELEM_TYPE
+  int64   elems[1];         // Raw elements, their actual size depends on elem_type
+};
+
+
 struct TERN_REL_OBJ {
   REF_OBJ ref_obj;
   uint32  size;
@@ -132,8 +195,15 @@ struct TAG_OBJ {
 
 struct SEQ_ITER {
   OBJ    *buffer;
+  PACKED_SEQ_OBJ *packed;   // Used instead of buffer for packed sequences
+  uint32  offset;
   uint32  idx;
   uint32  len;
+  // Tree sequences are iterated one leaf at a time, and the buffer is that of the current leaf,
+  // which contains the elements in [leaf_first, leaf_end). Not used if tree_root is null
+  TREE_SEQ_NODE *tree_root;
+  uint32  leaf_first;
+  uint32  leaf_end;
 };
 
 
@@ -150,6 +220,11 @@ struct BIN_REL_ITER {
   uint32 *rev_idxs; // If this is not null, we are iterating in right column order
   uint32  idx;
   uint32  end; // Non-inclusive upper bound
+  // Tree maps are iterated one leaf at a time, and the columns are those of the current leaf,
+  // which contains the entries in [leaf_first, leaf_end). Not used if tree_root is null
+  TREE_MAP_NODE *tree_root;
+  uint32  leaf_first;
+  uint32  leaf_end;
 };
 
 
@@ -170,25 +245,62 @@ struct STREAM {
 
 ////////////////////////////////////////////////////////////////////////////////
 
+enum VALUE_STORE_TYPE {
+  GENERIC_VALUE_STORE = 0,
+  INT_VALUE_STORE     = 1,  // Only integers
+  SYMB_VALUE_STORE    = 2   // Only symbols
+};
+
+
 struct VALUE_STORE {
   void *ptr;
   uint32 capacity;
   uint32 usage;
   uint32 first_free;
+  uint32 tombstones;  // Buckets of the hash index that are marked as deleted
+  uint32 first_untouched; // Slots from this one on have never been used, and are not initialized
+  VALUE_STORE_TYPE type;
+  // Block the store is being incrementally resized from, or NULL
+  void *old_ptr;
+  uint32 old_capacity;
+  uint32 old_tombstones;
+  uint32 migrated;    // Slots of the old block that have already been moved, with twice as many buckets
 };
 
 
 struct VALUE_STORE_UPDATES {
   void *ptr;
   uint32 capacity;
-  uint32 count;
+  uint32 count;       // For symbol stores, one more than the highest symbol index inserted
   uint32 first_free;
 };
 
 
+enum UNARY_CHUNK_TYPE {
+  ARRAY_CHUNK   = 0,
+  BITMAP_CHUNK  = 1,
+  RUN_CHUNK     = 2
+};
+
+// Values are partitioned into chunks of 2^16 consecutive surrogates. Each chunk stores
+// the lower 16 bits of its values either as a sorted array, as a bitmap or as a sorted
+// list of runs, whichever takes less memory. Chunks are never empty
+struct UNARY_CHUNK {
+  union {
+    uint16 *array;    // Sorted values
+    uint64 *bitmap;   // 1024 words
+    uint16 *runs;     // Pairs (first value, length - 1)
+  };
+  uint32 count;       // Number of values in the chunk
+  uint32 runs_count;  // Only used by run chunks
+  uint16 key;         // Upper 16 bits of all values in the chunk
+  uint8  type;        // UNARY_CHUNK_TYPE
+};
+
 struct UNARY_TABLE {
-  uint64 *bitmap;
-  uint32 size;
+  UNARY_CHUNK *chunks;  // Sorted by key
+  uint32 chunks_count;
+  uint32 capacity;
   uint32 count;
 };
 
@@ -202,15 +314,34 @@ struct UNARY_TABLE_UPDATES {
 
 
 struct UNARY_TABLE_ITER {
-  uint64 *bitmap;
-  uint32 size;
-  uint32 curr_value;
+  UNARY_CHUNK *chunk;
+  UNARY_CHUNK *end_chunk;
+  uint32 idx;         // Index of the current value in array chunks, and of the current run in run chunks
+  uint32 curr_value;  // Lower 16 bits of the current value
+};
+
+
+template <typename T> struct INDEX_BLOCK {
+  T       first; // Copy of elems[0], so that blocks can be searched without touching their content
+  T      *elems;
+  uint32  size;
+  uint32  capacity;
+};
+
+// Sorted set of tuples, stored as a sequence of sorted blocks of bounded size.
+// Blocks are never empty, and all the elements of a block are lower than the
+// first element of the next one
+template <typename T> struct SORTED_INDEX {
+  INDEX_BLOCK<T> *blocks;
+  uint32 blocks_count;
+  uint32 capacity;
+  uint32 count;
 };
 
 
 struct BINARY_TABLE {
-  std::set<uint64> left_to_right;
-  std::set<uint64> right_to_left;
+  SORTED_INDEX<uint64> left_to_right;
+  SORTED_INDEX<uint64> right_to_left;
 };
 
 
@@ -221,8 +352,9 @@ struct BINARY_TABLE_UPDATES {
 
 
 struct BINARY_TABLE_ITER {
-  std::set<uint64>::iterator iter;
-  std::set<uint64>::iterator end;
+  INDEX_BLOCK<uint64> *block;
+  INDEX_BLOCK<uint64> *end_block;
+  uint32 offset;
   uint32 value;
   bool reversed;
 };
@@ -246,10 +378,15 @@ struct tuple3 {
 // }
 
 
+// Only the unshifted index is always available. The other two, which are
+// needed only to search the table by columns other than the first one,
+// are built the first time they are used, and kept up to date afterwards
 struct TERNARY_TABLE {
-  std::set<tuple3> unshifted;
-  std::set<tuple3> shifted_once;
-  std::set<tuple3> shifted_twice;
+  SORTED_INDEX<tuple3> unshifted;
+  SORTED_INDEX<tuple3> shifted_once;
+  SORTED_INDEX<tuple3> shifted_twice;
+  bool shifted_once_built;
+  bool shifted_twice_built;
 };
 
 
@@ -260,8 +397,9 @@ struct TERNARY_TABLE_UPDATES {
 
 
 struct TERNARY_TABLE_ITER {
-  std::set<tuple3>::iterator iter;
-  std::set<tuple3>::iterator end;
+  INDEX_BLOCK<tuple3> *block;
+  INDEX_BLOCK<tuple3> *end_block;
+  uint32 offset;
   uint64 excl_upper_bound;
   uint8 shift;
 };
@@ -283,9 +421,9 @@ const uint16 symb_idx_failure = 7;
 
 ///////////////////////////////// mem_alloc.cpp ////////////////////////////////
 
-bool is_in_normal_state();
-bool is_in_try_state();
-bool is_in_copying_state();
+enum MEM_ALLOC_STATE {NORMAL, TRY, COPYING};
+
+extern thread_local MEM_ALLOC_STATE curr_mem_alloc_state;
 
 void enter_try_state();
 void enter_copy_state();
@@ -293,6 +431,9 @@ void restore_try_state();
 void return_to_normal_state();
 void abort_try_state();
 
+void mem_trim();
+void set_mem_retention(uint64 byte_size);
+
 //////////////////////////////// mem-copying.cpp ///////////////////////////////
 
 OBJ copy_obj(OBJ obj);
@@ -315,12 +456,17 @@ uint32 get_max_live_mem_usage();
 uint32 get_total_mem_requested();
 
 void print_all_live_objs();
+void print_mem_frag_report();
 
 /////////////////////////////////// mem.cpp ////////////////////////////////////
 
 void add_ref(REF_OBJ *);
 void add_ref(OBJ);
 void release(OBJ);
+void release_tree_map_node(TREE_MAP_NODE *);
+void release_tree_seq_node(TREE_SEQ_NODE *);
+
+bool is_unique(OBJ);
 
 void vec_add_ref(OBJ* objs, uint32 len);
 void vec_release(OBJ* objs, uint32 len);
@@ -329,6 +475,12 @@ OBJ* get_left_col_array_ptr(BIN_REL_OBJ*);
 OBJ* get_right_col_array_ptr(BIN_REL_OBJ*);
 uint32 *get_right_to_left_indexes(BIN_REL_OBJ*);
 
+OBJ *get_tree_map_node_values(TREE_MAP_NODE *leaf);
+TREE_MAP_NODE **get_tree_map_node_children(TREE_MAP_NODE *node);
+
+TREE_SEQ_NODE **get_tree_seq_node_children(TREE_SEQ_NODE *node);
+uint32 *get_tree_seq_node_ends(TREE_SEQ_NODE *node);
+
 OBJ *get_col_array_ptr(TERN_REL_OBJ *rel, int idx);
 uint32 *get_rotated_index(TERN_REL_OBJ *rel, int amount);
 
@@ -337,10 +489,19 @@ SEQ_OBJ*      new_seq(uint32 length);     // Sets ref_count, length, capacity, u
 BIN_REL_OBJ*  new_map(uint32 size);       // Sets ref_count and size, and clears rev_idxs
 BIN_REL_OBJ*  new_bin_rel(uint32 size);   // Sets ref_count and size
 TERN_REL_OBJ* new_tern_rel(uint32 size);  // Sets ref_count and size
+TREE_MAP_OBJ* new_tree_map(uint32 size);  // Sets ref_count and size, and clears array_view
+TREE_MAP_NODE* new_tree_map_node(uint32 count, uint32 height); // Sets ref_count, count and height
+TREE_SEQ_OBJ* new_tree_seq();             // Sets ref_count
+TREE_SEQ_NODE* new_tree_seq_node(uint32 count, uint32 height); // Sets ref_count, count and height
+PACKED_SEQ_OBJ* new_packed_seq(PACKED_ELEM_TYPE elem_type, uint32 size); // Sets ref_count, capacity, size and elem_type
 TAG_OBJ*      new_tag_obj();              // Sets ref_count
 
 SET_OBJ* shrink_set(SET_OBJ* set, uint32 new_size);
 
+SEQ_OBJ* expand_seq(SEQ_OBJ* seq, uint32 min_capacity);
+SET_OBJ* expand_set(SET_OBJ* set, uint32 idx);
+BIN_REL_OBJ* expand_map(BIN_REL_OBJ* map, uint32 idx);
+
 OBJ* new_obj_array(uint32 size);
 void delete_obj_array(OBJ* buffer, uint32 size);
 OBJ* resize_obj_array(OBJ* buffer, uint32 size, uint32 new_size);
@@ -367,46 +528,10 @@ void delete_void_array(void* buffer, uint32 size);
 
 //////////////////////////////// mem-utils.cpp /////////////////////////////////
 
+#include "obj-inline.h"
+
 OBJ_TYPE get_logical_type(OBJ); //## SHOULD IT EXPOSE THE DIFFERENCE BETWEEN MAPS AND NON-MAP BINARY RELATIONS?
 
-bool is_blank_obj(OBJ);
-bool is_null_obj(OBJ);
-bool is_symb(OBJ);
-bool is_bool(OBJ);
-bool is_int(OBJ);
-bool is_float(OBJ);
-bool is_seq(OBJ);
-bool is_empty_seq(OBJ);
-bool is_ne_seq(OBJ);
-bool is_empty_rel(OBJ);
-bool is_set(OBJ);
-bool is_ne_set(OBJ);
-bool is_bin_rel(OBJ);
-bool is_ne_bin_rel(OBJ);
-bool is_ne_map(OBJ);
-bool is_tern_rel(OBJ);
-bool is_ne_tern_rel(OBJ);
-bool is_tag_obj(OBJ);
-
-bool is_symb(OBJ, uint16);
-bool is_int(OBJ, int64);
-
-uint16 get_symb_idx(OBJ);
-bool   get_bool(OBJ);
-int64  get_int(OBJ);
-double get_float(OBJ);
-uint32 get_seq_length(OBJ);
-uint16 get_tag_idx(OBJ);
-OBJ    get_inner_obj(OBJ);
-
-OBJ make_blank_obj();
-OBJ make_null_obj();
-OBJ make_empty_seq();
-OBJ make_empty_rel();
-OBJ make_symb(uint16 symb_idx);
-OBJ make_bool(bool b);
-OBJ make_int(uint64 value);
-OBJ make_float(double value);
 OBJ make_seq(SEQ_OBJ* ptr, uint32 length);
 OBJ make_slice(SEQ_OBJ* ptr, MEM_LAYOUT mem_layout, uint32 offset, uint32 length);
 OBJ make_set(SET_OBJ*);
@@ -414,37 +539,24 @@ OBJ make_bin_rel(BIN_REL_OBJ*);
 OBJ make_tern_rel(TERN_REL_OBJ*);
 OBJ make_log_map(BIN_REL_OBJ*);
 OBJ make_map(BIN_REL_OBJ*);
+OBJ make_tree_map(TREE_MAP_OBJ*);
+OBJ make_tree_seq(TREE_SEQ_OBJ*, uint32 length);
+OBJ make_packed_seq(PACKED_SEQ_OBJ*, uint32 length);
+OBJ make_packed_slice(PACKED_SEQ_OBJ*, MEM_LAYOUT mem_layout, uint32 offset, uint32 length);
 OBJ make_tag_obj(uint16 tag_idx, OBJ obj);
 
 // These functions exist in a limbo between the logical and physical world
 
-uint32 get_seq_offset(OBJ);
-OBJ* get_seq_buffer_ptr(OBJ);
+OBJ* get_seq_buffer_ptr(OBJ);   // Not for tree and packed sequences, which are not stored as a single array of objects
+void copy_seq_elems(OBJ seq, uint32 first, uint32 count, OBJ *dest);
 
 // Purely physical representation functions
 
 OBJ repoint_to_std_mem_copy(OBJ obj, void *new_ptr);
 
-OBJ_TYPE get_physical_type(OBJ obj);
-
-SEQ_OBJ*      get_seq_ptr(OBJ);
-SET_OBJ*      get_set_ptr(OBJ);
-BIN_REL_OBJ*  get_bin_rel_ptr(OBJ);
-TERN_REL_OBJ* get_tern_rel_ptr(OBJ);
-TAG_OBJ*      get_tag_obj_ptr(OBJ);
-
-MEM_LAYOUT get_mem_layout(OBJ);
-
-bool is_inline_obj(OBJ);
-bool is_ref_obj(OBJ);
-bool uses_try_mem(OBJ obj);
-bool is_gc_obj(OBJ);
+BIN_REL_OBJ* get_bin_rel_ptr(OBJ);
 
 OBJ_TYPE get_ref_obj_type(OBJ);
-REF_OBJ* get_ref_obj_ptr(OBJ);
-
-bool are_shallow_eq(OBJ, OBJ);
-int shallow_cmp(OBJ, OBJ);
 
 //////////////////////////////// basic-ops.cpp /////////////////////////////////
 
@@ -491,6 +603,10 @@ OBJ build_seq(OBJ* elems, uint32 length);       // Objects in elems must be alre
 OBJ build_seq(STREAM &s);
 OBJ build_set(OBJ* elems, uint32 size);
 OBJ build_set(STREAM &s);
+OBJ insert_elem(OBJ set, OBJ elem);             // elem must be already reference-counted
+OBJ remove_elem(OBJ set, OBJ elem);
+OBJ insert_elem_unique(OBJ set, OBJ elem);      // Same as above, but take over the reference to set
+OBJ remove_elem_unique(OBJ set, OBJ elem);
 OBJ build_tagged_obj(OBJ tag, OBJ obj);         // obj must be already reference-counted
 // OBJ make_float(double val); // Already defined in mem_utils.cpp
 OBJ neg_float(OBJ val);
@@ -507,6 +623,7 @@ OBJ blank_array(int64 size);
 OBJ get_seq_slice(OBJ seq, int64 idx_first, int64 len);
 OBJ append_to_seq(OBJ seq, OBJ obj);            // Both seq and obj must already be reference counted
 OBJ update_seq_at(OBJ seq, OBJ idx, OBJ value); // Value must be reference counted already
+OBJ update_seq_at_unique(OBJ seq, OBJ idx, OBJ value); // Same, but takes over the reference to seq
 OBJ join_seqs(OBJ left, OBJ right);
 OBJ rev_seq(OBJ seq);
 void set_at(OBJ seq, uint32 idx, OBJ value);    // Value must be already reference counted
@@ -542,6 +659,59 @@ void get_bin_rel_iter(BIN_REL_ITER &it, OBJ rel);
 void get_bin_rel_iter_0(BIN_REL_ITER &it, OBJ rel, OBJ arg1);
 void get_bin_rel_iter_1(BIN_REL_ITER &it, OBJ rel, OBJ arg2);
 
+///////////////////////////////// tree-map.cpp /////////////////////////////////
+
+OBJ update_map(OBJ map, OBJ key, OBJ value);  // Key and value must be already reference counted
+OBJ remove_map_key(OBJ map, OBJ key);
+OBJ update_map_unique(OBJ map, OBJ key, OBJ value);   // Same as update_map(), but takes over the reference to map
+
+BIN_REL_OBJ *get_tree_map_array_view(TREE_MAP_OBJ *map);
+bool tree_map_lookup(TREE_MAP_OBJ *map, OBJ key, OBJ &value);
+void load_tree_map_iter_leaf(BIN_REL_ITER &it);
+void get_tree_map_iter(BIN_REL_ITER &it, TREE_MAP_OBJ *map);
+bool get_tree_map_iter_0(BIN_REL_ITER &it, TREE_MAP_OBJ *map, OBJ key);
+TREE_MAP_NODE *get_tree_map_leaf(TREE_MAP_OBJ *map, uint32 &idx);
+int comp_tree_maps(OBJ map1, OBJ map2);
+
+///////////////////////////////// tree-seq.cpp /////////////////////////////////
+
+bool use_tree_seq(OBJ seq, uint64 length);
+
+OBJ update_tree_seq_at(OBJ seq, uint32 idx, OBJ value);   // Value must be already reference counted
+OBJ update_unique_tree_seq_at(OBJ seq, uint32 idx, OBJ value);
+OBJ extend_tree_seq(OBJ seq, OBJ *new_elems, uint32 count);
+OBJ join_tree_seqs(OBJ left, OBJ right);
+OBJ get_tree_seq_slice(OBJ seq, uint32 idx_first, uint32 len);
+
+void copy_tree_seq_elems(OBJ seq, uint32 first, uint32 count, OBJ *dest);
+OBJ tree_seq_at(TREE_SEQ_OBJ *seq, uint32 idx);
+void load_tree_seq_iter_leaf(SEQ_ITER &it);
+void get_tree_seq_iter(SEQ_ITER &it, TREE_SEQ_OBJ *seq);
+int comp_tree_seqs(OBJ seq1, OBJ seq2);
+
+//////////////////////////////// packed-seq.cpp ////////////////////////////////
+
+uint32 packed_elem_size(PACKED_ELEM_TYPE elem_type);
+
+OBJ build_packed_uint8_seq(const uint8 *elems, uint32 len);
+OBJ build_packed_uint16_seq(const uint16 *elems, uint32 len);
+OBJ build_packed_int32_seq(const int32 *elems, uint32 len);
+OBJ build_packed_int64_seq(const int64 *elems, uint32 len);
+OBJ build_packed_float_seq(const double *elems, uint32 len);
+
+OBJ packed_seq_elem(PACKED_SEQ_OBJ *seq, uint32 idx);
+OBJ packed_seq_at(OBJ seq, uint32 idx);
+OBJ get_packed_seq_slice(OBJ seq, uint32 idx_first, uint32 len);
+
+bool can_extend_packed_seq(OBJ seq, OBJ *new_elems, uint32 count);
+bool can_join_packed_seqs(OBJ left, OBJ right);
+OBJ extend_packed_seq(OBJ seq, OBJ *new_elems, uint32 count);
+OBJ join_packed_seqs(OBJ left, OBJ right);
+
+int comp_packed_seqs(OBJ seq1, OBJ seq2);
+
+void copy_packed_seq_elems(OBJ seq, uint32 first, uint32 count, OBJ *dest);
+
 /////////////////////////////// tern-rel-obj.cpp ///////////////////////////////
 
 OBJ build_tern_rel(OBJ *col1, OBJ *col2, OBJ *col3, uint32 size);
@@ -577,12 +747,28 @@ void index_sort(uint32 *index, OBJ *values, uint32 count);
 void index_sort(uint32 *index, OBJ *major_sort, OBJ *minor_sort, uint32 count);
 void index_sort(uint32 *index, OBJ *major_sort, OBJ *middle_sort, OBJ *minor_sort, uint32 count);
 
+void sort_obj_array(OBJ* objs, uint32 len);
+void sort_inline_obj_array(OBJ* objs, uint32 len);
+
+struct SORT_KEY_FIELD {
+  bool core_data;   // Whether the key is the core data or the extra data
+  uint64 fixed;     // Value of the other field, which is the same for all objects
+};
+
+bool get_sort_key_field(OBJ *objs, uint32 count, SORT_KEY_FIELD &field);
+
+////////////////////////////////// parallel.cpp ////////////////////////////////
+
+uint32 parallel_threads_count();
+void parallel_for(void (*task)(void *, uint32), void *data, uint32 count);
+bool is_in_parallel_task();
+
 /////////////////////////////////// algs.cpp ///////////////////////////////////
 
 uint32 sort_and_release_dups(OBJ* objs, uint32 size);
 uint32 sort_and_check_no_dups(OBJ* keys, OBJ* values, uint32 size);
-void sort_obj_array(OBJ* objs, uint32 len);
 
+uint32 lower_bound(OBJ *sorted_array, uint32 len, OBJ obj);
 uint32 find_obj(OBJ* sorted_array, uint32 len, OBJ obj, bool &found); //## WHAT SHOULD THIS RETURN? ANY VALUE IN THE [0, 2^32-1] IS A VALID SEQUENCE INDEX, SO WHAT COULD BE USED TO REPRESENT "NOT FOUND"?
 uint32 find_objs_range(OBJ *sorted_array, uint32 len, OBJ obj, uint32 &count);
 uint32 find_idxs_range(uint32 *sorted_idx_array, OBJ *values, uint32 len, OBJ obj, uint32 &count);
@@ -591,6 +777,14 @@ uint32 find_idxs_range(uint32 *index, OBJ *major_col, OBJ *minor_col, uint32 len
 
 int comp_objs(OBJ obj1, OBJ obj2);
 
+/////////////////////////////// search-index.cpp ///////////////////////////////
+
+// Same as the ones above, but may use, or build, the search index of the array
+uint32 find_obj(OBJ *sorted_array, uint32 len, OBJ obj, bool &found, SEARCH_INDEX **index);
+uint32 find_objs_range(OBJ *sorted_array, uint32 len, OBJ obj, uint32 &count, SEARCH_INDEX **index);
+
+void release_search_index(SEARCH_INDEX *index);
+
 /////////////////////////////// inter-utils.cpp ////////////////////////////////
 
 void add_obj_to_cache(OBJ);
@@ -612,6 +806,8 @@ void obj_to_str(OBJ str_obj, char *buffer, uint32 size);
 
 char* obj_to_byte_array(OBJ byte_seq_obj, uint32 &size);
 
+int64 seq_to_utf8(OBJ char_seq, char *output);
+
 uint64 char_buffer_size(OBJ str_obj);
 
 //////////////////////////////// conversion.cpp ////////////////////////////////
@@ -654,18 +850,23 @@ uint32 compute_hash_code(OBJ obj);
 //////////////////////////////// value-store.cpp ///////////////////////////////
 
 void value_store_init(VALUE_STORE *store);
+void value_store_init_int(VALUE_STORE *store);
+void value_store_init_symb(VALUE_STORE *store);
 void value_store_cleanup(VALUE_STORE *store);
 
 void value_store_updates_init(VALUE_STORE *store, VALUE_STORE_UPDATES *updates);
 void value_store_updates_cleanup(VALUE_STORE_UPDATES *updates);
 
 uint32 value_store_insert(VALUE_STORE *store, VALUE_STORE_UPDATES *updates, OBJ value);
+void value_store_lookup_or_insert_batch(VALUE_STORE *store, VALUE_STORE_UPDATES *updates, OBJ *values, uint32 count, uint32 *surrs);
 
 void value_store_copy(VALUE_STORE *store, VALUE_STORE_UPDATES *updates);
 void value_store_apply(VALUE_STORE *store, VALUE_STORE_UPDATES *updates);
 
 void value_store_add_ref(VALUE_STORE *store, uint32 surr);
 void value_store_release(VALUE_STORE *store, uint32 surr);
+void value_store_add_refs(VALUE_STORE *store, uint32 surr, uint32 amount);
+void value_store_release_refs(VALUE_STORE *store, uint32 surr, uint32 amount);
 
 OBJ lookup_surrogate(VALUE_STORE *store, int64 surr);
 int64 lookup_value(VALUE_STORE *store, OBJ value);
@@ -695,6 +896,7 @@ void unary_table_updates_finish(UNARY_TABLE_UPDATES *updates, VALUE_STORE *vs);
 
 void unary_table_get_iter(UNARY_TABLE *table, UNARY_TABLE_ITER *iter);
 void unary_table_iter_next(UNARY_TABLE_ITER *iter);
+uint32 unary_table_iter_next_block(UNARY_TABLE_ITER *iter, uint32 *values, uint32 capacity);
 
 bool unary_table_iter_is_out_of_range(UNARY_TABLE_ITER *iter);
 
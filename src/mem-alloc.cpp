@@ -1,9 +1,24 @@
 #include "lib.h"
+#include "os-interface.h"
 
+#include <mutex>
+
+
+// Blocks of at least MAPPED_MIN_PAGES pages are mapped directly from the system instead
+// of going through malloc(), so that their memory is returned as soon as they're released
+// and they can be resized without copying them. Those of at least HUGE_PAGE_MIN_PAGES
+// pages (the arrays of large sequences, relations and value stores) are also backed by
+// transparent huge pages where available, to reduce TLB misses when they're scanned
+const unsigned int MAPPED_MIN_PAGES   = 64;   // 256KB
+const unsigned int HUGE_PAGE_MIN_PAGES = 512;  // 2MB
 
 void *alloc_pages(unsigned int page_count) {
   assert(page_count > 0);
-  void *ptr = malloc(4096 * page_count);
+  void *ptr;
+  if (page_count >= MAPPED_MIN_PAGES)
+    ptr = map_mem_pages(4096ULL * page_count, page_count >= HUGE_PAGE_MIN_PAGES);
+  else
+    ptr = malloc(4096 * page_count);
   // printf("+ %8llx - %4d\n", (unsigned long long) ptr, page_count);
   return ptr;
 }
@@ -11,100 +26,175 @@ void *alloc_pages(unsigned int page_count) {
 void release_pages(void *ptr, unsigned int page_count) {
   assert(ptr != NULL & page_count > 0);
   // printf("- %8llx - %4d\n", (unsigned long long) ptr, page_count);
-  free(ptr);
+  if (page_count >= MAPPED_MIN_PAGES)
+    unmap_mem_pages(ptr, 4096ULL * page_count);
+  else
+    free(ptr);
 }
 
-////////////////////////////////////////////////////////////////////////////////
-
-unsigned int size_code_size(int size_code) {
-  assert(size_code <= 5);
-  switch (size_code) {
-    case 0:   return 64;
-    case 1:   return 128;
-    case 2:   return 256;
-    case 3:   return 512;
-    case 4:   return 1024;
-    case 5:   return 2048;
-    default:  return 4096 * -size_code;
-  }
+// Returns NULL if the pages have to be copied to a new block
+void *resize_pages(void *ptr, unsigned int page_count, unsigned int new_page_count) {
+  assert(ptr != NULL & page_count > 0 & new_page_count > 0);
+  if (page_count < MAPPED_MIN_PAGES | new_page_count < MAPPED_MIN_PAGES)
+    return NULL;
+  return remap_mem_pages(ptr, 4096ULL * page_count, 4096ULL * new_page_count, new_page_count >= HUGE_PAGE_MIN_PAGES);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
-enum MEM_ALLOC_STATE {NORMAL, TRY, COPYING};
+// Block sizes of the size classes of standard and try memory. Blocks of any
+// other size are allocated directly, in pages, and encoded as -(page count).
+// The 24-byte class, which fits a TAG_OBJ exactly, is the only one whose blocks
+// are aligned to 8 rather than 16 bytes, but nothing allocated here needs more
+const int SLOT_COUNT = 25;
 
-static MEM_ALLOC_STATE curr_mem_alloc_state = NORMAL;
+static const uint32 size_class_sizes[SLOT_COUNT] = {
+    16,   24,   32,   48,   64,   80,   96,  112,  128,
+   160,  192,  224,  256,  320,  384,  448,  512,
+   640,  768,  896, 1024, 1280, 1536, 1792, 2048
+};
 
+unsigned int size_code_size(int size_code) {
+  assert(size_code < SLOT_COUNT);
+  return size_code >= 0 ? size_class_sizes[size_code] : 4096 * -size_code;
+}
+
+////////////////////////////////////////////////////////////////////////////////
 
-const int SLOT_COUNT = 6;
+// Each thread has its own allocator state: the current memory state, the free lists of
+// standard memory and the memory allocated in try state, which is private to the thread
+// that allocated it. Threads that run separate automata share nothing and don't need to
+// synchronize. The thread-local variables are all plain data, so that accessing them
+// doesn't involve any initialization check: the bookkeeping for try state, which isn't,
+// is allocated the first time a thread enters it, and then kept for as long as it lives.
+// When a thread exits its free lists are handed over to the shared pool described below.
+//
+// Blocks of standard memory can be released by a thread other than the one that allocated
+// them, in which case they end up in the free lists of the releasing thread. So that memory
+// doesn't pile up in a thread that releases more than it allocates, when a free list grows
+// too long half of it is moved to a shared pool, the only part of the allocator that needs
+// locking, from which threads whose free lists are empty take blocks before allocating pages
+//
+// Try memory is never reused before it's released in bulk, when the thread leaves try
+// state, so it's allocated from an arena: blocks are carved out of 64KB chunks by just
+// bumping a pointer, and releasing them does nothing. Large blocks are allocated
+// separately, and only recorded. A large block of standard memory that is released in
+// try state is not released immediately either, but when try state is left. Up to
+// MAX_SPARE_TRY_MEM_CHUNKS chunks are kept for the next time the thread enters it
+
+thread_local MEM_ALLOC_STATE curr_mem_alloc_state = NORMAL;
+
+
+// Maximum size in bytes of the memory held in a free list of standard memory
+const uint32 MAX_POOLED_MEM_SIZE = 8 * 16 * 4096;
 
 struct STD_MEM_ALLOC {
   void *mem_blocks_pool[SLOT_COUNT];
+  uint32 pooled_blocks_count[SLOT_COUNT];
 };
 
+// Maximum number of 64KB chunks kept by a thread when it leaves try state
+const uint32 MAX_SPARE_TRY_MEM_CHUNKS = 16;
+
 struct TRY_STATE_MEM_ALLOC {
-  void *mem_blocks_pool[SLOT_COUNT];
-  std::vector<void *> pooled_blocks;
-  std::map<void *, unsigned int> large_blocks;
+  char *next_block;
+  char *chunk_end;
+  std::vector<void *> chunks;
+  std::vector<void *> spare_chunks;
+  std::vector<std::pair<void *, unsigned int> > large_blocks;
+  std::vector<std::pair<void *, unsigned int> > released_large_blocks;
 };
 
-static STD_MEM_ALLOC       std_mem_alloc;
-static TRY_STATE_MEM_ALLOC try_mem_alloc;
+static thread_local STD_MEM_ALLOC       std_mem_alloc;
+static thread_local TRY_STATE_MEM_ALLOC *try_mem_alloc = NULL;
 
-static void **curr_mem_blocks_pool = std_mem_alloc.mem_blocks_pool;
+// Hands over the memory of a thread when it exits: the free lists go to the shared pool,
+// and the try memory is released. It's only touched when the thread first gets blocks
+// for its free lists or enters try state, so that the fast paths don't have to check
+// whether it has been registered for destruction. It has no state of its own: referencing
+// it is what makes sure it's constructed, and so destroyed when the thread exits
+struct THREAD_MEM_ALLOC_CLEANUP {
+  ~THREAD_MEM_ALLOC_CLEANUP();
+};
 
-////////////////////////////////////////////////////////////////////////////////
+static thread_local THREAD_MEM_ALLOC_CLEANUP thread_mem_alloc_cleanup;
 
-bool is_in_normal_state() {
-  return curr_mem_alloc_state == NORMAL;
+static void register_thread_mem_alloc_cleanup() {
+  (void) &thread_mem_alloc_cleanup;
 }
 
-bool is_in_try_state() {
-  return curr_mem_alloc_state == TRY;
-}
+// Chains of free blocks of standard memory, with MAX_POOLED_MEM_SIZE / 2 bytes each.
+// Each chain is linked through the first word of its blocks, like the free lists, and
+// the chains themselves through the second word of their first block
+static void *shared_mem_blocks_chains[SLOT_COUNT];
+static std::mutex shared_mem_blocks_mutex;
 
-bool is_in_copying_state() {
-  return curr_mem_alloc_state == COPYING;
-}
+// Blocks left over by threads that have exited, too few to form a chain of the above
+// length, and how many there are. Guarded by shared_mem_blocks_mutex
+static void *shared_mem_blocks_leftovers[SLOT_COUNT];
+static uint32 shared_mem_blocks_leftovers_count[SLOT_COUNT];
+
+// All the 64KB slabs of standard memory that are currently allocated, used to find
+// out which slab a free block belongs to. Guarded by shared_mem_blocks_mutex
+static std::set<void *> std_mem_slabs;
+
+// Maximum amount of memory, in bytes, that mem_trim() keeps in fully free slabs
+static uint64 retained_mem_size = 0;
 
 ////////////////////////////////////////////////////////////////////////////////
 
 void enter_try_state() {
   assert(curr_mem_alloc_state == NORMAL);
 
+  if (try_mem_alloc == NULL) {
+    register_thread_mem_alloc_cleanup();
+    try_mem_alloc = new TRY_STATE_MEM_ALLOC;
+    try_mem_alloc->next_block = NULL;
+    try_mem_alloc->chunk_end = NULL;
+  }
+
   curr_mem_alloc_state = TRY;
-  curr_mem_blocks_pool = try_mem_alloc.mem_blocks_pool;
 }
 
 void enter_copy_state() {
   assert(curr_mem_alloc_state == TRY);
 
   curr_mem_alloc_state = COPYING;
-  curr_mem_blocks_pool = std_mem_alloc.mem_blocks_pool;
 }
 
 void restore_try_state() {
   assert(curr_mem_alloc_state == COPYING);
 
   curr_mem_alloc_state = TRY;
-  curr_mem_blocks_pool = try_mem_alloc.mem_blocks_pool;
 }
 
 void release_all_try_state_memory() {
-  std::vector<void *>::iterator pit = try_mem_alloc.pooled_blocks.begin();
-  std::vector<void *>::iterator pend = try_mem_alloc.pooled_blocks.end();
-  for ( ; pit != pend ; pit++)
-    release_pages(*pit, 16);
-  try_mem_alloc.pooled_blocks.clear();
-
-  std::map<void *, unsigned int>::iterator lit = try_mem_alloc.large_blocks.begin();
-  std::map<void *, unsigned int>::iterator lend = try_mem_alloc.large_blocks.end();
-  for ( ; lit != lend ; lit++)
-    release_pages(lit->first, lit->second);
-  try_mem_alloc.large_blocks.clear();
+  std::vector<void *> &chunks = try_mem_alloc->chunks;
+  std::vector<void *> &spare_chunks = try_mem_alloc->spare_chunks;
+  for (uint32 i=0 ; i < chunks.size() ; i++)
+    if (spare_chunks.size() < MAX_SPARE_TRY_MEM_CHUNKS)
+      spare_chunks.push_back(chunks[i]);
+    else
+      release_pages(chunks[i], 16);
+  chunks.clear();
+  try_mem_alloc->next_block = NULL;
+  try_mem_alloc->chunk_end = NULL;
+
+  std::vector<std::pair<void *, unsigned int> > &large_blocks = try_mem_alloc->large_blocks;
+  std::vector<std::pair<void *, unsigned int> > &released_large_blocks = try_mem_alloc->released_large_blocks;
+
+  // Releasing the large blocks of standard memory that were released in try state
+  if (!released_large_blocks.empty()) {
+    std::sort(large_blocks.begin(), large_blocks.end());
+    for (uint32 i=0 ; i < released_large_blocks.size() ; i++)
+      if (!std::binary_search(large_blocks.begin(), large_blocks.end(), released_large_blocks[i]))
+        release_pages(released_large_blocks[i].first, released_large_blocks[i].second);
+    released_large_blocks.clear();
+  }
 
-  for (int i=0 ; i < SLOT_COUNT ; i++)
-    try_mem_alloc.mem_blocks_pool[i] = NULL;
+  for (uint32 i=0 ; i < large_blocks.size() ; i++)
+    release_pages(large_blocks[i].first, large_blocks[i].second);
+  large_blocks.clear();
 }
 
 void return_to_normal_state() {
@@ -118,61 +208,173 @@ void abort_try_state() {
   assert(curr_mem_alloc_state == TRY);
 
   curr_mem_alloc_state = NORMAL;
-  curr_mem_blocks_pool = std_mem_alloc.mem_blocks_pool;
   release_all_try_state_memory();
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
+////////////////////////////////////////////////////////////////////////////////
+
+// Moves half of the blocks in the free list to the shared pool
+static void move_to_shared_pool(int size_code) {
+  uint32 chain_length = (MAX_POOLED_MEM_SIZE / 2) / size_code_size(size_code);
+
+  void *chain = std_mem_alloc.mem_blocks_pool[size_code];
+  void *last = chain;
+  for (uint32 i=1 ; i < chain_length ; i++)
+    last = * (void **) last;
+
+  std_mem_alloc.mem_blocks_pool[size_code] = * (void **) last;
+  std_mem_alloc.pooled_blocks_count[size_code] -= chain_length;
+  * (void **) last = NULL;
+
+  std::lock_guard<std::mutex> lock(shared_mem_blocks_mutex);
+  ((void **) chain)[1] = shared_mem_blocks_chains[size_code];
+  shared_mem_blocks_chains[size_code] = chain;
+}
+
+// Refills the (empty) free list with a chain of blocks from the shared pool, if there's any
+static void take_from_shared_pool(int size_code) {
+  assert(std_mem_alloc.mem_blocks_pool[size_code] == NULL);
+
+  std::lock_guard<std::mutex> lock(shared_mem_blocks_mutex);
+  void *chain = shared_mem_blocks_chains[size_code];
+  if (chain == NULL) {
+    if (shared_mem_blocks_leftovers[size_code] != NULL) {
+      std_mem_alloc.mem_blocks_pool[size_code] = shared_mem_blocks_leftovers[size_code];
+      std_mem_alloc.pooled_blocks_count[size_code] = shared_mem_blocks_leftovers_count[size_code];
+      shared_mem_blocks_leftovers[size_code] = NULL;
+      shared_mem_blocks_leftovers_count[size_code] = 0;
+    }
+    return;
+  }
+  shared_mem_blocks_chains[size_code] = ((void **) chain)[1];
+
+  std_mem_alloc.mem_blocks_pool[size_code] = chain;
+  std_mem_alloc.pooled_blocks_count[size_code] = (MAX_POOLED_MEM_SIZE / 2) / size_code_size(size_code);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+THREAD_MEM_ALLOC_CLEANUP::~THREAD_MEM_ALLOC_CLEANUP() {
+  {
+    std::lock_guard<std::mutex> lock(shared_mem_blocks_mutex);
+
+    for (int size_code=0 ; size_code < SLOT_COUNT ; size_code++) {
+      void *head = std_mem_alloc.mem_blocks_pool[size_code];
+      if (head == NULL)
+        continue;
+
+      // Adding the whole free list to the leftovers
+      void *last = head;
+      while (* (void **) last != NULL)
+        last = * (void **) last;
+      * (void **) last = shared_mem_blocks_leftovers[size_code];
+      uint32 count = shared_mem_blocks_leftovers_count[size_code] + std_mem_alloc.pooled_blocks_count[size_code];
+      std_mem_alloc.mem_blocks_pool[size_code] = NULL;
+      std_mem_alloc.pooled_blocks_count[size_code] = 0;
+
+      // Turning as many of them as possible into chains for the shared pool
+      uint32 chain_length = (MAX_POOLED_MEM_SIZE / 2) / size_code_size(size_code);
+      while (count >= chain_length) {
+        void *chain = head;
+        last = chain;
+        for (uint32 i=1 ; i < chain_length ; i++)
+          last = * (void **) last;
+        head = * (void **) last;
+        * (void **) last = NULL;
+        ((void **) chain)[1] = shared_mem_blocks_chains[size_code];
+        shared_mem_blocks_chains[size_code] = chain;
+        count -= chain_length;
+      }
+
+      shared_mem_blocks_leftovers[size_code] = head;
+      shared_mem_blocks_leftovers_count[size_code] = count;
+    }
+  }
+
+  if (try_mem_alloc != NULL) {
+    release_all_try_state_memory();
+    std::vector<void *> &spare_chunks = try_mem_alloc->spare_chunks;
+    for (uint32 i=0 ; i < spare_chunks.size() ; i++)
+      release_pages(spare_chunks[i], 16);
+    delete try_mem_alloc;
+    try_mem_alloc = NULL;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void *alloc_try_mem_block(uint32 block_size) {
+  char *block = try_mem_alloc->next_block;
+  if (try_mem_alloc->chunk_end - block < block_size) {
+    std::vector<void *> &spare_chunks = try_mem_alloc->spare_chunks;
+    if (!spare_chunks.empty()) {
+      block = (char *) spare_chunks.back();
+      spare_chunks.pop_back();
+    }
+    else
+      block = (char *) alloc_pages(16);
+#ifndef NDEBUG
+    memset(block, 0xFF, 16 * 4096);
+#endif
+    try_mem_alloc->chunks.push_back(block);
+    try_mem_alloc->chunk_end = block + 16 * 4096;
+  }
+  try_mem_alloc->next_block = block + block_size;
+  return block;
+}
+
 void *alloc_mem_block(int size_code) {
-  assert(size_code <= 5);
+  assert(size_code < SLOT_COUNT);
 
   if (size_code >= 0) {
-    void **pool_head = curr_mem_blocks_pool + size_code;
+    if (curr_mem_alloc_state == TRY)
+      return alloc_try_mem_block(size_code_size(size_code));
+
+    void **pool_head = std_mem_alloc.mem_blocks_pool + size_code;
+
+    if (*pool_head == NULL) {
+      register_thread_mem_alloc_cleanup();
+      take_from_shared_pool(size_code);
+    }
 
     void *head = *pool_head;
     if (head == NULL) {
       // Allocate new memory block
       void *ptr = alloc_pages(16);
-      if (curr_mem_alloc_state == TRY)
-        try_mem_alloc.pooled_blocks.push_back(ptr);
+      {
+        std::lock_guard<std::mutex> lock(shared_mem_blocks_mutex);
+        std_mem_slabs.insert(ptr);
+      }
 #ifndef NDEBUG
       memset(ptr, 0xFF, 16 * 4096);
 #endif
-      int log_size = size_code + 6;
-      int block_size = size_code_size(size_code);
-      assert(
-        (size_code == 0 & block_size ==   64) |
-        (size_code == 1 & block_size ==  128) |
-        (size_code == 2 & block_size ==  256) |
-        (size_code == 3 & block_size ==  512) |
-        (size_code == 4 & block_size == 1024) |
-        (size_code == 5 & block_size == 2048)
-      );
-
-      unsigned int last_block_idx = ((16 * 4096) >> log_size) - 1;
-      assert(last_block_idx + 1 == (16 * 4096) / block_size);
-      for (int i=1 ; i < last_block_idx ; i++) {
-        void *block_ptr = ((char *) ptr) + (i << log_size);
-        assert(block_ptr == ((char *) ptr) + i * block_size);
-        * (void **) block_ptr = ((char *) block_ptr) + block_size;
+      // The first block is returned, and the others are linked together in the free list.
+      // Sizes that don't divide the slab size leave its tail unused
+      uint32 block_size = size_code_size(size_code);
+      uint32 blocks_count = (16 * 4096) / block_size;
+      char *block_ptr = ((char *) ptr) + block_size;
+      for (uint32 i=2 ; i < blocks_count ; i++) {
+        * (void **) block_ptr = block_ptr + block_size;
+        block_ptr += block_size;
       }
-      void *last_block_ptr = ((char *) ptr) + (last_block_idx << log_size);
-      assert(last_block_ptr == ((char *) ptr) + (last_block_idx * block_size));
-      * (void **) last_block_ptr = NULL;
+      * (void **) block_ptr = NULL;
       *pool_head = ((char *) ptr) + block_size;
+      std_mem_alloc.pooled_blocks_count[size_code] = blocks_count - 1;
       return ptr;
     }
     else {
       void *next = * (void **) head;
       *pool_head = next;
+      std_mem_alloc.pooled_blocks_count[size_code]--;
       return head;
     }
   }
   else {
     void *ptr = alloc_pages(-size_code);
     if (curr_mem_alloc_state == TRY)
-      try_mem_alloc.large_blocks[ptr] = -size_code;
+      try_mem_alloc->large_blocks.push_back(std::make_pair(ptr, (unsigned int) -size_code));
 #ifndef NDEBUG
     memset(ptr, 0xFF, -size_code * 4096);
 #endif
@@ -181,21 +383,201 @@ void *alloc_mem_block(int size_code) {
 }
 
 void release_mem_block(void *ptr, int size_code) {
-  assert(size_code <= 5);
+  assert(size_code < SLOT_COUNT);
 
   if (size_code >= 0) {
 #ifndef NDEBUG
     unsigned int block_size = size_code_size(size_code);
     memset(ptr, 0xFF, block_size);
 #endif
-    void **pool_head = curr_mem_blocks_pool + size_code;
+    if (curr_mem_alloc_state == TRY)
+      return;
+    void **pool_head = std_mem_alloc.mem_blocks_pool + size_code;
     void *tail = *pool_head;
+    if (tail == NULL)
+      register_thread_mem_alloc_cleanup();
     * (void **) ptr = tail;
     *pool_head = ptr;
+    if (++std_mem_alloc.pooled_blocks_count[size_code] > MAX_POOLED_MEM_SIZE / size_code_size(size_code))
+      move_to_shared_pool(size_code);
   }
   else {
-    release_pages(ptr, -size_code);
     if (curr_mem_alloc_state == TRY)
-      try_mem_alloc.large_blocks.erase(ptr);
+      try_mem_alloc->released_large_blocks.push_back(std::make_pair(ptr, (unsigned int) -size_code));
+    else
+      release_pages(ptr, -size_code);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Slabs of standard memory are never released when their blocks are, as that would
+// require keeping a count of the live blocks of each slab in the allocation fast path,
+// and updating it from whichever thread releases a block. mem_trim() instead derives
+// those counts from the free lists: a slab all of whose blocks are free is not in use,
+// and can be returned to the system. Only the free lists of the calling thread and
+// the shared pool are examined, so a thread that is about to go idle after releasing
+// a lot of memory should call it itself. Large blocks are released as soon as they're
+// freed, and try memory in bulk, except for the chunks a thread keeps for its next
+// transaction, which mem_trim() releases as well
+
+// Returns the position in <slabs>, a sorted snapshot of std_mem_slabs, of the slab the block belongs to
+static uint32 get_std_mem_slab(const std::vector<void *> &slabs, void *block) {
+  std::vector<void *>::const_iterator it = std::upper_bound(slabs.begin(), slabs.end(), block);
+  assert(it != slabs.begin());
+  uint32 idx = (it - slabs.begin()) - 1;
+  assert(((char *) block) - ((char *) slabs[idx]) < 16 * 4096);
+  return idx;
+}
+
+// Appends the list starting at <list> to the free list of this thread
+static void add_to_free_list(int size_code, void *list) {
+  void *last = list;
+  while (* (void **) last != NULL)
+    last = * (void **) last;
+  * (void **) last = std_mem_alloc.mem_blocks_pool[size_code];
+  std_mem_alloc.mem_blocks_pool[size_code] = list;
+}
+
+void set_mem_retention(uint64 byte_size) {
+  std::lock_guard<std::mutex> lock(shared_mem_blocks_mutex);
+  retained_mem_size = byte_size;
+}
+
+void mem_trim() {
+  assert(curr_mem_alloc_state == NORMAL);
+
+  // The lock is only held to take over the shared pool and to copy the list of slabs.
+  // From then on the blocks are private to this thread, and so is any slab all of whose
+  // blocks are among them. Slabs allocated later cannot contain any of those blocks
+  void *shared_chains[SLOT_COUNT];
+  void *shared_leftovers[SLOT_COUNT];
+  std::vector<void *> slabs;
+  uint64 retention;
+  {
+    std::lock_guard<std::mutex> lock(shared_mem_blocks_mutex);
+    for (int size_code=0 ; size_code < SLOT_COUNT ; size_code++) {
+      shared_chains[size_code] = shared_mem_blocks_chains[size_code];
+      shared_leftovers[size_code] = shared_mem_blocks_leftovers[size_code];
+      shared_mem_blocks_chains[size_code] = NULL;
+      shared_mem_blocks_leftovers[size_code] = NULL;
+      shared_mem_blocks_leftovers_count[size_code] = 0;
+    }
+    slabs.assign(std_mem_slabs.begin(), std_mem_slabs.end());
+    retention = retained_mem_size;
   }
+
+  uint64 retained_size = 0;
+  std::vector<uint32> free_blocks(slabs.size());
+  std::vector<bool> released(slabs.size());
+  std::vector<void *> released_slabs;
+  std::vector<void *> excess_chains[SLOT_COUNT];
+
+  for (int size_code=0 ; size_code < SLOT_COUNT ; size_code++) {
+    uint32 block_size = size_code_size(size_code);
+    uint32 blocks_per_slab = (16 * 4096) / block_size;
+
+    // Merging the shared chains and leftovers into the free list of this thread
+    void *chain = shared_chains[size_code];
+    while (chain != NULL) {
+      void *next_chain = ((void **) chain)[1];
+      add_to_free_list(size_code, chain);
+      chain = next_chain;
+    }
+    if (shared_leftovers[size_code] != NULL)
+      add_to_free_list(size_code, shared_leftovers[size_code]);
+
+    if (std_mem_alloc.mem_blocks_pool[size_code] == NULL)
+      continue;
+
+    // Counting the free blocks of each slab
+    std::fill(free_blocks.begin(), free_blocks.end(), 0);
+    for (void *block = std_mem_alloc.mem_blocks_pool[size_code] ; block != NULL ; block = * (void **) block)
+      free_blocks[get_std_mem_slab(slabs, block)]++;
+
+    // Selecting the slabs to release, keeping the first ones within the retention limit
+    bool any_released = false;
+    for (uint32 i=0 ; i < slabs.size() ; i++)
+      if (free_blocks[i] == blocks_per_slab) {
+        if (retained_size + 16 * 4096 <= retention) {
+          retained_size += 16 * 4096;
+        }
+        else {
+          released[i] = true;
+          released_slabs.push_back(slabs[i]);
+          any_released = true;
+        }
+      }
+
+    // Rebuilding the free list without the blocks of the released slabs
+    void *head = NULL;
+    uint32 count = 0;
+    void *block = std_mem_alloc.mem_blocks_pool[size_code];
+    while (block != NULL) {
+      void *next = * (void **) block;
+      if (!any_released || !released[get_std_mem_slab(slabs, block)]) {
+        * (void **) block = head;
+        head = block;
+        count++;
+      }
+      block = next;
+    }
+
+    // Setting aside what exceeds the maximum length of a free list, to be moved back to the shared pool
+    uint32 chain_length = (MAX_POOLED_MEM_SIZE / 2) / block_size;
+    while (count > MAX_POOLED_MEM_SIZE / block_size) {
+      void *chain = head;
+      void *last = chain;
+      for (uint32 i=1 ; i < chain_length ; i++)
+        last = * (void **) last;
+      head = * (void **) last;
+      * (void **) last = NULL;
+      excess_chains[size_code].push_back(chain);
+      count -= chain_length;
+    }
+
+    std_mem_alloc.mem_blocks_pool[size_code] = head;
+    std_mem_alloc.pooled_blocks_count[size_code] = count;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(shared_mem_blocks_mutex);
+    for (uint32 i=0 ; i < released_slabs.size() ; i++)
+      std_mem_slabs.erase(released_slabs[i]);
+    for (int size_code=0 ; size_code < SLOT_COUNT ; size_code++) {
+      std::vector<void *> &chains = excess_chains[size_code];
+      for (uint32 i=0 ; i < chains.size() ; i++) {
+        ((void **) chains[i])[1] = shared_mem_blocks_chains[size_code];
+        shared_mem_blocks_chains[size_code] = chains[i];
+      }
+    }
+  }
+
+  for (uint32 i=0 ; i < released_slabs.size() ; i++)
+    release_pages(released_slabs[i], 16);
+
+  // The chunks of try memory kept by this thread for its next transaction
+  if (try_mem_alloc != NULL) {
+    std::vector<void *> &spare_chunks = try_mem_alloc->spare_chunks;
+    for (uint32 i=0 ; i < spare_chunks.size() ; i++)
+      release_pages(spare_chunks[i], 16);
+    spare_chunks.clear();
+  }
+
+  trim_os_heap();
+}
+
+// Returns NULL if the block cannot be resized in place or remapped,
+// in which case the caller has to allocate a new one and copy it
+void *resize_mem_block(void *ptr, int size_code, int new_size_code) {
+  assert(size_code < SLOT_COUNT & new_size_code < SLOT_COUNT);
+
+  if (size_code == new_size_code)
+    return ptr;
+
+  // In try state the old block may belong to standard memory, which must not be released yet
+  if (size_code >= 0 | new_size_code >= 0 | curr_mem_alloc_state == TRY)
+    return NULL;
+
+  return resize_pages(ptr, -size_code, -new_size_code);
 }
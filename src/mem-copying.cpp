@@ -33,6 +33,29 @@ SEQ_OBJ *make_or_get_seq_obj_copy(SEQ_OBJ *seq) {
   }
 }
 
+PACKED_SEQ_OBJ *make_or_get_packed_seq_obj_copy(PACKED_SEQ_OBJ *seq) {
+  uint32 size = seq->size;
+  if (size > 0) {
+    // The object has not been copied yet, so we do it now. The elements are not
+    // objects, so there's nothing to copy recursively. Views are never cached in try state
+    PACKED_ELEM_TYPE elem_type = (PACKED_ELEM_TYPE) seq->elem_type;
+    PACKED_SEQ_OBJ *seq_copy = new_packed_seq(elem_type, size);
+    memcpy(seq_copy->elems, seq->elems, size * packed_elem_size(elem_type));
+    // Same as for sets, marking the old object as copied. The elements are raw
+    // integers, so the pointer to the copy is stored in them with memcpy()
+    seq->size = 0;
+    memcpy(seq->elems, &seq_copy, sizeof(PACKED_SEQ_OBJ *));
+    return seq_copy;
+  }
+  else {
+    // The object has already been copied. We just return a (reference-counted) pointer to the copy
+    PACKED_SEQ_OBJ *seq_copy;
+    memcpy(&seq_copy, seq->elems, sizeof(PACKED_SEQ_OBJ *));
+    add_ref((REF_OBJ *) seq_copy);
+    return seq_copy;
+  }
+}
+
 SET_OBJ *make_or_get_set_obj_copy(SET_OBJ *set) {
   uint32 size = set->size;
   if (size > 0) {
@@ -163,6 +186,11 @@ OBJ copy_obj(OBJ obj) {
       return repoint_to_std_mem_copy(obj, seq_copy_buffer + get_seq_offset(obj));
     }
 
+    case TYPE_PACKED_SEQ: {
+      PACKED_SEQ_OBJ *seq_copy = make_or_get_packed_seq_obj_copy(get_packed_seq_ptr(obj));
+      return repoint_to_std_mem_copy(obj, seq_copy);
+    }
+
     case TYPE_SET: {
       SET_OBJ *set_copy = make_or_get_set_obj_copy(get_set_ptr(obj));
       return repoint_to_std_mem_copy(obj, set_copy);
@@ -1,70 +1,60 @@
 #include "lib.h"
 
+#include <mutex>
+
 
 unsigned int size_code_size(int size_code);
 void *alloc_mem_block(int byte_size);
 void release_mem_block(void *ptr, int byte_size);
+void *resize_mem_block(void *ptr, int size_code, int new_size_code);
 
 ////////////////////////////////////////////////////////////////////////////////
 
-int min_size_code_ref(uint32 byte_size) {
-  if (byte_size <= 64)
-    return 0;
-  if (byte_size <= 128)
-    return 1;
-  if (byte_size <= 256)
-    return 2;
-  if (byte_size <= 512)
-    return 3;
-  if (byte_size <= 1024)
-    return 4;
-  if (byte_size <= 2048)
-    return 5;
+// Blocks of up to 2048 bytes come from one of the size classes of the allocator (see
+// size_code_size() in mem-alloc.cpp): there's one for tag objects, then they are 16 bytes
+// apart up to 128 bytes and a quarter of a power of two apart after that, so that no more
+// than 20% of a block is wasted past the first few classes. Larger blocks are allocated
+// as a whole number of pages
 
-  for (int i=0 ; i < 20 ; i++)
-    if (byte_size <= 4096 << i)
-      return -(1 << i);
+int min_size_code_ref(uint32 byte_size) {
+  if (byte_size <= 2048) {
+    int size_code = 0;
+    while (size_code_size(size_code) < byte_size)
+      size_code++;
+    return size_code;
+  }
 
-  return -(1 << 20);
+  return -(int) ((byte_size + 4095ULL) / 4096);
 }
 
 int min_size_code_fast(uint32 byte_size) {
-  const uint64 SLOT_MASK =
-    (0ULL <<  1 * 4) |  //   64
-    (1ULL <<  2 * 4) |  //  128
-    (2ULL <<  3 * 4) |  //  196
-    (2ULL <<  4 * 4) |  //  256
-    (3ULL <<  5 * 4) |  //  320
-    (3ULL <<  6 * 4) |  //  384
-    (3ULL <<  7 * 4) |  //  448
-    (3ULL <<  8 * 4) |  //  512
-    (4ULL <<  9 * 4) |  //  576
-    (4ULL << 10 * 4) |  //  640
-    (4ULL << 11 * 4) |  //  704
-    (4ULL << 12 * 4) |  //  768
-    (4ULL << 13 * 4) |  //  832
-    (4ULL << 14 * 4) |  //  896
-    (4ULL << 15 * 4);   //  960
+  // Size code of the smallest class that can hold (idx * 8) bytes
+  static const uint8 size_codes[257] = {
+     0,  0,  0,  1,  2,  3,  3,  4,  4,  5,  5,  6,  6,  7,  7,  8,  // up to  120
+     8,  9,  9,  9,  9, 10, 10, 10, 10, 11, 11, 11, 11, 12, 12, 12,  // up to  248
+    12, 13, 13, 13, 13, 13, 13, 13, 13, 14, 14, 14, 14, 14, 14, 14,  // up to  376
+    14, 15, 15, 15, 15, 15, 15, 15, 15, 16, 16, 16, 16, 16, 16, 16,  // up to  504
+    16, 17, 17, 17, 17, 17, 17, 17, 17, 17, 17, 17, 17, 17, 17, 17,  // up to  632
+    17, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18,  // up to  760
+    18, 19, 19, 19, 19, 19, 19, 19, 19, 19, 19, 19, 19, 19, 19, 19,  // up to  888
+    19, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20,  // up to 1016
+    20, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21,  // up to 1144
+    21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21,  // up to 1272
+    21, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22,  // up to 1400
+    22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22,  // up to 1528
+    22, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23,  // up to 1656
+    23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23,  // up to 1784
+    23, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24,  // up to 1912
+    24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24,  // up to 2040
+    24  // up to 2048
+  };
 
   assert(byte_size > 0);
 
-  if (byte_size <= 960) {
-    int blocks_64_count = (byte_size + 63) / 64;
-    assert(blocks_64_count < 16);
-    return (SLOT_MASK >> (4 * blocks_64_count)) & 7;
-  }
-
-  if (byte_size <= 1024)
-    return 4;
-
   if (byte_size <= 2048)
-    return 5;
-
-  for (int i=0 ; i < 20 ; i++)
-    if (byte_size <= 4096 << i)
-      return -(1 << i);
+    return size_codes[(byte_size + 7) / 8];
 
-  return -(1 << 20);
+  return -(int) ((byte_size + 4095ULL) / 4096);
 }
 
 int min_size_code(uint32 byte_size) {
@@ -88,7 +78,19 @@ uint32 live_mem_usage;
 uint32 max_live_mem_usage;
 uint32 total_mem_requested;
 
-std::set<void *> live_objs;
+// Live objects, with the size that was requested for each of them
+std::map<void *, uint32> live_objs;
+
+// Number of live objects, and bytes requested and allocated for them, for each size
+// class (see min_size_code()). Objects that are allocated in pages are counted last
+const int SIZE_CLASSES_COUNT = 26;
+
+uint32 live_objs_by_size_class[SIZE_CLASSES_COUNT];
+uint64 requested_mem_by_size_class[SIZE_CLASSES_COUNT];
+uint64 allocated_mem_by_size_class[SIZE_CLASSES_COUNT];
+
+// Objects can be allocated and released by different threads
+std::mutex live_objs_mutex;
 
 void inc_live_obj_count(uint32 byte_size) {
   num_of_live_objs++;
@@ -107,6 +109,20 @@ void dec_live_obj_count(uint32 byte_size) {
   live_mem_usage -= byte_size;
 }
 
+void track_obj_size(int size_code, uint32 requested_byte_size, bool alloc) {
+  int size_class = size_code >= 0 ? size_code : SIZE_CLASSES_COUNT - 1;
+  if (alloc) {
+    live_objs_by_size_class[size_class]++;
+    requested_mem_by_size_class[size_class] += requested_byte_size;
+    allocated_mem_by_size_class[size_class] += size_code_size(size_code);
+  }
+  else {
+    live_objs_by_size_class[size_class]--;
+    requested_mem_by_size_class[size_class] -= requested_byte_size;
+    allocated_mem_by_size_class[size_class] -= size_code_size(size_code);
+  }
+}
+
 uint32 get_live_objs_count() {
   return num_of_live_objs;
 }
@@ -134,8 +150,8 @@ uint32 get_total_mem_requested() {
 void print_all_live_objs() {
   if (!live_objs.empty()) {
     fprintf(stderr, "Live objects:\n");
-    for (std::set<void*>::iterator it = live_objs.begin() ; it != live_objs.end() ; it++) {
-      void *ptr = *it;
+    for (std::map<void *, uint32>::iterator it = live_objs.begin() ; it != live_objs.end() ; it++) {
+      void *ptr = it->first;
       printf("  %8llx\n", (unsigned long long)ptr);
     }
     fflush(stdout);
@@ -146,18 +162,50 @@ bool is_alive(void *obj) {
   return live_objs.find(obj) != live_objs.end();
 }
 
+// Prints, for each size class, how much of the memory allocated for the live
+// objects was actually requested, and how much is lost to internal fragmentation
+void print_mem_frag_report() {
+  std::lock_guard<std::mutex> lock(live_objs_mutex);
+
+  uint64 total_requested = 0;
+  uint64 total_allocated = 0;
+
+  fprintf(stderr, "Block size    Objects     Requested     Allocated    Wasted\n");
+  for (int i=0 ; i < SIZE_CLASSES_COUNT ; i++) {
+    uint32 count = live_objs_by_size_class[i];
+    uint64 requested = requested_mem_by_size_class[i];
+    uint64 allocated = allocated_mem_by_size_class[i];
+    if (count > 0) {
+      if (i < SIZE_CLASSES_COUNT - 1)
+        fprintf(stderr, "%10u", size_code_size(i));
+      else
+        fprintf(stderr, "%10s", "pages");
+      fprintf(stderr, " %10u  %12llu  %12llu    %5.1f%%\n", count, (unsigned long long) requested,
+        (unsigned long long) allocated, 100.0 * (allocated - requested) / allocated);
+    }
+    total_requested += requested;
+    total_allocated += allocated;
+  }
+  if (total_allocated > 0)
+    fprintf(stderr, "%10s %10u  %12llu  %12llu    %5.1f%%\n", "total", num_of_live_objs, (unsigned long long) total_requested,
+      (unsigned long long) total_allocated, 100.0 * (total_allocated - total_requested) / total_allocated);
+}
+
 #endif
 
 ////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
 
 void *new_obj(uint32 byte_size) {
-  void *mem_block = alloc_mem_block(min_size_code(byte_size));
+  int size_code = min_size_code(byte_size);
+  void *mem_block = alloc_mem_block(size_code);
 
 #ifndef NDEBUG
   if (!is_in_try_state()) {
+    std::lock_guard<std::mutex> lock(live_objs_mutex);
     inc_live_obj_count(byte_size); //## THE SIZE IS THE WRONG ONE, BUT IT IS THE SAME THAT IS REPORTED BACK TO free_obj
-    live_objs.insert(mem_block);
+    track_obj_size(size_code, byte_size, true);
+    live_objs[mem_block] = byte_size;
   }
 #endif
 
@@ -171,8 +219,10 @@ void *new_obj(uint32 byte_size_requested, uint32 &byte_size_returned) {
 
 #ifndef NDEBUG
   if (!is_in_try_state()) {
+    std::lock_guard<std::mutex> lock(live_objs_mutex);
     inc_live_obj_count(byte_size_returned);
-    live_objs.insert(mem_block);
+    track_obj_size(size_code, byte_size_requested, true);
+    live_objs[mem_block] = byte_size_requested;
   }
 #endif
 
@@ -180,21 +230,50 @@ void *new_obj(uint32 byte_size_requested, uint32 &byte_size_returned) {
 }
 
 void free_obj(void *ptr, uint32 byte_size) {
+  int size_code = min_size_code(byte_size);
+
 #ifndef NDEBUG
   if (!is_in_try_state()) {
+    std::lock_guard<std::mutex> lock(live_objs_mutex);
     assert(num_of_live_objs > 0);
     assert(is_alive(ptr));
 
     dec_live_obj_count(byte_size);
-    live_objs.erase(live_objs.find(ptr));
+    std::map<void *, uint32>::iterator it = live_objs.find(ptr);
+    assert(min_size_code(it->second) == size_code);
+    track_obj_size(size_code, it->second, false);
+    live_objs.erase(it);
   }
 #endif
 
-  release_mem_block(ptr, min_size_code(byte_size));
+  release_mem_block(ptr, size_code);
 }
 
+// Blocks that stay in the same size class are reused as they are,
+// and large ones are remapped by the system when possible
 void* resize_obj(void *ptr, uint32 byte_size, uint32 new_byte_size) {
-  void *new_ptr = new_obj(new_byte_size);
+  int size_code = min_size_code(byte_size);
+  int new_size_code = min_size_code(new_byte_size);
+  void *new_ptr = resize_mem_block(ptr, size_code, new_size_code);
+
+  if (new_ptr != NULL) {
+#ifndef NDEBUG
+    if (!is_in_try_state()) {
+      std::lock_guard<std::mutex> lock(live_objs_mutex);
+      assert(is_alive(ptr));
+      std::map<void *, uint32>::iterator it = live_objs.find(ptr);
+      dec_live_obj_count(byte_size);
+      track_obj_size(size_code, it->second, false);
+      live_objs.erase(it);
+      inc_live_obj_count(new_byte_size);
+      track_obj_size(new_size_code, new_byte_size, true);
+      live_objs[new_ptr] = new_byte_size;
+    }
+#endif
+    return new_ptr;
+  }
+
+  new_ptr = new_obj(new_byte_size);
   uint32 min_byte_size = byte_size < new_byte_size ? byte_size : new_byte_size;
   memcpy(new_ptr, ptr, min_byte_size);
   free_obj(ptr, byte_size);
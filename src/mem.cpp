@@ -26,6 +26,33 @@ uint64 map_obj_mem_size(uint64 size) {
   return bin_rel_obj_mem_size(size);
 }
 
+uint64 tree_map_obj_mem_size() {
+  return sizeof(TREE_MAP_OBJ);
+}
+
+uint64 tree_map_node_mem_size(uint32 count, bool is_leaf) {
+  assert(count > 0);
+  uint64 mem_size = sizeof(TREE_MAP_NODE) + (count - 1) * sizeof(OBJ);
+  return mem_size + count * (is_leaf ? sizeof(OBJ) : sizeof(TREE_MAP_NODE *));
+}
+
+uint64 tree_seq_obj_mem_size() {
+  return sizeof(TREE_SEQ_OBJ);
+}
+
+uint64 tree_seq_node_mem_size(uint32 count, bool is_leaf) {
+  assert(count > 0);
+  if (is_leaf)
+    return sizeof(TREE_SEQ_NODE) + (count - 1) * sizeof(OBJ);
+  else
+    return sizeof(TREE_SEQ_NODE) - sizeof(OBJ) + count * (sizeof(TREE_SEQ_NODE *) + sizeof(uint32));
+}
+
+uint64 packed_seq_obj_mem_size(PACKED_ELEM_TYPE elem_type, uint64 size) {
+  assert(size > 0);
+  return sizeof(PACKED_SEQ_OBJ) - sizeof(int64) + size * packed_elem_size(elem_type);
+}
+
 uint64 tag_obj_mem_size() {
   return sizeof(TAG_OBJ);
 }
@@ -46,6 +73,28 @@ uint32 *get_right_to_left_indexes(BIN_REL_OBJ *rel) {
 
 ////////////////////////////////////////////////////////////////////////////////
 
+OBJ *get_tree_map_node_values(TREE_MAP_NODE *leaf) {
+  assert(leaf->height == 0);
+  return leaf->keys + leaf->count;
+}
+
+TREE_MAP_NODE **get_tree_map_node_children(TREE_MAP_NODE *node) {
+  assert(node->height > 0);
+  return (TREE_MAP_NODE **) (node->keys + node->count);
+}
+
+TREE_SEQ_NODE **get_tree_seq_node_children(TREE_SEQ_NODE *node) {
+  assert(node->height > 0);
+  return (TREE_SEQ_NODE **) node->elems;
+}
+
+uint32 *get_tree_seq_node_ends(TREE_SEQ_NODE *node) {
+  assert(node->height > 0);
+  return (uint32 *) (get_tree_seq_node_children(node) + node->count);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
 OBJ *get_col_array_ptr(TERN_REL_OBJ *rel, int idx) {
   assert(idx >= 0 & idx <= 2);
   return rel->buffer + idx * rel->size;
@@ -84,6 +133,7 @@ SET_OBJ *new_set(uint32 size) {
   SET_OBJ *set = (SET_OBJ *) new_obj(set_obj_mem_size(size));
   set->ref_obj.ref_count = 1;
   set->size = size;
+  set->search_index = NULL;
   return set;
 }
 
@@ -93,6 +143,7 @@ BIN_REL_OBJ *new_map(uint32 size) {
   BIN_REL_OBJ *map = (BIN_REL_OBJ *) new_obj(map_obj_mem_size(size));
   map->ref_obj.ref_count = 1;
   map->size = size;
+  map->search_index = NULL;
   uint32 *rev_idxs = get_right_to_left_indexes(map);
   rev_idxs[0] = INVALID_INDEX;
   return map;
@@ -104,6 +155,7 @@ BIN_REL_OBJ *new_bin_rel(uint32 size) {
   BIN_REL_OBJ *rel = (BIN_REL_OBJ *) new_obj(bin_rel_obj_mem_size(size));
   rel->ref_obj.ref_count = 1;
   rel->size = size;
+  rel->search_index = NULL;
   return rel;
 }
 
@@ -116,6 +168,59 @@ TERN_REL_OBJ *new_tern_rel(uint32 size) {
   return rel;
 }
 
+TREE_MAP_OBJ *new_tree_map(uint32 size) {
+  assert(size > 0);
+
+  TREE_MAP_OBJ *map = (TREE_MAP_OBJ *) new_obj(tree_map_obj_mem_size());
+  map->ref_obj.ref_count = 1;
+  map->size = size;
+  map->array_view = NULL;
+  return map;
+}
+
+TREE_MAP_NODE *new_tree_map_node(uint32 count, uint32 height) {
+  assert(count > 0);
+
+  TREE_MAP_NODE *node = (TREE_MAP_NODE *) new_obj(tree_map_node_mem_size(count, height == 0));
+  node->ref_obj.ref_count = 1;
+  node->count = count;
+  node->height = height;
+  return node;
+}
+
+TREE_SEQ_OBJ *new_tree_seq() {
+  TREE_SEQ_OBJ *seq = (TREE_SEQ_OBJ *) new_obj(tree_seq_obj_mem_size());
+  seq->ref_obj.ref_count = 1;
+  return seq;
+}
+
+TREE_SEQ_NODE *new_tree_seq_node(uint32 count, uint32 height) {
+  assert(count > 0);
+
+  TREE_SEQ_NODE *node = (TREE_SEQ_NODE *) new_obj(tree_seq_node_mem_size(count, height == 0));
+  node->ref_obj.ref_count = 1;
+  node->count = count;
+  node->height = height;
+  return node;
+}
+
+PACKED_SEQ_OBJ *new_packed_seq(PACKED_ELEM_TYPE elem_type, uint32 size) {
+  assert(size > 0);
+
+  if (size > 0xFFFFFFF)
+    impl_fail("Maximum permitted sequence length (2^28-1) exceeded");
+
+  uint32 elem_size = packed_elem_size(elem_type);
+  uint32 actual_byte_size;
+  PACKED_SEQ_OBJ *seq = (PACKED_SEQ_OBJ *) new_obj(packed_seq_obj_mem_size(elem_type, size), actual_byte_size);
+  seq->ref_obj.ref_count = 1;
+  // Same as for ordinary sequences, the capacity is whatever fits in the memory that was actually allocated
+  seq->capacity = (actual_byte_size - (sizeof(PACKED_SEQ_OBJ) - sizeof(int64))) / elem_size;
+  seq->size = size;
+  seq->elem_type = elem_type;
+  return seq;
+}
+
 TAG_OBJ *new_tag_obj() {
   TAG_OBJ *tag_obj = (TAG_OBJ *) new_obj(tag_obj_mem_size());
   tag_obj->ref_obj.ref_count = 1;
@@ -127,26 +232,78 @@ TAG_OBJ *new_tag_obj() {
 
 //## WHY ISN'T THERE A shrink_map()?
 
+// Sets and maps have no spare capacity of their own, but they are resized with
+// resize_obj(), which keeps the same block as long as the new size falls in the same
+// size class of the allocator, and remaps large blocks instead of copying them. Since
+// size classes grow geometrically, a set or map that is updated in place one element
+// at a time is only reallocated every so many insertions or removals
+
 SET_OBJ *shrink_set(SET_OBJ *set, uint32 new_size) {
   assert(new_size < set->size);
   assert(set->ref_obj.ref_count == 1);
 
+  release_search_index(set->search_index);
+  set->search_index = NULL;
+
   uint32 size = set->size;
-  uint32 mem_size = set_obj_mem_size(size);
-  uint32 new_mem_size = set_obj_mem_size(new_size);
-
-  if (mem_size == new_mem_size) {
-    // If the memory footprint is exactly the same, I can safely reuse
-    // the same object without causing problems in the memory allocator.
-    set->size = new_size;
-    return set;
-  }
+  set = (SET_OBJ *) resize_obj(set, set_obj_mem_size(size), set_obj_mem_size(new_size));
+  set->size = new_size;
+  return set;
+}
 
-  SET_OBJ *new_set = ::new_set(new_size);
-  memcpy(new_set->buffer, set->buffer, new_size * sizeof(OBJ));
-  free_obj(set, mem_size);
+// The following functions grow an object that is referenced only once, moving its content
+// into a new one when needed, and free the old one without releasing what it references
 
-  return new_set;
+// The new sequence has room for at least <min_capacity> elements
+SEQ_OBJ *expand_seq(SEQ_OBJ *seq, uint32 min_capacity) {
+  assert(seq->ref_obj.ref_count == 1);
+  assert(min_capacity > seq->capacity);
+
+  uint32 size = seq->size;
+  SEQ_OBJ *new_seq = ::new_seq(min_capacity);
+  new_seq->size = size;
+  memcpy(new_seq->buffer, seq->buffer, size * sizeof(OBJ));
+  free_obj(seq, seq_obj_mem_size(seq->capacity));
+  return new_seq;
+}
+
+// The new set has one more element, which is left uninitialized, at index <idx>
+SET_OBJ *expand_set(SET_OBJ *set, uint32 idx) {
+  assert(set->ref_obj.ref_count == 1);
+  assert(idx <= set->size);
+
+  release_search_index(set->search_index);
+  set->search_index = NULL;
+
+  uint32 size = set->size;
+  set = (SET_OBJ *) resize_obj(set, set_obj_mem_size(size), set_obj_mem_size(size + 1));
+  memmove(set->buffer + idx + 1, set->buffer + idx, (size - idx) * sizeof(OBJ));
+  set->size = size + 1;
+  return set;
+}
+
+// Same as expand_set(), the new entry is at index <idx> in both columns
+BIN_REL_OBJ *expand_map(BIN_REL_OBJ *map, uint32 idx) {
+  assert(map->ref_obj.ref_count == 1);
+  assert(idx <= map->size);
+
+  release_search_index(map->search_index);
+  map->search_index = NULL;
+
+  uint32 size = map->size;
+  map = (BIN_REL_OBJ *) resize_obj(map, map_obj_mem_size(size), map_obj_mem_size(size + 1));
+
+  // The values move one slot to the right to make room for the new key, and those
+  // after <idx> one more. The tail goes first, as it's where both ranges end up
+  OBJ *buffer = map->buffer;
+  memmove(buffer + size + idx + 2, buffer + size + idx, (size - idx) * sizeof(OBJ));
+  memmove(buffer + size + 1, buffer + size, idx * sizeof(OBJ));
+  memmove(buffer + idx + 1, buffer + idx, (size - idx) * sizeof(OBJ));
+
+  map->size = size + 1;
+  // The right-to-left index, which follows the values, is rebuilt lazily
+  get_right_to_left_indexes(map)[0] = INVALID_INDEX;
+  return map;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -241,6 +398,50 @@ static void release(OBJ *objs, uint32 count, OBJ *queue, uint32 &queue_start, ui
   }
 }
 
+static void release(TREE_MAP_NODE *node, OBJ *queue, uint32 &queue_start, uint32 &queue_size) {
+  uint32 ref_count = node->ref_obj.ref_count;
+  assert(ref_count > 0);
+
+  if (ref_count > 1) {
+    node->ref_obj.ref_count = ref_count - 1;
+    return;
+  }
+
+  uint32 count = node->count;
+  bool is_leaf = node->height == 0;
+  if (is_leaf) {
+    release(node->keys, 2 * count, queue, queue_start, queue_size);
+  }
+  else {
+    TREE_MAP_NODE **children = get_tree_map_node_children(node);
+    for (uint32 i=0 ; i < count ; i++)
+      release(children[i], queue, queue_start, queue_size);
+  }
+  free_obj(node, tree_map_node_mem_size(count, is_leaf));
+}
+
+static void release(TREE_SEQ_NODE *node, OBJ *queue, uint32 &queue_start, uint32 &queue_size) {
+  uint32 ref_count = node->ref_obj.ref_count;
+  assert(ref_count > 0);
+
+  if (ref_count > 1) {
+    node->ref_obj.ref_count = ref_count - 1;
+    return;
+  }
+
+  uint32 count = node->count;
+  bool is_leaf = node->height == 0;
+  if (is_leaf) {
+    release(node->elems, count, queue, queue_start, queue_size);
+  }
+  else {
+    TREE_SEQ_NODE **children = get_tree_seq_node_children(node);
+    for (uint32 i=0 ; i < count ; i++)
+      release(children[i], queue, queue_start, queue_size);
+  }
+  free_obj(node, tree_seq_node_mem_size(count, is_leaf));
+}
+
 static void delete_obj(OBJ obj, OBJ *queue, uint32 &queue_start, uint32 &queue_size) {
   assert(is_gc_obj(obj));
 
@@ -259,6 +460,7 @@ static void delete_obj(OBJ obj, OBJ *queue, uint32 &queue_start, uint32 &queue_s
       SET_OBJ *set = (SET_OBJ *) ref_obj;
       uint32 size = set->size;
       release(set->buffer, size, queue, queue_start, queue_size);
+      release_search_index(set->search_index);
       free_obj(set, set_obj_mem_size(size));
       break;
     }
@@ -267,10 +469,37 @@ static void delete_obj(OBJ obj, OBJ *queue, uint32 &queue_start, uint32 &queue_s
       BIN_REL_OBJ *rel = (BIN_REL_OBJ *) ref_obj;
       uint32 size = rel->size;
       release(rel->buffer, 2*size, queue, queue_start, queue_size);
+      release_search_index(rel->search_index);
       free_obj(rel, obj_type == TYPE_MAP ? map_obj_mem_size(size) : bin_rel_obj_mem_size(size));
       break;
     }
 
+    case TYPE_TREE_MAP: {
+      TREE_MAP_OBJ *map = (TREE_MAP_OBJ *) ref_obj;
+      release(map->root, queue, queue_start, queue_size);
+      BIN_REL_OBJ *view = map->array_view;
+      if (view != NULL) {
+        // The view doesn't own its entries, they belong to the tree
+        release_search_index(view->search_index);
+        free_obj(view, map_obj_mem_size(view->size));
+      }
+      free_obj(map, tree_map_obj_mem_size());
+      break;
+    }
+
+    case TYPE_TREE_SEQ: {
+      TREE_SEQ_OBJ *seq = (TREE_SEQ_OBJ *) ref_obj;
+      release(seq->root, queue, queue_start, queue_size);
+      free_obj(seq, tree_seq_obj_mem_size());
+      break;
+    }
+
+    case TYPE_PACKED_SEQ: {
+      PACKED_SEQ_OBJ *seq = (PACKED_SEQ_OBJ *) ref_obj;
+      free_obj(seq, packed_seq_obj_mem_size((PACKED_ELEM_TYPE) seq->elem_type, seq->capacity));
+      break;
+    }
+
     case TYPE_TERN_REL: {
       TERN_REL_OBJ *rel = (TERN_REL_OBJ *) ref_obj;
       uint32 size = rel->size;
@@ -308,6 +537,42 @@ static void delete_obj(OBJ obj) {
   }
 }
 
+void release_tree_map_node(TREE_MAP_NODE *node) {
+#ifndef NOGC
+  uint32 queue_start = 0;
+  uint32 queue_size = 0;
+  OBJ queue[MAX_QUEUE_SIZE];
+
+  release(node, queue, queue_start, queue_size);
+
+  while (queue_size > 0) {
+    OBJ next_obj = queue[queue_start % MAX_QUEUE_SIZE];
+    queue_size--;
+    queue_start++;
+
+    delete_obj(next_obj, queue, queue_start, queue_size);
+  }
+#endif
+}
+
+void release_tree_seq_node(TREE_SEQ_NODE *node) {
+#ifndef NOGC
+  uint32 queue_start = 0;
+  uint32 queue_size = 0;
+  OBJ queue[MAX_QUEUE_SIZE];
+
+  release(node, queue, queue_start, queue_size);
+
+  while (queue_size > 0) {
+    OBJ next_obj = queue[queue_start % MAX_QUEUE_SIZE];
+    queue_size--;
+    queue_start++;
+
+    delete_obj(next_obj, queue, queue_start, queue_size);
+  }
+#endif
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 void add_ref(REF_OBJ *ptr) {
@@ -338,6 +603,17 @@ void release(OBJ obj) {
 #endif
 }
 
+// True if the caller holds the only reference to the object, which can then be modified
+// in place. Objects that are not reference counted in the current state are never unique
+bool is_unique(OBJ obj) {
+#ifndef NOGC
+  return is_gc_obj(obj) && get_ref_obj_ptr(obj)->ref_count == 1;
+#else
+  // Without reference counting there's no way to tell
+  return false;
+#endif
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 void vec_add_ref(OBJ *objs, uint32 len) {
@@ -0,0 +1,459 @@
+// Inline definitions of the functions that build, inspect and take apart the OBJ structure,
+// and of the ones that get from it to the header of the object it points to. They're at the
+// bottom of almost every operation of the runtime, including comp_objs(), add_ref() and
+// release(), and they are cheaper to inline than to call. Included by lib.h, in the place
+// of their declarations. Those that allocate memory or build views are in mem-utils.cpp
+
+const uint32 SEQ_BUFFER_FIELD_OFFSET = offsetof(SEQ_OBJ, buffer);
+
+////////////////////////////////////////////////////////////////////////////////
+
+#define MASK(S, W)      (((1ULL << (W)) - 1) << (S))
+#define MAKE(V, S)      (((uint64) (V)) << (S))
+#define GET(V, S, W)    (((V) & MASK(S, W)) >> (S))
+#define CLEAR(V, M)     ((V) & ~(M))
+
+////////////////////////////////////////////////////////////////////////////////
+
+const int TYPE_SHIFT          = 56;
+const int MEM_LAYOUT_SHIFT    = 60;
+const int TAGS_COUNT_SHIFT    = 62;
+
+const int TYPE_WIDTH          = 4;
+const int MEM_LAYOUT_WIDTH    = 2;
+const int TAGS_COUNT_WIDTH    = 2;
+
+const int SYMB_IDX_SHIFT      = 0;
+const int LENGTH_SHIFT        = 0;
+const int INNER_TAG_SHIFT     = 16;
+const int TAG_SHIFT           = 32;
+const int OFFSET_SHIFT        = 28;
+
+const int SYMB_IDX_WIDTH      = 16;
+const int LENGTH_WIDTH        = 28;
+const int TAG_WIDTH           = 16;
+const int OFFSET_WIDTH        = 28;
+
+const uint64 TYPE_MASK        = MASK(TYPE_SHIFT, TYPE_WIDTH);
+const uint64 MEM_LAYOUT_MASK  = MASK(MEM_LAYOUT_SHIFT, MEM_LAYOUT_WIDTH);
+const uint64 TAGS_COUNT_MASK  = MASK(TAGS_COUNT_SHIFT, TAGS_COUNT_WIDTH);
+
+const uint64 SYMB_IDX_MASK    = MASK(SYMB_IDX_SHIFT, SYMB_IDX_WIDTH);
+const uint64 LENGTH_MASK      = MASK(LENGTH_SHIFT, LENGTH_WIDTH);
+const uint64 INNER_TAG_MASK   = MASK(INNER_TAG_SHIFT, TAG_WIDTH);
+const uint64 TAG_MASK         = MASK(TAG_SHIFT, TAG_WIDTH);
+const uint64 OFFSET_MASK      = MASK(OFFSET_SHIFT, OFFSET_WIDTH);
+
+////////////////////////////////////////////////////////////////////////////////
+
+#define MAKE_TYPE(T)        MAKE(T, TYPE_SHIFT)
+#define MAKE_MEM_LAYOUT(L)  MAKE(L, MEM_LAYOUT_SHIFT)
+#define MAKE_OFFSET(O)      MAKE(O, OFFSET_SHIFT)
+#define MAKE_LENGTH(L)      MAKE(L, LENGTH_SHIFT)
+#define MAKE_TAGS_COUNT(C)  MAKE(C, TAGS_COUNT_SHIFT)
+#define MAKE_INNER_TAG(T)   MAKE(T, INNER_TAG_SHIFT)
+#define MAKE_SYMB_IDX(I)    MAKE(I, SYMB_IDX_SHIFT)
+#define MAKE_TAG(T)         MAKE(T, TAG_SHIFT)
+
+#define STD_MEM_LAYOUT      MAKE_MEM_LAYOUT(STD_MEM)
+#define TRY_MEM_LAYOUT      MAKE_MEM_LAYOUT(TRY_MEM)
+
+////////////////////////////////////////////////////////////////////////////////
+
+const uint64 BLANK_OBJ_MASK       = MAKE_TYPE(TYPE_BLANK_OBJ);
+const uint64 NULL_OBJ_MASK        = MAKE_TYPE(TYPE_NULL_OBJ);
+
+const uint64 SYMBOL_BASE_MASK     = MAKE_TYPE(TYPE_SYMBOL);
+const uint64 INTEGER_MASK         = MAKE_TYPE(TYPE_INTEGER);
+const uint64 FLOAT_MASK           = MAKE_TYPE(TYPE_FLOAT);
+const uint64 EMPTY_SEQ_MASK       = MAKE_TYPE(TYPE_SEQUENCE);
+const uint64 NE_SEQ_BASE_MASK     = MAKE_TYPE(TYPE_SEQUENCE) | STD_MEM_LAYOUT;
+const uint64 EMPTY_REL_MASK       = MAKE_TYPE(TYPE_SET);
+const uint64 NE_SET_MASK          = MAKE_TYPE(TYPE_SET)      | STD_MEM_LAYOUT;
+const uint64 NE_BIN_REL_MASK      = MAKE_TYPE(TYPE_BIN_REL)  | STD_MEM_LAYOUT;
+const uint64 NE_MAP_MASK          = MAKE_TYPE(TYPE_MAP)      | STD_MEM_LAYOUT;
+const uint64 NE_LOG_MAP_MASK      = MAKE_TYPE(TYPE_LOG_MAP)  | STD_MEM_LAYOUT;
+const uint64 NE_TERN_REL_MASK     = MAKE_TYPE(TYPE_TERN_REL) | STD_MEM_LAYOUT;
+const uint64 NE_TREE_MAP_MASK     = MAKE_TYPE(TYPE_TREE_MAP) | STD_MEM_LAYOUT;
+const uint64 NE_TREE_SEQ_BASE_MASK = MAKE_TYPE(TYPE_TREE_SEQ) | STD_MEM_LAYOUT;
+const uint64 NE_PACKED_SEQ_BASE_MASK = MAKE_TYPE(TYPE_PACKED_SEQ) | STD_MEM_LAYOUT;
+const uint64 TAG_OBJ_MASK         = MAKE_TYPE(TYPE_TAG_OBJ)  | STD_MEM_LAYOUT;
+
+const uint64 TRY_STATE_NE_SEQ_BASE_MASK   = MAKE_TYPE(TYPE_SEQUENCE) | TRY_MEM_LAYOUT;
+const uint64 TRY_STATE_NE_PACKED_SEQ_BASE_MASK = MAKE_TYPE(TYPE_PACKED_SEQ) | TRY_MEM_LAYOUT;
+const uint64 TRY_STATE_NE_SET_MASK        = MAKE_TYPE(TYPE_SET)      | TRY_MEM_LAYOUT;
+const uint64 TRY_STATE_NE_BIN_REL_MASK    = MAKE_TYPE(TYPE_BIN_REL)  | TRY_MEM_LAYOUT;
+const uint64 TRY_STATE_NE_MAP_MASK        = MAKE_TYPE(TYPE_MAP)      | TRY_MEM_LAYOUT;
+const uint64 TRY_STATE_NE_LOG_MAP_MASK    = MAKE_TYPE(TYPE_LOG_MAP)  | TRY_MEM_LAYOUT;
+const uint64 TRY_STATE_NE_TERN_REL_MASK   = MAKE_TYPE(TYPE_TERN_REL) | TRY_MEM_LAYOUT;
+const uint64 TRY_STATE_TAG_OBJ_MASK       = MAKE_TYPE(TYPE_TAG_OBJ)  | TRY_MEM_LAYOUT;
+
+const uint64 SET_LOG_MASK       = MAKE_TYPE(TYPE_SET);
+const uint64 BIN_REL_LOG_MASK   = MAKE_TYPE(TYPE_BIN_REL);
+const uint64 MAP_LOG_MASK       = MAKE_TYPE(TYPE_MAP);
+const uint64 LOG_MAP_LOG_MASK   = MAKE_TYPE(TYPE_LOG_MAP);
+const uint64 TREE_MAP_LOG_MASK  = MAKE_TYPE(TYPE_TREE_MAP);
+const uint64 TERN_REL_LOG_MASK  = MAKE_TYPE(TYPE_TERN_REL);
+
+////////////////////////////////////////////////////////////////////////////////
+
+inline OBJ_TYPE get_physical_type(OBJ obj) {
+  return (OBJ_TYPE) GET(obj.extra_data, TYPE_SHIFT, TYPE_WIDTH);
+}
+
+inline MEM_LAYOUT get_mem_layout(OBJ obj) {
+  return (MEM_LAYOUT) GET(obj.extra_data, MEM_LAYOUT_SHIFT, MEM_LAYOUT_WIDTH);
+}
+
+inline uint32 get_tags_count(OBJ obj) {
+  return GET(obj.extra_data, TAGS_COUNT_SHIFT, TAGS_COUNT_WIDTH); // Masking is actually unnecessary here
+}
+
+inline uint64 get_log_mask(OBJ obj) {
+  return CLEAR(obj.extra_data, MEM_LAYOUT_MASK);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+inline bool is_blank_obj(OBJ obj) {
+  return get_physical_type(obj) == TYPE_BLANK_OBJ;
+}
+
+inline bool is_null_obj(OBJ obj) {
+  return get_physical_type(obj) == TYPE_NULL_OBJ;
+}
+
+inline bool is_symb(OBJ obj) {
+  return (obj.extra_data >> 16) == (SYMBOL_BASE_MASK >> 16);
+}
+
+inline bool is_bool(OBJ obj) {
+  assert(symb_idx_false == 0 & symb_idx_true == 1); // The correctness of the body depends on this assumption
+  return (obj.extra_data >> 1) == (SYMBOL_BASE_MASK >> 1);
+}
+
+inline bool is_int(OBJ obj) {
+  return obj.extra_data == INTEGER_MASK;
+}
+
+inline bool is_float(OBJ obj) {
+  return obj.extra_data == FLOAT_MASK;
+}
+
+inline bool is_seq(OBJ obj) {
+  OBJ_TYPE physical_type = get_physical_type(obj);
+  bool is_seq_or_tree_seq = physical_type == TYPE_SEQUENCE | physical_type == TYPE_TREE_SEQ;
+  return (is_seq_or_tree_seq & get_tags_count(obj) == 0) | physical_type == TYPE_SLICE | physical_type == TYPE_PACKED_SEQ;
+}
+
+inline bool is_empty_seq(OBJ obj) {
+  return obj.extra_data == EMPTY_SEQ_MASK;
+}
+
+inline bool is_ne_seq(OBJ obj) {
+  // return ((obj.extra_data.word >> 32) == (NE_SEQ_BASE_MASK >> 32)) | (get_physical_type(obj) == TYPE_SLICE);
+  return is_seq(obj) & !is_empty_seq(obj);
+}
+
+inline bool is_empty_rel(OBJ obj) {
+  return obj.extra_data == EMPTY_REL_MASK;
+}
+
+inline bool is_ne_set(OBJ obj) {
+  return obj.extra_data == NE_SET_MASK | obj.extra_data == TRY_STATE_NE_SET_MASK;
+}
+
+inline bool is_set(OBJ obj) {
+  return get_log_mask(obj) == SET_LOG_MASK;
+}
+
+inline bool is_ne_bin_rel(OBJ obj) {
+  uint64 log_mask = get_log_mask(obj);
+  return log_mask == BIN_REL_LOG_MASK | log_mask == LOG_MAP_LOG_MASK | log_mask == MAP_LOG_MASK | log_mask == TREE_MAP_LOG_MASK;
+}
+
+inline bool is_ne_map(OBJ obj) {
+  uint64 log_mask = get_log_mask(obj);
+  return log_mask == MAP_LOG_MASK | log_mask == LOG_MAP_LOG_MASK | log_mask == TREE_MAP_LOG_MASK;
+}
+
+inline bool is_bin_rel(OBJ obj) {
+  return is_empty_rel(obj) | is_ne_bin_rel(obj);
+}
+
+inline bool is_ne_tern_rel(OBJ obj) {
+  uint64 extra_data = obj.extra_data;
+  return extra_data == NE_TERN_REL_MASK | extra_data == TRY_STATE_NE_TERN_REL_MASK;
+}
+
+inline bool is_tern_rel(OBJ obj) {
+  return is_empty_rel(obj) | is_ne_tern_rel(obj);
+}
+
+inline bool is_tag_obj(OBJ obj) {
+  return get_tags_count(obj) != 0 | get_physical_type(obj) == TYPE_TAG_OBJ;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+inline bool is_symb(OBJ obj, uint16 symb_idx) {
+  return obj.extra_data == (symb_idx | SYMBOL_BASE_MASK);
+}
+
+inline bool is_int(OBJ obj, int64 n) {
+  return obj.core_data.int_ == n & obj.extra_data == INTEGER_MASK;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+inline bool is_inline_obj(OBJ obj) {
+  assert((get_mem_layout(obj) == 0) == (get_physical_type(obj) <= MAX_INLINE_OBJ_TYPE_VALUE | obj.core_data.ptr == NULL));
+  return get_mem_layout(obj) == 0;
+}
+
+inline bool is_ref_obj(OBJ obj) {
+  return get_mem_layout(obj) != 0;
+}
+
+inline bool uses_try_mem(OBJ obj) {
+  return get_mem_layout(obj) > 1;
+}
+
+inline bool is_in_normal_state() {
+  return curr_mem_alloc_state == NORMAL;
+}
+
+inline bool is_in_try_state() {
+  return curr_mem_alloc_state == TRY;
+}
+
+inline bool is_in_copying_state() {
+  return curr_mem_alloc_state == COPYING;
+}
+
+inline bool is_gc_obj(OBJ obj) {
+  return get_mem_layout(obj) == (is_in_try_state() ? 2 : 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+inline OBJ make_blank_obj() {
+  OBJ obj;
+  obj.core_data.int_ = 0;
+  obj.extra_data = BLANK_OBJ_MASK;
+  return obj;
+}
+
+inline OBJ make_null_obj() {
+  OBJ obj;
+  obj.core_data.int_ = 0;
+  obj.extra_data = NULL_OBJ_MASK;
+  return obj;
+}
+
+inline OBJ make_symb(uint16 symb_idx) {
+  OBJ obj;
+  obj.core_data.int_ = 0;
+  obj.extra_data = symb_idx | SYMBOL_BASE_MASK;
+  return obj;
+}
+
+inline OBJ make_bool(bool b) {
+  OBJ obj;
+  obj.core_data.int_ = 0;
+  obj.extra_data = (b ? symb_idx_true : symb_idx_false) | SYMBOL_BASE_MASK;
+  return obj;
+}
+
+inline OBJ make_int(uint64 value) {
+  OBJ obj;
+  obj.core_data.int_ = value;
+  obj.extra_data = INTEGER_MASK;
+  return obj;
+}
+
+inline OBJ make_empty_seq() {
+  OBJ obj;
+  obj.core_data.ptr = NULL;
+  obj.extra_data = EMPTY_SEQ_MASK;
+  return obj;
+}
+
+inline OBJ make_empty_rel() {
+  OBJ obj;
+  obj.core_data.ptr = NULL;
+  obj.extra_data = EMPTY_REL_MASK;
+  return obj;
+}
+
+inline OBJ make_float(double value) {
+  OBJ obj;
+  obj.core_data.float_ = value;
+  obj.extra_data = FLOAT_MASK;
+  return obj;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+inline uint16 get_symb_idx(OBJ obj) {
+  assert(is_symb(obj));
+  return GET(obj.extra_data, SYMB_IDX_SHIFT, SYMB_IDX_WIDTH);
+}
+
+inline bool get_bool(OBJ obj) {
+  assert(is_bool(obj));
+  return get_symb_idx(obj) == symb_idx_true;
+}
+
+inline int64 get_int(OBJ obj) {
+  assert(is_int(obj));
+  return obj.core_data.int_;
+}
+
+inline double get_float(OBJ obj) {
+  assert(is_float(obj));
+  return obj.core_data.float_;
+}
+
+inline uint32 get_seq_length(OBJ seq) {
+  assert(is_seq(seq));
+  return GET(seq.extra_data, LENGTH_SHIFT, LENGTH_WIDTH);
+}
+
+inline uint32 get_seq_offset(OBJ seq) {
+  assert(is_seq(seq));
+  OBJ_TYPE type = get_physical_type(seq);
+  return type == TYPE_SLICE | type == TYPE_PACKED_SEQ ? GET(seq.extra_data, OFFSET_SHIFT, OFFSET_WIDTH) : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+inline uint16 get_tag_idx(OBJ obj) {
+  assert(is_tag_obj(obj));
+  assert(get_physical_type(obj) != TYPE_SLICE);
+
+  if (get_tags_count(obj) != 0)
+    return GET(obj.extra_data, TAG_SHIFT, TAG_WIDTH);
+  else
+    return ((TAG_OBJ *) obj.core_data.ptr)->tag_idx;
+}
+
+inline OBJ get_inner_obj(OBJ obj) {
+  assert(is_tag_obj(obj));
+
+  OBJ_TYPE type = get_physical_type(obj);
+  assert(type != TYPE_SLICE);
+
+  if (type == TYPE_SEQUENCE | type == TYPE_TREE_SEQ) {
+    assert(get_tags_count(obj) == 1);
+    obj.extra_data = CLEAR(obj.extra_data, TAG_MASK | TAGS_COUNT_MASK);
+    // obj.extra_data.seq.tag = 0;
+    // obj.extra_data.seq.num_tags = 0;
+    return obj;
+  }
+
+  uint8 tags_count = get_tags_count(obj);
+  if (tags_count > 0) {
+    uint16 inner_tag = GET(obj.extra_data, INNER_TAG_SHIFT, TAG_WIDTH);
+    uint64 cleared_extra_data = CLEAR(obj.extra_data, INNER_TAG_MASK | TAG_MASK | TAGS_COUNT_MASK);
+    obj.extra_data = cleared_extra_data | MAKE_TAG(inner_tag) | MAKE_TAGS_COUNT(tags_count-1);
+    // obj.extra_data.std.tag = obj.extra_data.std.inner_tag;
+    // obj.extra_data.std.inner_tag = 0;
+    // obj.extra_data.std.num_tags = tags_count - 1;
+    return obj;
+  }
+
+  return ((TAG_OBJ *) obj.core_data.ptr)->obj;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+inline SEQ_OBJ* get_seq_ptr(OBJ obj) {
+  assert(get_physical_type(obj) == TYPE_SEQUENCE || get_physical_type(obj) == TYPE_SLICE);
+  assert(obj.core_data.ptr != NULL);
+
+  char *buffer_ptr = (char *) obj.core_data.ptr;
+  // Here I cannot simply use get_seq_offset(obj) because that function asserts the object has to be an untagged sequence
+  uint32 slice_offset = get_physical_type(obj) == TYPE_SLICE ? GET(obj.extra_data, OFFSET_SHIFT, OFFSET_WIDTH) : 0;
+
+  return (SEQ_OBJ *) (buffer_ptr - (SEQ_BUFFER_FIELD_OFFSET + slice_offset * sizeof(OBJ)));
+}
+
+inline SET_OBJ* get_set_ptr(OBJ obj) {
+  assert(get_physical_type(obj) == TYPE_SET & obj.core_data.ptr != NULL);
+  return (SET_OBJ *) obj.core_data.ptr;
+}
+
+inline TERN_REL_OBJ *get_tern_rel_ptr(OBJ obj) {
+  assert(get_physical_type(obj) == TYPE_TERN_REL & obj.core_data.ptr != NULL);
+  return (TERN_REL_OBJ *) obj.core_data.ptr;
+}
+
+inline TREE_MAP_OBJ *get_tree_map_ptr(OBJ obj) {
+  assert(get_physical_type(obj) == TYPE_TREE_MAP & obj.core_data.ptr != NULL);
+  return (TREE_MAP_OBJ *) obj.core_data.ptr;
+}
+
+inline TREE_SEQ_OBJ *get_tree_seq_ptr(OBJ obj) {
+  assert(get_physical_type(obj) == TYPE_TREE_SEQ & obj.core_data.ptr != NULL);
+  return (TREE_SEQ_OBJ *) obj.core_data.ptr;
+}
+
+inline PACKED_SEQ_OBJ *get_packed_seq_ptr(OBJ obj) {
+  assert(get_physical_type(obj) == TYPE_PACKED_SEQ & obj.core_data.ptr != NULL);
+  return (PACKED_SEQ_OBJ *) obj.core_data.ptr;
+}
+
+inline TAG_OBJ *get_tag_obj_ptr(OBJ obj) {
+  assert(get_physical_type(obj) == TYPE_TAG_OBJ & obj.core_data.ptr != NULL);
+  return (TAG_OBJ *) obj.core_data.ptr;
+}
+
+inline REF_OBJ *get_ref_obj_ptr(OBJ obj) {
+  assert(is_ref_obj(obj));
+
+  OBJ_TYPE type = get_physical_type(obj);
+  assert( type == TYPE_SEQUENCE | type == TYPE_SLICE | type == TYPE_SET | type == TYPE_BIN_REL |
+          type == TYPE_LOG_MAP | type == TYPE_MAP | type == TYPE_TREE_MAP | type == TYPE_TERN_REL |
+          type == TYPE_TAG_OBJ | type == TYPE_TREE_SEQ | type == TYPE_PACKED_SEQ);
+
+  if (type == TYPE_SLICE) {
+    char *buffer_ptr = (char *) obj.core_data.ptr;
+    return (REF_OBJ *) (buffer_ptr - (SEQ_BUFFER_FIELD_OFFSET + get_seq_offset(obj) * sizeof(OBJ)));
+  }
+
+  if (type == TYPE_SEQUENCE)
+    return (REF_OBJ *) (((char *) obj.core_data.ptr) - SEQ_BUFFER_FIELD_OFFSET);
+
+  return (REF_OBJ *) obj.core_data.ptr;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+inline bool are_shallow_eq(OBJ obj1, OBJ obj2) {
+  return obj1.core_data.int_ == obj2.core_data.int_ && obj1.extra_data == obj2.extra_data;
+}
+
+inline int shallow_cmp(OBJ obj1, OBJ obj2) {
+  assert(is_inline_obj(obj1) & is_inline_obj(obj2));
+
+  uint64 extra_data_1 = obj1.extra_data;
+  uint64 extra_data_2 = obj2.extra_data;
+
+  if (extra_data_1 < extra_data_2)
+    return 1;
+
+  if (extra_data_1 > extra_data_2)
+    return -1;
+
+  int64 core_data_1 = obj1.core_data.int_;
+  int64 core_data_2 = obj2.core_data.int_;
+
+  if (core_data_1 < core_data_2)
+    return 1;
+
+  if (core_data_1 > core_data_2)
+    return -1;
+
+  return 0;
+}
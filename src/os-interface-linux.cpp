@@ -1,6 +1,12 @@
 #include "lib.h"
 #include "os-interface.h"
 
+#include <sys/mman.h>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
 
 uint64 get_tick_count() {
   struct timespec ts;
@@ -45,3 +51,45 @@ bool file_write(const char *fname, const char *buffer, int size, bool append) {
   fclose(fp);
   return written == size;
 }
+
+// Returns to the system the free memory held by the C heap, which
+// doesn't shrink on its own unless the free memory is at its top
+void trim_os_heap() {
+#ifdef __GLIBC__
+  malloc_trim(0);
+#endif
+}
+
+// Returns NULL if the memory cannot be mapped. The huge page advice is only a hint,
+// which is ignored if transparent huge pages are disabled or not supported
+
+void *map_mem_pages(uint64 byte_size, bool huge_pages) {
+  void *ptr = mmap(NULL, byte_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (ptr == MAP_FAILED)
+    return NULL;
+#ifdef MADV_HUGEPAGE
+  if (huge_pages)
+    madvise(ptr, byte_size, MADV_HUGEPAGE);
+#endif
+  return ptr;
+}
+
+void unmap_mem_pages(void *ptr, uint64 byte_size) {
+  munmap(ptr, byte_size);
+}
+
+// The pages are moved rather than copied, if the mapping cannot be extended where it is
+void *remap_mem_pages(void *ptr, uint64 byte_size, uint64 new_byte_size, bool huge_pages) {
+#ifdef MREMAP_MAYMOVE
+  void *new_ptr = mremap(ptr, byte_size, new_byte_size, MREMAP_MAYMOVE);
+  if (new_ptr == MAP_FAILED)
+    return NULL;
+#ifdef MADV_HUGEPAGE
+  if (huge_pages)
+    madvise(new_ptr, new_byte_size, MADV_HUGEPAGE);
+#endif
+  return new_ptr;
+#else
+  return NULL;
+#endif
+}
@@ -2,3 +2,9 @@
 
 char *file_read(const char *fname, int &size);
 bool file_write(const char *fname, const char *buffer, int size, bool append);
+
+void trim_os_heap();
+
+void *map_mem_pages(uint64 byte_size, bool huge_pages);
+void  unmap_mem_pages(void *ptr, uint64 byte_size);
+void *remap_mem_pages(void *ptr, uint64 byte_size, uint64 new_byte_size, bool huge_pages);
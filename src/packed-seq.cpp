@@ -0,0 +1,366 @@
+#include "lib.h"
+
+
+// Sequences of bytes, integers or floating point numbers that come from outside the
+// program (files, constant data and arrays passed in through the interface) and the
+// characters of strings are stored as packed arrays of raw elements instead of arrays
+// of objects: a file of n bytes takes n bytes instead of 16 n. The type of the elements
+// is stored in the object, and elements are turned into objects on demand, one at a time,
+// by at(), iteration, hashing, comparison and printing, none of which allocates anything.
+// Operations that create an ordinary sequence out of a packed one, like updating one of
+// its elements, reversing it or concatenating it with an ordinary sequence, unpack its
+// elements straight into the new sequence, with copy_seq_elems().
+//
+// Appending elements that fit in the element type of a packed sequence, or concatenating
+// two packed sequences of compatible types, creates another packed sequence, with some
+// spare capacity. As with ordinary sequences, if a sequence ends at the last element of its
+// object and there's enough spare capacity left, the new elements are stored there without
+// copying the existing ones, so a string built one piece at a time takes linear time.
+//
+// Just like ordinary slices, packed sequences store the offset of their first element in
+// the object, so slicing them doesn't copy anything, but that leaves no room for inline
+// tags: tagged packed sequences are always wrapped in a TAG_OBJ.
+//
+// Packed sequences have no array of objects, so get_seq_buffer_ptr() cannot be used with
+// them: code that deals with sequences of any type goes through at(), SEQ_ITER or
+// copy_seq_elems() instead
+
+////////////////////////////////////////////////////////////////////////////////
+
+uint32 packed_elem_size(PACKED_ELEM_TYPE elem_type) {
+  switch (elem_type) {
+    case PACKED_UINT8:  return sizeof(uint8);
+    case PACKED_UINT16: return sizeof(uint16);
+    case PACKED_INT32:  return sizeof(int32);
+    case PACKED_INT64:  return sizeof(int64);
+    case PACKED_FLOAT:  return sizeof(double);
+  }
+  internal_fail();
+}
+
+static OBJ build_packed_seq(PACKED_ELEM_TYPE elem_type, const void *elems, uint32 len) {
+  if (len == 0)
+    return make_empty_seq();
+
+  PACKED_SEQ_OBJ *seq = new_packed_seq(elem_type, len);
+  memcpy(seq->elems, elems, len * packed_elem_size(elem_type));
+  return make_packed_seq(seq, len);
+}
+
+OBJ build_packed_uint8_seq(const uint8 *elems, uint32 len) {
+  return build_packed_seq(PACKED_UINT8, elems, len);
+}
+
+OBJ build_packed_uint16_seq(const uint16 *elems, uint32 len) {
+  return build_packed_seq(PACKED_UINT16, elems, len);
+}
+
+OBJ build_packed_int32_seq(const int32 *elems, uint32 len) {
+  return build_packed_seq(PACKED_INT32, elems, len);
+}
+
+OBJ build_packed_int64_seq(const int64 *elems, uint32 len) {
+  return build_packed_seq(PACKED_INT64, elems, len);
+}
+
+OBJ build_packed_float_seq(const double *elems, uint32 len) {
+  return build_packed_seq(PACKED_FLOAT, elems, len);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+OBJ packed_seq_elem(PACKED_SEQ_OBJ *seq, uint32 idx) {
+  assert(idx < seq->size);
+
+  switch (seq->elem_type) {
+    case PACKED_UINT8:
+      return make_int(((uint8 *) seq->elems)[idx]);
+
+    case PACKED_UINT16:
+      return make_int(((uint16 *) seq->elems)[idx]);
+
+    case PACKED_INT32:
+      return make_int(((int32 *) seq->elems)[idx]);
+
+    case PACKED_INT64:
+      return make_int(((int64 *) seq->elems)[idx]);
+
+    case PACKED_FLOAT:
+      return make_float(((double *) seq->elems)[idx]);
+  }
+  internal_fail();
+}
+
+OBJ packed_seq_at(OBJ seq, uint32 idx) {
+  assert(idx < get_seq_length(seq));
+  return packed_seq_elem(get_packed_seq_ptr(seq), get_seq_offset(seq) + idx);
+}
+
+OBJ get_packed_seq_slice(OBJ seq, uint32 idx_first, uint32 len) {
+  assert(len > 0 & idx_first + len <= get_seq_length(seq));
+
+  add_ref(seq);
+  uint32 offset = get_seq_offset(seq) + idx_first;
+  return make_packed_slice(get_packed_seq_ptr(seq), get_mem_layout(seq), offset, len);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Narrowest element type that can store the object, if any
+static bool get_packed_elem_type(OBJ obj, PACKED_ELEM_TYPE &elem_type) {
+  if (is_float(obj)) {
+    elem_type = PACKED_FLOAT;
+    return true;
+  }
+
+  if (!is_int(obj))
+    return false;
+
+  int64 value = get_int(obj);
+  if (value >= 0 & value <= 0xFF)
+    elem_type = PACKED_UINT8;
+  else if (value >= 0 & value <= 0xFFFF)
+    elem_type = PACKED_UINT16;
+  else if (value == (int32) value)
+    elem_type = PACKED_INT32;
+  else
+    elem_type = PACKED_INT64;
+  return true;
+}
+
+// Narrowest element type that can store the elements of both types, if any.
+// Integers and floating point numbers cannot be mixed
+static bool join_packed_elem_types(PACKED_ELEM_TYPE type1, PACKED_ELEM_TYPE type2, PACKED_ELEM_TYPE &elem_type) {
+  if ((type1 == PACKED_FLOAT) != (type2 == PACKED_FLOAT))
+    return false;
+  elem_type = type1 > type2 ? type1 : type2;
+  return true;
+}
+
+static bool get_packed_elems_type(PACKED_ELEM_TYPE init_type, OBJ *objs, uint32 count, PACKED_ELEM_TYPE &elem_type) {
+  elem_type = init_type;
+  for (uint32 i=0 ; i < count ; i++) {
+    PACKED_ELEM_TYPE obj_type;
+    if (!get_packed_elem_type(objs[i], obj_type) || !join_packed_elem_types(elem_type, obj_type, elem_type))
+      return false;
+  }
+  return true;
+}
+
+// The object must fit in the element type of the sequence
+static void set_packed_elem(PACKED_SEQ_OBJ *seq, uint32 idx, OBJ obj) {
+  assert(idx < seq->size);
+
+  switch (seq->elem_type) {
+    case PACKED_UINT8:
+      ((uint8 *) seq->elems)[idx] = get_int(obj);
+      break;
+
+    case PACKED_UINT16:
+      ((uint16 *) seq->elems)[idx] = get_int(obj);
+      break;
+
+    case PACKED_INT32:
+      ((int32 *) seq->elems)[idx] = get_int(obj);
+      break;
+
+    case PACKED_INT64:
+      ((int64 *) seq->elems)[idx] = get_int(obj);
+      break;
+
+    case PACKED_FLOAT:
+      ((double *) seq->elems)[idx] = get_float(obj);
+      break;
+
+    default:
+      internal_fail();
+  }
+}
+
+// Copies the elements of a packed sequence into another one, whose element type must be
+// the same or a wider one. Elements whose type is different are converted one at a time
+static void copy_packed_elems(OBJ seq, PACKED_SEQ_OBJ *dest, uint32 dest_idx) {
+  PACKED_SEQ_OBJ *src = get_packed_seq_ptr(seq);
+  uint32 offset = get_seq_offset(seq);
+  uint32 len = get_seq_length(seq);
+
+  assert(dest_idx + len <= dest->size);
+
+  if (src->elem_type == dest->elem_type) {
+    uint32 elem_size = packed_elem_size((PACKED_ELEM_TYPE) src->elem_type);
+    memcpy((uint8 *) dest->elems + dest_idx * elem_size, (uint8 *) src->elems + offset * elem_size, len * elem_size);
+  }
+  else {
+    for (uint32 i=0 ; i < len ; i++)
+      set_packed_elem(dest, dest_idx + i, packed_seq_elem(src, offset + i));
+  }
+}
+
+// Returns a packed sequence of the given element type, with the elements of <seq> followed
+// by room for <count> more ones. If possible that room is found in the spare capacity of
+// the object of <seq>, otherwise the elements are copied to a new and bigger object
+static OBJ make_room(OBJ seq, PACKED_ELEM_TYPE elem_type, uint32 count) {
+  PACKED_SEQ_OBJ *ptr = get_packed_seq_ptr(seq);
+  uint32 offset = get_seq_offset(seq);
+  uint32 len = get_seq_length(seq);
+  uint32 size = ptr->size;
+
+  uint64 new_len = (uint64) len + count;
+  if (new_len > 0xFFFFFFF)
+    impl_fail("Maximum permitted sequence length (2^28-1) exceeded");
+
+  bool ends_at_last_elem = offset + len == size;
+  bool has_needed_spare_capacity = size + count <= ptr->capacity;
+  bool same_elem_type = ptr->elem_type == elem_type;
+
+  if (ends_at_last_elem & has_needed_spare_capacity & same_elem_type) {
+    ptr->size = size + count;
+    add_ref(seq);
+    return make_packed_slice(ptr, get_mem_layout(seq), offset, new_len);
+  }
+
+  // Leaving some spare capacity, so that the next extension can be done in place
+  uint64 capacity = new_len + new_len / 2;
+  PACKED_SEQ_OBJ *new_ptr = new_packed_seq(elem_type, capacity <= 0xFFFFFFF ? capacity : new_len);
+  new_ptr->size = new_len;
+  copy_packed_elems(seq, new_ptr, 0);
+  return make_packed_seq(new_ptr, new_len);
+}
+
+bool can_extend_packed_seq(OBJ seq, OBJ *new_elems, uint32 count) {
+  PACKED_ELEM_TYPE elem_type;
+  PACKED_ELEM_TYPE init_type = (PACKED_ELEM_TYPE) get_packed_seq_ptr(seq)->elem_type;
+  return get_packed_elems_type(init_type, new_elems, count, elem_type);
+}
+
+bool can_join_packed_seqs(OBJ left, OBJ right) {
+  PACKED_ELEM_TYPE elem_type;
+  PACKED_ELEM_TYPE left_type = (PACKED_ELEM_TYPE) get_packed_seq_ptr(left)->elem_type;
+  PACKED_ELEM_TYPE right_type = (PACKED_ELEM_TYPE) get_packed_seq_ptr(right)->elem_type;
+  return join_packed_elem_types(left_type, right_type, elem_type);
+}
+
+// Same as extend_sequence(). The new elements must fit in a packed sequence, see can_extend_packed_seq()
+OBJ extend_packed_seq(OBJ seq, OBJ *new_elems, uint32 count) {
+  PACKED_ELEM_TYPE init_type = (PACKED_ELEM_TYPE) get_packed_seq_ptr(seq)->elem_type;
+  PACKED_ELEM_TYPE elem_type = init_type;
+  if (!get_packed_elems_type(init_type, new_elems, count, elem_type))
+    internal_fail();
+
+  uint32 len = get_seq_length(seq);
+  OBJ res = make_room(seq, elem_type, count);
+  PACKED_SEQ_OBJ *ptr = get_packed_seq_ptr(res);
+  uint32 offset = get_seq_offset(res);
+  for (uint32 i=0 ; i < count ; i++)
+    set_packed_elem(ptr, offset + len + i, new_elems[i]);
+  return res;
+}
+
+// Both sequences must be packed, see can_join_packed_seqs()
+OBJ join_packed_seqs(OBJ left, OBJ right) {
+  PACKED_ELEM_TYPE left_type = (PACKED_ELEM_TYPE) get_packed_seq_ptr(left)->elem_type;
+  PACKED_ELEM_TYPE right_type = (PACKED_ELEM_TYPE) get_packed_seq_ptr(right)->elem_type;
+  PACKED_ELEM_TYPE elem_type = left_type;
+  if (!join_packed_elem_types(left_type, right_type, elem_type))
+    internal_fail();
+
+  uint32 len = get_seq_length(left);
+  OBJ res = make_room(left, elem_type, get_seq_length(right));
+  copy_packed_elems(right, get_packed_seq_ptr(res), get_seq_offset(res) + len);
+  return res;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// At least one of the two sequences is packed, and they have the same length.
+// Elements are compared one by one, so that nothing needs to be materialized
+int comp_packed_seqs(OBJ seq1, OBJ seq2) {
+  uint32 len = get_seq_length(seq1);
+  assert(len > 0 & get_seq_length(seq2) == len);
+
+  bool is_packed_1 = get_physical_type(seq1) == TYPE_PACKED_SEQ;
+  bool is_packed_2 = get_physical_type(seq2) == TYPE_PACKED_SEQ;
+
+  uint32 idx = 0;
+
+  if (is_packed_1 & is_packed_2) {
+    PACKED_SEQ_OBJ *ptr1 = get_packed_seq_ptr(seq1);
+    PACKED_SEQ_OBJ *ptr2 = get_packed_seq_ptr(seq2);
+
+    if (ptr1->elem_type == ptr2->elem_type) {
+      // Two elements of the same type are equal if and only if their raw bytes are,
+      // so only the first element whose bytes differ needs to be actually compared
+      uint32 elem_size = packed_elem_size((PACKED_ELEM_TYPE) ptr1->elem_type);
+      uint8 *bytes1 = (uint8 *) ptr1->elems + get_seq_offset(seq1) * elem_size;
+      uint8 *bytes2 = (uint8 *) ptr2->elems + get_seq_offset(seq2) * elem_size;
+
+      if (memcmp(bytes1, bytes2, len * elem_size) == 0)
+        return 0;
+
+      uint32 byte_idx = 0;
+      while (bytes1[byte_idx] == bytes2[byte_idx])
+        byte_idx++;
+      idx = byte_idx / elem_size;
+    }
+  }
+
+  for ( ; idx < len ; idx++) {
+    OBJ elem1 = is_packed_1 ? packed_seq_at(seq1, idx) : at(seq1, idx);
+    OBJ elem2 = is_packed_2 ? packed_seq_at(seq2, idx) : at(seq2, idx);
+    int cr = comp_objs(elem1, elem2);
+    if (cr != 0)
+      return cr;
+  }
+
+  return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Turns the elements of the sequence in the range [first, first + count) into objects, and stores them in <dest>
+void copy_packed_seq_elems(OBJ seq, uint32 first, uint32 count, OBJ *dest) {
+  assert(first + count <= get_seq_length(seq));
+
+  PACKED_SEQ_OBJ *ptr = get_packed_seq_ptr(seq);
+  uint32 offset = get_seq_offset(seq) + first;
+
+  switch (ptr->elem_type) {
+    case PACKED_UINT8: {
+      uint8 *elems = (uint8 *) ptr->elems + offset;
+      for (uint32 i=0 ; i < count ; i++)
+        dest[i] = make_int(elems[i]);
+      break;
+    }
+
+    case PACKED_UINT16: {
+      uint16 *elems = (uint16 *) ptr->elems + offset;
+      for (uint32 i=0 ; i < count ; i++)
+        dest[i] = make_int(elems[i]);
+      break;
+    }
+
+    case PACKED_INT32: {
+      int32 *elems = (int32 *) ptr->elems + offset;
+      for (uint32 i=0 ; i < count ; i++)
+        dest[i] = make_int(elems[i]);
+      break;
+    }
+
+    case PACKED_INT64: {
+      int64 *elems = (int64 *) ptr->elems + offset;
+      for (uint32 i=0 ; i < count ; i++)
+        dest[i] = make_int(elems[i]);
+      break;
+    }
+
+    case PACKED_FLOAT: {
+      double *elems = (double *) ptr->elems + offset;
+      for (uint32 i=0 ; i < count ; i++)
+        dest[i] = make_float(elems[i]);
+      break;
+    }
+
+    default:
+      internal_fail();
+  }
+}
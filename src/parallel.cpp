@@ -0,0 +1,124 @@
+#include "lib.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <algorithm>
+
+
+// Upper bound to the number of threads, including the caller's, used by parallel_for()
+const uint32 MAX_THREADS = 16;
+
+// Workers are started the first time they are needed and then kept around, waiting for
+// the next job, for as long as the process lives. The pool itself is never deleted,
+// as destroying a condition variable that threads are still waiting on never returns.
+// Several threads can submit jobs at the same time: each job has its own progress
+// counters, and jobs are queued and picked up by the workers in submission order
+
+struct PARALLEL_JOB {
+  void (*task)(void *, uint32);
+  void *data;
+  uint32 size;
+  uint32 next;
+  uint32 completed;
+};
+
+struct THREAD_POOL {
+  std::mutex mutex;
+  std::condition_variable job_available;
+  std::condition_variable job_done;
+
+  uint32 workers_count;
+
+  // Jobs that still have items that haven't been started
+  std::deque<PARALLEL_JOB *> jobs;
+};
+
+static THREAD_POOL *pool = NULL;
+static std::once_flag pool_started;
+
+// Set while the thread is running a task of parallel_for(), whether it's a worker or the caller
+static thread_local bool running_parallel_task = false;
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Runs items of the given job until there are no more left to start, and removes the job
+// from the queue when starting its last item. Must be called with the lock held, which is
+// released while running a task. The job must not be accessed once this function returns,
+// as the thread that submitted it may have already moved on
+static void run_job_items(std::unique_lock<std::mutex> &lock, PARALLEL_JOB *job) {
+  while (job->next < job->size) {
+    uint32 idx = job->next++;
+    if (job->next == job->size)
+      pool->jobs.erase(std::find(pool->jobs.begin(), pool->jobs.end(), job));
+    lock.unlock();
+    running_parallel_task = true;
+    job->task(job->data, idx);
+    running_parallel_task = false;
+    lock.lock();
+    if (++job->completed == job->size)
+      pool->job_done.notify_all();
+  }
+}
+
+static void worker_main() {
+  std::unique_lock<std::mutex> lock(pool->mutex);
+  for ( ; ; ) {
+    while (pool->jobs.empty())
+      pool->job_available.wait(lock);
+    run_job_items(lock, pool->jobs.front());
+  }
+}
+
+static void start_pool() {
+  uint32 threads = std::thread::hardware_concurrency();
+  if (threads > MAX_THREADS)
+    threads = MAX_THREADS;
+
+  pool = new THREAD_POOL;
+  pool->workers_count = threads > 1 ? threads - 1 : 0;
+
+  for (uint32 i=0 ; i < pool->workers_count ; i++)
+    std::thread(worker_main).detach();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool is_in_parallel_task() {
+  return running_parallel_task;
+}
+
+uint32 parallel_threads_count() {
+  std::call_once(pool_started, start_pool);
+  return pool->workers_count + 1;
+}
+
+// Calls task(data, i) for every i in [0, count), spreading the calls across the
+// workers and the calling thread, and returns only after all of them have returned.
+// Tasks must not allocate or release objects: each thread has its own allocator, and those
+// of the workers are not in the same state (normal, try or copying) as the caller's
+void parallel_for(void (*task)(void *, uint32), void *data, uint32 count) {
+  if (parallel_threads_count() == 1 || count <= 1) {
+    running_parallel_task = true;
+    for (uint32 i=0 ; i < count ; i++)
+      task(data, i);
+    running_parallel_task = false;
+    return;
+  }
+
+  PARALLEL_JOB job;
+  job.task = task;
+  job.data = data;
+  job.size = count;
+  job.next = 0;
+  job.completed = 0;
+
+  std::unique_lock<std::mutex> lock(pool->mutex);
+  pool->jobs.push_back(&job);
+  pool->job_available.notify_all();
+
+  run_job_items(lock, &job);
+  while (job.completed < job.size)
+    pool->job_done.wait(lock);
+}
@@ -642,6 +642,27 @@ inline char hex_digit(char ch) {
   return isdigit(ch) ? (ch - '0') : (tolower(ch) - 'a' + 10);
 }
 
+// Reads a character of a string literal, which may be an escape sequence, and moves past it
+static uint16 read_string_char(const char *&text) {
+  char ch = *(text++);
+  if (ch != '\\')
+    return ch;
+
+  ch = *(text++);
+  if (ch == '"' | ch == '\\')
+    return ch;
+  if (ch == 'n')
+    return '\n';
+  if (ch == 't')
+    return '\t';
+
+  char hex3 = hex_digit(ch);
+  char hex2 = hex_digit(*(text++));
+  char hex1 = hex_digit(*(text++));
+  char hex0 = hex_digit(*(text++));
+  return 16 * (16 * (16 * hex3 + hex2) + hex1) + hex0;
+}
+
 void parse_string(TOKEN *token, OBJ *var) {
   const char *text = token->value.string.ptr;
   uint32 length = token->value.string.length;
@@ -651,33 +672,25 @@ void parse_string(TOKEN *token, OBJ *var) {
     return;
   }
 
-  SEQ_OBJ *raw_str = new_seq(length);
-  *var = make_tag_obj(symb_idx_string, make_seq(raw_str, length));
+  // The characters are stored as bytes unless some of them don't fit in one
+  bool fits_in_bytes = true;
+  const char *ptr = text;
+  for (uint32 i=0 ; i < length ; i++)
+    if (read_string_char(ptr) > 0xFF)
+      fits_in_bytes = false;
 
-  OBJ *buffer = raw_str->buffer;
+  PACKED_SEQ_OBJ *raw_str = new_packed_seq(fits_in_bytes ? PACKED_UINT8 : PACKED_UINT16, length);
+  *var = make_tag_obj(symb_idx_string, make_packed_seq(raw_str, length));
 
-  for (uint32 i=0 ; i < length ; i++) {
-    char ch = *(text++);
-    uint16 parsed_char;
-    if (ch == '\\') {
-      ch = *(text++);
-      if (ch == '"' | ch == '\\')
-        parsed_char = ch;
-      else if (ch == 'n')
-        parsed_char = '\n';
-      else if (ch == 't')
-        parsed_char = '\t';
-      else {
-        char hex3 = hex_digit(ch);
-        char hex2 = hex_digit(*(text++));
-        char hex1 = hex_digit(*(text++));
-        char hex0 = hex_digit(*(text++));
-        parsed_char = 16 * (16 * (16 * hex3 + hex2) + hex1) + hex0;
-      }
-    }
-    else
-      parsed_char = ch;
-    buffer[i] = make_int(parsed_char);
+  if (fits_in_bytes) {
+    uint8 *chars = (uint8 *) raw_str->elems;
+    for (uint32 i=0 ; i < length ; i++)
+      chars[i] = read_string_char(text);
+  }
+  else {
+    uint16 *chars = (uint16 *) raw_str->elems;
+    for (uint32 i=0 ; i < length ; i++)
+      chars[i] = read_string_char(text);
   }
 }
 
@@ -11,11 +11,18 @@ bool is_str(uint16 tag_idx, OBJ obj) {
   if (!is_ne_seq(obj))
     return false;
 
-  uint32 len = get_seq_length(obj);
-  OBJ *elems = get_seq_buffer_ptr(obj);
+  // Characters stored as bytes or 16-bit integers are all valid
+  if (get_physical_type(obj) == TYPE_PACKED_SEQ) {
+    uint32 elem_type = get_packed_seq_ptr(obj)->elem_type;
+    if (elem_type == PACKED_UINT8 | elem_type == PACKED_UINT16)
+      return true;
+  }
+
+  SEQ_ITER it;
+  get_seq_iter(it, obj);
 
-  for (uint32 i=0 ; i < len ; i++) {
-    OBJ elem = elems[i];
+  while (!is_out_of_range(it)) {
+    OBJ elem = get_curr_obj(it);
 
     if (!is_int(elem))
       return false;
@@ -23,6 +30,8 @@ bool is_str(uint16 tag_idx, OBJ obj) {
     int64 value = get_int_val(elem);
     if (value < 0 | value >= 65536)
       return false;
+
+    move_forward(it);
   }
 
   return true;
@@ -33,12 +42,11 @@ bool is_record(OBJ obj) {
   if (!is_ne_map(obj))
     return false;
 
-  BIN_REL_OBJ *map = get_bin_rel_ptr(obj);
-  uint32 size = map->size;
-  OBJ *keys = get_left_col_array_ptr(map);
+  BIN_REL_ITER it;
+  get_bin_rel_iter(it, obj);
 
-  for (uint32 i=0 ; i < size ; i++)
-    if (!is_symb(keys[i]))
+  for ( ; !is_out_of_range(it) ; move_forward(it))
+    if (!is_symb(get_curr_left_arg(it)))
       return false;
 
   return true;
@@ -54,11 +62,11 @@ void print_bare_str(OBJ str, void (*emit)(void *, const void *, EMIT_ACTION), vo
   if (is_empty_seq(char_seq))
     return;
 
-  uint32 len = get_seq_length(char_seq);
-  OBJ *chars = get_seq_buffer_ptr(char_seq);
+  SEQ_ITER it;
+  get_seq_iter(it, char_seq);
 
-  for (uint32 i=0 ; i < len ; i++) {
-    int64 ch = get_int_val(chars[i]);
+  for ( ; !is_out_of_range(it) ; move_forward(it)) {
+    int64 ch = get_int_val(get_curr_obj(it));
     assert(ch >= 0 & ch < 65536);
     if (ch >= ' ' & ch <= '~') {
       buffer[0] = '\\';
@@ -115,12 +123,12 @@ void print_seq(OBJ obj, bool print_parentheses, void (*emit)(void *, const void
   if (print_parentheses)
     emit(data, "(", TEXT);
   if (!is_empty_seq(obj)) {
-    uint32 len = get_seq_length(obj);
-    OBJ *elems = get_seq_buffer_ptr(obj);
-    for (uint32 i=0 ; i < len ; i++) {
-      if (i > 0)
+    SEQ_ITER it;
+    get_seq_iter(it, obj);
+    for ( ; !is_out_of_range(it) ; move_forward(it)) {
+      if (it.idx > 0)
         emit(data, ", ", TEXT);
-      print_obj(elems[i], emit, data);
+      print_obj(get_curr_obj(it), emit, data);
     }
   }
   if (print_parentheses)
@@ -147,22 +155,20 @@ void print_set(OBJ obj, void (*emit)(void *, const void *, EMIT_ACTION), void *d
 void print_ne_bin_rel(OBJ obj, void (*emit)(void *, const void *, EMIT_ACTION), void *data) {
   emit(data, "[", TEXT);
 
-  BIN_REL_OBJ *rel = get_bin_rel_ptr(obj);
-  uint32 size = rel->size;
-  OBJ *left_col = get_left_col_array_ptr(rel);
-  OBJ *right_col = get_right_col_array_ptr(rel);
+  BIN_REL_ITER it;
+  get_bin_rel_iter(it, obj);
 
-  for (uint32 i=0 ; i < size ; i++) {
-    if (i > 0)
+  for ( ; !is_out_of_range(it) ; move_forward(it)) {
+    if (it.idx > 0)
       emit(data, "; ", TEXT);
     emit(data, NULL, SUB_START);
-    print_obj(left_col[i], emit, data);
+    print_obj(get_curr_left_arg(it), emit, data);
     emit(data, ", ", TEXT);
-    print_obj(right_col[i], emit, data);
+    print_obj(get_curr_right_arg(it), emit, data);
     emit(data, NULL, SUB_END);
   }
 
-  if (size == 1)
+  if (it.end == 1)
     emit(data, ";", TEXT);
 
   emit(data, "]", TEXT);
@@ -170,20 +176,18 @@ void print_ne_bin_rel(OBJ obj, void (*emit)(void *, const void *, EMIT_ACTION),
 
 
 void print_ne_map(OBJ obj, void (*emit)(void *, const void *, EMIT_ACTION), void *data) {
-  BIN_REL_OBJ *map = get_bin_rel_ptr(obj);
-  uint32 size = map->size;
-  OBJ *keys = get_left_col_array_ptr(map);
-  OBJ *values = get_right_col_array_ptr(map);
+  BIN_REL_ITER it;
+  get_bin_rel_iter(it, obj);
 
   emit(data, "[", TEXT);
 
-  for (uint32 i=0 ; i < size ; i++) {
-    if (i > 0)
+  for ( ; !is_out_of_range(it) ; move_forward(it)) {
+    if (it.idx > 0)
       emit(data, ", ", TEXT);
     emit(data, NULL, SUB_START);
-    print_obj(keys[i], emit, data);
+    print_obj(get_curr_left_arg(it), emit, data);
     emit(data, " -> ", TEXT);
-    print_obj(values[i], emit, data);
+    print_obj(get_curr_right_arg(it), emit, data);
     emit(data, NULL, SUB_END);
   }
 
@@ -195,18 +199,16 @@ void print_record(OBJ obj, bool print_parentheses, void (*emit)(void *, const vo
   if (print_parentheses)
     emit(data, "(", TEXT);
 
-  BIN_REL_OBJ *map = get_bin_rel_ptr(obj);
-  uint32 size = map->size;
-  OBJ *keys = get_left_col_array_ptr(map);
-  OBJ *values = get_right_col_array_ptr(map);
+  BIN_REL_ITER it;
+  get_bin_rel_iter(it, obj);
 
-  for (uint32 i=0 ; i < size ; i++) {
-    if (i > 0)
+  for ( ; !is_out_of_range(it) ; move_forward(it)) {
+    if (it.idx > 0)
       emit(data, ", ", TEXT);
     emit(data, NULL, SUB_START);
-    print_symb(keys[i], emit, data);
+    print_symb(get_curr_left_arg(it), emit, data);
     emit(data, ": ", TEXT);
-    print_obj(values[i], emit, data);
+    print_obj(get_curr_right_arg(it), emit, data);
     emit(data, NULL, SUB_END);
   }
 
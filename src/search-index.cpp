@@ -0,0 +1,186 @@
+#include "lib.h"
+
+
+// Large sorted arrays of inline objects that are searched often, like the elements of a
+// set or the keys of a map, get a secondary search index the first time they have been
+// searched enough times to pay for it. The index stores the objects as 64-bit keys (see
+// get_sort_key_field() in sorting.cpp) in Eytzinger order, that is, laid out like the
+// nodes of a binary heap, so that the top levels of the search tree share a few cache
+// lines and the next ones can be prefetched, and it's searched without branching on the
+// result of the comparisons. The index of an object is released together with the object.
+//
+// Before the index is built, the pointer to it is used to count the lookups instead, with
+// the lowest bit set to tell the two apart. Arrays that cannot be indexed, because they
+// contain objects that are not inline or because both fields vary, point to a sentinel.
+// Indexes are only built in normal state: objects that live in try memory are discarded
+// without being released, and an index allocated in try state would not survive it.
+// Nor are they built, or lookups counted, inside the tasks of parallel_for(), which
+// may be searching the same array at the same time: those only use existing indexes
+
+// Arrays shorter than this are always searched directly
+const uint32 SEARCH_INDEX_MIN_SIZE = 1024;
+
+// The index is built after len / SEARCH_INDEX_LOOKUPS_RATIO lookups
+const uint32 SEARCH_INDEX_LOOKUPS_RATIO = 64;
+
+const uint64 SIGN_BIT_MASK = 1ULL << 63;
+
+
+struct SEARCH_INDEX {
+  uint32 size;
+  SORT_KEY_FIELD field;
+  uint64 *keys;     // In Eytzinger order, starting at 1
+  uint32 *ranks;    // Position in the original array of the corresponding key
+};
+
+static SEARCH_INDEX unindexable_array;
+
+////////////////////////////////////////////////////////////////////////////////
+
+inline bool is_lookup_count(SEARCH_INDEX *index) {
+  return ((uint64) index) & 1;
+}
+
+inline uint64 get_lookup_count(SEARCH_INDEX *index) {
+  return index != NULL ? ((uint64) index) >> 1 : 0;
+}
+
+inline SEARCH_INDEX *lookup_count_marker(uint64 count) {
+  return (SEARCH_INDEX *) ((count << 1) | 1);
+}
+
+inline uint64 search_key(OBJ obj, SORT_KEY_FIELD field) {
+  return field.core_data ? obj.core_data.int_ ^ SIGN_BIT_MASK : obj.extra_data;
+}
+
+// Returns false if the object is not comparable with the keys in the index,
+// which means it's not in the indexed array either
+inline bool get_search_key(OBJ obj, SORT_KEY_FIELD field, uint64 &key) {
+  if (!is_inline_obj(obj))
+    return false;
+  if (field.core_data ? obj.extra_data != field.fixed : (uint64) obj.core_data.int_ != field.fixed)
+    return false;
+  key = search_key(obj, field);
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Fills the subtree rooted at node <node> with the objects starting at <rank>,
+// and returns the rank of the first object that was not used
+static uint32 eytzinger_fill(SEARCH_INDEX *index, OBJ *objs, uint32 rank, uint64 node) {
+  if (node <= index->size) {
+    rank = eytzinger_fill(index, objs, rank, 2 * node);
+    index->keys[node] = search_key(objs[rank], index->field);
+    index->ranks[node] = rank;
+    rank = eytzinger_fill(index, objs, rank + 1, 2 * node + 1);
+  }
+  return rank;
+}
+
+static SEARCH_INDEX *build_search_index(OBJ *objs, uint32 len) {
+  SORT_KEY_FIELD field;
+  if (!get_sort_key_field(objs, len, field))
+    return &unindexable_array;
+
+  uint64 count = (uint64) len + 1;
+  SEARCH_INDEX *index = (SEARCH_INDEX *) malloc(sizeof(SEARCH_INDEX) + count * (sizeof(uint64) + sizeof(uint32)));
+  index->size = len;
+  index->field = field;
+  index->keys = (uint64 *) (index + 1);
+  index->ranks = (uint32 *) (index->keys + count);
+
+  uint32 used = eytzinger_fill(index, objs, 0, 1);
+  assert(used == len);
+
+  return index;
+}
+
+// Returns the index of the array, or NULL if there's none (yet)
+static SEARCH_INDEX *get_search_index(OBJ *objs, uint32 len, SEARCH_INDEX **index_ptr) {
+  if (len < SEARCH_INDEX_MIN_SIZE)
+    return NULL;
+
+  SEARCH_INDEX *index = *index_ptr;
+  if (index == NULL || is_lookup_count(index)) {
+    if (is_in_parallel_task())
+      return NULL;
+    uint64 count = get_lookup_count(index) + 1;
+    if (count < len / SEARCH_INDEX_LOOKUPS_RATIO || !is_in_normal_state()) {
+      *index_ptr = lookup_count_marker(count);
+      return NULL;
+    }
+    index = build_search_index(objs, len);
+    *index_ptr = index;
+  }
+
+  return index != &unindexable_array ? index : NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Returns the node of the first key that is greater than or equal to <key>, or 0 if there's none
+static uint64 lower_bound_node(SEARCH_INDEX *index, uint64 key) {
+  uint64 *keys = index->keys;
+  uint64 size = index->size;
+
+  uint64 node = 1;
+  while (node <= size) {
+    // Nodes three levels below the current one are stored contiguously
+    __builtin_prefetch(keys + 8 * node);
+    node = 2 * node + (keys[node] < key);
+  }
+
+  // Removing the trailing right turns, and the last left turn before them
+  return node >> (__builtin_ctzll(~node) + 1);
+}
+
+static uint32 lower_bound_rank(SEARCH_INDEX *index, uint64 key) {
+  uint64 node = lower_bound_node(index, key);
+  return node != 0 ? index->ranks[node] : index->size;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+uint32 find_obj(OBJ *sorted_array, uint32 len, OBJ obj, bool &found, SEARCH_INDEX **index_ptr) {
+  SEARCH_INDEX *index = get_search_index(sorted_array, len, index_ptr);
+  if (index == NULL)
+    return find_obj(sorted_array, len, obj, found);
+
+  uint64 key;
+  if (get_search_key(obj, index->field, key)) {
+    uint64 node = lower_bound_node(index, key);
+    if (node != 0 && index->keys[node] == key) {
+      found = true;
+      return index->ranks[node];
+    }
+  }
+
+  found = false;
+  return -1;
+}
+
+uint32 find_objs_range(OBJ *sorted_array, uint32 len, OBJ obj, uint32 &count, SEARCH_INDEX **index_ptr) {
+  SEARCH_INDEX *index = get_search_index(sorted_array, len, index_ptr);
+  if (index == NULL)
+    return find_objs_range(sorted_array, len, obj, count);
+
+  uint64 key;
+  if (get_search_key(obj, index->field, key)) {
+    uint64 node = lower_bound_node(index, key);
+    if (node != 0 && index->keys[node] == key) {
+      uint32 first = index->ranks[node];
+      uint32 end = key != 0xFFFFFFFFFFFFFFFFULL ? lower_bound_rank(index, key + 1) : len;
+      count = end - first;
+      return first;
+    }
+  }
+
+  count = 0;
+  return INVALID_INDEX;
+}
+
+void release_search_index(SEARCH_INDEX *index) {
+  if (index != NULL && !is_lookup_count(index) && index != &unindexable_array)
+    free(index);
+}
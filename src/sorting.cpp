@@ -1,6 +1,20 @@
 #include "lib.h"
 
 
+struct obj_less {
+  bool operator () (OBJ obj1, OBJ obj2) {
+    return comp_objs(obj1, obj2) > 0;
+  }
+};
+
+struct obj_inline_less {
+  bool operator () (OBJ obj1, OBJ obj2) {
+    return shallow_cmp(obj1, obj2) > 0;
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
 struct obj_idx_less {
   OBJ *objs;
   obj_idx_less(OBJ *objs) : objs(objs) {}
@@ -60,30 +74,280 @@ struct obj_triple_idx_less {
 ////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
 
+// Arrays shorter than this are always sorted by the calling thread alone
+const uint32 PARALLEL_SORT_MIN_SIZE = 1 << 16;
+
+// Parallel merge sort: the array is split into a power-of-two number of runs, which
+// are sorted independently, and then merged pairwise, back and forth between the array
+// and a temporary buffer. When there are fewer pairs left than threads, each merge is
+// split into independent parts, using binary search to find where each part starts
+template <typename T, typename LESS> struct PARALLEL_SORT {
+  T *src, *dest;
+  uint32 count;
+  uint32 runs;
+  uint32 width;   // Length of the runs being merged, in initial runs
+  uint32 parts;   // Parts each merge is split into
+  LESS less;
+
+  PARALLEL_SORT(LESS less) : less(less) {}
+
+  uint32 run_start(uint32 run) {
+    return run < runs ? (uint64) run * count / runs : count;
+  }
+};
+
+template <typename T, typename LESS> static void sort_run(void *data, uint32 idx) {
+  PARALLEL_SORT<T, LESS> *sort = (PARALLEL_SORT<T, LESS> *) data;
+  std::sort(sort->src + sort->run_start(idx), sort->src + sort->run_start(idx + 1), sort->less);
+}
+
+template <typename T, typename LESS> static void merge_runs(void *data, uint32 idx) {
+  PARALLEL_SORT<T, LESS> *sort = (PARALLEL_SORT<T, LESS> *) data;
+  uint32 parts = sort->parts;
+  uint32 pair = idx / parts;
+  uint32 part = idx % parts;
+
+  uint32 start = sort->run_start(2 * pair * sort->width);
+  uint32 middle = sort->run_start((2 * pair + 1) * sort->width);
+  uint32 end = sort->run_start((2 * pair + 2) * sort->width);
+
+  T *left = sort->src + start;
+  T *right = sort->src + middle;
+  uint32 left_len = middle - start;
+  uint32 right_len = end - middle;
+
+  // Elements of the left run come first among equal ones, as in std::merge()
+  uint32 left_from = (uint64) part * left_len / parts;
+  uint32 left_to = (uint64) (part + 1) * left_len / parts;
+  uint32 right_from = part == 0 ? 0 : std::lower_bound(right, right + right_len, left[left_from], sort->less) - right;
+  uint32 right_to = part == parts - 1 ? right_len : std::lower_bound(right, right + right_len, left[left_to], sort->less) - right;
+
+  std::merge(
+    left + left_from, left + left_to, right + right_from, right + right_to,
+    sort->dest + start + left_from + right_from, sort->less
+  );
+}
+
+template <typename T, typename LESS> void parallel_sort(T *array, uint32 count, LESS less) {
+  uint32 threads = count >= PARALLEL_SORT_MIN_SIZE ? parallel_threads_count() : 1;
+  if (threads == 1) {
+    std::sort(array, array + count, less);
+    return;
+  }
+
+  PARALLEL_SORT<T, LESS> sort(less);
+  sort.count = count;
+  sort.runs = 1;
+  while (sort.runs < threads)
+    sort.runs *= 2;
+
+  sort.src = array;
+  parallel_for(sort_run<T, LESS>, &sort, sort.runs);
+
+  T *buffer = (T *) new_obj(count * sizeof(T));
+  sort.dest = buffer;
+  for (sort.width = 1 ; sort.width < sort.runs ; sort.width *= 2) {
+    uint32 pairs = sort.runs / (2 * sort.width);
+    sort.parts = (threads + pairs - 1) / pairs;
+    parallel_for(merge_runs<T, LESS>, &sort, pairs * sort.parts);
+    std::swap(sort.src, sort.dest);
+  }
+
+  if (sort.src != array)
+    memcpy(array, sort.src, count * sizeof(T));
+  free_obj(buffer, count * sizeof(T));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+// Inline objects are ordered by their extra data first, as an unsigned integer, and
+// then by their core data, as a signed one. In an array of inline objects where one
+// of the two fields has the same value for all elements, as is the case for arrays
+// of integers, floats or symbols, the other one can be turned into an unsigned 64-bit
+// key that preserves the ordering, and the array can be radix sorted using those keys
+
+// Arrays shorter than this are always sorted by comparison
+const uint32 RADIX_SORT_MIN_SIZE = 256;
+
+const uint64 SIGN_BIT_MASK = 1ULL << 63;
+
+
+struct KEY_IDX {
+  uint64 key;
+  uint32 idx;
+};
+
+
+bool get_sort_key_field(OBJ *objs, uint32 count, SORT_KEY_FIELD &field) {
+  uint64 extra_data = objs[0].extra_data;
+  uint64 core_data = objs[0].core_data.int_;
+  bool same_extra_data = true;
+  bool same_core_data = true;
+  for (uint32 i=0 ; i < count ; i++) {
+    OBJ obj = objs[i];
+    if (!is_inline_obj(obj))
+      return false;
+    same_extra_data &= obj.extra_data == extra_data;
+    same_core_data &= (uint64) obj.core_data.int_ == core_data;
+  }
+  if (!same_extra_data && !same_core_data)
+    return false;
+  field.core_data = same_extra_data;
+  field.fixed = same_extra_data ? extra_data : core_data;
+  return true;
+}
+
+inline uint64 sort_key(OBJ obj, SORT_KEY_FIELD field) {
+  return field.core_data ? obj.core_data.int_ ^ SIGN_BIT_MASK : obj.extra_data;
+}
+
+inline OBJ key_to_obj(uint64 key, SORT_KEY_FIELD field) {
+  OBJ obj;
+  if (field.core_data) {
+    obj.core_data.int_ = key ^ SIGN_BIT_MASK;
+    obj.extra_data = field.fixed;
+  }
+  else {
+    obj.core_data.int_ = field.fixed;
+    obj.extra_data = key;
+  }
+  return obj;
+}
+
+inline uint64 radix_key(uint64 key) {
+  return key;
+}
+
+inline uint64 radix_key(const KEY_IDX &entry) {
+  return entry.key;
+}
+
+// Stable LSD radix sort, one byte at a time. Bytes that are the same for all keys
+// are skipped, so small integers only take a couple of passes. Returns a pointer to
+// the sorted data, which can be either <array> or <buffer>
+template <typename T> static T *radix_sort(T *array, T *buffer, uint32 count) {
+  uint32 counters[8][256];
+  memset(counters, 0, sizeof(counters));
+  for (uint32 i=0 ; i < count ; i++) {
+    uint64 key = radix_key(array[i]);
+    for (uint32 j=0 ; j < 8 ; j++)
+      counters[j][(key >> (8 * j)) & 0xFF]++;
+  }
+
+  T *src = array;
+  T *dest = buffer;
+  for (uint32 j=0 ; j < 8 ; j++) {
+    uint32 *byte_counters = counters[j];
+    if (byte_counters[(radix_key(src[0]) >> (8 * j)) & 0xFF] == count)
+      continue;
+
+    uint32 offset = 0;
+    for (uint32 b=0 ; b < 256 ; b++) {
+      uint32 byte_count = byte_counters[b];
+      byte_counters[b] = offset;
+      offset += byte_count;
+    }
+
+    for (uint32 i=0 ; i < count ; i++) {
+      T elem = src[i];
+      dest[byte_counters[(radix_key(elem) >> (8 * j)) & 0xFF]++] = elem;
+    }
+
+    std::swap(src, dest);
+  }
+  return src;
+}
+
+// Fills <index> with the indexes of the rows of <cols> sorted by column 0, column 1 and
+// so on, and then by index, but only if all columns can be radix sorted. The columns are
+// sorted from the least significant to the most one, starting from the identity
+// permutation, so that the stability of the sort takes care of breaking ties
+static bool radix_index_sort(uint32 *index, OBJ **cols, uint32 cols_count, uint32 count) {
+  if (count < RADIX_SORT_MIN_SIZE)
+    return false;
+
+  SORT_KEY_FIELD fields[3];
+  assert(cols_count <= 3);
+  for (uint32 i=0 ; i < cols_count ; i++)
+    if (!get_sort_key_field(cols[i], count, fields[i]))
+      return false;
+
+  KEY_IDX *entries = (KEY_IDX *) new_obj(count * sizeof(KEY_IDX));
+  KEY_IDX *buffer = (KEY_IDX *) new_obj(count * sizeof(KEY_IDX));
+  KEY_IDX *sorted = NULL;
+  for (int32 c=cols_count-1 ; c >= 0 ; c--) {
+    OBJ *col = cols[c];
+    SORT_KEY_FIELD field = fields[c];
+    KEY_IDX *dest = sorted == buffer ? entries : buffer;
+    for (uint32 i=0 ; i < count ; i++) {
+      uint32 idx = sorted != NULL ? sorted[i].idx : i;
+      dest[i].key = sort_key(col[idx], field);
+      dest[i].idx = idx;
+    }
+    sorted = radix_sort(dest, dest == buffer ? entries : buffer, count);
+  }
+
+  for (uint32 i=0 ; i < count ; i++)
+    index[i] = sorted[i].idx;
+
+  free_obj(entries, count * sizeof(KEY_IDX));
+  free_obj(buffer, count * sizeof(KEY_IDX));
+  return true;
+}
+
+static bool radix_sort_objs(OBJ *objs, uint32 count) {
+  SORT_KEY_FIELD field;
+  if (count < RADIX_SORT_MIN_SIZE || !get_sort_key_field(objs, count, field))
+    return false;
+
+  uint64 *keys = (uint64 *) new_obj(2 * count * sizeof(uint64));
+  for (uint32 i=0 ; i < count ; i++)
+    keys[i] = sort_key(objs[i], field);
+  uint64 *sorted = radix_sort(keys, keys + count, count);
+  for (uint32 i=0 ; i < count ; i++)
+    objs[i] = key_to_obj(sorted[i], field);
+  free_obj(keys, 2 * count * sizeof(uint64));
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
 void stable_index_sort(uint32 *index, OBJ *values, uint32 count) {
+  if (radix_index_sort(index, &values, 1, count))
+    return;
   for (uint32 i=0 ; i < count ; i++)
     index[i] = i;
-  std::sort(index, index+count, obj_idx_less_no_eq(values));
+  parallel_sort(index, count, obj_idx_less_no_eq(values));
 }
 
 void stable_index_sort(uint32 *index, OBJ *major_sort, OBJ *minor_sort, uint32 count) {
+  OBJ *cols[2] = {major_sort, minor_sort};
+  if (radix_index_sort(index, cols, 2, count))
+    return;
   for (uint32 i=0 ; i < count ; i++)
     index[i] = i;
-  std::sort(index, index+count, obj_pair_idx_less(major_sort, minor_sort));
+  parallel_sort(index, count, obj_pair_idx_less(major_sort, minor_sort));
 }
 
 void stable_index_sort(uint32 *index, OBJ *major_sort, OBJ *middle_sort, OBJ *minor_sort, uint32 count) {
+  OBJ *cols[3] = {major_sort, middle_sort, minor_sort};
+  if (radix_index_sort(index, cols, 3, count))
+    return;
   for (uint32 i=0 ; i < count ; i++)
     index[i] = i;
-  std::sort(index, index+count, obj_triple_idx_less(major_sort, middle_sort, minor_sort));
+  parallel_sort(index, count, obj_triple_idx_less(major_sort, middle_sort, minor_sort));
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
 void index_sort(uint32 *index, OBJ *values, uint32 count) {
+  if (radix_index_sort(index, &values, 1, count))
+    return;
   for (uint32 i=0 ; i < count ; i++)
     index[i] = i;
-  std::sort(index, index+count, obj_idx_less(values));
+  parallel_sort(index, count, obj_idx_less(values));
 }
 
 void index_sort(uint32 *index, OBJ *major_sort, OBJ *minor_sort, uint32 count) {
@@ -93,3 +357,17 @@ void index_sort(uint32 *index, OBJ *major_sort, OBJ *minor_sort, uint32 count) {
 void index_sort(uint32 *index, OBJ *major_sort, OBJ *middle_sort, OBJ *minor_sort, uint32 count) {
   stable_index_sort(index, major_sort, middle_sort, minor_sort, count);
 }
+
+////////////////////////////////////////////////////////////////////////////////
+
+void sort_obj_array(OBJ *objs, uint32 len) {
+  if (radix_sort_objs(objs, len))
+    return;
+  parallel_sort(objs, len, obj_less());
+}
+
+void sort_inline_obj_array(OBJ *objs, uint32 len) {
+  if (radix_sort_objs(objs, len))
+    return;
+  parallel_sort(objs, len, obj_inline_less());
+}
@@ -14,7 +14,17 @@ inline uint32 right(uint64 pair) {
   return pair;
 }
 
+// Sorting is skipped if the vector is already sorted and free of duplicates, which
+// is the case when it has already been through sort_unique(), for example
+// in one of the *_updates_check_*() functions, or when its content was
+// obtained by iterating through a table
 template <typename T> void sort_unique(std::vector<T> &xs) {
+  uint32 count = xs.size();
+  uint32 i = 1;
+  while (i < count && xs[i-1] < xs[i])
+    i++;
+  if (i >= count)
+    return;
   std::sort(xs.begin(), xs.end());
   xs.erase(std::unique(xs.begin(), xs.end()), xs.end());
 }
@@ -24,6 +34,9 @@ struct col_0 {
   static uint32 key(uint64 tuple) {
     return left(tuple);
   }
+  static uint32 key(const tuple3 &tuple) {
+    return left(tuple.fields01);
+  }
   static uint32 key_shifted(uint64 unshifted_tuple) {
     return left(unshifted_tuple);
   }
@@ -39,6 +52,9 @@ struct col_1 {
   static uint32 key(uint64 tuple) {
     return right(tuple);
   }
+  static uint32 key(const tuple3 &tuple) {
+    return right(tuple.fields01);
+  }
   static uint32 key_shifted(uint64 flipped_tuple) {
     return left(flipped_tuple);
   }
@@ -126,6 +142,335 @@ struct col_2 {
 
 ////////////////////////////////////////////////////////////////////////////////
 
+const uint32 INDEX_BLOCK_MAX_SIZE   = 1024;
+const uint32 INDEX_BLOCK_SPLIT_SIZE = 768;  // Target size of the blocks created by a split
+const uint32 INDEX_BLOCK_MERGE_SIZE = 256;  // Blocks smaller than this are merged with a neighbour
+
+// Blocks grow in steps of 64 elements, so that they don't waste much more
+// than that whatever their fill level. Small blocks are sized to a power of 2
+inline uint32 index_block_capacity(uint32 size) {
+  if (size > 64)
+    return (size + 63) & ~63U;
+  uint32 capacity = 4;
+  while (capacity < size)
+    capacity *= 2;
+  return capacity;
+}
+
+template <typename T> void index_init(SORTED_INDEX<T> &index) {
+  index.blocks = NULL;
+  index.blocks_count = 0;
+  index.capacity = 0;
+  index.count = 0;
+}
+
+template <typename T> void index_cleanup(SORTED_INDEX<T> &index) {
+  uint32 blocks_count = index.blocks_count;
+  for (uint32 i=0 ; i < blocks_count ; i++)
+    free(index.blocks[i].elems);
+  free(index.blocks);
+  index_init(index);
+}
+
+// Returns the index of the last block, starting from <first_block>, whose first
+// element is not greater than <key>, or <first_block> if there's no such block
+template <typename T> uint32 index_find_block(SORTED_INDEX<T> &index, const T &key, uint32 first_block) {
+  assert(first_block < index.blocks_count);
+  INDEX_BLOCK<T> *blocks = index.blocks;
+  uint32 low = first_block;
+  uint32 high = index.blocks_count;
+  while (high - low > 1) {
+    uint32 middle = (low + high) / 2;
+    if (key < blocks[middle].first)
+      high = middle;
+    else
+      low = middle;
+  }
+  return low;
+}
+
+template <typename T> bool index_contains(SORTED_INDEX<T> &index, const T &key) {
+  if (index.count == 0)
+    return false;
+  INDEX_BLOCK<T> &block = index.blocks[index_find_block(index, key, 0)];
+  return std::binary_search(block.elems, block.elems + block.size, key);
+}
+
+// Returns in <block_idx> and <offset> the position of the first element that is not lower
+// than <key>. If there's no such element, <block_idx> is set to the number of blocks
+template <typename T> void index_lower_bound(SORTED_INDEX<T> &index, const T &key, uint32 &block_idx, uint32 &offset) {
+  if (index.count == 0) {
+    block_idx = 0;
+    offset = 0;
+    return;
+  }
+  uint32 idx = index_find_block(index, key, 0);
+  INDEX_BLOCK<T> &block = index.blocks[idx];
+  uint32 off = std::lower_bound(block.elems, block.elems + block.size, key) - block.elems;
+  if (off == block.size) {
+    idx++;
+    off = 0;
+  }
+  block_idx = idx;
+  offset = off;
+}
+
+// Opens a gap of <count> uninitialized blocks at position <idx>
+template <typename T> void index_insert_blocks(SORTED_INDEX<T> &index, uint32 idx, uint32 count) {
+  uint32 blocks_count = index.blocks_count;
+  uint32 min_capacity = blocks_count + count;
+  if (min_capacity > index.capacity) {
+    uint32 new_capacity = index.capacity > 0 ? 2 * index.capacity : 4;
+    while (new_capacity < min_capacity)
+      new_capacity *= 2;
+    index.blocks = (INDEX_BLOCK<T> *) realloc(index.blocks, new_capacity * sizeof(INDEX_BLOCK<T>));
+    index.capacity = new_capacity;
+  }
+  INDEX_BLOCK<T> *blocks = index.blocks;
+  memmove(blocks + idx + count, blocks + idx, (blocks_count - idx) * sizeof(INDEX_BLOCK<T>));
+  index.blocks_count = min_capacity;
+}
+
+// Stores the <size> sorted elements of <elems> in the block at position <idx>, splitting
+// them across several new blocks if there are too many of them. <elems> must have been
+// allocated with malloc(), and the index takes ownership of it. Returns the number of blocks used
+template <typename T> uint32 index_set_block(SORTED_INDEX<T> &index, uint32 idx, T *elems, uint32 size, uint32 capacity) {
+  assert(size > 0);
+
+  if (size <= INDEX_BLOCK_MAX_SIZE) {
+    uint32 min_capacity = index_block_capacity(size);
+    if (capacity > min_capacity) {
+      elems = (T *) realloc(elems, min_capacity * sizeof(T));
+      capacity = min_capacity;
+    }
+    INDEX_BLOCK<T> &block = index.blocks[idx];
+    block.first = elems[0];
+    block.elems = elems;
+    block.size = size;
+    block.capacity = capacity;
+    return 1;
+  }
+
+  uint32 pieces = (size + INDEX_BLOCK_SPLIT_SIZE - 1) / INDEX_BLOCK_SPLIT_SIZE;
+  index_insert_blocks(index, idx + 1, pieces - 1);
+
+  uint32 offset = 0;
+  for (uint32 i=0 ; i < pieces ; i++) {
+    uint32 piece_size = (size - offset) / (pieces - i);
+    uint32 piece_capacity = index_block_capacity(piece_size);
+    T *piece = (T *) malloc(piece_capacity * sizeof(T));
+    memcpy(piece, elems + offset, piece_size * sizeof(T));
+    INDEX_BLOCK<T> &block = index.blocks[idx + i];
+    block.first = piece[0];
+    block.elems = piece;
+    block.size = piece_size;
+    block.capacity = piece_capacity;
+    offset += piece_size;
+  }
+  assert(offset == size);
+
+  free(elems);
+  return pieces;
+}
+
+// Inserts the sorted, duplicate-free elements of <elems> into the index, with a single merge pass
+// over each block that is affected. On exit <elems> contains, in order, only the elements
+// that were not already in the index, and their number is returned
+template <typename T> uint32 index_insert(SORTED_INDEX<T> &index, T *elems, uint32 count) {
+  if (count == 0)
+    return 0;
+
+  if (index.blocks_count == 0) {
+    T *block_elems = (T *) malloc(count * sizeof(T));
+    memcpy(block_elems, elems, count * sizeof(T));
+    index_insert_blocks(index, 0, 1);
+    index_set_block(index, 0, block_elems, count, count);
+    index.count = count;
+    return count;
+  }
+
+  uint32 inserted = 0;
+  uint32 block_idx = 0;
+  for (uint32 i=0 ; i < count ; ) {
+    block_idx = index_find_block(index, elems[i], block_idx);
+
+    // The elements that go into the current block are those
+    // that are lower than the first element of the next one
+    uint32 end = count;
+    if (block_idx + 1 < index.blocks_count)
+      end = std::lower_bound(elems + i, elems + count, index.blocks[block_idx + 1].first) - elems;
+    assert(end > i);
+
+    INDEX_BLOCK<T> block = index.blocks[block_idx];
+    uint32 max_size = block.size + end - i;
+    uint32 capacity = max_size <= INDEX_BLOCK_MAX_SIZE ? index_block_capacity(max_size) : max_size;
+    T *merged = (T *) malloc(capacity * sizeof(T));
+
+    // Since at most one element is stored back into <elems> for each one that is consumed,
+    // <inserted> can never overtake <i>, and the elements still to be read are never overwritten
+    uint32 size = 0;
+    uint32 j = 0;
+    while (j < block.size & i < end) {
+      T block_elem = block.elems[j];
+      T elem = elems[i];
+      if (block_elem < elem) {
+        merged[size++] = block_elem;
+        j++;
+      }
+      else if (elem < block_elem) {
+        merged[size++] = elem;
+        elems[inserted++] = elem;
+        i++;
+      }
+      else {
+        merged[size++] = block_elem;
+        j++;
+        i++;
+      }
+    }
+    while (j < block.size)
+      merged[size++] = block.elems[j++];
+    while (i < end) {
+      T elem = elems[i++];
+      merged[size++] = elem;
+      elems[inserted++] = elem;
+    }
+
+    free(block.elems);
+    block_idx += index_set_block(index, block_idx, merged, size, capacity);
+    if (block_idx == index.blocks_count)
+      block_idx--;
+  }
+
+  index.count += inserted;
+  return inserted;
+}
+
+// Merges adjacent blocks when at least one of them has shrunk below INDEX_BLOCK_MERGE_SIZE
+template <typename T> void index_merge_small_blocks(SORTED_INDEX<T> &index) {
+  uint32 blocks_count = index.blocks_count;
+  if (blocks_count < 2)
+    return;
+
+  INDEX_BLOCK<T> *blocks = index.blocks;
+  uint32 last_idx = 0;
+  for (uint32 i=1 ; i < blocks_count ; i++) {
+    INDEX_BLOCK<T> &last = blocks[last_idx];
+    INDEX_BLOCK<T> &curr = blocks[i];
+    uint32 size = last.size + curr.size;
+    if ((last.size < INDEX_BLOCK_MERGE_SIZE | curr.size < INDEX_BLOCK_MERGE_SIZE) & size <= INDEX_BLOCK_SPLIT_SIZE) {
+      if (size > last.capacity) {
+        uint32 capacity = index_block_capacity(size);
+        last.elems = (T *) realloc(last.elems, capacity * sizeof(T));
+        last.capacity = capacity;
+      }
+      memcpy(last.elems + last.size, curr.elems, curr.size * sizeof(T));
+      last.size = size;
+      free(curr.elems);
+    }
+    else
+      blocks[++last_idx] = curr;
+  }
+  index.blocks_count = last_idx + 1;
+}
+
+// Removes the sorted, duplicate-free elements of <elems> from the index, with a single pass
+// over each block that is affected. On exit <elems> contains, in order, only the elements
+// that were actually found in the index, and their number is returned
+template <typename T> uint32 index_remove(SORTED_INDEX<T> &index, T *elems, uint32 count) {
+  uint32 removed = 0;
+  uint32 block_idx = 0;
+  for (uint32 i=0 ; i < count & block_idx < index.blocks_count ; ) {
+    block_idx = index_find_block(index, elems[i], block_idx);
+
+    uint32 end = count;
+    if (block_idx + 1 < index.blocks_count)
+      end = std::lower_bound(elems + i, elems + count, index.blocks[block_idx + 1].first) - elems;
+    assert(end > i);
+
+    INDEX_BLOCK<T> &block = index.blocks[block_idx];
+    T *block_elems = block.elems;
+    uint32 block_size = block.size;
+
+    uint32 size = 0;
+    uint32 j = 0;
+    while (j < block_size & i < end) {
+      T block_elem = block_elems[j];
+      T elem = elems[i];
+      if (block_elem < elem) {
+        block_elems[size++] = block_elem;
+        j++;
+      }
+      else if (elem < block_elem) {
+        i++;
+      }
+      else {
+        elems[removed++] = elem;
+        j++;
+        i++;
+      }
+    }
+    while (j < block_size)
+      block_elems[size++] = block_elems[j++];
+    i = end;
+
+    if (size == 0) {
+      free(block_elems);
+      uint32 blocks_count = index.blocks_count;
+      INDEX_BLOCK<T> *blocks = index.blocks;
+      memmove(blocks + block_idx, blocks + block_idx + 1, (blocks_count - block_idx - 1) * sizeof(INDEX_BLOCK<T>));
+      index.blocks_count = blocks_count - 1;
+    }
+    else {
+      block.first = block_elems[0];
+      block.size = size;
+      uint32 capacity = index_block_capacity(size);
+      if (capacity < block.capacity) {
+        block.elems = (T *) realloc(block_elems, capacity * sizeof(T));
+        block.capacity = capacity;
+      }
+      block_idx++;
+    }
+
+    if (block_idx == index.blocks_count)
+      break;
+  }
+
+  index.count -= removed;
+  if (removed > 0)
+    index_merge_small_blocks(index);
+  return removed;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Adds or removes one reference to the value in column K of each tuple, with a single
+// update for each run of consecutive tuples with the same value in that column.
+// When the tuples are sorted by column K there's exactly one update for each value
+template <typename K, typename T> void value_store_add_refs(VALUE_STORE *store, const T *tuples, uint32 count) {
+  for (uint32 i=0 ; i < count ; ) {
+    uint32 surr = K::key(tuples[i]);
+    uint32 j = i + 1;
+    while (j < count && K::key(tuples[j]) == surr)
+      j++;
+    value_store_add_refs(store, surr, j - i);
+    i = j;
+  }
+}
+
+template <typename K, typename T> void value_store_release_refs(VALUE_STORE *store, const T *tuples, uint32 count) {
+  for (uint32 i=0 ; i < count ; ) {
+    uint32 surr = K::key(tuples[i]);
+    uint32 j = i + 1;
+    while (j < count && K::key(tuples[j]) == surr)
+      j++;
+    value_store_release_refs(store, surr, j - i);
+    i = j;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
 template <typename K, typename T> void take_keys(std::vector<typename K::key_type> &keys, const std::vector<T> &tuples) {
   uint32 count = tuples.size();
   keys.resize(count);
@@ -149,14 +494,15 @@ template <typename T> bool sorted_vector_has_duplicates(std::vector<T> &xs) {
 }
 
 template <typename K, typename T>
-bool update_has_conflicts(std::vector<typename K::key_type> &inserted_keys, std::vector<typename K::key_type> &deleted_keys, std::set<T> &target) {
+bool update_has_conflicts(std::vector<typename K::key_type> &inserted_keys, std::vector<typename K::key_type> &deleted_keys, SORTED_INDEX<T> &target) {
   int count = inserted_keys.size();
   for (int i=0 ; i < count ; i++) {
     typename K::key_type key = inserted_keys[i];
     if (!binary_search(deleted_keys.begin(), deleted_keys.end(), key)) {
       T lb = K::lower_bound(key);
-      typename std::set<T>::iterator it = target.lower_bound(lb);
-      if (it != target.end() && K::key_shifted(*it) == key)
+      uint32 block_idx, offset;
+      index_lower_bound(target, lb, block_idx, offset);
+      if (block_idx < target.blocks_count && K::key_shifted(target.blocks[block_idx].elems[offset]) == key)
         return true;
     }
   }
@@ -166,7 +512,7 @@ bool update_has_conflicts(std::vector<typename K::key_type> &inserted_keys, std:
 ////////////////////////////////////////////////////////////////////////////////
 
 template <typename K, typename T>
-bool table_updates_check_key(const std::vector<T> &inserts, const std::vector<T> &deletes, std::set<T> &target) {
+bool table_updates_check_key(const std::vector<T> &inserts, const std::vector<T> &deletes, SORTED_INDEX<T> &target) {
   // Gathering and sorting all keys from tuples to delete
   std::vector<typename K::key_type> deleted_keys;
   take_keys<K>(deleted_keys, deletes);
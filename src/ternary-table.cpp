@@ -3,11 +3,74 @@
 
 
 void ternary_table_init(TERNARY_TABLE *table) {
-
+  index_init(table->unshifted);
+  index_init(table->shifted_once);
+  index_init(table->shifted_twice);
+  table->shifted_once_built = false;
+  table->shifted_twice_built = false;
 }
 
 void ternary_table_cleanup(TERNARY_TABLE *table) {
+  index_cleanup(table->unshifted);
+  index_cleanup(table->shifted_once);
+  index_cleanup(table->shifted_twice);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Copies <count> tuples from <src> to <dest>, rotating each of them <shifts> times, and sorts the result
+static void sorted_shifted(const tuple3 *src, uint32 count, int shifts, std::vector<tuple3> &dest) {
+  dest.resize(count);
+  for (uint32 i=0 ; i < count ; i++) {
+    tuple3 entry = src[i];
+    shift(entry);
+    if (shifts == 2)
+      shift(entry);
+    dest[i] = entry;
+  }
+  std::sort(dest.begin(), dest.end());
+}
+
+static void build_shifted_index(TERNARY_TABLE *table, SORTED_INDEX<tuple3> &index, int shifts) {
+  SORTED_INDEX<tuple3> &unshifted = table->unshifted;
+  assert(index.count == 0);
+
+  uint32 count = unshifted.count;
+  if (count == 0)
+    return;
+
+  std::vector<tuple3> tuples(count);
+  uint32 idx = 0;
+  for (uint32 i=0 ; i < unshifted.blocks_count ; i++) {
+    INDEX_BLOCK<tuple3> &block = unshifted.blocks[i];
+    for (uint32 j=0 ; j < block.size ; j++) {
+      tuple3 entry = block.elems[j];
+      shift(entry);
+      if (shifts == 2)
+        shift(entry);
+      tuples[idx++] = entry;
+    }
+  }
+  assert(idx == count);
+
+  std::sort(tuples.begin(), tuples.end());
+  index_insert(index, &tuples.front(), count);
+}
+
+static SORTED_INDEX<tuple3> &shifted_once(TERNARY_TABLE *table) {
+  if (!table->shifted_once_built) {
+    build_shifted_index(table, table->shifted_once, 1);
+    table->shifted_once_built = true;
+  }
+  return table->shifted_once;
+}
 
+static SORTED_INDEX<tuple3> &shifted_twice(TERNARY_TABLE *table) {
+  if (!table->shifted_twice_built) {
+    build_shifted_index(table, table->shifted_twice, 2);
+    table->shifted_twice_built = true;
+  }
+  return table->shifted_twice;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -27,9 +90,7 @@ bool ternary_table_contains(TERNARY_TABLE *table, uint32 left_val, uint32 middle
   tuple3 entry;
   build(entry, left_val, middle_val, right_val);
 
-  std::set<tuple3> &unshifted = table->unshifted;
-  std::set<tuple3>::iterator it = unshifted.find(entry);
-  return it != unshifted.end();
+  return index_contains(table->unshifted, entry);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -38,14 +99,15 @@ void ternary_table_delete_range_(TERNARY_TABLE_ITER *iter, TERNARY_TABLE_UPDATES
   int shift = iter->shift;
   std::vector<tuple3> &deletes = updates->deletes;
   while (!ternary_table_iter_is_out_of_range(iter)) {
+    tuple3 &curr = iter->block->elems[iter->offset];
     if (shift == 0) {
-      deletes.push_back(*iter->iter);
+      deletes.push_back(curr);
     }
     else {
       assert(shift == 1 || shift == 2);
 
-      uint64 fields01 = iter->iter->fields01;
-      uint32 field2 = iter->iter->field2;
+      uint64 fields01 = curr.fields01;
+      uint32 field2 = curr.field2;
 
       tuple3 entry;
 
@@ -121,40 +183,46 @@ void ternary_table_insert(TERNARY_TABLE_UPDATES *updates, uint32 left_val, uint3
 
 ////////////////////////////////////////////////////////////////////////////////
 
+// The deletes and inserts are sorted and merged into each index in a single pass.
+// Ineffective deletes are dropped, so that ternary_table_updates_finish() only
+// releases the values of the tuples that were actually removed
 void ternary_table_updates_apply(TERNARY_TABLE *table, TERNARY_TABLE_UPDATES *updates, VALUE_STORE *vs0, VALUE_STORE *vs1, VALUE_STORE *vs2) {
-  std::set<tuple3> &unshifted = table->unshifted;
-  std::set<tuple3> &shifted_once = table->shifted_once;
-  std::set<tuple3> &shifted_twice = table->shifted_twice;
+  std::vector<tuple3> shifted;
 
-  uint32 count = updates->deletes.size();
-  if (count > 0) {
-    tuple3 *deletes = &updates->deletes.front();
-    for (uint32 i=0 ; i < count ; i++) {
-      tuple3 entry = deletes[i];
-      if (unshifted.erase(entry) > 0) {
-        shift(entry);
-        shifted_once.erase(entry);
-        shift(entry);
-        shifted_twice.erase(entry);
+  std::vector<tuple3> &deletes = updates->deletes;
+  if (!deletes.empty()) {
+    sort_unique(deletes);
+    uint32 count = index_remove(table->unshifted, &deletes.front(), deletes.size());
+    deletes.resize(count);
+    if (count > 0) {
+      if (table->shifted_once_built) {
+        sorted_shifted(&deletes.front(), count, 1, shifted);
+        index_remove(table->shifted_once, &shifted.front(), count);
+      }
+      if (table->shifted_twice_built) {
+        sorted_shifted(&deletes.front(), count, 2, shifted);
+        index_remove(table->shifted_twice, &shifted.front(), count);
       }
-      else
-        deletes[i].fields01 = 0xFFFFFFFFFFFFFFFFULL;
     }
   }
 
-  count = updates->inserts.size();
-  if (count > 0) {
-    tuple3 *inserts = &updates->inserts.front();
-    for (uint32 i=0 ; i < count ; i++) {
-      tuple3 entry = inserts[i];
-      if (unshifted.insert(entry).second) {
-        value_store_add_ref(vs0, left(entry.fields01));
-        value_store_add_ref(vs1, right(entry.fields01));
-        value_store_add_ref(vs2, entry.field2);
-        shift(entry);
-        shifted_once.insert(entry);
-        shift(entry);
-        shifted_twice.insert(entry);
+  std::vector<tuple3> &inserts = updates->inserts;
+  if (!inserts.empty()) {
+    sort_unique(inserts);
+    tuple3 *entries = &inserts.front();
+    uint32 count = index_insert(table->unshifted, entries, inserts.size());
+    inserts.resize(count);
+    value_store_add_refs<col_0>(vs0, entries, count);
+    value_store_add_refs<col_1>(vs1, entries, count);
+    value_store_add_refs<col_2>(vs2, entries, count);
+    if (count > 0) {
+      if (table->shifted_once_built) {
+        sorted_shifted(entries, count, 1, shifted);
+        index_insert(table->shifted_once, &shifted.front(), count);
+      }
+      if (table->shifted_twice_built) {
+        sorted_shifted(entries, count, 2, shifted);
+        index_insert(table->shifted_twice, &shifted.front(), count);
       }
     }
   }
@@ -164,92 +232,56 @@ void ternary_table_updates_finish(TERNARY_TABLE_UPDATES *updates, VALUE_STORE *v
   uint32 count = updates->deletes.size();
   if (count > 0) {
     tuple3 *deletes = &updates->deletes.front();
-    for (uint32 i=0 ; i < count ; i++) {
-      tuple3 entry = deletes[i];
-      if (entry.fields01 != 0xFFFFFFFFFFFFFFFFULL) {
-        value_store_release(vs0, left(entry.fields01));
-        value_store_release(vs1, right(entry.fields01));
-        value_store_release(vs2, entry.field2);
-      }
-    }
+    value_store_release_refs<col_0>(vs0, deletes, count);
+    value_store_release_refs<col_1>(vs1, deletes, count);
+    value_store_release_refs<col_2>(vs2, deletes, count);
   }
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
+static void ternary_table_init_iter(SORTED_INDEX<tuple3> &index, TERNARY_TABLE_ITER *iter, uint64 lower_bound, uint64 excl_upper_bound, uint8 shift) {
+  uint32 block_idx, offset;
+  index_lower_bound(index, ::lower_bound(lower_bound), block_idx, offset);
+  iter->block = index.blocks + block_idx;
+  iter->end_block = index.blocks + index.blocks_count;
+  iter->offset = offset;
+  iter->excl_upper_bound = excl_upper_bound;
+  iter->shift = shift;
+}
+
 void ternary_table_get_iter_by_cols_01(TERNARY_TABLE *table, TERNARY_TABLE_ITER *iter, uint32 value0, uint32 value1) {
-  std::set<tuple3> &target = table->unshifted;
-  tuple3 lb;
-  build(lb, value0, value1, 0);
-  iter->iter = target.lower_bound(lb);
-  iter->end = target.end();
-  iter->excl_upper_bound = pack(value0, value1+1);
-  iter->shift = 0;
+  ternary_table_init_iter(table->unshifted, iter, pack(value0, value1), pack(value0, value1+1), 0);
 }
 
 void ternary_table_get_iter_by_cols_02(TERNARY_TABLE *table, TERNARY_TABLE_ITER *iter, uint32 value0, uint32 value2) {
-  std::set<tuple3> &target = table->shifted_twice;
-  tuple3 lb;
-  build(lb, value2, value0, 0);
-  iter->iter = target.lower_bound(lb);
-  iter->end = target.end();
-  iter->excl_upper_bound = pack(value2, value0+1);
-  iter->shift = 2;
+  ternary_table_init_iter(shifted_twice(table), iter, pack(value2, value0), pack(value2, value0+1), 2);
 }
 
 void ternary_table_get_iter_by_cols_12(TERNARY_TABLE *table, TERNARY_TABLE_ITER *iter, uint32 value1, uint32 value2) {
-  std::set<tuple3> &target = table->shifted_once;
-  tuple3 lb;
-  build(lb, value1, value2, 0);
-  iter->iter = target.lower_bound(lb);
-  iter->end = target.end();
-  iter->excl_upper_bound = pack(value1, value2+1);
-  iter->shift = 1;
+  ternary_table_init_iter(shifted_once(table), iter, pack(value1, value2), pack(value1, value2+1), 1);
 }
 
 void ternary_table_get_iter_by_col_0(TERNARY_TABLE *table, TERNARY_TABLE_ITER *iter, uint32 value) {
-  std::set<tuple3> &target = table->unshifted;
-  tuple3 lb;
-  build(lb, value, 0, 0);
-  iter->iter = target.lower_bound(lb);
-  iter->end = target.end();
-  iter->excl_upper_bound = pack(value+1, 0);
-  iter->shift = 0;
+  ternary_table_init_iter(table->unshifted, iter, pack(value, 0), pack(value+1, 0), 0);
 }
 
 void ternary_table_get_iter_by_col_1(TERNARY_TABLE *table, TERNARY_TABLE_ITER *iter, uint32 value) {
-  std::set<tuple3> &target = table->shifted_once;
-  tuple3 lb;
-  build(lb, value, 0, 0);
-  iter->iter = target.lower_bound(lb);
-  iter->end = target.end();
-  iter->excl_upper_bound = pack(value+1, 0);
-  iter->shift = 1;
+  ternary_table_init_iter(shifted_once(table), iter, pack(value, 0), pack(value+1, 0), 1);
 }
 
 void ternary_table_get_iter_by_col_2(TERNARY_TABLE *table, TERNARY_TABLE_ITER *iter, uint32 value) {
-  std::set<tuple3> &target = table->shifted_twice;
-  tuple3 lb;
-  build(lb, value, 0, 0);
-  iter->iter = target.lower_bound(lb);
-  iter->end = target.end();
-  iter->excl_upper_bound = pack(value+1, 0);
-  iter->shift = 2;
+  ternary_table_init_iter(shifted_twice(table), iter, pack(value, 0), pack(value+1, 0), 2);
 }
 
 void ternary_table_get_iter(TERNARY_TABLE *table, TERNARY_TABLE_ITER *iter) {
-  std::set<tuple3> &target = table->unshifted;
-  iter->iter = target.begin();
-  iter->end = target.end();
-  iter->excl_upper_bound = 0xFFFFFFFFFFFFFFFFULL;
-  iter->shift = 0;
+  ternary_table_init_iter(table->unshifted, iter, 0, 0xFFFFFFFFFFFFFFFFULL, 0);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
 bool ternary_table_iter_is_out_of_range(TERNARY_TABLE_ITER *iter) {
-  std::set<tuple3>::iterator it = iter->iter;
-  return it == iter->end || it->fields01 >= iter->excl_upper_bound;
+  return iter->block == iter->end_block || iter->block->elems[iter->offset].fields01 >= iter->excl_upper_bound;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -258,40 +290,43 @@ uint32 ternary_table_iter_get_left_field(TERNARY_TABLE_ITER *iter) {
   uint8 shift = iter->shift;
   assert(shift >= 0 && shift <= 2);
   if (shift == 0)
-    return left(iter->iter->fields01);
+    return left(iter->block->elems[iter->offset].fields01);
   else if (shift == 1)
-    return iter->iter->field2;
+    return iter->block->elems[iter->offset].field2;
   else
-    return right(iter->iter->fields01);
+    return right(iter->block->elems[iter->offset].fields01);
 }
 
 uint32 ternary_table_iter_get_middle_field(TERNARY_TABLE_ITER *iter) {
   uint8 shift = iter->shift;
   assert(shift >= 0 && shift <= 2);
   if (shift == 0)
-    return right(iter->iter->fields01);
+    return right(iter->block->elems[iter->offset].fields01);
   else if (shift == 1)
-    return left(iter->iter->fields01);
+    return left(iter->block->elems[iter->offset].fields01);
   else
-    return iter->iter->field2;
+    return iter->block->elems[iter->offset].field2;
 }
 
 uint32 ternary_table_iter_get_right_field(TERNARY_TABLE_ITER *iter) {
   uint8 shift = iter->shift;
   assert(shift >= 0 && shift <= 2);
   if (shift == 0)
-    return iter->iter->field2;
+    return iter->block->elems[iter->offset].field2;
   else if (shift == 1)
-    return right(iter->iter->fields01);
+    return right(iter->block->elems[iter->offset].fields01);
   else
-    return left(iter->iter->fields01);
+    return left(iter->block->elems[iter->offset].fields01);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
 void ternary_table_iter_next(TERNARY_TABLE_ITER *iter) {
   assert(!ternary_table_iter_is_out_of_range(iter));
-  iter->iter++;
+  if (++iter->offset == iter->block->size) {
+    iter->block++;
+    iter->offset = 0;
+  }
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -303,28 +338,24 @@ bool ternary_table_updates_check_01(TERNARY_TABLE *table, TERNARY_TABLE_UPDATES
 
 bool ternary_table_updates_check_01_2(TERNARY_TABLE *table, TERNARY_TABLE_UPDATES *updates) {
   return ternary_table_updates_check_01(table, updates) &&
-    table_updates_check_key<col_2>(updates->inserts, updates->deletes, table->shifted_twice);
+    table_updates_check_key<col_2>(updates->inserts, updates->deletes, shifted_twice(table));
 }
 
 bool ternary_table_updates_check_01_12(TERNARY_TABLE *table, TERNARY_TABLE_UPDATES *updates) {
   return ternary_table_updates_check_01(table, updates) &&
-    table_updates_check_key<cols_12>(updates->inserts, updates->deletes, table->shifted_once);
+    table_updates_check_key<cols_12>(updates->inserts, updates->deletes, shifted_once(table));
 }
 
 bool ternary_table_updates_check_01_12_20(TERNARY_TABLE *table, TERNARY_TABLE_UPDATES *updates) {
   return ternary_table_updates_check_01_12(table, updates) &&
-    table_updates_check_key<cols_20>(updates->inserts, updates->deletes, table->shifted_twice);
+    table_updates_check_key<cols_20>(updates->inserts, updates->deletes, shifted_twice(table));
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
 OBJ copy_ternary_table(TERNARY_TABLE *table, VALUE_STORE *vs1, VALUE_STORE *vs2, VALUE_STORE *vs3, int idx1, int idx2, int idx3) {
-  OBJ *slots1 = value_store_slot_array(vs1);
-  OBJ *slots2 = value_store_slot_array(vs2);
-  OBJ *slots3 = value_store_slot_array(vs3);
-
-  std::set<tuple3> &rows = table->unshifted;
-  uint32 size = rows.size();
+  SORTED_INDEX<tuple3> &rows = table->unshifted;
+  uint32 size = rows.count;
 
   if (size == 0)
     return make_empty_rel();
@@ -334,17 +365,17 @@ OBJ copy_ternary_table(TERNARY_TABLE *table, VALUE_STORE *vs1, VALUE_STORE *vs2,
   OBJ *col3 = col2 + size;
 
   uint32 idx = 0;
-  for (std::set<tuple3>::iterator it=rows.begin() ; it != rows.end() ; it++) {
-    tuple3 row = *it;
-    col1[idx] = slots1[left(row.fields01)];
-    col2[idx] = slots2[right(row.fields01)];
-    col3[idx++] = slots3[row.field2];
+  for (uint32 i=0 ; i < rows.blocks_count ; i++) {
+    INDEX_BLOCK<tuple3> &block = rows.blocks[i];
+    for (uint32 j=0 ; j < block.size ; j++) {
+      tuple3 row = block.elems[j];
+      col1[idx] = lookup_surrogate(vs1, left(row.fields01));
+      col2[idx] = lookup_surrogate(vs2, right(row.fields01));
+      col3[idx++] = lookup_surrogate(vs3, row.field2);
+    }
   }
   assert(idx == size);
 
-  for (int64 i=0 ; i < 3 * size ; i++)
-    add_ref(col1[i]);
-
   OBJ *rec_cols[3];
   rec_cols[idx1] = col1;
   rec_cols[idx2] = col2;
@@ -375,28 +406,14 @@ void set_ternary_table(
   OBJ *col2 = get_col_array_ptr(ptr, idx2);
   OBJ *col3 = get_col_array_ptr(ptr, idx3);
 
-  for (uint32 i=0 ; i < size ; i++) {
-    OBJ obj = col1[i];
-    uint32 ref1 = lookup_value_ex(vs1, vsu1, obj);
-    if (ref1 == -1) {
-      add_ref(obj);
-      ref1 = value_store_insert(vs1, vsu1, obj);
-    }
+  std::vector<uint32> surrs(3 * size);
+  uint32 *surrs1 = &surrs.front();
+  uint32 *surrs2 = surrs1 + size;
+  uint32 *surrs3 = surrs2 + size;
+  value_store_lookup_or_insert_batch(vs1, vsu1, col1, size, surrs1);
+  value_store_lookup_or_insert_batch(vs2, vsu2, col2, size, surrs2);
+  value_store_lookup_or_insert_batch(vs3, vsu3, col3, size, surrs3);
 
-    obj = col2[i];
-    uint32 ref2 = lookup_value_ex(vs2, vsu2, obj);
-    if (ref2 == -1) {
-      add_ref(obj);
-      ref2 = value_store_insert(vs2, vsu2, obj);
-    }
-
-    obj = col3[i];
-    uint32 ref3 = lookup_value_ex(vs3, vsu3, obj);
-    if (ref3 == -1) {
-      add_ref(obj);
-      ref3 = value_store_insert(vs3, vsu3, obj);
-    }
-
-    ternary_table_insert(updates, ref1, ref2, ref3);
-  }
+  for (uint32 i=0 ; i < size ; i++)
+    ternary_table_insert(updates, surrs1[i], surrs2[i], surrs3[i]);
 }
@@ -0,0 +1,763 @@
+#include "lib.h"
+
+
+// Maps are normally stored as a BIN_REL_OBJ, that is, as a sorted array of keys followed
+// by the array of the corresponding values, so updating a single entry means copying the
+// whole map. Large maps are turned into persistent B+ trees the first time they're updated
+// instead: an update only copies the nodes on the path from the root to the affected leaf,
+// and shares all other nodes with the original map. Nodes are reference-counted like objects,
+// and leaves own a reference to their keys and values. The keys stored in inner nodes are
+// copies of the first key of each child, and are not reference-counted.
+//
+// lookup(), has_key(), has_pair(), get_size(), compute_hash_code(), comp_objs() and the
+// update functions below work on the tree directly, and BIN_REL_ITER iterates over it one
+// leaf at a time, finding each leaf from the root, like comp_tree_maps() does. Only code
+// that needs the entries stored contiguously, which is the iteration in value order done
+// by get_bin_rel_iter_1(), goes through get_bin_rel_ptr(), which for a tree map returns an
+// array view of it that is built the first time it's needed and kept for as long as the
+// map lives. comp_objs() in particular must not allocate, as it's called by the parallel
+// sorting tasks, and views are only ever built by the thread that owns the map.
+//
+// Tree maps are only created and updated in normal state. In try state maps are always
+// updated by copying their entries into a new array, and the array view of a tree map is
+// not cached, since whatever is allocated in try state is discarded in bulk at the end of it.
+
+// Smaller maps are always updated by copying them
+const uint32 TREE_MAP_MIN_SIZE = 1024;
+
+const uint32 TREE_MAP_LEAF_CAPACITY = 32;
+const uint32 TREE_MAP_NODE_CAPACITY = 32;
+
+// Nodes that shrink below these sizes are merged with a neighbour if the result fits in
+// a single node, or otherwise have their entries (or children) redistributed with it
+const uint32 TREE_MAP_LEAF_MIN_SIZE = TREE_MAP_LEAF_CAPACITY / 4;
+const uint32 TREE_MAP_NODE_MIN_SIZE = TREE_MAP_NODE_CAPACITY / 4;
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Index of the child of an inner node whose subtree <key> belongs to
+static uint32 child_idx(TREE_MAP_NODE *node, OBJ key) {
+  OBJ *keys = node->keys;
+  uint32 low = 0;
+  uint32 high = node->count;
+  while (low < high) {
+    uint32 middle = (low + high) / 2;
+    if (comp_objs(keys[middle], key) >= 0)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  return low > 0 ? low - 1 : 0;
+}
+
+static TREE_MAP_NODE *find_leaf(TREE_MAP_NODE *node, OBJ key) {
+  while (node->height > 0)
+    node = get_tree_map_node_children(node)[child_idx(node, key)];
+  return node;
+}
+
+// Returns the leaf that contains the entry at <idx>, and sets <idx> to its position in the leaf
+static TREE_MAP_NODE *leaf_at(TREE_MAP_NODE *node, uint32 &idx) {
+  while (node->height > 0) {
+    TREE_MAP_NODE **children = get_tree_map_node_children(node);
+    uint32 i = 0;
+    while (idx >= children[i]->size)
+      idx -= children[i++]->size;
+    node = children[i];
+  }
+  return node;
+}
+
+// Position in the map of the first entry whose key is not lower than <key>
+static uint32 lower_bound_idx(TREE_MAP_NODE *node, OBJ key, bool &found) {
+  uint32 idx = 0;
+  while (node->height > 0) {
+    TREE_MAP_NODE **children = get_tree_map_node_children(node);
+    uint32 child = child_idx(node, key);
+    for (uint32 i=0 ; i < child ; i++)
+      idx += children[i]->size;
+    node = children[child];
+  }
+
+  uint32 leaf_idx = lower_bound(node->keys, node->count, key);
+  found = leaf_idx < node->count && comp_objs(node->keys[leaf_idx], key) == 0;
+  return idx + leaf_idx;
+}
+
+static void add_ref(TREE_MAP_NODE **nodes, uint32 count) {
+  for (uint32 i=0 ; i < count ; i++)
+    add_ref(&nodes[i]->ref_obj);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Takes ownership of the keys and values
+static TREE_MAP_NODE *make_leaf(OBJ *keys, OBJ *values, uint32 count) {
+  assert(count > 0 & count <= TREE_MAP_LEAF_CAPACITY);
+
+  TREE_MAP_NODE *leaf = new_tree_map_node(count, 0);
+  leaf->size = count;
+  memcpy(leaf->keys, keys, count * sizeof(OBJ));
+  memcpy(get_tree_map_node_values(leaf), values, count * sizeof(OBJ));
+  return leaf;
+}
+
+// Takes ownership of the children, which must all have the same height
+static TREE_MAP_NODE *make_inner_node(TREE_MAP_NODE **children, uint32 count) {
+  assert(count > 0 & count <= TREE_MAP_NODE_CAPACITY);
+
+  TREE_MAP_NODE *node = new_tree_map_node(count, children[0]->height + 1);
+  TREE_MAP_NODE **node_children = get_tree_map_node_children(node);
+  uint32 size = 0;
+  for (uint32 i=0 ; i < count ; i++) {
+    TREE_MAP_NODE *child = children[i];
+    assert(child->height + 1 == node->height);
+    node->keys[i] = child->keys[0];
+    node_children[i] = child;
+    size += child->size;
+  }
+  node->size = size;
+  return node;
+}
+
+// Same as make_leaf(), but if there are too many entries for a single
+// leaf they are split in two, and the second one is stored in <sibling>
+static TREE_MAP_NODE *make_leaves(OBJ *keys, OBJ *values, uint32 count, TREE_MAP_NODE *&sibling) {
+  if (count <= TREE_MAP_LEAF_CAPACITY) {
+    sibling = NULL;
+    return make_leaf(keys, values, count);
+  }
+
+  uint32 half = count / 2;
+  sibling = make_leaf(keys + half, values + half, count - half);
+  return make_leaf(keys, values, half);
+}
+
+static TREE_MAP_NODE *make_inner_nodes(TREE_MAP_NODE **children, uint32 count, TREE_MAP_NODE *&sibling) {
+  if (count <= TREE_MAP_NODE_CAPACITY) {
+    sibling = NULL;
+    return make_inner_node(children, count);
+  }
+
+  uint32 half = count / 2;
+  sibling = make_inner_node(children + half, count - half);
+  return make_inner_node(children, half);
+}
+
+// Returns a node with the contents of two adjacent nodes of the same height, or two nodes
+// that share them evenly, the second of which is stored in <sibling>, if they don't fit in
+// a single one. Neither of the two nodes is consumed
+static TREE_MAP_NODE *merge(TREE_MAP_NODE *left, TREE_MAP_NODE *right, TREE_MAP_NODE *&sibling) {
+  assert(left->height == right->height);
+
+  uint32 left_count = left->count;
+  uint32 right_count = right->count;
+  uint32 count = left_count + right_count;
+
+  if (left->height == 0) {
+    OBJ new_keys[2 * TREE_MAP_LEAF_CAPACITY];
+    OBJ new_values[2 * TREE_MAP_LEAF_CAPACITY];
+    memcpy(new_keys, left->keys, left_count * sizeof(OBJ));
+    memcpy(new_values, get_tree_map_node_values(left), left_count * sizeof(OBJ));
+    memcpy(new_keys + left_count, right->keys, right_count * sizeof(OBJ));
+    memcpy(new_values + left_count, get_tree_map_node_values(right), right_count * sizeof(OBJ));
+    vec_add_ref(new_keys, count);
+    vec_add_ref(new_values, count);
+    return make_leaves(new_keys, new_values, count, sibling);
+  }
+
+  TREE_MAP_NODE *new_children[2 * TREE_MAP_NODE_CAPACITY];
+  memcpy(new_children, get_tree_map_node_children(left), left_count * sizeof(TREE_MAP_NODE *));
+  memcpy(new_children + left_count, get_tree_map_node_children(right), right_count * sizeof(TREE_MAP_NODE *));
+  add_ref(new_children, count);
+  return make_inner_nodes(new_children, count, sibling);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Returns a copy of the subtree with the entry inserted or replaced. If the copy
+// had to be split in two, the second half is returned in <sibling>
+static TREE_MAP_NODE *insert(TREE_MAP_NODE *node, OBJ key, OBJ value, TREE_MAP_NODE *&sibling) {
+  uint32 count = node->count;
+
+  if (node->height == 0) {
+    OBJ *keys = node->keys;
+    OBJ *values = get_tree_map_node_values(node);
+
+    uint32 idx = lower_bound(keys, count, key);
+    uint32 next = idx < count && comp_objs(keys[idx], key) == 0 ? idx + 1 : idx;
+
+    OBJ new_keys[TREE_MAP_LEAF_CAPACITY + 1];
+    OBJ new_values[TREE_MAP_LEAF_CAPACITY + 1];
+
+    memcpy(new_keys, keys, idx * sizeof(OBJ));
+    memcpy(new_values, values, idx * sizeof(OBJ));
+    new_keys[idx] = key;
+    new_values[idx] = value;
+    memcpy(new_keys + idx + 1, keys + next, (count - next) * sizeof(OBJ));
+    memcpy(new_values + idx + 1, values + next, (count - next) * sizeof(OBJ));
+
+    uint32 new_count = idx + 1 + count - next;
+    for (uint32 i=0 ; i < new_count ; i++)
+      if (i != idx) {
+        add_ref(new_keys[i]);
+        add_ref(new_values[i]);
+      }
+
+    return make_leaves(new_keys, new_values, new_count, sibling);
+  }
+
+  TREE_MAP_NODE **children = get_tree_map_node_children(node);
+  uint32 idx = child_idx(node, key);
+
+  TREE_MAP_NODE *child_sibling;
+  TREE_MAP_NODE *child = insert(children[idx], key, value, child_sibling);
+
+  TREE_MAP_NODE *new_children[TREE_MAP_NODE_CAPACITY + 1];
+  uint32 new_count = 0;
+
+  add_ref(children, idx);
+  memcpy(new_children, children, idx * sizeof(TREE_MAP_NODE *));
+  new_count = idx;
+  new_children[new_count++] = child;
+  if (child_sibling != NULL)
+    new_children[new_count++] = child_sibling;
+  add_ref(children + idx + 1, count - idx - 1);
+  memcpy(new_children + new_count, children + idx + 1, (count - idx - 1) * sizeof(TREE_MAP_NODE *));
+  new_count += count - idx - 1;
+
+  return make_inner_nodes(new_children, new_count, sibling);
+}
+
+// Returns a copy of the subtree without the entry with the given key, which must
+// be there, or NULL if the subtree contained nothing else. Empty nodes are removed,
+// and nodes that become too small are merged with a neighbouring one, or rebalanced
+static TREE_MAP_NODE *remove(TREE_MAP_NODE *node, OBJ key) {
+  uint32 count = node->count;
+
+  if (node->height == 0) {
+    if (count == 1)
+      return NULL;
+
+    bool found;
+    uint32 idx = find_obj(node->keys, count, key, found);
+    assert(found);
+
+    OBJ *keys = node->keys;
+    OBJ *values = get_tree_map_node_values(node);
+
+    OBJ new_keys[TREE_MAP_LEAF_CAPACITY];
+    OBJ new_values[TREE_MAP_LEAF_CAPACITY];
+
+    memcpy(new_keys, keys, idx * sizeof(OBJ));
+    memcpy(new_values, values, idx * sizeof(OBJ));
+    memcpy(new_keys + idx, keys + idx + 1, (count - idx - 1) * sizeof(OBJ));
+    memcpy(new_values + idx, values + idx + 1, (count - idx - 1) * sizeof(OBJ));
+    vec_add_ref(new_keys, count - 1);
+    vec_add_ref(new_values, count - 1);
+
+    return make_leaf(new_keys, new_values, count - 1);
+  }
+
+  TREE_MAP_NODE **children = get_tree_map_node_children(node);
+  uint32 idx = child_idx(node, key);
+
+  // Children in [first, last] are replaced by <new_child> and <new_sibling>, if they're not NULL
+  uint32 first = idx;
+  uint32 last = idx;
+  TREE_MAP_NODE *new_child = remove(children[idx], key);
+  TREE_MAP_NODE *new_sibling = NULL;
+
+  if (new_child != NULL && count > 1) {
+    uint32 min_size = new_child->height == 0 ? TREE_MAP_LEAF_MIN_SIZE : TREE_MAP_NODE_MIN_SIZE;
+    if (new_child->count < min_size) {
+      uint32 other_idx = idx + 1 < count ? idx + 1 : idx - 1;
+      TREE_MAP_NODE *other = children[other_idx];
+      TREE_MAP_NODE *merged;
+      if (idx < other_idx) {
+        merged = merge(new_child, other, new_sibling);
+        last = other_idx;
+      }
+      else {
+        merged = merge(other, new_child, new_sibling);
+        first = other_idx;
+      }
+      release_tree_map_node(new_child);
+      new_child = merged;
+    }
+  }
+
+  uint32 new_count = count - (last - first + 1) + (new_child != NULL ? 1 : 0) + (new_sibling != NULL ? 1 : 0);
+  if (new_count == 0)
+    return NULL;
+
+  TREE_MAP_NODE *new_children[TREE_MAP_NODE_CAPACITY];
+  add_ref(children, first);
+  memcpy(new_children, children, first * sizeof(TREE_MAP_NODE *));
+  uint32 next = first;
+  if (new_child != NULL)
+    new_children[next++] = new_child;
+  if (new_sibling != NULL)
+    new_children[next++] = new_sibling;
+  add_ref(children + last + 1, count - last - 1);
+  memcpy(new_children + next, children + last + 1, (count - last - 1) * sizeof(TREE_MAP_NODE *));
+  assert(next + count - last - 1 == new_count);
+
+  return make_inner_node(new_children, new_count);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static OBJ make_tree_map(TREE_MAP_NODE *root) {
+  TREE_MAP_OBJ *map = new_tree_map(root->size);
+  map->root = root;
+  return make_tree_map(map);
+}
+
+// Builds a tree map with the same entries as a map stored as an array
+static OBJ array_map_to_tree_map(OBJ map) {
+  BIN_REL_OBJ *ptr = get_bin_rel_ptr(map);
+  uint32 size = ptr->size;
+  OBJ *keys = get_left_col_array_ptr(ptr);
+  OBJ *values = get_right_col_array_ptr(ptr);
+
+  vec_add_ref(keys, size);
+  vec_add_ref(values, size);
+
+  uint32 count = (size + TREE_MAP_LEAF_CAPACITY - 1) / TREE_MAP_LEAF_CAPACITY;
+  TREE_MAP_NODE **nodes = (TREE_MAP_NODE **) new_ptr_array(count);
+
+  for (uint32 i=0 ; i < count ; i++) {
+    uint32 offset = i * TREE_MAP_LEAF_CAPACITY;
+    uint32 leaf_size = size - offset < TREE_MAP_LEAF_CAPACITY ? size - offset : TREE_MAP_LEAF_CAPACITY;
+    nodes[i] = make_leaf(keys + offset, values + offset, leaf_size);
+  }
+
+  uint32 level_count = count;
+  while (level_count > 1) {
+    uint32 parents_count = (level_count + TREE_MAP_NODE_CAPACITY - 1) / TREE_MAP_NODE_CAPACITY;
+    for (uint32 i=0 ; i < parents_count ; i++) {
+      uint32 offset = i * TREE_MAP_NODE_CAPACITY;
+      uint32 children_count = level_count - offset < TREE_MAP_NODE_CAPACITY ? level_count - offset : TREE_MAP_NODE_CAPACITY;
+      nodes[i] = make_inner_node(nodes + offset, children_count);
+    }
+    level_count = parents_count;
+  }
+
+  TREE_MAP_NODE *root = nodes[0];
+  delete_ptr_array((void **) nodes, count);
+  return make_tree_map(root);
+}
+
+static OBJ update_tree_map(TREE_MAP_OBJ *map, OBJ key, OBJ value) {
+  TREE_MAP_NODE *sibling;
+  TREE_MAP_NODE *root = insert(map->root, key, value, sibling);
+  if (sibling != NULL) {
+    TREE_MAP_NODE *children[2] = {root, sibling};
+    root = make_inner_node(children, 2);
+  }
+  return make_tree_map(root);
+}
+
+static OBJ remove_tree_map_key(OBJ map, OBJ key) {
+  TREE_MAP_OBJ *ptr = get_tree_map_ptr(map);
+
+  OBJ value;
+  if (!tree_map_lookup(ptr, key, value)) {
+    add_ref(map);
+    return map;
+  }
+
+  if (ptr->size == 1)
+    return make_empty_rel();
+
+  TREE_MAP_NODE *root = remove(ptr->root, key);
+  while (root->height > 0 && root->count == 1) {
+    TREE_MAP_NODE *child = get_tree_map_node_children(root)[0];
+    add_ref(&child->ref_obj);
+    release_tree_map_node(root);
+    root = child;
+  }
+  return make_tree_map(root);
+}
+
+// Replaces in place the value associated to a key that is already in the map, and returns
+// true, unless some of the nodes on the path to it are shared, in which case it returns false
+static bool replace_unique_tree_map_value(TREE_MAP_OBJ *map, OBJ key, OBJ value) {
+  TREE_MAP_NODE *node = map->root;
+  for ( ; ; ) {
+    if (node->ref_obj.ref_count != 1)
+      return false;
+    if (node->height == 0)
+      break;
+    node = get_tree_map_node_children(node)[child_idx(node, key)];
+  }
+
+  bool found;
+  uint32 idx = find_obj(node->keys, node->count, key, found);
+  if (!found)
+    return false;
+
+  OBJ *values = get_tree_map_node_values(node);
+  release(values[idx]);
+  values[idx] = value;
+
+  // The view doesn't hold references to the entries, so it can be updated as well
+  BIN_REL_OBJ *view = map->array_view;
+  if (view != NULL) {
+    uint32 view_idx = find_obj(get_left_col_array_ptr(view), view->size, key, found, &view->search_index);
+    assert(found);
+    get_right_col_array_ptr(view)[view_idx] = value;
+    get_right_to_left_indexes(view)[0] = INVALID_INDEX;
+  }
+
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Returns a pointer to the keys (or values) of the map starting at the one at <idx>,
+// and sets <count> to the number of them that are stored contiguously from there
+static OBJ *get_entries_ptr(OBJ map, uint32 idx, bool values, uint32 &count) {
+  if (get_physical_type(map) != TYPE_TREE_MAP) {
+    BIN_REL_OBJ *ptr = get_bin_rel_ptr(map);
+    count = ptr->size - idx;
+    return (values ? get_right_col_array_ptr(ptr) : get_left_col_array_ptr(ptr)) + idx;
+  }
+
+  TREE_MAP_NODE *leaf = leaf_at(get_tree_map_ptr(map)->root, idx);
+  count = leaf->count - idx;
+  return (values ? get_tree_map_node_values(leaf) : leaf->keys) + idx;
+}
+
+// Copies the entries of the map in the range [first, end) to <keys>
+// and <values>, without taking a reference to them
+static void copy_map_entries(OBJ map, uint32 first, uint32 end, OBJ *keys, OBJ *values) {
+  uint32 idx = first;
+  while (idx < end) {
+    uint32 count;
+    OBJ *src_keys = get_entries_ptr(map, idx, false, count);
+    OBJ *src_values = get_entries_ptr(map, idx, true, count);
+    if (count > end - idx)
+      count = end - idx;
+    memcpy(keys + idx - first, src_keys, count * sizeof(OBJ));
+    memcpy(values + idx - first, src_values, count * sizeof(OBJ));
+    idx += count;
+  }
+}
+
+// Position of the first entry of a non-empty map whose key is not lower than <key>
+static uint32 map_lower_bound(OBJ map, OBJ key, bool &found) {
+  if (get_physical_type(map) == TYPE_TREE_MAP)
+    return lower_bound_idx(get_tree_map_ptr(map)->root, key, found);
+
+  BIN_REL_OBJ *ptr = get_bin_rel_ptr(map);
+  OBJ *keys = get_left_col_array_ptr(ptr);
+  uint32 idx = lower_bound(keys, ptr->size, key);
+  found = idx < ptr->size && comp_objs(keys[idx], key) == 0;
+  return idx;
+}
+
+// Binary relations that are not maps are rebuilt from scratch
+static OBJ rebuild_bin_rel(OBJ rel, OBJ key, OBJ *new_value) {
+  BIN_REL_OBJ *ptr = get_bin_rel_ptr(rel);
+  uint32 size = ptr->size;
+  OBJ *left_col = get_left_col_array_ptr(ptr);
+  OBJ *right_col = get_right_col_array_ptr(ptr);
+
+  uint32 capacity = size + 1;
+  OBJ *col1 = new_obj_array(capacity);
+  OBJ *col2 = new_obj_array(capacity);
+
+  uint32 count = 0;
+  for (uint32 i=0 ; i < size ; i++)
+    if (comp_objs(left_col[i], key) != 0) {
+      col1[count] = left_col[i];
+      col2[count] = right_col[i];
+      count++;
+    }
+  vec_add_ref(col1, count);
+  vec_add_ref(col2, count);
+
+  if (new_value != NULL) {
+    col1[count] = key;
+    col2[count] = *new_value;
+    count++;
+  }
+
+  OBJ res = build_bin_rel(col1, col2, count);
+
+  delete_obj_array(col1, capacity);
+  delete_obj_array(col2, capacity);
+
+  return res;
+}
+
+// Copies the entries of the map, which can be stored either as an array or as a tree, to a new
+// map stored as an array. Tree maps end up here only in try state, where they aren't updated
+static OBJ update_array_map(OBJ map, OBJ key, OBJ value) {
+  if (!is_ne_map(map))
+    return rebuild_bin_rel(map, key, &value);
+
+  uint32 size = get_size(map);
+  bool found;
+  uint32 idx = map_lower_bound(map, key, found);
+  uint32 next = found ? idx + 1 : idx;
+  uint32 new_size = idx + 1 + size - next;
+
+  BIN_REL_OBJ *new_ptr = new_map(new_size);
+  OBJ *new_keys = get_left_col_array_ptr(new_ptr);
+  OBJ *new_values = get_right_col_array_ptr(new_ptr);
+
+  copy_map_entries(map, 0, idx, new_keys, new_values);
+  new_keys[idx] = key;
+  new_values[idx] = value;
+  copy_map_entries(map, next, size, new_keys + idx + 1, new_values + idx + 1);
+
+  for (uint32 i=0 ; i < new_size ; i++)
+    if (i != idx) {
+      add_ref(new_keys[i]);
+      add_ref(new_values[i]);
+    }
+
+  return make_map(new_ptr);
+}
+
+// The map must be unique. Values are replaced in place, new entries are
+// added by moving the existing ones to a bigger object, but only in small maps
+static bool update_unique_array_map(BIN_REL_OBJ *&ptr, OBJ key, OBJ value) {
+  uint32 size = ptr->size;
+  OBJ *keys = get_left_col_array_ptr(ptr);
+
+  uint32 idx = lower_bound(keys, size, key);
+  if (idx < size && comp_objs(keys[idx], key) == 0) {
+    OBJ *values = get_right_col_array_ptr(ptr);
+    release(key);
+    release(values[idx]);
+    values[idx] = value;
+    // The right-to-left index is rebuilt lazily the next time it's needed
+    get_right_to_left_indexes(ptr)[0] = INVALID_INDEX;
+    return true;
+  }
+
+  if (size >= TREE_MAP_MIN_SIZE)
+    return false;
+
+  ptr = expand_map(ptr, idx);
+  get_left_col_array_ptr(ptr)[idx] = key;
+  get_right_col_array_ptr(ptr)[idx] = value;
+  return true;
+}
+
+// Same as update_array_map()
+static OBJ remove_array_map_key(OBJ map, OBJ key) {
+  if (!is_ne_map(map)) {
+    uint32 count;
+    BIN_REL_OBJ *ptr = get_bin_rel_ptr(map);
+    find_objs_range(get_left_col_array_ptr(ptr), ptr->size, key, count);
+    if (count == 0) {
+      add_ref(map);
+      return map;
+    }
+    return rebuild_bin_rel(map, key, NULL);
+  }
+
+  uint32 size = get_size(map);
+  bool found;
+  uint32 idx;
+  if (get_physical_type(map) == TYPE_TREE_MAP) {
+    idx = map_lower_bound(map, key, found);
+  }
+  else {
+    BIN_REL_OBJ *ptr = get_bin_rel_ptr(map);
+    idx = find_obj(get_left_col_array_ptr(ptr), size, key, found, &ptr->search_index);
+  }
+  if (!found) {
+    add_ref(map);
+    return map;
+  }
+
+  if (size == 1)
+    return make_empty_rel();
+
+  BIN_REL_OBJ *new_ptr = new_map(size - 1);
+  OBJ *new_keys = get_left_col_array_ptr(new_ptr);
+  OBJ *new_values = get_right_col_array_ptr(new_ptr);
+
+  copy_map_entries(map, 0, idx, new_keys, new_values);
+  copy_map_entries(map, idx + 1, size, new_keys + idx, new_values + idx);
+  vec_add_ref(new_keys, size - 1);
+  vec_add_ref(new_values, size - 1);
+
+  return make_map(new_ptr);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static uint32 copy_entries(TREE_MAP_NODE *node, OBJ *keys, OBJ *values, uint32 offset) {
+  uint32 count = node->count;
+  if (node->height == 0) {
+    memcpy(keys + offset, node->keys, count * sizeof(OBJ));
+    memcpy(values + offset, get_tree_map_node_values(node), count * sizeof(OBJ));
+    return offset + count;
+  }
+
+  TREE_MAP_NODE **children = get_tree_map_node_children(node);
+  for (uint32 i=0 ; i < count ; i++)
+    offset = copy_entries(children[i], keys, values, offset);
+  return offset;
+}
+
+BIN_REL_OBJ *get_tree_map_array_view(TREE_MAP_OBJ *map) {
+  BIN_REL_OBJ *view = map->array_view;
+  if (view != NULL)
+    return view;
+
+  assert(!is_in_parallel_task());
+
+  uint32 size = map->size;
+  view = new_map(size);
+  uint32 count = copy_entries(map->root, get_left_col_array_ptr(view), get_right_col_array_ptr(view), 0);
+  assert(count == size);
+
+  if (!is_in_try_state())
+    map->array_view = view;
+
+  return view;
+}
+
+// Same as comparing the arrays of keys and then those of values, as comp_objs() does
+// for maps stored as a BIN_REL_OBJ, but going through the leaves one at a time
+int comp_tree_maps(OBJ map1, OBJ map2) {
+  uint32 size = get_size(map1);
+  assert(size > 0 & get_size(map2) == size);
+
+  for (int col=0 ; col < 2 ; col++) {
+    uint32 idx = 0;
+    while (idx < size) {
+      uint32 count1, count2;
+      OBJ *entries1 = get_entries_ptr(map1, idx, col == 1, count1);
+      OBJ *entries2 = get_entries_ptr(map2, idx, col == 1, count2);
+      uint32 count = count1 < count2 ? count1 : count2;
+      for (uint32 i=0 ; i < count ; i++) {
+        int cr = comp_objs(entries1[i], entries2[i]);
+        if (cr != 0)
+          return cr;
+      }
+      idx += count;
+    }
+  }
+
+  return 0;
+}
+
+bool tree_map_lookup(TREE_MAP_OBJ *map, OBJ key, OBJ &value) {
+  TREE_MAP_NODE *leaf = find_leaf(map->root, key);
+  bool found;
+  uint32 idx = find_obj(leaf->keys, leaf->count, key, found);
+  if (found)
+    value = get_tree_map_node_values(leaf)[idx];
+  return found;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Points the iterator to the leaf that contains the entry at <it.idx>
+void load_tree_map_iter_leaf(BIN_REL_ITER &it) {
+  assert(it.tree_root != NULL & it.idx < it.end);
+
+  uint32 idx = it.idx;
+  TREE_MAP_NODE *leaf = leaf_at(it.tree_root, idx);
+  it.left_col = leaf->keys;
+  it.right_col = get_tree_map_node_values(leaf);
+  it.leaf_first = it.idx - idx;
+  it.leaf_end = it.leaf_first + leaf->count;
+}
+
+void get_tree_map_iter(BIN_REL_ITER &it, TREE_MAP_OBJ *map) {
+  it.tree_root = map->root;
+  it.rev_idxs = NULL;
+  it.idx = 0;
+  it.end = map->size;
+  load_tree_map_iter_leaf(it);
+}
+
+// Iterates over the entry with the given key, if there's one. Returns false if there's none
+bool get_tree_map_iter_0(BIN_REL_ITER &it, TREE_MAP_OBJ *map, OBJ key) {
+  bool found;
+  uint32 idx = lower_bound_idx(map->root, key, found);
+  if (!found)
+    return false;
+
+  it.tree_root = map->root;
+  it.rev_idxs = NULL;
+  it.idx = idx;
+  it.end = idx + 1;
+  load_tree_map_iter_leaf(it);
+  return true;
+}
+
+// Returns the leaf that contains the entry at <idx>, and sets <idx> to its position in the leaf
+TREE_MAP_NODE *get_tree_map_leaf(TREE_MAP_OBJ *map, uint32 &idx) {
+  assert(idx < map->size);
+  return leaf_at(map->root, idx);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+OBJ update_map(OBJ map, OBJ key, OBJ value) {
+  assert(is_bin_rel(map));
+
+  if (is_empty_rel(map))
+    return build_map(&key, &value, 1);
+
+  if (is_in_normal_state()) {
+    if (get_physical_type(map) == TYPE_TREE_MAP)
+      return update_tree_map(get_tree_map_ptr(map), key, value);
+
+    if (is_ne_map(map) && get_size(map) >= TREE_MAP_MIN_SIZE) {
+      OBJ tree_map = array_map_to_tree_map(map);
+      OBJ res = update_tree_map(get_tree_map_ptr(tree_map), key, value);
+      release(tree_map);
+      return res;
+    }
+  }
+
+  return update_array_map(map, key, value);
+}
+
+OBJ update_map_unique(OBJ map, OBJ key, OBJ value) {
+  assert(is_bin_rel(map));
+
+  if (is_unique(map)) {
+    OBJ_TYPE type = get_physical_type(map);
+
+    if (type == TYPE_MAP) {
+      BIN_REL_OBJ *ptr = get_bin_rel_ptr(map);
+      if (update_unique_array_map(ptr, key, value))
+        return make_map(ptr);
+    }
+    else if (type == TYPE_TREE_MAP) {
+      if (replace_unique_tree_map_value(get_tree_map_ptr(map), key, value)) {
+        release(key);
+        return map;
+      }
+    }
+  }
+
+  OBJ res = update_map(map, key, value);
+  release(map);
+  return res;
+}
+
+OBJ remove_map_key(OBJ map, OBJ key) {
+  assert(is_bin_rel(map));
+
+  if (is_empty_rel(map))
+    return map;
+
+  if (get_physical_type(map) == TYPE_TREE_MAP && is_in_normal_state())
+    return remove_tree_map_key(map, key);
+
+  return remove_array_map_key(map, key);
+}
@@ -0,0 +1,517 @@
+#include "lib.h"
+
+
+// Sequences are normally stored as a contiguous array of objects, so updating a single
+// element or concatenating two sequences means copying them (unless the left one can be
+// extended in place). Long sequences that are updated or concatenated are turned into
+// persistent trees instead, loosely modeled after RRB vectors: updates, concatenation
+// and slicing only create the nodes on the paths they touch, and share all other nodes
+// with the sequences they started from. Nodes are reference-counted like objects, and
+// leaves own a reference to their elements.
+//
+// Every inner node stores the end offset of each of its children, that is, the number
+// of elements in the subtrees of that child and all the ones that precede it, so that
+// nodes need not be full and the trees can be concatenated and sliced without moving
+// elements around, other than those in the leaves at the boundaries. All the leaves are
+// at the same depth. When two trees are joined the nodes along the seam are merged (or
+// their children redistributed) if they are not big enough, which keeps the trees shallow.
+//
+// Tree sequences have no array of objects, so, just like packed ones, they cannot be used
+// with get_seq_buffer_ptr(). at(), compute_hash_code(), comp_objs() and the update, join
+// and slice operations below work on the tree directly, SEQ_ITER iterates over it one leaf
+// at a time, finding each leaf from the root, and the operations that create an ordinary
+// sequence out of a tree one copy its elements straight from the leaves, with copy_seq_elems().
+// None of them allocates anything other than the result.
+//
+// Tree sequences are only created in normal state. In try state sequences are always
+// updated by copying them
+
+// Shorter sequences are always updated and concatenated by copying them
+const uint32 TREE_SEQ_MIN_LENGTH = 1024;
+
+const uint32 TREE_SEQ_LEAF_CAPACITY = 32;
+const uint32 TREE_SEQ_NODE_CAPACITY = 32;
+
+// Leaves on the seam of a concatenation that are smaller
+// than this are merged with their neighbour, or rebalanced
+const uint32 TREE_SEQ_LEAF_MIN_SIZE = TREE_SEQ_LEAF_CAPACITY / 2;
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Index of the child of an inner node whose subtree contains the element at <idx>
+static uint32 child_idx(TREE_SEQ_NODE *node, uint32 idx) {
+  uint32 *ends = get_tree_seq_node_ends(node);
+  uint32 low = 0;
+  uint32 high = node->count - 1;
+  while (low < high) {
+    uint32 middle = (low + high) / 2;
+    if (ends[middle] <= idx)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  return low;
+}
+
+// Index in the subtree of the node of the first element of the child at <idx>
+static uint32 child_offset(TREE_SEQ_NODE *node, uint32 idx) {
+  return idx > 0 ? get_tree_seq_node_ends(node)[idx - 1] : 0;
+}
+
+// Returns the leaf that contains the element at <idx>, and sets <idx> to its position in the leaf
+static TREE_SEQ_NODE *leaf_at(TREE_SEQ_NODE *node, uint32 &idx) {
+  while (node->height > 0) {
+    uint32 child = child_idx(node, idx);
+    idx -= child_offset(node, child);
+    node = get_tree_seq_node_children(node)[child];
+  }
+  return node;
+}
+
+static void add_ref(TREE_SEQ_NODE **nodes, uint32 count) {
+  for (uint32 i=0 ; i < count ; i++)
+    add_ref(&nodes[i]->ref_obj);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Takes ownership of the elements
+static TREE_SEQ_NODE *make_leaf(OBJ *elems, uint32 count) {
+  assert(count > 0 & count <= TREE_SEQ_LEAF_CAPACITY);
+
+  TREE_SEQ_NODE *leaf = new_tree_seq_node(count, 0);
+  leaf->size = count;
+  memcpy(leaf->elems, elems, count * sizeof(OBJ));
+  return leaf;
+}
+
+// Takes ownership of the children, which must all have the same height
+static TREE_SEQ_NODE *make_inner_node(TREE_SEQ_NODE **children, uint32 count) {
+  assert(count > 0 & count <= TREE_SEQ_NODE_CAPACITY);
+
+  TREE_SEQ_NODE *node = new_tree_seq_node(count, children[0]->height + 1);
+  TREE_SEQ_NODE **node_children = get_tree_seq_node_children(node);
+  uint32 *ends = get_tree_seq_node_ends(node);
+  uint32 size = 0;
+  for (uint32 i=0 ; i < count ; i++) {
+    TREE_SEQ_NODE *child = children[i];
+    assert(child->height + 1 == node->height);
+    node_children[i] = child;
+    size += child->size;
+    ends[i] = size;
+  }
+  node->size = size;
+  return node;
+}
+
+// Same as make_leaf(), but if there are too many elements for a single
+// leaf they are split in two, and the second one is stored in <sibling>
+static TREE_SEQ_NODE *make_leaves(OBJ *elems, uint32 count, TREE_SEQ_NODE *&sibling) {
+  if (count <= TREE_SEQ_LEAF_CAPACITY) {
+    sibling = NULL;
+    return make_leaf(elems, count);
+  }
+
+  uint32 half = count / 2;
+  sibling = make_leaf(elems + half, count - half);
+  return make_leaf(elems, half);
+}
+
+static TREE_SEQ_NODE *make_inner_nodes(TREE_SEQ_NODE **children, uint32 count, TREE_SEQ_NODE *&sibling) {
+  if (count <= TREE_SEQ_NODE_CAPACITY) {
+    sibling = NULL;
+    return make_inner_node(children, count);
+  }
+
+  uint32 half = count / 2;
+  sibling = make_inner_node(children + half, count - half);
+  return make_inner_node(children, half);
+}
+
+// Builds a tree out of the elements of a non-empty sequence, or of an array
+// of elements if <elems> is not NULL, and takes a reference to them
+static TREE_SEQ_NODE *build_tree(OBJ seq, OBJ *elems, uint32 len) {
+  assert(len > 0);
+
+  uint32 count = (len + TREE_SEQ_LEAF_CAPACITY - 1) / TREE_SEQ_LEAF_CAPACITY;
+  TREE_SEQ_NODE **nodes = (TREE_SEQ_NODE **) new_ptr_array(count);
+
+  for (uint32 i=0 ; i < count ; i++) {
+    uint32 offset = i * TREE_SEQ_LEAF_CAPACITY;
+    uint32 leaf_size = len - offset < TREE_SEQ_LEAF_CAPACITY ? len - offset : TREE_SEQ_LEAF_CAPACITY;
+    TREE_SEQ_NODE *leaf = new_tree_seq_node(leaf_size, 0);
+    leaf->size = leaf_size;
+    if (elems != NULL)
+      memcpy(leaf->elems, elems + offset, leaf_size * sizeof(OBJ));
+    else
+      copy_seq_elems(seq, offset, leaf_size, leaf->elems);
+    vec_add_ref(leaf->elems, leaf_size);
+    nodes[i] = leaf;
+  }
+
+  uint32 level_count = count;
+  while (level_count > 1) {
+    uint32 parents_count = (level_count + TREE_SEQ_NODE_CAPACITY - 1) / TREE_SEQ_NODE_CAPACITY;
+    for (uint32 i=0 ; i < parents_count ; i++) {
+      uint32 offset = i * TREE_SEQ_NODE_CAPACITY;
+      uint32 children_count = level_count - offset < TREE_SEQ_NODE_CAPACITY ? level_count - offset : TREE_SEQ_NODE_CAPACITY;
+      nodes[i] = make_inner_node(nodes + offset, children_count);
+    }
+    level_count = parents_count;
+  }
+
+  TREE_SEQ_NODE *root = nodes[0];
+  delete_ptr_array((void **) nodes, count);
+  return root;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Returns a copy of the subtree with the element at <idx> replaced by <value>
+static TREE_SEQ_NODE *update(TREE_SEQ_NODE *node, uint32 idx, OBJ value) {
+  uint32 count = node->count;
+
+  if (node->height == 0) {
+    OBJ new_elems[TREE_SEQ_LEAF_CAPACITY];
+    memcpy(new_elems, node->elems, count * sizeof(OBJ));
+    new_elems[idx] = value;
+    for (uint32 i=0 ; i < count ; i++)
+      if (i != idx)
+        add_ref(new_elems[i]);
+    return make_leaf(new_elems, count);
+  }
+
+  TREE_SEQ_NODE **children = get_tree_seq_node_children(node);
+  uint32 child = child_idx(node, idx);
+
+  TREE_SEQ_NODE *new_children[TREE_SEQ_NODE_CAPACITY];
+  memcpy(new_children, children, count * sizeof(TREE_SEQ_NODE *));
+  add_ref(new_children, child);
+  add_ref(new_children + child + 1, count - child - 1);
+  new_children[child] = update(children[child], idx - child_offset(node, child), value);
+
+  return make_inner_node(new_children, count);
+}
+
+// Same as update(), but takes over the reference to the subtree, and
+// modifies in place the nodes that nobody else holds a reference to
+static TREE_SEQ_NODE *update_unique(TREE_SEQ_NODE *node, uint32 idx, OBJ value) {
+  if (node->ref_obj.ref_count != 1) {
+    TREE_SEQ_NODE *copy = update(node, idx, value);
+    release_tree_seq_node(node);
+    return copy;
+  }
+
+  if (node->height == 0) {
+    release(node->elems[idx]);
+    node->elems[idx] = value;
+    return node;
+  }
+
+  TREE_SEQ_NODE **children = get_tree_seq_node_children(node);
+  uint32 child = child_idx(node, idx);
+  children[child] = update_unique(children[child], idx - child_offset(node, child), value);
+  return node;
+}
+
+// Returns the concatenation of the two subtrees, as a subtree as tall as the taller of the two.
+// If it has to be split in two, the second half is returned in <sibling>. Neither of the two
+// subtrees is consumed: the nodes that are shared with the result get a new reference
+static TREE_SEQ_NODE *join(TREE_SEQ_NODE *left, TREE_SEQ_NODE *right, TREE_SEQ_NODE *&sibling) {
+  uint32 left_count = left->count;
+  uint32 right_count = right->count;
+
+  if (left->height == 0 & right->height == 0) {
+    if (left_count >= TREE_SEQ_LEAF_MIN_SIZE & right_count >= TREE_SEQ_LEAF_MIN_SIZE) {
+      add_ref(&left->ref_obj);
+      add_ref(&right->ref_obj);
+      sibling = right;
+      return left;
+    }
+
+    OBJ new_elems[2 * TREE_SEQ_LEAF_CAPACITY];
+    memcpy(new_elems, left->elems, left_count * sizeof(OBJ));
+    memcpy(new_elems + left_count, right->elems, right_count * sizeof(OBJ));
+    vec_add_ref(new_elems, left_count + right_count);
+    return make_leaves(new_elems, left_count + right_count, sibling);
+  }
+
+  // Children of the resulting node(s), that is, all the children of the taller subtree(s),
+  // with the ones on the seam replaced by the result of joining them recursively
+  TREE_SEQ_NODE *new_children[2 * TREE_SEQ_NODE_CAPACITY];
+  uint32 new_count = 0;
+
+  TREE_SEQ_NODE *seam_sibling;
+
+  if (left->height > right->height) {
+    TREE_SEQ_NODE **children = get_tree_seq_node_children(left);
+    add_ref(children, left_count - 1);
+    memcpy(new_children, children, (left_count - 1) * sizeof(TREE_SEQ_NODE *));
+    new_count = left_count - 1;
+    new_children[new_count++] = join(children[left_count - 1], right, seam_sibling);
+    if (seam_sibling != NULL)
+      new_children[new_count++] = seam_sibling;
+  }
+  else if (left->height < right->height) {
+    TREE_SEQ_NODE **children = get_tree_seq_node_children(right);
+    new_children[new_count++] = join(left, children[0], seam_sibling);
+    if (seam_sibling != NULL)
+      new_children[new_count++] = seam_sibling;
+    add_ref(children + 1, right_count - 1);
+    memcpy(new_children + new_count, children + 1, (right_count - 1) * sizeof(TREE_SEQ_NODE *));
+    new_count += right_count - 1;
+  }
+  else {
+    TREE_SEQ_NODE **left_children = get_tree_seq_node_children(left);
+    TREE_SEQ_NODE **right_children = get_tree_seq_node_children(right);
+    add_ref(left_children, left_count - 1);
+    memcpy(new_children, left_children, (left_count - 1) * sizeof(TREE_SEQ_NODE *));
+    new_count = left_count - 1;
+    new_children[new_count++] = join(left_children[left_count - 1], right_children[0], seam_sibling);
+    if (seam_sibling != NULL)
+      new_children[new_count++] = seam_sibling;
+    add_ref(right_children + 1, right_count - 1);
+    memcpy(new_children + new_count, right_children + 1, (right_count - 1) * sizeof(TREE_SEQ_NODE *));
+    new_count += right_count - 1;
+  }
+
+  return make_inner_nodes(new_children, new_count, sibling);
+}
+
+// Returns the elements of the subtree in the range [first, end), as a subtree of the same height
+static TREE_SEQ_NODE *slice(TREE_SEQ_NODE *node, uint32 first, uint32 end) {
+  assert(first < end & end <= node->size);
+
+  if (first == 0 & end == node->size) {
+    add_ref(&node->ref_obj);
+    return node;
+  }
+
+  if (node->height == 0) {
+    vec_add_ref(node->elems + first, end - first);
+    return make_leaf(node->elems + first, end - first);
+  }
+
+  TREE_SEQ_NODE **children = get_tree_seq_node_children(node);
+  uint32 *ends = get_tree_seq_node_ends(node);
+  uint32 first_child = child_idx(node, first);
+  uint32 last_child = child_idx(node, end - 1);
+
+  TREE_SEQ_NODE *new_children[TREE_SEQ_NODE_CAPACITY];
+  for (uint32 i=first_child ; i <= last_child ; i++) {
+    uint32 offset = child_offset(node, i);
+    uint32 child_first = first > offset ? first - offset : 0;
+    uint32 child_end = (end < ends[i] ? end : ends[i]) - offset;
+    new_children[i - first_child] = slice(children[i], child_first, child_end);
+  }
+
+  return make_inner_node(new_children, last_child - first_child + 1);
+}
+
+// Copies the elements of the subtree in the range [first, end) to
+// <dest>, without taking a reference to them, and returns <dest> + end - first
+static OBJ *copy_elems(TREE_SEQ_NODE *node, uint32 first, uint32 end, OBJ *dest) {
+  assert(first < end & end <= node->size);
+
+  if (node->height == 0) {
+    memcpy(dest, node->elems + first, (end - first) * sizeof(OBJ));
+    return dest + end - first;
+  }
+
+  TREE_SEQ_NODE **children = get_tree_seq_node_children(node);
+  uint32 *ends = get_tree_seq_node_ends(node);
+  uint32 last_child = child_idx(node, end - 1);
+  for (uint32 i=child_idx(node, first) ; i <= last_child ; i++) {
+    uint32 offset = child_offset(node, i);
+    uint32 child_first = first > offset ? first - offset : 0;
+    uint32 child_end = (end < ends[i] ? end : ends[i]) - offset;
+    dest = copy_elems(children[i], child_first, child_end, dest);
+  }
+  return dest;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Takes ownership of the root
+static OBJ make_tree_seq(TREE_SEQ_NODE *root) {
+  while (root->height > 0 && root->count == 1) {
+    TREE_SEQ_NODE *child = get_tree_seq_node_children(root)[0];
+    add_ref(&child->ref_obj);
+    release_tree_seq_node(root);
+    root = child;
+  }
+
+  TREE_SEQ_OBJ *seq = new_tree_seq();
+  seq->root = root;
+  return make_tree_seq(seq, root->size);
+}
+
+// Returns a reference to the root of a tree with the same elements as a non-empty sequence,
+// which is built on the spot if the sequence is not already stored as a tree
+static TREE_SEQ_NODE *get_root(OBJ seq) {
+  if (get_physical_type(seq) == TYPE_TREE_SEQ) {
+    TREE_SEQ_NODE *root = get_tree_seq_ptr(seq)->root;
+    add_ref(&root->ref_obj);
+    return root;
+  }
+
+  return build_tree(seq, NULL, get_seq_length(seq));
+}
+
+static TREE_SEQ_NODE *join(TREE_SEQ_NODE *left, TREE_SEQ_NODE *right) {
+  TREE_SEQ_NODE *sibling;
+  TREE_SEQ_NODE *root = join(left, right, sibling);
+  if (sibling != NULL) {
+    TREE_SEQ_NODE *children[2] = {root, sibling};
+    root = make_inner_node(children, 2);
+  }
+  return root;
+}
+
+static void check_length(uint64 length) {
+  if (length > 0xFFFFFFF)
+    impl_fail("Maximum permitted sequence length (2^28-1) exceeded");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// True if the result of updating or extending <seq>, which has length <length>, should
+// be stored as a tree. Sequences that are already trees stay trees, but only in normal state
+bool use_tree_seq(OBJ seq, uint64 length) {
+  if (!is_in_normal_state())
+    return false;
+  return length >= TREE_SEQ_MIN_LENGTH || get_physical_type(seq) == TYPE_TREE_SEQ;
+}
+
+OBJ update_tree_seq_at(OBJ seq, uint32 idx, OBJ value) {
+  assert(is_in_normal_state() & idx < get_seq_length(seq));
+
+  TREE_SEQ_NODE *root = get_root(seq);
+  OBJ res = make_tree_seq(update(root, idx, value));
+  release_tree_seq_node(root);
+  return res;
+}
+
+// The sequence must be unique, and is updated in place
+OBJ update_unique_tree_seq_at(OBJ seq, uint32 idx, OBJ value) {
+  assert(is_unique(seq) & idx < get_seq_length(seq));
+
+  TREE_SEQ_OBJ *ptr = get_tree_seq_ptr(seq);
+  ptr->root = update_unique(ptr->root, idx, value);
+  return seq;
+}
+
+// Same as extend_sequence(), the new elements are not reference counted yet
+OBJ extend_tree_seq(OBJ seq, OBJ *new_elems, uint32 count) {
+  assert(is_in_normal_state() & !is_empty_seq(seq) & count > 0);
+  check_length((uint64) get_seq_length(seq) + count);
+
+  TREE_SEQ_NODE *left = get_root(seq);
+  TREE_SEQ_NODE *right = build_tree(make_empty_seq(), new_elems, count);
+  OBJ res = make_tree_seq(join(left, right));
+  release_tree_seq_node(left);
+  release_tree_seq_node(right);
+  return res;
+}
+
+OBJ join_tree_seqs(OBJ left, OBJ right) {
+  assert(is_in_normal_state() & !is_empty_seq(left) & !is_empty_seq(right));
+  check_length((uint64) get_seq_length(left) + get_seq_length(right));
+
+  TREE_SEQ_NODE *left_root = get_root(left);
+  TREE_SEQ_NODE *right_root = get_root(right);
+  OBJ res = make_tree_seq(join(left_root, right_root));
+  release_tree_seq_node(left_root);
+  release_tree_seq_node(right_root);
+  return res;
+}
+
+// Long slices share the nodes of the original tree, short ones are copied into a new array
+OBJ get_tree_seq_slice(OBJ seq, uint32 idx_first, uint32 len) {
+  TREE_SEQ_NODE *root = get_tree_seq_ptr(seq)->root;
+  assert(len > 0 & idx_first + len <= root->size);
+
+  if (len == root->size) {
+    add_ref(seq);
+    return seq;
+  }
+
+  if (len >= TREE_SEQ_MIN_LENGTH && is_in_normal_state())
+    return make_tree_seq(slice(root, idx_first, idx_first + len));
+
+  SEQ_OBJ *seq_ptr = new_seq(len);
+  copy_elems(root, idx_first, idx_first + len, seq_ptr->buffer);
+  vec_add_ref(seq_ptr->buffer, len);
+  return make_seq(seq_ptr, len);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Same as copy_seq_elems(), which calls it for tree sequences
+void copy_tree_seq_elems(OBJ seq, uint32 first, uint32 count, OBJ *dest) {
+  assert(count > 0 & first + count <= get_seq_length(seq));
+  copy_elems(get_tree_seq_ptr(seq)->root, first, first + count, dest);
+}
+
+// Returns a pointer to the elements of the sequence starting at the one at <idx>,
+// and sets <count> to the number of them that are stored contiguously from there
+static OBJ *get_elems_ptr(OBJ seq, uint32 idx, uint32 &count) {
+  if (get_physical_type(seq) != TYPE_TREE_SEQ) {
+    count = get_seq_length(seq) - idx;
+    return get_seq_buffer_ptr(seq) + idx;
+  }
+
+  TREE_SEQ_NODE *leaf = leaf_at(get_tree_seq_ptr(seq)->root, idx);
+  count = leaf->count - idx;
+  return leaf->elems + idx;
+}
+
+// Compares two sequences of the same length, at least one of which is a tree
+// sequence and neither of which is packed, going through the leaves one at a time
+int comp_tree_seqs(OBJ seq1, OBJ seq2) {
+  uint32 len = get_seq_length(seq1);
+  assert(len > 0 & get_seq_length(seq2) == len);
+
+  uint32 idx = 0;
+  while (idx < len) {
+    uint32 count1, count2;
+    OBJ *elems1 = get_elems_ptr(seq1, idx, count1);
+    OBJ *elems2 = get_elems_ptr(seq2, idx, count2);
+    uint32 count = count1 < count2 ? count1 : count2;
+    for (uint32 i=0 ; i < count ; i++) {
+      int cr = comp_objs(elems1[i], elems2[i]);
+      if (cr != 0)
+        return cr;
+    }
+    idx += count;
+  }
+
+  return 0;
+}
+
+OBJ tree_seq_at(TREE_SEQ_OBJ *seq, uint32 idx) {
+  assert(idx < seq->root->size);
+  TREE_SEQ_NODE *leaf = leaf_at(seq->root, idx);
+  return leaf->elems[idx];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Points the iterator to the leaf that contains the element at <it.idx>
+void load_tree_seq_iter_leaf(SEQ_ITER &it) {
+  assert(it.tree_root != NULL & it.idx < it.len);
+
+  uint32 idx = it.idx;
+  TREE_SEQ_NODE *leaf = leaf_at(it.tree_root, idx);
+  it.buffer = leaf->elems;
+  it.leaf_first = it.idx - idx;
+  it.leaf_end = it.leaf_first + leaf->count;
+}
+
+void get_tree_seq_iter(SEQ_ITER &it, TREE_SEQ_OBJ *seq) {
+  it.tree_root = seq->root;
+  it.packed = NULL;
+  it.idx = 0;
+  it.len = seq->root->size;
+  load_tree_seq_iter_leaf(it);
+}
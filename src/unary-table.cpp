@@ -1,17 +1,398 @@
 #include "lib.h"
 
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+
+const uint32 CHUNK_SIZE       = 65536;
+const uint32 BITMAP_WORDS     = CHUNK_SIZE / 64;
+const uint32 ARRAY_MAX_COUNT  = 4096;   // Above this size, a bitmap takes less memory than an array
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Returns the index of the first nonzero word in bitmap[idx .. count), or count if there's none
+static uint32 next_nonzero_word(const uint64 *bitmap, uint32 idx, uint32 count) {
+#ifdef __AVX2__
+  // Skipping over empty runs of 256 bits at a time
+  while (idx + 4 <= count) {
+    __m256i words = _mm256_loadu_si256((const __m256i *) (bitmap + idx));
+    if (!_mm256_testz_si256(words, words))
+      break;
+    idx += 4;
+  }
+#endif
+  while (idx < count && bitmap[idx] == 0)
+    idx++;
+  return idx;
+}
+
+// Returns the first value >= <value> that is in the chunk bitmap, or CHUNK_SIZE if there's none
+static uint32 next_set_bit(const uint64 *bitmap, uint32 value) {
+  if (value >= CHUNK_SIZE)
+    return CHUNK_SIZE;
+  uint32 idx = value / 64;
+  uint64 word = bitmap[idx] & (0xFFFFFFFFFFFFFFFFULL << (value % 64));
+  if (word == 0) {
+    idx = next_nonzero_word(bitmap, idx + 1, BITMAP_WORDS);
+    if (idx == BITMAP_WORDS)
+      return CHUNK_SIZE;
+    word = bitmap[idx];
+  }
+  return 64 * idx + __builtin_ctzll(word);
+}
+
+// Returns the first value >= <value> that is not in the chunk bitmap, or CHUNK_SIZE if there's none
+static uint32 next_clear_bit(const uint64 *bitmap, uint32 value) {
+  for (uint32 idx=value/64 ; idx < BITMAP_WORDS ; idx++) {
+    uint64 word = ~bitmap[idx];
+    if (idx == value / 64)
+      word &= 0xFFFFFFFFFFFFFFFFULL << (value % 64);
+    if (word != 0)
+      return 64 * idx + __builtin_ctzll(word);
+  }
+  return CHUNK_SIZE;
+}
+
+static void set_bit_range(uint64 *bitmap, uint32 first, uint32 last) {
+  for (uint32 idx=first/64 ; idx <= last/64 ; idx++) {
+    uint64 mask = 0xFFFFFFFFFFFFFFFFULL;
+    if (idx == first / 64)
+      mask &= 0xFFFFFFFFFFFFFFFFULL << (first % 64);
+    if (idx == last / 64)
+      mask &= 0xFFFFFFFFFFFFFFFFULL >> (63 - last % 64);
+    bitmap[idx] |= mask;
+  }
+}
+
+static uint32 bitmap_count(const uint64 *bitmap) {
+  uint32 count = 0;
+  for (uint32 i=0 ; i < BITMAP_WORDS ; i++)
+    count += __builtin_popcountll(bitmap[i]);
+  return count;
+}
+
+// A run starts at each set bit whose predecessor is not set
+static uint32 bitmap_runs_count(const uint64 *bitmap) {
+  uint32 count = 0;
+  uint64 carry = 0;
+  for (uint32 i=0 ; i < BITMAP_WORDS ; i++) {
+    uint64 word = bitmap[i];
+    count += __builtin_popcountll(word & ~((word << 1) | carry));
+    carry = word >> 63;
+  }
+  return count;
+}
+
+static uint32 array_runs_count(const uint16 *values, uint32 count) {
+  uint32 runs_count = count > 0 ? 1 : 0;
+  for (uint32 i=1 ; i < count ; i++)
+    if (values[i] != values[i-1] + 1)
+      runs_count++;
+  return runs_count;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void chunk_to_bitmap(UNARY_CHUNK &chunk, uint64 *bitmap) {
+  if (chunk.type == BITMAP_CHUNK) {
+    memcpy(bitmap, chunk.bitmap, BITMAP_WORDS * sizeof(uint64));
+    return;
+  }
+
+  memset(bitmap, 0, BITMAP_WORDS * sizeof(uint64));
+  if (chunk.type == ARRAY_CHUNK) {
+    uint16 *values = chunk.array;
+    uint32 count = chunk.count;
+    for (uint32 i=0 ; i < count ; i++)
+      bitmap[values[i] / 64] |= 1ULL << (values[i] % 64);
+  }
+  else {
+    assert(chunk.type == RUN_CHUNK);
+    uint16 *runs = chunk.runs;
+    uint32 runs_count = chunk.runs_count;
+    for (uint32 i=0 ; i < runs_count ; i++)
+      set_bit_range(bitmap, runs[2 * i], runs[2 * i] + runs[2 * i + 1]);
+  }
+}
+
+// Stores the <count> sorted values in <values> into the chunk, as either an array or a list
+// of runs. <values> must have been allocated with malloc(), and the chunk takes ownership of it
+static void chunk_set_array(UNARY_CHUNK &chunk, uint16 *values, uint32 count) {
+  assert(count > 0 && count <= ARRAY_MAX_COUNT);
+
+  uint32 runs_count = array_runs_count(values, count);
+  if (2 * runs_count < count) {
+    uint16 *runs = (uint16 *) malloc(2 * runs_count * sizeof(uint16));
+    uint32 run_idx = 0;
+    for (uint32 i=0 ; i < count ; ) {
+      uint32 j = i + 1;
+      while (j < count && values[j] == values[j-1] + 1)
+        j++;
+      runs[2 * run_idx] = values[i];
+      runs[2 * run_idx + 1] = j - i - 1;
+      run_idx++;
+      i = j;
+    }
+    assert(run_idx == runs_count);
+    free(values);
+    chunk.runs = runs;
+    chunk.runs_count = runs_count;
+    chunk.type = RUN_CHUNK;
+  }
+  else {
+    chunk.array = (uint16 *) realloc(values, count * sizeof(uint16));
+    chunk.runs_count = 0;
+    chunk.type = ARRAY_CHUNK;
+  }
+  chunk.count = count;
+}
+
+// Stores the content of <bitmap> into the chunk, choosing the representation that
+// takes less memory. The chunk's previous data must have already been released.
+// If <owned> is true <bitmap> was allocated with malloc(), and the chunk takes
+// ownership of it, otherwise it's copied if needed
+static void chunk_set_bitmap(UNARY_CHUNK &chunk, uint64 *bitmap, bool owned) {
+  uint32 count = bitmap_count(bitmap);
+  if (count == 0) {
+    if (owned)
+      free(bitmap);
+    chunk.array = NULL;
+    chunk.count = 0;
+    chunk.runs_count = 0;
+    chunk.type = ARRAY_CHUNK;
+    return;
+  }
+
+  uint32 runs_count = bitmap_runs_count(bitmap);
+  uint32 array_size = count <= ARRAY_MAX_COUNT ? 2 * count : 8 * BITMAP_WORDS;
+
+  if (4 * runs_count < array_size) {
+    uint16 *runs = (uint16 *) malloc(2 * runs_count * sizeof(uint16));
+    uint32 run_idx = 0;
+    for (uint32 first=next_set_bit(bitmap, 0) ; first < CHUNK_SIZE ; ) {
+      uint32 end = next_clear_bit(bitmap, first);
+      runs[2 * run_idx] = first;
+      runs[2 * run_idx + 1] = end - first - 1;
+      run_idx++;
+      first = next_set_bit(bitmap, end);
+    }
+    assert(run_idx == runs_count);
+    if (owned)
+      free(bitmap);
+    chunk.runs = runs;
+    chunk.runs_count = runs_count;
+    chunk.type = RUN_CHUNK;
+  }
+  else if (count <= ARRAY_MAX_COUNT) {
+    uint16 *values = (uint16 *) malloc(count * sizeof(uint16));
+    uint32 idx = 0;
+    for (uint32 i=next_nonzero_word(bitmap, 0, BITMAP_WORDS) ; i < BITMAP_WORDS ; i=next_nonzero_word(bitmap, i+1, BITMAP_WORDS)) {
+      uint64 word = bitmap[i];
+      do {
+        values[idx++] = 64 * i + __builtin_ctzll(word);
+        word &= word - 1;
+      } while (word != 0);
+    }
+    assert(idx == count);
+    if (owned)
+      free(bitmap);
+    chunk.array = values;
+    chunk.runs_count = 0;
+    chunk.type = ARRAY_CHUNK;
+  }
+  else {
+    if (!owned) {
+      uint64 *copy = (uint64 *) malloc(BITMAP_WORDS * sizeof(uint64));
+      memcpy(copy, bitmap, BITMAP_WORDS * sizeof(uint64));
+      bitmap = copy;
+    }
+    chunk.bitmap = bitmap;
+    chunk.runs_count = 0;
+    chunk.type = BITMAP_CHUNK;
+  }
+  chunk.count = count;
+}
+
+static bool chunk_contains(UNARY_CHUNK &chunk, uint32 value) {
+  if (chunk.type == ARRAY_CHUNK)
+    return std::binary_search(chunk.array, chunk.array + chunk.count, value);
+
+  if (chunk.type == BITMAP_CHUNK)
+    return (chunk.bitmap[value / 64] >> (value % 64)) & 1;
+
+  assert(chunk.type == RUN_CHUNK);
+  uint16 *runs = chunk.runs;
+  uint32 low = 0;
+  uint32 high = chunk.runs_count;
+  while (low < high) {
+    uint32 middle = (low + high) / 2;
+    if (runs[2 * middle] <= value)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  return low > 0 && value <= runs[2 * (low - 1)] + runs[2 * (low - 1) + 1];
+}
+
+// <deletes> are the sorted full values to remove from the chunk, possibly with duplicates.
+// The ones that are not removed (because they're not in the chunk, or are duplicates) are
+// set to 0xFFFFFFFF. The chunk is left empty if all its values are removed
+static void chunk_delete(UNARY_CHUNK &chunk, uint32 *deletes, uint32 count) {
+  if (chunk.type == ARRAY_CHUNK) {
+    uint16 *values = chunk.array;
+    uint32 size = chunk.count;
+    uint32 j = 0;
+    uint32 new_size = 0;
+    for (uint32 i=0 ; i < count ; i++) {
+      uint16 value = deletes[i];
+      while (j < size && values[j] < value)
+        values[new_size++] = values[j++];
+      if (j < size && values[j] == value)
+        j++;
+      else
+        deletes[i] = 0xFFFFFFFFU;
+    }
+    while (j < size)
+      values[new_size++] = values[j++];
+
+    if (new_size > 0) {
+      chunk_set_array(chunk, values, new_size);
+    }
+    else {
+      free(values);
+      chunk.array = NULL;
+      chunk.count = 0;
+    }
+    return;
+  }
+
+  uint64 buffer[BITMAP_WORDS];
+  bool owned = chunk.type == BITMAP_CHUNK;
+  uint64 *bitmap = owned ? chunk.bitmap : buffer;
+  if (!owned) {
+    chunk_to_bitmap(chunk, buffer);
+    free(chunk.runs);
+  }
+
+  for (uint32 i=0 ; i < count ; i++) {
+    uint16 value = deletes[i];
+    uint64 mask = 1ULL << (value % 64);
+    uint64 word = bitmap[value / 64];
+    if (word & mask)
+      bitmap[value / 64] = word & ~mask;
+    else
+      deletes[i] = 0xFFFFFFFFU;
+  }
+
+  chunk_set_bitmap(chunk, bitmap, owned);
+}
+
+// <inserts> are the sorted, duplicate-free full values to add to the chunk.
+// The ones that were already in the chunk are set to 0xFFFFFFFF
+static void chunk_insert(UNARY_CHUNK &chunk, uint32 *inserts, uint32 count) {
+  if (chunk.type == ARRAY_CHUNK && chunk.count + count <= ARRAY_MAX_COUNT) {
+    uint16 *values = chunk.array;
+    uint32 size = chunk.count;
+    uint16 *new_values = (uint16 *) malloc((size + count) * sizeof(uint16));
+    uint32 j = 0;
+    uint32 new_size = 0;
+    for (uint32 i=0 ; i < count ; i++) {
+      uint16 value = inserts[i];
+      while (j < size && values[j] < value)
+        new_values[new_size++] = values[j++];
+      if (j < size && values[j] == value) {
+        inserts[i] = 0xFFFFFFFFU;
+        j++;
+      }
+      new_values[new_size++] = value;
+    }
+    while (j < size)
+      new_values[new_size++] = values[j++];
+    free(values);
+    chunk_set_array(chunk, new_values, new_size);
+    return;
+  }
+
+  uint64 buffer[BITMAP_WORDS];
+  bool owned = chunk.type == BITMAP_CHUNK;
+  uint64 *bitmap = owned ? chunk.bitmap : buffer;
+  if (!owned) {
+    chunk_to_bitmap(chunk, buffer);
+    free(chunk.array);
+  }
+
+  for (uint32 i=0 ; i < count ; i++) {
+    uint16 value = inserts[i];
+    uint64 mask = 1ULL << (value % 64);
+    uint64 word = bitmap[value / 64];
+    if (word & mask)
+      inserts[i] = 0xFFFFFFFFU;
+    else
+      bitmap[value / 64] = word | mask;
+  }
+
+  chunk_set_bitmap(chunk, bitmap, owned);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Returns the index of the first chunk whose key is not lower than <key>
+static uint32 find_chunk(UNARY_TABLE *table, uint32 key) {
+  UNARY_CHUNK *chunks = table->chunks;
+  uint32 low = 0;
+  uint32 high = table->chunks_count;
+  while (low < high) {
+    uint32 middle = (low + high) / 2;
+    if (chunks[middle].key < key)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  return low;
+}
+
+static void insert_chunk(UNARY_TABLE *table, uint32 idx, uint32 key) {
+  uint32 chunks_count = table->chunks_count;
+  if (chunks_count == table->capacity) {
+    uint32 capacity = chunks_count > 0 ? 2 * chunks_count : 4;
+    table->chunks = (UNARY_CHUNK *) realloc(table->chunks, capacity * sizeof(UNARY_CHUNK));
+    table->capacity = capacity;
+  }
+  UNARY_CHUNK *chunks = table->chunks;
+  memmove(chunks + idx + 1, chunks + idx, (chunks_count - idx) * sizeof(UNARY_CHUNK));
+  table->chunks_count = chunks_count + 1;
+
+  UNARY_CHUNK &chunk = chunks[idx];
+  chunk.array = NULL;
+  chunk.count = 0;
+  chunk.runs_count = 0;
+  chunk.key = key;
+  chunk.type = ARRAY_CHUNK;
+}
+
+static void remove_chunk(UNARY_TABLE *table, uint32 idx) {
+  UNARY_CHUNK *chunks = table->chunks;
+  uint32 chunks_count = table->chunks_count - 1;
+  assert(chunks[idx].count == 0 && chunks[idx].array == NULL);
+  memmove(chunks + idx, chunks + idx + 1, (chunks_count - idx) * sizeof(UNARY_CHUNK));
+  table->chunks_count = chunks_count;
+}
+
+////////////////////////////////////////////////////////////////////////////////
 
 void unary_table_init(UNARY_TABLE *table) {
-  const uint32 INIT_SIZE = 1024;
-  uint64 *bitmap = (uint64 *) malloc(INIT_SIZE/8);
-  memset(bitmap, 0, INIT_SIZE/8);
-  table->bitmap = bitmap;
-  table->size = INIT_SIZE;
+  table->chunks = NULL;
+  table->chunks_count = 0;
+  table->capacity = 0;
   table->count = 0;
 }
 
 void unary_table_cleanup(UNARY_TABLE *table) {
-  free(table->bitmap);
+  uint32 chunks_count = table->chunks_count;
+  for (uint32 i=0 ; i < chunks_count ; i++)
+    free(table->chunks[i].array);
+  free(table->chunks);
 }
 
 void unary_table_updates_init(UNARY_TABLE_UPDATES *table) {
@@ -30,20 +411,22 @@ void unary_table_updates_cleanup(UNARY_TABLE_UPDATES *table) {
 ////////////////////////////////////////////////////////////////////////////////
 
 bool unary_table_contains(UNARY_TABLE *table, uint32 value) {
-  assert(value < table->size);
-
-  uint64 *bitmap = table->bitmap;
-  uint32 idx = value >> 6;
-  uint64 mask = 1ULL << (value % 64);
-  return bitmap[idx] & mask;
+  uint32 key = value >> 16;
+  uint32 idx = find_chunk(table, key);
+  if (idx == table->chunks_count)
+    return false;
+  UNARY_CHUNK &chunk = table->chunks[idx];
+  return chunk.key == key && chunk_contains(chunk, value & 0xFFFF);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
 // Returns new capacity
-uint32 unary_table_updates_resize(UNARY_TABLE_UPDATES *updates) {
+uint32 unary_table_updates_resize(UNARY_TABLE_UPDATES *updates, uint32 min_capacity) {
   uint32 capacity = updates->capacity;
   uint32 new_capacity = capacity > 0 ? 2 * capacity : 32;
+  while (new_capacity < min_capacity)
+    new_capacity *= 2;
   uint32 *new_buffer = (uint32 *) malloc(new_capacity * sizeof(uint32));
   // uint32 *new_buffer = new_uint32_array(new_capacity);
 
@@ -74,7 +457,7 @@ void unary_table_insert(UNARY_TABLE_UPDATES *updates, uint32 value) {
   uint32 inserts_count = updates->inserts_count;
 
   if (deletes_count + inserts_count >= capacity)
-    capacity = unary_table_updates_resize(updates);
+    capacity = unary_table_updates_resize(updates, 0);
 
   uint32 *next_slot = updates->buffer + capacity - 1 - inserts_count;
   *next_slot = value;
@@ -87,7 +470,7 @@ void unary_table_delete(UNARY_TABLE *, UNARY_TABLE_UPDATES *updates, uint32 valu
   uint32 inserts_count = updates->inserts_count;
 
   if (deletes_count + inserts_count >= capacity)
-    capacity = unary_table_updates_resize(updates);
+    capacity = unary_table_updates_resize(updates, 0);
 
   uint32 *next_slot = updates->buffer + deletes_count;
   *next_slot = value;
@@ -95,70 +478,83 @@ void unary_table_delete(UNARY_TABLE *, UNARY_TABLE_UPDATES *updates, uint32 valu
 }
 
 void unary_table_clear(UNARY_TABLE *table, UNARY_TABLE_UPDATES *updates) {
-  uint64 *bitmap = table->bitmap;
-  uint32 cell_count = table->size / 64;
-  for (int i=0 ; i < cell_count ; i++) {
-    uint64 cell = bitmap[i];
-    for (int j=0 ; j < 64 ; j++)
-      if ((cell >> j) & 1)
-        unary_table_delete(table, updates, 64 * i + j);
-  }
+  uint32 count = table->count;
+  if (count == 0)
+    return;
+
+  uint32 deletes_count = updates->deletes_count;
+  uint32 min_capacity = deletes_count + updates->inserts_count + count;
+  if (min_capacity > updates->capacity)
+    unary_table_updates_resize(updates, min_capacity);
+
+  UNARY_TABLE_ITER iter;
+  unary_table_get_iter(table, &iter);
+  uint32 stored = unary_table_iter_next_block(&iter, updates->buffer + deletes_count, count);
+  assert(stored == count && unary_table_iter_is_out_of_range(&iter));
+  updates->deletes_count = deletes_count + count;
 }
 
 bool unary_table_updates_check(UNARY_TABLE *table, UNARY_TABLE_UPDATES *updates) {
   return true;
 }
 
+// Both deletes and inserts are sorted first, so that
+// each affected chunk is updated only once
 void unary_table_updates_apply(UNARY_TABLE *table, UNARY_TABLE_UPDATES *updates, VALUE_STORE *vs) {
   uint32 inserts_count = updates->inserts_count;
   uint32 deletes_count = updates->deletes_count;
 
   if (deletes_count > 0) {
     uint32 *deletes = updates->buffer;
-    uint64 *bitmap = table->bitmap;
-    for (uint32 i=0 ; i < deletes_count ; i++) {
-      uint32 value = deletes[i];
-      uint32 idx = value >> 6;
-      uint64 mask = 1ULL << (value % 64);
-      uint64 cell = bitmap[idx];
-      if (cell & mask) {
-        cell &= ~mask;
-        bitmap[idx] = cell;
-        table->count--;
+    std::sort(deletes, deletes + deletes_count);
+    for (uint32 i=0 ; i < deletes_count ; ) {
+      uint32 key = deletes[i] >> 16;
+      uint32 j = i + 1;
+      while (j < deletes_count && deletes[j] >> 16 == key)
+        j++;
+
+      uint32 idx = find_chunk(table, key);
+      if (idx < table->chunks_count && table->chunks[idx].key == key) {
+        UNARY_CHUNK &chunk = table->chunks[idx];
+        uint32 count = chunk.count;
+        chunk_delete(chunk, deletes + i, j - i);
+        table->count -= count - chunk.count;
+        if (chunk.count == 0)
+          remove_chunk(table, idx);
       }
-      else
-        deletes[i] = 0xFFFFFFFFU;
+      else {
+        for (uint32 k=i ; k < j ; k++)
+          deletes[k] = 0xFFFFFFFFU;
+      }
+
+      i = j;
     }
   }
 
   if (inserts_count > 0) {
     uint32 *inserts = updates->buffer + updates->capacity - inserts_count;
-    uint32 max_val = *std::max_element(inserts, inserts + inserts_count);
-    uint32 size = table->size;
-    uint64 *bitmap = table->bitmap;
-    if (max_val >= size) {
-      // Reallocating the table
-      uint32 new_size = 2 * size;
-      while (max_val >= new_size)
-        new_size *= 2;
-      uint64 *bitmap = (uint64 *) realloc(bitmap, new_size / 8);
-      memset(bitmap + (size / 64), 0, (new_size - size) / 8);
-      size = new_size;
-      table->size = size;
-      table->bitmap = bitmap;
-    }
-
-    for (uint32 i=0 ; i < inserts_count ; i++) {
-      uint32 value = inserts[i];
-      uint32 idx = value >> 6;
-      uint64 mask = 1ULL << (value % 64);
-      uint64 cell = bitmap[idx];
-      if (!(cell & mask)) {
-        cell |= mask;
-        bitmap[idx] = cell;
-        table->count++;
-        value_store_add_ref(vs, value);
-      }
+    std::sort(inserts, inserts + inserts_count);
+    uint32 count = std::unique(inserts, inserts + inserts_count) - inserts;
+
+    for (uint32 i=0 ; i < count ; ) {
+      uint32 key = inserts[i] >> 16;
+      uint32 j = i + 1;
+      while (j < count && inserts[j] >> 16 == key)
+        j++;
+
+      uint32 idx = find_chunk(table, key);
+      if (idx == table->chunks_count || table->chunks[idx].key != key)
+        insert_chunk(table, idx, key);
+      UNARY_CHUNK &chunk = table->chunks[idx];
+      uint32 chunk_count = chunk.count;
+      chunk_insert(chunk, inserts + i, j - i);
+      table->count += chunk.count - chunk_count;
+
+      for (uint32 k=i ; k < j ; k++)
+        if (inserts[k] != 0xFFFFFFFFU)
+          value_store_add_ref(vs, inserts[k]);
+
+      i = j;
     }
   }
 }
@@ -183,88 +579,136 @@ void unary_table_updates_finish(UNARY_TABLE_UPDATES *updates, VALUE_STORE *vs) {
 
 ////////////////////////////////////////////////////////////////////////////////
 
+// Positions the iterator on the first value of the current chunk, if there's one
+static void unary_table_iter_start_chunk(UNARY_TABLE_ITER *iter) {
+  UNARY_CHUNK *chunk = iter->chunk;
+  if (chunk == iter->end_chunk)
+    return;
+
+  iter->idx = 0;
+  if (chunk->type == ARRAY_CHUNK)
+    iter->curr_value = chunk->array[0];
+  else if (chunk->type == BITMAP_CHUNK)
+    iter->curr_value = next_set_bit(chunk->bitmap, 0);
+  else
+    iter->curr_value = chunk->runs[0];
+}
+
 void unary_table_get_iter(UNARY_TABLE *table, UNARY_TABLE_ITER *iter) {
-  if (table->count != 0) {
-    uint64 *bitmap = table->bitmap;
-    uint32 size = table->size;
-
-    iter->bitmap = bitmap;
-    iter->size = size;
-
-    uint32 cell_count = size / 64;
-    for (uint32 i=0 ; i < cell_count ; i++) {
-      uint64 cell = bitmap[i];
-      if (cell != 0)
-        for (int j=0 ; j < 64 ; j++)
-          if (((cell >> j) & 1) != 0) {
-            iter->curr_value = 64 * i + j;
-            return;
-          }
-    }
-    internal_fail();
-  }
-  else {
-    iter->bitmap = NULL;
-    iter->size = 0;
-    iter->curr_value = 0;
-  }
+  iter->chunk = table->chunks;
+  iter->end_chunk = table->chunks + table->chunks_count;
+  iter->idx = 0;
+  iter->curr_value = 0;
+  unary_table_iter_start_chunk(iter);
 }
 
 uint32 unary_table_iter_get_field(UNARY_TABLE_ITER *iter) {
   assert(!unary_table_iter_is_out_of_range(iter));
 
-  return iter->curr_value;
+  return (iter->chunk->key << 16) | iter->curr_value;
 }
 
 void unary_table_iter_next(UNARY_TABLE_ITER *iter) {
   assert(!unary_table_iter_is_out_of_range(iter));
 
-  uint64 *bitmap = iter->bitmap;
-  uint32 size = iter->size;
-  uint32 curr_value = iter->curr_value;
+  UNARY_CHUNK *chunk = iter->chunk;
+  uint8 type = chunk->type;
 
-  uint32 cell_count = size / 64;
+  if (type == ARRAY_CHUNK) {
+    uint32 idx = iter->idx + 1;
+    if (idx < chunk->count) {
+      iter->idx = idx;
+      iter->curr_value = chunk->array[idx];
+      return;
+    }
+  }
+  else if (type == BITMAP_CHUNK) {
+    uint32 value = next_set_bit(chunk->bitmap, iter->curr_value + 1);
+    if (value < CHUNK_SIZE) {
+      iter->curr_value = value;
+      return;
+    }
+  }
+  else {
+    uint16 *runs = chunk->runs;
+    uint32 idx = iter->idx;
+    if (iter->curr_value < runs[2 * idx] + runs[2 * idx + 1]) {
+      iter->curr_value++;
+      return;
+    }
+    if (++idx < chunk->runs_count) {
+      iter->idx = idx;
+      iter->curr_value = runs[2 * idx];
+      return;
+    }
+  }
 
-  uint32 idx = curr_value / 64;
-  uint32 offset = curr_value % 64 + 1;
+  iter->chunk++;
+  unary_table_iter_start_chunk(iter);
+}
 
-  uint64 cell = bitmap[idx];
-  if (cell >> offset != 0) {
-    for (int i=offset ; i < 64 ; i++)
-      if (((cell >> i) & 1) != 0) {
-        iter->curr_value = 64 * idx + i;
-        return;
+// Stores into <values> the current value and the ones that follow it, up to
+// a maximum of <capacity>, and moves the iterator past them.
+// Returns the number of values stored, which is 0 only if the iterator is out of range
+uint32 unary_table_iter_next_block(UNARY_TABLE_ITER *iter, uint32 *values, uint32 capacity) {
+  uint32 stored = 0;
+  while (stored < capacity && !unary_table_iter_is_out_of_range(iter)) {
+    UNARY_CHUNK *chunk = iter->chunk;
+    uint32 high = chunk->key << 16;
+
+    if (chunk->type == ARRAY_CHUNK) {
+      uint32 idx = iter->idx;
+      uint32 count = std::min(chunk->count - idx, capacity - stored);
+      uint16 *array = chunk->array + idx;
+      for (uint32 i=0 ; i < count ; i++)
+        values[stored++] = high | array[i];
+      if (idx + count < chunk->count) {
+        iter->idx = idx + count;
+        iter->curr_value = chunk->array[idx + count];
+        return stored;
       }
-    internal_fail();
-  }
-
-  for (uint32 i=idx+1 ; i < cell_count ; i++) {
-    cell = bitmap[i];
-    if (cell != 0)
-      for (int j=0 ; j < 64 ; j++)
-        if (((cell >> j) & 1) != 0) {
-          iter->curr_value = 64 * i + j;
-          return;
+    }
+    else if (chunk->type == BITMAP_CHUNK) {
+      uint64 *bitmap = chunk->bitmap;
+      uint32 value = iter->curr_value;
+      uint32 idx = value / 64;
+      uint64 word = bitmap[idx] & (0xFFFFFFFFFFFFFFFFULL << (value % 64));
+      for ( ; ; ) {
+        while (word != 0) {
+          if (stored == capacity) {
+            iter->curr_value = 64 * idx + __builtin_ctzll(word);
+            return stored;
+          }
+          values[stored++] = high | (64 * idx + __builtin_ctzll(word));
+          word &= word - 1;
         }
-  }
+        idx = next_nonzero_word(bitmap, idx + 1, BITMAP_WORDS);
+        if (idx == BITMAP_WORDS)
+          break;
+        word = bitmap[idx];
+      }
+    }
+    else {
+      do {
+        values[stored++] = unary_table_iter_get_field(iter);
+        unary_table_iter_next(iter);
+      } while (stored < capacity && iter->chunk == chunk);
+      continue;
+    }
 
-  iter->bitmap = NULL;
-  iter->size = 0;
-  iter->curr_value = 0;
+    iter->chunk++;
+    unary_table_iter_start_chunk(iter);
+  }
+  return stored;
 }
 
 bool unary_table_iter_is_out_of_range(UNARY_TABLE_ITER *iter) {
-  return iter->bitmap == NULL;
+  return iter->chunk == iter->end_chunk;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
 OBJ copy_unary_table(UNARY_TABLE *table, VALUE_STORE *vs) {
-  assert(table->size % 64 == 0);
-
-  OBJ *slots = value_store_slot_array(vs);
-  uint64 *bitmap = table->bitmap;
-  uint32 size = table->size;
   uint32 count = table->count;
 
   if (count == 0)
@@ -273,15 +717,17 @@ OBJ copy_unary_table(UNARY_TABLE *table, VALUE_STORE *vs) {
   SET_OBJ *set = new_set(count);
   OBJ *buffer = set->buffer;
 
+  uint32 surrs[256];
   uint32 idx = 0;
-  for (uint32 i=0 ; i < size/64 ; i++) {
-    uint64 word = bitmap[i];
-    for (int j=0 ; j < 64 ; j++)
-      if ((word >> j) & 1) {
-        OBJ obj = slots[64 * i + j];
-        add_ref(obj);
-        buffer[idx++] = obj;
-      }
+  UNARY_TABLE_ITER iter;
+  unary_table_get_iter(table, &iter);
+  for ( ; ; ) {
+    uint32 block_size = unary_table_iter_next_block(&iter, surrs, 256);
+    if (block_size == 0)
+      break;
+    for (uint32 i=0 ; i < block_size ; i++) {
+      buffer[idx++] = lookup_surrogate(vs, surrs[i]);
+    }
   }
   assert(idx == count);
 
@@ -299,15 +745,10 @@ void set_unary_table(UNARY_TABLE *table, UNARY_TABLE_UPDATES *updates, VALUE_STO
 
   SET_OBJ *ptr = get_set_ptr(set);
   uint32 size = ptr->size;
-  OBJ *buffer = ptr->buffer;
-
-  for (uint32 i=0 ; i < size ; i++) {
-    OBJ obj = buffer[i];
-    uint32 ref = lookup_value_ex(vs, vsu, obj);
-    if (ref == -1) {
-      add_ref(obj);
-      ref = value_store_insert(vs, vsu, obj);
-    }
-    unary_table_insert(updates, ref);
-  }
+
+  std::vector<uint32> surrs(size);
+  value_store_lookup_or_insert_batch(vs, vsu, ptr->buffer, size, &surrs.front());
+
+  for (uint32 i=0 ; i < size ; i++)
+    unary_table_insert(updates, surrs[i]);
 }
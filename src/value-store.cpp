@@ -1,47 +1,48 @@
 #include "lib.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
-struct NODE {
-  uint32 next;
-  uint32 hash_code;
-};
 
+// The hash index is an open addressing table with twice as many buckets as there are
+// slots, searched 16 buckets at a time. Each bucket has a control byte, which is
+// either EMPTY, DELETED or a 7-bit fingerprint of the hash code of the value it
+// points to, and the index of that value's slot
 
-NODE node(uint32 next_node, uint32 hash_code) {
-  NODE node;
-  node.next = next_node;
-  node.hash_code = hash_code;
-  return node;
-}
+const uint8 EMPTY_BUCKET    = 0x80;
+const uint8 DELETED_BUCKET  = 0xFE;
 
-NODE empty_node() {
-  return node(0xFFFFFFFFU, 0xFFFFFFFFU);
-}
+const uint32 GROUP_SIZE = 16;
 
 ////////////////////////////////////////////////////////////////////////////////
 
-const int BYTES_PER_ENTRY         = sizeof(OBJ) + sizeof(NODE) + sizeof(uint32) + sizeof(uint32);
-const int UPDATE_BYTES_PER_ENTRY  = sizeof(OBJ) + sizeof(NODE) + sizeof(uint32) + sizeof(uint32);
+const int BYTES_PER_ENTRY         = sizeof(OBJ) + sizeof(uint32) + sizeof(uint32) + 2 * (sizeof(uint8) + sizeof(uint32));
+const int UPDATE_BYTES_PER_ENTRY  = sizeof(OBJ) + sizeof(uint32) + sizeof(uint32) + 2 * (sizeof(uint8) + sizeof(uint32));
 
 
 OBJ *slot_array(void *ptr) {
   return (OBJ *) ptr;
 }
 
-NODE *node_array(void *ptr, uint32 capacity) {
-  return (NODE *)(slot_array(ptr) + capacity);
-}
-
-uint32 *hashtable_ptr(void *ptr, uint32 capacity) {
-  return (uint32 *)(node_array(ptr, capacity) + capacity);
+uint32 *hash_code_array(void *ptr, uint32 capacity) {
+  return (uint32 *)(slot_array(ptr) + capacity);
 }
 
 uint32 *ref_count_array(void *ptr, uint32 capacity) {
-  return (uint32 *)(hashtable_ptr(ptr, capacity) + capacity);
+  return hash_code_array(ptr, capacity) + capacity;
 }
 
 uint32 *surr_array(void *ptr, uint32 capacity) {
-  return (uint32 *)(hashtable_ptr(ptr, capacity) + capacity);
+  return hash_code_array(ptr, capacity) + capacity;
+}
+
+uint8 *control_array(void *ptr, uint32 capacity) {
+  return (uint8 *)(ref_count_array(ptr, capacity) + capacity);
+}
+
+uint32 *bucket_array(void *ptr, uint32 capacity) {
+  return (uint32 *)(control_array(ptr, capacity) + 2 * capacity);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -55,90 +56,184 @@ void reset_slot(OBJ *slot, uint32 first_free) {
   assert(get_physical_type(*slot) == TYPE_BLANK_OBJ);
 }
 
+// Hash codes are scrambled before being used, as the ones of small integers are not
+inline uint64 scramble(uint32 hash_code) {
+  return hash_code * 0x9E3779B97F4A7C15ULL;
+}
+
+inline uint8 fingerprint(uint64 scrambled_hash) {
+  return scrambled_hash >> 57;
+}
+
+inline uint32 first_group(uint64 scrambled_hash, uint32 groups_mask) {
+  return (scrambled_hash >> 32) & groups_mask;
+}
+
+// Returns a mask with the n-th bit set if the n-th control byte in the group is equal to <byte>
+static uint32 group_match(const uint8 *group, uint8 byte) {
+#ifdef __SSE2__
+  __m128i ctrls = _mm_loadu_si128((const __m128i *) group);
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrls, _mm_set1_epi8(byte)));
+#else
+  uint32 mask = 0;
+  for (uint32 i=0 ; i < GROUP_SIZE ; i++)
+    if (group[i] == byte)
+      mask |= 1U << i;
+  return mask;
+#endif
+}
+
+// Same as group_match(), but matches both empty and deleted buckets
+static uint32 group_match_free(const uint8 *group) {
+#ifdef __SSE2__
+  return _mm_movemask_epi8(_mm_loadu_si128((const __m128i *) group));
+#else
+  uint32 mask = 0;
+  for (uint32 i=0 ; i < GROUP_SIZE ; i++)
+    if (group[i] & 0x80)
+      mask |= 1U << i;
+  return mask;
+#endif
+}
+
 static void hashtable_clear(void *ptr, uint32 capacity) {
   OBJ *slots = slot_array(ptr);
   for (uint32 i=0 ; i < capacity ; i++)
     reset_slot(slots+i, i+1);
-  uint32 *hash_table = hashtable_ptr(ptr, capacity);
-  memset(hash_table, 0xFF, capacity * sizeof(uint32));
-  // Initializing the array of node is not stricly necessary
-  NODE *nodes = node_array(ptr, capacity);
-  for (uint32 i=0 ; i < capacity ; i++)
-    nodes[i] = empty_node();
-}
-
-static void hashtable_insert(void *ptr, uint32 capacity, uint32 hash_code, uint32 value) {
-  uint32 *hashtable = hashtable_ptr(ptr, capacity);
-  NODE *nodes = node_array(ptr, capacity);
-  uint32 index = hash_code % capacity;
-  uint32 entry = hashtable[index];
-  hashtable[index] = value;
-  nodes[value] = node(entry, hash_code);
-}
-
-static void hashtable_delete(void *ptr, uint32 capacity, uint32 value) {
-  uint32 *hashtable = hashtable_ptr(ptr, capacity);
-  NODE *nodes = node_array(ptr, capacity);
-  NODE del_node = nodes[value];
-  nodes[value] = empty_node(); // Not strictly necessary
-  uint32 index = del_node.hash_code % capacity;
-  uint32 entry = hashtable[index];
-  assert(entry >= 0 & entry < capacity);
-  // We first check to see if the deleted node is the first one in the list
-  if (entry == value) {
-    hashtable[index] = del_node.next; // Note that <next> can be EMPTY_SLOT_MARKER
-    return;
+  memset(control_array(ptr, capacity), EMPTY_BUCKET, 2 * capacity);
+}
+
+// Returns true if the value was stored in a bucket that was marked as deleted
+static bool buckets_insert(uint8 *controls, uint32 *buckets, uint32 capacity, uint32 hash_code, uint32 value) {
+  uint32 groups_mask = 2 * capacity / GROUP_SIZE - 1;
+  uint64 scrambled_hash = scramble(hash_code);
+
+  uint32 group = first_group(scrambled_hash, groups_mask);
+  for (uint32 step=1 ; ; step++) {
+    uint8 *group_ptr = controls + group * GROUP_SIZE;
+    uint32 free_mask = group_match_free(group_ptr);
+    if (free_mask != 0) {
+      uint32 idx = group * GROUP_SIZE + __builtin_ctz(free_mask);
+      bool was_deleted = controls[idx] == DELETED_BUCKET;
+      controls[idx] = fingerprint(scrambled_hash);
+      buckets[idx] = value;
+      return was_deleted;
+    }
+    group = (group + step) & groups_mask;
+  }
+}
+
+// Returns the index of the first bucket with the right fingerprint whose entry satisfies
+// <matches>, or -1 if the search reaches a group with an empty bucket before finding it
+template <typename M> static int64 index_find(const uint8 *controls, const uint32 *buckets, uint32 capacity, uint32 hash_code, M matches) {
+  uint32 groups_mask = 2 * capacity / GROUP_SIZE - 1;
+  uint64 scrambled_hash = scramble(hash_code);
+  uint8 fprint = fingerprint(scrambled_hash);
+
+  uint32 group = first_group(scrambled_hash, groups_mask);
+  for (uint32 step=1 ; ; step++) {
+    const uint8 *group_ptr = controls + group * GROUP_SIZE;
+    uint32 match = group_match(group_ptr, fprint);
+    while (match != 0) {
+      uint32 idx = group * GROUP_SIZE + __builtin_ctz(match);
+      if (matches(buckets[idx]))
+        return idx;
+      match &= match - 1;
+    }
+    if (group_match(group_ptr, EMPTY_BUCKET) != 0)
+      return -1;
+    group = (group + step) & groups_mask;
+  }
+}
+
+struct entry_eq {
+  uint32 entry;
+  entry_eq(uint32 entry) : entry(entry) {}
+
+  bool operator () (uint32 other_entry) {
+    return other_entry == entry;
   }
-  // Here <entry> is the index of the current cell
-  // We already know that the current cell is not the one we're looking for.
-  NODE node = nodes[entry];
-  while (node.next != value) {
-    entry = node.next;
-    assert(entry >= 0 & entry < capacity);
-    node = nodes[entry];
+};
+
+struct slot_eq {
+  OBJ *slots;
+  uint32 *hash_codes;
+  OBJ value;
+  uint32 hash_code;
+  slot_eq(OBJ *slots, uint32 *hash_codes, OBJ value, uint32 hash_code) : slots(slots), hash_codes(hash_codes), value(value), hash_code(hash_code) {}
+
+  bool operator () (uint32 entry) {
+    return hash_codes[entry] == hash_code && comp_objs(value, slots[entry]) == 0;
+  }
+};
+
+// Returns the index of the bucket that points to <value>, or -1 if there's none
+static int64 buckets_find(const uint8 *controls, const uint32 *buckets, uint32 capacity, uint32 hash_code, uint32 value) {
+  return index_find(controls, buckets, capacity, hash_code, entry_eq(value));
+}
+
+// Returns true if the bucket had to be marked as deleted
+static bool bucket_clear(uint8 *controls, uint32 idx) {
+  // If the group still has an empty bucket, no search has ever
+  // gone past it, so the bucket can be marked as empty again
+  if (group_match(controls + idx / GROUP_SIZE * GROUP_SIZE, EMPTY_BUCKET) != 0) {
+    controls[idx] = EMPTY_BUCKET;
+    return false;
   }
-  // We've finally reached the cell before the one we are deleting
-  // Again <entry> is the index of the current cell, and <node> is its content
-  node.next = del_node.next;
-  nodes[entry] = node;
+  controls[idx] = DELETED_BUCKET;
+  return true;
+}
+
+static bool hashtable_insert(void *ptr, uint32 capacity, uint32 hash_code, uint32 value) {
+  hash_code_array(ptr, capacity)[value] = hash_code;
+  return buckets_insert(control_array(ptr, capacity), bucket_array(ptr, capacity), capacity, hash_code, value);
+}
+
+// Looks the value up in the index made of <controls> and <buckets>, whose
+// entries point into <slots> and <hash_codes>, which can be larger than it
+static int64 index_lookup(const uint8 *controls, const uint32 *buckets, uint32 capacity, OBJ *slots, uint32 *hash_codes, OBJ value, uint32 hash_code) {
+  int64 idx = index_find(controls, buckets, capacity, hash_code, slot_eq(slots, hash_codes, value, hash_code));
+  return idx != -1 ? (int64) buckets[idx] : -1;
 }
 
 static int64 hashtable_lookup(void *ptr, uint32 capacity, OBJ value, uint32 hash_code) {
+  uint8 *controls = control_array(ptr, capacity);
+  uint32 *buckets = bucket_array(ptr, capacity);
+  return index_lookup(controls, buckets, capacity, slot_array(ptr), hash_code_array(ptr, capacity), value, hash_code);
+}
+
+// Rebuilds the hash index from scratch, getting rid of all deleted buckets.
+// Only the first <slots_count> slots are initialized, the others are all free
+static void hashtable_rebuild(void *ptr, uint32 capacity, uint32 slots_count) {
   OBJ *slots = slot_array(ptr);
-  NODE *nodes = node_array(ptr, capacity);
-  uint32 *hashtable = hashtable_ptr(ptr, capacity);
-  uint32 index = hash_code % capacity;
-  uint32 entry = hashtable[index];
-  while (entry != EMPTY_SLOT_MARKER) {
-    NODE node = nodes[entry];
-    if (node.hash_code == hash_code && comp_objs(value, slots[entry]) == 0)
-      return entry;
-    entry = node.next;
-  }
-  return -1;
+  uint32 *hash_codes = hash_code_array(ptr, capacity);
+  memset(control_array(ptr, capacity), EMPTY_BUCKET, 2 * capacity);
+  for (uint32 i=0 ; i < slots_count ; i++)
+    if (!is_blank_obj(slots[i]))
+      hashtable_insert(ptr, capacity, hash_codes[i], i);
 }
 
-static void hashtable_copy(void *src_ptr, uint32 src_cpty, void *dest_ptr, uint32 dest_cpty) {
+// Copies slots and hash codes, leaving the hash index of the destination empty
+static void hashtable_copy_slots(void *src_ptr, uint32 src_cpty, void *dest_ptr, uint32 dest_cpty) {
   assert(dest_cpty > src_cpty);
 
-  OBJ *src_slots = slot_array(src_ptr);
   OBJ *dest_slots = slot_array(dest_ptr);
-  memcpy(dest_slots, src_slots, src_cpty * sizeof(OBJ));
+  memcpy(dest_slots, slot_array(src_ptr), src_cpty * sizeof(OBJ));
   for (uint32 i=src_cpty ; i < dest_cpty ; i++)
     reset_slot(dest_slots+i, i+1);
 
-  uint32 *dest_hashtable = hashtable_ptr(dest_ptr, dest_cpty);
-  memset(dest_hashtable, 0xFF, dest_cpty * sizeof(uint32));
+  memcpy(hash_code_array(dest_ptr, dest_cpty), hash_code_array(src_ptr, src_cpty), src_cpty * sizeof(uint32));
+  memset(control_array(dest_ptr, dest_cpty), EMPTY_BUCKET, 2 * dest_cpty);
+}
 
-  // Initializing the new array of node is not stricly necessary
-  NODE *dest_nodes = node_array(dest_ptr, dest_cpty);
-  for (uint32 i=0 ; i < dest_cpty ; i++)
-    dest_nodes[i] = empty_node();
+static void hashtable_copy(void *src_ptr, uint32 src_cpty, void *dest_ptr, uint32 dest_cpty) {
+  hashtable_copy_slots(src_ptr, src_cpty, dest_ptr, dest_cpty);
 
-  NODE *src_nodes = node_array(src_ptr, src_cpty);
+  OBJ *src_slots = slot_array(src_ptr);
+  uint32 *src_hash_codes = hash_code_array(src_ptr, src_cpty);
   for (uint32 i=0 ; i < src_cpty ; i++)
     if (!is_blank_obj(src_slots[i]))
-      hashtable_insert(dest_ptr, dest_cpty, src_nodes[i].hash_code, i);
+      hashtable_insert(dest_ptr, dest_cpty, src_hash_codes[i], i);
 }
 
 // int64 ref_hashtable_lookup(void *ptr, uint32 capacity, OBJ value, uint32 hash_code) {
@@ -163,7 +258,8 @@ static void hashtable_copy(void *src_ptr, uint32 src_cpty, void *dest_ptr, uint3
 ////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
 
-const uint32 INIT_SIZE = 4;
+// The smallest capacity whose hash index has at least one full group of buckets
+const uint32 INIT_SIZE = GROUP_SIZE / 2;
 
 uint32 calc_capacity(uint32 min_capacity) {
   uint32 capacity = INIT_SIZE;
@@ -172,6 +268,598 @@ uint32 calc_capacity(uint32 min_capacity) {
   return capacity;
 }
 
+//////////////////////////// Integer value stores ////////////////////////////
+
+// Stores for columns that only contain integers keep the values themselves, 8 bytes
+// each, instead of their OBJ representation. Hash codes are cheap to recompute, so
+// they are not stored either. Free slots contain the index of the next free slot
+
+const int INT_BYTES_PER_ENTRY = sizeof(int64) + sizeof(uint32) + 2 * (sizeof(uint8) + sizeof(uint32));
+
+
+int64 *int_value_array(void *ptr) {
+  return (int64 *) ptr;
+}
+
+uint32 *int_ref_count_array(void *ptr, uint32 capacity) {
+  return (uint32 *)(int_value_array(ptr) + capacity);
+}
+
+uint32 *int_surr_array(void *ptr, uint32 capacity) {
+  return (uint32 *)(int_value_array(ptr) + capacity);
+}
+
+uint8 *int_control_array(void *ptr, uint32 capacity) {
+  return (uint8 *)(int_ref_count_array(ptr, capacity) + capacity);
+}
+
+uint32 *int_bucket_array(void *ptr, uint32 capacity) {
+  return (uint32 *)(int_control_array(ptr, capacity) + 2 * capacity);
+}
+
+inline uint32 int_hash_code(int64 value) {
+  return (uint32) (value ^ (value >> 32));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void int_hashtable_clear(void *ptr, uint32 capacity) {
+  int64 *values = int_value_array(ptr);
+  for (uint32 i=0 ; i < capacity ; i++)
+    values[i] = i + 1;
+  memset(int_control_array(ptr, capacity), EMPTY_BUCKET, 2 * capacity);
+}
+
+static bool int_hashtable_insert(void *ptr, uint32 capacity, uint32 value) {
+  uint32 hash_code = int_hash_code(int_value_array(ptr)[value]);
+  return buckets_insert(int_control_array(ptr, capacity), int_bucket_array(ptr, capacity), capacity, hash_code, value);
+}
+
+struct int_slot_eq {
+  int64 *values;
+  int64 value;
+  int_slot_eq(int64 *values, int64 value) : values(values), value(value) {}
+
+  bool operator () (uint32 entry) {
+    return values[entry] == value;
+  }
+};
+
+static int64 int_index_lookup(const uint8 *controls, const uint32 *buckets, uint32 capacity, int64 *values, int64 value) {
+  int64 idx = index_find(controls, buckets, capacity, int_hash_code(value), int_slot_eq(values, value));
+  return idx != -1 ? (int64) buckets[idx] : -1;
+}
+
+static int64 int_hashtable_lookup(void *ptr, uint32 capacity, int64 value) {
+  uint8 *controls = int_control_array(ptr, capacity);
+  uint32 *buckets = int_bucket_array(ptr, capacity);
+  return int_index_lookup(controls, buckets, capacity, int_value_array(ptr), value);
+}
+
+// There's no way to tell a free slot from a used one, so the
+// values to reinsert are taken from the old hash index instead
+static void int_hashtable_rebuild(void *ptr, uint32 capacity) {
+  uint8 *controls = int_control_array(ptr, capacity);
+  uint32 *buckets = int_bucket_array(ptr, capacity);
+
+  uint32 *entries = new_uint32_array(capacity);
+  uint32 count = 0;
+  for (uint32 i=0 ; i < 2 * capacity ; i++)
+    if (!(controls[i] & 0x80))
+      entries[count++] = buckets[i];
+  assert(count <= capacity);
+
+  memset(controls, EMPTY_BUCKET, 2 * capacity);
+  for (uint32 i=0 ; i < count ; i++)
+    int_hashtable_insert(ptr, capacity, entries[i]);
+
+  delete_uint32_array(entries, capacity);
+}
+
+static void int_hashtable_copy_slots(void *src_ptr, uint32 src_cpty, void *dest_ptr, uint32 dest_cpty) {
+  assert(dest_cpty > src_cpty);
+
+  int64 *dest_values = int_value_array(dest_ptr);
+  memcpy(dest_values, int_value_array(src_ptr), src_cpty * sizeof(int64));
+  for (uint32 i=src_cpty ; i < dest_cpty ; i++)
+    dest_values[i] = i + 1;
+
+  memset(int_control_array(dest_ptr, dest_cpty), EMPTY_BUCKET, 2 * dest_cpty);
+}
+
+static void int_hashtable_copy(void *src_ptr, uint32 src_cpty, void *dest_ptr, uint32 dest_cpty) {
+  int_hashtable_copy_slots(src_ptr, src_cpty, dest_ptr, dest_cpty);
+
+  uint8 *src_controls = int_control_array(src_ptr, src_cpty);
+  uint32 *src_buckets = int_bucket_array(src_ptr, src_cpty);
+  for (uint32 i=0 ; i < 2 * src_cpty ; i++)
+    if (!(src_controls[i] & 0x80))
+      int_hashtable_insert(dest_ptr, dest_cpty, src_buckets[i]);
+}
+
+static void int_hashtable_prefetch(void *ptr, uint32 capacity, int64 value) {
+  uint32 groups_mask = 2 * capacity / GROUP_SIZE - 1;
+  uint32 group = first_group(scramble(int_hash_code(value)), groups_mask);
+  __builtin_prefetch(int_control_array(ptr, capacity) + group * GROUP_SIZE);
+  __builtin_prefetch(int_bucket_array(ptr, capacity) + group * GROUP_SIZE);
+}
+
+/////////////////////////// Incremental resizing ////////////////////////////
+
+// When a large store is resized, copying its slots and rebuilding its hash index at once
+// would make that one commit much slower than all others. Instead, the old block is kept
+// around, and its slots and the buckets of its hash index are moved to the new block a
+// few at a time at each commit, in order and two buckets per slot, so that the first
+// <migrated> slots, and twice as many buckets, have been moved so far. Until that's done,
+// the slots that have not been moved yet are accessed in the old block, and lookups that
+// don't find a value in the new index try the old one. Only the control bytes of the new
+// index are initialized upfront. The slots from <first_untouched> on, in any store, have
+// never been used and are not initialized: they're implicitly free, and each of them
+// follows the previous one in the free list
+
+// Stores smaller than this are always resized in one go
+const uint32 INCREMENTAL_RESIZE_MIN_CAPACITY = 1 << 14;
+
+// Slots migrated by each commit, on top of one per inserted value
+const uint32 MIGRATION_MIN_STEP = 512;
+
+
+static uint32 store_bytes_per_entry(VALUE_STORE *store) {
+  return store->type == INT_VALUE_STORE ? INT_BYTES_PER_ENTRY : BYTES_PER_ENTRY;
+}
+
+static uint8 *store_control_array(VALUE_STORE *store, void *ptr, uint32 capacity) {
+  return store->type == INT_VALUE_STORE ? int_control_array(ptr, capacity) : control_array(ptr, capacity);
+}
+
+static uint32 *store_bucket_array(VALUE_STORE *store, void *ptr, uint32 capacity) {
+  return store->type == INT_VALUE_STORE ? int_bucket_array(ptr, capacity) : bucket_array(ptr, capacity);
+}
+
+// Returns the block that holds the slot, hash code and reference count of a surrogate
+static void *entry_block(VALUE_STORE *store, uint32 surr, uint32 &capacity) {
+  if (store->old_ptr != NULL && surr >= store->migrated && surr < store->old_capacity) {
+    capacity = store->old_capacity;
+    return store->old_ptr;
+  }
+  capacity = store->capacity;
+  return store->ptr;
+}
+
+static OBJ *store_slot(VALUE_STORE *store, uint32 surr) {
+  uint32 capacity;
+  return slot_array(entry_block(store, surr, capacity)) + surr;
+}
+
+static int64 *int_store_value(VALUE_STORE *store, uint32 surr) {
+  uint32 capacity;
+  return int_value_array(entry_block(store, surr, capacity)) + surr;
+}
+
+static uint32 *store_ref_count(VALUE_STORE *store, uint32 surr) {
+  uint32 capacity;
+  void *ptr = entry_block(store, surr, capacity);
+  if (store->type == INT_VALUE_STORE)
+    return int_ref_count_array(ptr, capacity) + surr;
+  else
+    return ref_count_array(ptr, capacity) + surr;
+}
+
+static uint32 store_hash_code(VALUE_STORE *store, uint32 surr) {
+  if (store->type == INT_VALUE_STORE)
+    return int_hash_code(*int_store_value(store, surr));
+  uint32 capacity;
+  void *ptr = entry_block(store, surr, capacity);
+  return hash_code_array(ptr, capacity)[surr];
+}
+
+// Returns the slot that follows a free one in the free list
+static uint32 next_free_slot(VALUE_STORE *store, uint32 surr) {
+  if (surr >= store->first_untouched)
+    return surr + 1;
+  if (store->type == INT_VALUE_STORE)
+    return *int_store_value(store, surr);
+  return store_slot(store, surr)->core_data.int_;
+}
+
+// To be called before a free slot is used. Slots are taken from the free list in order,
+// so if the slot has never been used before, it's the first one that hasn't
+static void touch_slot(VALUE_STORE *store, uint32 surr) {
+  if (surr >= store->first_untouched) {
+    assert(surr == store->first_untouched);
+    store->first_untouched = surr + 1;
+    *store_ref_count(store, surr) = 0;
+  }
+}
+
+// Initializes all the slots that have never been used, for the code that goes through all of them
+static void touch_all_slots(VALUE_STORE *store) {
+  assert(store->old_ptr == NULL);
+
+  void *ptr = store->ptr;
+  uint32 capacity = store->capacity;
+  if (store->type == INT_VALUE_STORE) {
+    int64 *values = int_value_array(ptr);
+    uint32 *ref_counts = int_ref_count_array(ptr, capacity);
+    for (uint32 i=store->first_untouched ; i < capacity ; i++) {
+      values[i] = i + 1;
+      ref_counts[i] = 0;
+    }
+  }
+  else {
+    OBJ *slots = slot_array(ptr);
+    uint32 *ref_counts = ref_count_array(ptr, capacity);
+    for (uint32 i=store->first_untouched ; i < capacity ; i++) {
+      reset_slot(slots+i, i+1);
+      ref_counts[i] = 0;
+    }
+  }
+  store->first_untouched = capacity;
+}
+
+static void store_migrate(VALUE_STORE *store, uint32 max_slots) {
+  void *old_ptr = store->old_ptr;
+  uint32 old_capacity = store->old_capacity;
+  void *ptr = store->ptr;
+  uint32 capacity = store->capacity;
+
+  uint32 start = store->migrated;
+  uint32 end = start + std::min(old_capacity - start, max_slots);
+  uint32 count = end - start;
+
+  if (store->type == INT_VALUE_STORE) {
+    memcpy(int_value_array(ptr) + start, int_value_array(old_ptr) + start, count * sizeof(int64));
+    memcpy(int_ref_count_array(ptr, capacity) + start, int_ref_count_array(old_ptr, old_capacity) + start, count * sizeof(uint32));
+  }
+  else {
+    memcpy(slot_array(ptr) + start, slot_array(old_ptr) + start, count * sizeof(OBJ));
+    memcpy(hash_code_array(ptr, capacity) + start, hash_code_array(old_ptr, old_capacity) + start, count * sizeof(uint32));
+    memcpy(ref_count_array(ptr, capacity) + start, ref_count_array(old_ptr, old_capacity) + start, count * sizeof(uint32));
+  }
+  store->migrated = end;
+
+  uint8 *old_controls = store_control_array(store, old_ptr, old_capacity);
+  uint32 *old_buckets = store_bucket_array(store, old_ptr, old_capacity);
+  uint8 *controls = store_control_array(store, ptr, capacity);
+  uint32 *buckets = store_bucket_array(store, ptr, capacity);
+
+  uint32 reused = 0;
+  for (uint32 i=2*start ; i < 2*end ; i++)
+    if (!(old_controls[i] & 0x80)) {
+      uint32 surr = old_buckets[i];
+      reused += buckets_insert(controls, buckets, capacity, store_hash_code(store, surr), surr);
+      old_controls[i] = DELETED_BUCKET;
+    }
+  store->tombstones -= reused;
+
+  if (end == old_capacity) {
+    free_obj(old_ptr, old_capacity * store_bytes_per_entry(store));
+    store->old_ptr = NULL;
+    store->old_tombstones = 0;
+  }
+}
+
+// Switches the store to a new block, which is not initialized, except for its hash index
+// being emptied here. The old block is freed once all its slots have been moved
+static void store_start_migration(VALUE_STORE *store, void *new_ptr, uint32 new_capacity) {
+  assert(store->old_ptr == NULL);
+  memset(store_control_array(store, new_ptr, new_capacity), EMPTY_BUCKET, 2 * new_capacity);
+  store->old_ptr = store->ptr;
+  store->old_capacity = store->capacity;
+  store->old_tombstones = store->tombstones;
+  store->migrated = 0;
+  store->ptr = new_ptr;
+  store->capacity = new_capacity;
+  store->tombstones = 0;
+}
+
+// Deleted buckets are never more than half the number of slots when new values are
+// inserted, so that at least a quarter of the buckets in the index are always empty.
+// While a resize is in progress, those of the old index count as well, and it has to be
+// finished before the rebuild, which would otherwise have to include them
+static bool store_needs_rebuild(VALUE_STORE *store, uint32 new_usage) {
+  uint32 capacity = store->capacity;
+  return capacity >= new_usage && store->tombstones + store->old_tombstones > capacity / 2;
+}
+
+static void store_index_delete(VALUE_STORE *store, uint32 surr) {
+  uint32 hash_code = store_hash_code(store, surr);
+
+  uint8 *controls = store_control_array(store, store->ptr, store->capacity);
+  uint32 *buckets = store_bucket_array(store, store->ptr, store->capacity);
+  int64 idx = buckets_find(controls, buckets, store->capacity, hash_code, surr);
+  if (idx != -1) {
+    store->tombstones += bucket_clear(controls, idx);
+    return;
+  }
+
+  assert(store->old_ptr != NULL);
+  uint8 *old_controls = store_control_array(store, store->old_ptr, store->old_capacity);
+  uint32 *old_buckets = store_bucket_array(store, store->old_ptr, store->old_capacity);
+  idx = buckets_find(old_controls, old_buckets, store->old_capacity, hash_code, surr);
+  assert(idx != -1);
+  store->old_tombstones += bucket_clear(old_controls, idx);
+}
+
+struct store_slot_eq {
+  VALUE_STORE *store;
+  OBJ value;
+  uint32 hash_code;
+  store_slot_eq(VALUE_STORE *store, OBJ value, uint32 hash_code) : store(store), value(value), hash_code(hash_code) {}
+
+  bool operator () (uint32 entry) {
+    uint32 capacity;
+    void *ptr = entry_block(store, entry, capacity);
+    return hash_code_array(ptr, capacity)[entry] == hash_code && comp_objs(value, slot_array(ptr)[entry]) == 0;
+  }
+};
+
+struct int_store_slot_eq {
+  VALUE_STORE *store;
+  int64 value;
+  int_store_slot_eq(VALUE_STORE *store, int64 value) : store(store), value(value) {}
+
+  bool operator () (uint32 entry) {
+    return *int_store_value(store, entry) == value;
+  }
+};
+
+static int64 store_lookup(VALUE_STORE *store, OBJ value, uint32 hash_code) {
+  void *ptr = store->ptr;
+  uint32 capacity = store->capacity;
+  uint8 *controls = control_array(ptr, capacity);
+  uint32 *buckets = bucket_array(ptr, capacity);
+  if (store->old_ptr == NULL)
+    return index_lookup(controls, buckets, capacity, slot_array(ptr), hash_code_array(ptr, capacity), value, hash_code);
+
+  store_slot_eq eq(store, value, hash_code);
+  int64 idx = index_find(controls, buckets, capacity, hash_code, eq);
+  if (idx != -1)
+    return buckets[idx];
+
+  void *old_ptr = store->old_ptr;
+  uint32 old_capacity = store->old_capacity;
+  uint32 *old_buckets = bucket_array(old_ptr, old_capacity);
+  idx = index_find(control_array(old_ptr, old_capacity), old_buckets, old_capacity, hash_code, eq);
+  return idx != -1 ? (int64) old_buckets[idx] : -1;
+}
+
+static int64 int_store_lookup(VALUE_STORE *store, int64 value) {
+  if (store->old_ptr == NULL)
+    return int_hashtable_lookup(store->ptr, store->capacity, value);
+
+  uint32 hash_code = int_hash_code(value);
+  int_store_slot_eq eq(store, value);
+
+  void *ptr = store->ptr;
+  uint32 capacity = store->capacity;
+  uint32 *buckets = int_bucket_array(ptr, capacity);
+  int64 idx = index_find(int_control_array(ptr, capacity), buckets, capacity, hash_code, eq);
+  if (idx != -1)
+    return buckets[idx];
+
+  void *old_ptr = store->old_ptr;
+  uint32 old_capacity = store->old_capacity;
+  uint32 *old_buckets = int_bucket_array(old_ptr, old_capacity);
+  idx = index_find(int_control_array(old_ptr, old_capacity), old_buckets, old_capacity, hash_code, eq);
+  return idx != -1 ? (int64) old_buckets[idx] : -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void int_store_init(VALUE_STORE *store) {
+  void *ptr = new_obj(INIT_SIZE * INT_BYTES_PER_ENTRY);
+  store->ptr = ptr;
+  store->capacity = INIT_SIZE;
+  store->usage = 0;
+  store->first_free = 0;
+  store->tombstones = 0;
+  store->old_ptr = NULL;
+  store->old_tombstones = 0;
+  store->first_untouched = INIT_SIZE;
+  int_hashtable_clear(ptr, INIT_SIZE);
+  memset(int_ref_count_array(ptr, INIT_SIZE), 0, INIT_SIZE * sizeof(uint32));
+}
+
+static uint32 int_store_insert(VALUE_STORE *store, VALUE_STORE_UPDATES *updates, int64 value) {
+  void *ptr = updates->ptr;
+  uint32 capacity = updates->capacity;
+  uint32 count = updates->count;
+  assert(count <= capacity);
+
+  if (count == capacity) {
+    uint32 new_capacity = capacity != 0 ? 2 * capacity : 32;
+    void *new_ptr = new_obj(new_capacity * INT_BYTES_PER_ENTRY);
+    if (capacity > 0) {
+      int_hashtable_copy(ptr, capacity, new_ptr, new_capacity);
+      memcpy(int_surr_array(new_ptr, new_capacity), int_surr_array(ptr, capacity), capacity * sizeof(uint32));
+      free_obj(ptr, capacity * INT_BYTES_PER_ENTRY);
+    }
+    else
+      int_hashtable_clear(new_ptr, new_capacity);
+    updates->capacity = capacity = new_capacity;
+    updates->ptr = ptr = new_ptr;
+  }
+
+  int_value_array(ptr)[count] = value;
+  int_hashtable_insert(ptr, capacity, count);
+  uint32 first_free = count == 0 ? store->first_free : updates->first_free;
+  int_surr_array(ptr, capacity)[count] = first_free;
+  updates->count = count + 1;
+  updates->first_free = next_free_slot(store, first_free);
+  return first_free;
+}
+
+static void int_store_apply(VALUE_STORE *store, VALUE_STORE_UPDATES *updates) {
+  uint32 store_capacity = store->capacity;
+  void *ptr = store->ptr;
+
+  uint32 count = updates->count;
+  uint32 new_usage = store->usage + count;
+
+  if (store_needs_rebuild(store, new_usage)) {
+    if (store->old_ptr != NULL)
+      store_migrate(store, 0xFFFFFFFFU);
+    int_hashtable_rebuild(ptr, store_capacity);
+    store->tombstones = 0;
+  }
+
+  if (store_capacity < new_usage) {
+    if (store->old_ptr != NULL)
+      store_migrate(store, 0xFFFFFFFFU);
+
+    uint32 new_capacity = calc_capacity(new_usage);
+    void *new_ptr = new_obj(new_capacity * INT_BYTES_PER_ENTRY);
+    if (store_capacity >= INCREMENTAL_RESIZE_MIN_CAPACITY)
+      store_start_migration(store, new_ptr, new_capacity);
+    else {
+      touch_all_slots(store);
+      int_hashtable_copy(ptr, store_capacity, new_ptr, new_capacity);
+      uint32 *new_ref_counts = int_ref_count_array(new_ptr, new_capacity);
+      memcpy(new_ref_counts, int_ref_count_array(ptr, store_capacity), store_capacity * sizeof(uint32));
+      memset(new_ref_counts+store_capacity, 0, (new_capacity-store_capacity) * sizeof(uint32));
+      free_obj(ptr, store_capacity * INT_BYTES_PER_ENTRY);
+      store->ptr = new_ptr;
+      store->capacity = new_capacity;
+      store->tombstones = 0;
+      store->first_untouched = new_capacity;
+    }
+    ptr = new_ptr;
+    store_capacity = new_capacity;
+  }
+
+  uint8 *controls = int_control_array(ptr, store_capacity);
+  uint32 *buckets = int_bucket_array(ptr, store_capacity);
+
+  uint32 update_cpty = updates->capacity;
+  void *update_ptr = updates->ptr;
+  int64 *values = int_value_array(update_ptr);
+  uint32 *surrs = int_surr_array(update_ptr, update_cpty);
+  uint32 reused = 0;
+  for (uint32 i=0 ; i < count ; i++) {
+    uint32 surr = surrs[i];
+    int64 value = values[i];
+    touch_slot(store, surr);
+    *int_store_value(store, surr) = value;
+    reused += buckets_insert(controls, buckets, store_capacity, int_hash_code(value), surr);
+  }
+  store->tombstones -= reused;
+  store->usage = new_usage;
+  store->first_free = updates->first_free;
+
+  if (store->old_ptr != NULL)
+    store_migrate(store, MIGRATION_MIN_STEP + count);
+}
+
+static void int_store_release_refs(VALUE_STORE *store, uint32 surr, uint32 amount) {
+  uint32 *ref_count = store_ref_count(store, surr);
+  uint32 count = *ref_count;
+  assert(count >= amount && amount > 0);
+  if (count == amount) {
+    // The value is needed to find its bucket, so it must be removed from the index first
+    store_index_delete(store, surr);
+    *int_store_value(store, surr) = store->first_free;
+    store->first_free = surr;
+    store->usage--;
+    *ref_count = 0;
+  }
+  else
+    *ref_count = count - amount;
+}
+
+static int64 int_store_lookup_ex(VALUE_STORE *store, VALUE_STORE_UPDATES *updates, int64 value) {
+  int64 surr = int_store_lookup(store, value);
+  if (surr != -1)
+    return surr;
+  uint32 capacity = updates->capacity;
+  if (capacity > 0) {
+    void *ptr = updates->ptr;
+    int64 index = int_hashtable_lookup(ptr, capacity, value);
+    if (index >= 0)
+      return int_surr_array(ptr, capacity)[index];
+  }
+  return -1;
+}
+
+static void int_store_lookup_or_insert_batch(VALUE_STORE *store, VALUE_STORE_UPDATES *updates, OBJ *values, uint32 count, uint32 *surrs) {
+  const uint32 BATCH_SIZE = 64;
+  int64 ints[BATCH_SIZE];
+
+  for (uint32 offset=0 ; offset < count ; offset += BATCH_SIZE) {
+    uint32 batch_size = std::min(count - offset, BATCH_SIZE);
+
+    void *ptr = store->ptr;
+    uint32 capacity = store->capacity;
+    for (uint32 i=0 ; i < batch_size ; i++) {
+      int64 value = get_int(values[offset + i]);
+      ints[i] = value;
+      int_hashtable_prefetch(ptr, capacity, value);
+    }
+
+    for (uint32 i=0 ; i < batch_size ; i++) {
+      int64 value = ints[i];
+      int64 surr = int_store_lookup_ex(store, updates, value);
+      if (surr == -1)
+        surr = int_store_insert(store, updates, value);
+      surrs[offset + i] = surr;
+    }
+  }
+}
+
+//////////////////////////// Symbol value stores /////////////////////////////
+
+// In stores for columns that only contain symbols, the surrogate of a symbol is its
+// index, and the only thing that is actually stored is a dense array of reference
+// counts, indexed by symbol. A symbol belongs to the store if its reference count is
+// not zero. Since inserting a symbol has no effect other than making sure the array
+// is large enough, the updates only keep track of the highest index inserted so far:
+// their <count> field is always one more than that
+
+static void symb_store_init(VALUE_STORE *store) {
+  void *ptr = new_obj(INIT_SIZE * sizeof(uint32));
+  memset(ptr, 0, INIT_SIZE * sizeof(uint32));
+  store->ptr = ptr;
+  store->capacity = INIT_SIZE;
+  store->usage = 0;
+  store->first_free = 0;
+  store->tombstones = 0;
+  store->old_ptr = NULL;
+  store->old_tombstones = 0;
+  store->first_untouched = 0;
+}
+
+static uint32 symb_store_insert(VALUE_STORE_UPDATES *updates, OBJ value) {
+  uint16 idx = get_symb_idx(value);
+  if (idx >= updates->count)
+    updates->count = idx + 1;
+  return idx;
+}
+
+static void symb_store_apply(VALUE_STORE *store, VALUE_STORE_UPDATES *updates) {
+  uint32 capacity = store->capacity;
+  uint32 count = updates->count;
+  if (count > capacity) {
+    uint32 new_capacity = calc_capacity(count);
+    uint32 *ref_counts = (uint32 *) store->ptr;
+    uint32 *new_ref_counts = (uint32 *) resize_obj(ref_counts, capacity * sizeof(uint32), new_capacity * sizeof(uint32));
+    memset(new_ref_counts+capacity, 0, (new_capacity-capacity) * sizeof(uint32));
+    store->ptr = new_ref_counts;
+    store->capacity = new_capacity;
+  }
+}
+
+static int64 symb_store_lookup(VALUE_STORE *store, OBJ value) {
+  if (!is_symb(value))
+    return -1;
+  uint16 idx = get_symb_idx(value);
+  if (idx < store->capacity && ((uint32 *) store->ptr)[idx] > 0)
+    return idx;
+  return -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
 ////////////////////////////////////////////////////////////////////////////////
 
 void value_store_init(VALUE_STORE *store) {
@@ -180,14 +868,48 @@ void value_store_init(VALUE_STORE *store) {
   store->capacity = INIT_SIZE;
   store->usage = 0;
   store->first_free = 0;
+  store->tombstones = 0;
+  store->old_ptr = NULL;
+  store->old_tombstones = 0;
+  store->first_untouched = INIT_SIZE;
+  store->type = GENERIC_VALUE_STORE;
   hashtable_clear(ptr, INIT_SIZE);
   memset(ref_count_array(ptr, INIT_SIZE), 0, INIT_SIZE * sizeof(uint32));
 }
 
+// Stores are only ever created by the generated code, which picks the variant for each
+// column when initializing it: the specialized ones are for columns whose values are
+// known at compile time to be all integers or all symbols. The runtime code that uses
+// stores goes through the functions below, and works the same with all of them
+
+void value_store_init_int(VALUE_STORE *store) {
+  int_store_init(store);
+  store->type = INT_VALUE_STORE;
+}
+
+void value_store_init_symb(VALUE_STORE *store) {
+  symb_store_init(store);
+  store->type = SYMB_VALUE_STORE;
+}
+
 void value_store_cleanup(VALUE_STORE *store) {
+  if (store->old_ptr != NULL)
+    store_migrate(store, 0xFFFFFFFFU);
+
   uint32 capacity = store->capacity;
+
+  if (store->type == INT_VALUE_STORE) {
+    free_obj(store->ptr, capacity * INT_BYTES_PER_ENTRY);
+    return;
+  }
+
+  if (store->type == SYMB_VALUE_STORE) {
+    free_obj(store->ptr, capacity * sizeof(uint32));
+    return;
+  }
+
   OBJ *slots = slot_array(store->ptr);
-  for (uint32 i=0 ; i < capacity ; i++)
+  for (uint32 i=0 ; i < store->first_untouched ; i++)
     release(slots[i]);
   free_obj(slots, capacity * BYTES_PER_ENTRY);
 }
@@ -208,9 +930,7 @@ void value_store_updates_cleanup(VALUE_STORE_UPDATES *updates) {
 
 ////////////////////////////////////////////////////////////////////////////////
 
-uint32 value_store_insert(VALUE_STORE *store, VALUE_STORE_UPDATES *updates, OBJ value) {
-  uint32 hash_code = compute_hash_code(value);
-
+static uint32 value_store_insert(VALUE_STORE *store, VALUE_STORE_UPDATES *updates, OBJ value, uint32 hash_code) {
   void *ptr = updates->ptr;
   uint32 capacity = updates->capacity;
   uint32 count = updates->count;
@@ -240,13 +960,18 @@ uint32 value_store_insert(VALUE_STORE *store, VALUE_STORE_UPDATES *updates, OBJ
   uint32 *surrs = surr_array(ptr, capacity);
   surrs[count] = first_free;
   updates->count = count + 1;
-  if (first_free < store->capacity)
-    updates->first_free = slot_array(store->ptr)[first_free].core_data.int_;
-  else
-    updates->first_free = first_free + 1;
+  updates->first_free = next_free_slot(store, first_free);
   return first_free;
 }
 
+uint32 value_store_insert(VALUE_STORE *store, VALUE_STORE_UPDATES *updates, OBJ value) {
+  if (store->type == INT_VALUE_STORE)
+    return int_store_insert(store, updates, get_int(value));
+  if (store->type == SYMB_VALUE_STORE)
+    return symb_store_insert(updates, value);
+  return value_store_insert(store, updates, value, compute_hash_code(value));
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 void value_store_copy(VALUE_STORE *store, VALUE_STORE_UPDATES *updates) {
@@ -254,8 +979,21 @@ void value_store_copy(VALUE_STORE *store, VALUE_STORE_UPDATES *updates) {
 }
 
 void value_store_apply(VALUE_STORE *store, VALUE_STORE_UPDATES *updates) {
-  if (updates->capacity == 0)
+  if (store->type == SYMB_VALUE_STORE) {
+    symb_store_apply(store, updates);
     return;
+  }
+
+  if (updates->capacity == 0) {
+    if (store->old_ptr != NULL)
+      store_migrate(store, MIGRATION_MIN_STEP);
+    return;
+  }
+
+  if (store->type == INT_VALUE_STORE) {
+    int_store_apply(store, updates);
+    return;
+  }
 
   uint32 store_capacity = store->capacity;
   void *ptr = store->ptr;
@@ -264,77 +1002,153 @@ void value_store_apply(VALUE_STORE *store, VALUE_STORE_UPDATES *updates) {
   uint32 count = updates->count;
   uint32 new_usage = usage + count;
 
+  if (store_needs_rebuild(store, new_usage)) {
+    if (store->old_ptr != NULL)
+      store_migrate(store, 0xFFFFFFFFU);
+    hashtable_rebuild(ptr, store_capacity, store->first_untouched);
+    store->tombstones = 0;
+  }
+
   if (store_capacity < new_usage) {
+    // If the previous resize has not completed yet, it has to be finished first
+    if (store->old_ptr != NULL)
+      store_migrate(store, 0xFFFFFFFFU);
+
     uint32 new_capacity = calc_capacity(new_usage);
     void *new_ptr = new_obj(new_capacity * BYTES_PER_ENTRY);
-    hashtable_copy(ptr, store_capacity, new_ptr, new_capacity);
-    uint32 *ref_counts = ref_count_array(ptr, store_capacity);
-    uint32 *new_ref_counts = ref_count_array(new_ptr, new_capacity);
-    memcpy(new_ref_counts, ref_counts, store_capacity * sizeof(uint32));
-    memset(new_ref_counts+store_capacity, 0, (new_capacity-store_capacity) * sizeof(uint32));
-    free_obj(ptr, store_capacity * BYTES_PER_ENTRY);
-    store->ptr = ptr = new_ptr;
-    store->capacity = store_capacity = new_capacity;
+    if (store_capacity >= INCREMENTAL_RESIZE_MIN_CAPACITY)
+      store_start_migration(store, new_ptr, new_capacity);
+    else {
+      touch_all_slots(store);
+      hashtable_copy(ptr, store_capacity, new_ptr, new_capacity);
+      uint32 *new_ref_counts = ref_count_array(new_ptr, new_capacity);
+      memcpy(new_ref_counts, ref_count_array(ptr, store_capacity), store_capacity * sizeof(uint32));
+      memset(new_ref_counts+store_capacity, 0, (new_capacity-store_capacity) * sizeof(uint32));
+      free_obj(ptr, store_capacity * BYTES_PER_ENTRY);
+      store->ptr = new_ptr;
+      store->capacity = new_capacity;
+      store->tombstones = 0;
+      store->first_untouched = new_capacity;
+    }
+    ptr = new_ptr;
+    store_capacity = new_capacity;
   }
 
-  OBJ *slots = slot_array(ptr);
+  uint8 *controls = control_array(ptr, store_capacity);
+  uint32 *buckets = bucket_array(ptr, store_capacity);
 
   uint32 update_cpty = updates->capacity;
   void *update_ptr = updates->ptr;
   OBJ *values = slot_array(update_ptr);
-  NODE *nodes = node_array(update_ptr, update_cpty);
+  uint32 *hash_codes = hash_code_array(update_ptr, update_cpty);
   uint32 *surrs = surr_array(update_ptr, update_cpty);
+  uint32 reused = 0;
   for (uint32 i=0 ; i < count ; i++) {
     uint32 surr = surrs[i];
-    slots[surr] = copy_obj(values[i]);
-    hashtable_insert(ptr, store_capacity, nodes[i].hash_code, surr);
+    uint32 hash_code = hash_codes[i];
+    touch_slot(store, surr);
+    uint32 block_cpty;
+    void *block = entry_block(store, surr, block_cpty);
+    slot_array(block)[surr] = copy_obj(values[i]);
+    hash_code_array(block, block_cpty)[surr] = hash_code;
+    reused += buckets_insert(controls, buckets, store_capacity, hash_code, surr);
   }
+  store->tombstones -= reused;
   store->usage = new_usage;
   store->first_free = updates->first_free;
+
+  // The amount of migration work done by a commit is proportional to
+  // the number of new values, rather than to the size of the store
+  if (store->old_ptr != NULL)
+    store_migrate(store, MIGRATION_MIN_STEP + count);
 }
 
 void value_store_add_ref(VALUE_STORE *store, uint32 surr) {
-  assert(surr < store->capacity);
-  uint32 *ref_counts = ref_count_array(store->ptr, store->capacity);
-  ref_counts[surr]++;
+  value_store_add_refs(store, surr, 1);
 }
 
 void value_store_release(VALUE_STORE *store, uint32 surr) {
+  value_store_release_refs(store, surr, 1);
+}
+
+void value_store_add_refs(VALUE_STORE *store, uint32 surr, uint32 amount) {
+  assert(surr < store->capacity);
+  uint32 *ref_count;
+  if (store->type == SYMB_VALUE_STORE) {
+    ref_count = (uint32 *) store->ptr + surr;
+    if (*ref_count == 0)
+      store->usage++;
+  }
+  else
+    ref_count = store_ref_count(store, surr);
+  *ref_count += amount;
+}
+
+void value_store_release_refs(VALUE_STORE *store, uint32 surr, uint32 amount) {
   void *ptr = store->ptr;
-  uint32 capacity = store->capacity;
   assert(surr < store->capacity);
-  uint32 *ref_counts = ref_count_array(ptr, capacity);
-  uint32 count = ref_counts[surr];
-  assert(count != 0);
-  if (count == 1) {
-    OBJ *slot = slot_array(ptr) + surr;
+
+  if (store->type == INT_VALUE_STORE) {
+    int_store_release_refs(store, surr, amount);
+    return;
+  }
+
+  if (store->type == SYMB_VALUE_STORE) {
+    uint32 *ref_counts = (uint32 *) ptr;
+    assert(ref_counts[surr] >= amount && amount > 0);
+    ref_counts[surr] -= amount;
+    if (ref_counts[surr] == 0)
+      store->usage--;
+    return;
+  }
+
+  uint32 *ref_count = store_ref_count(store, surr);
+  uint32 count = *ref_count;
+  assert(count >= amount && amount > 0);
+  if (count == amount) {
+    OBJ *slot = store_slot(store, surr);
     release(*slot);
     reset_slot(slot, store->first_free);
     store->first_free = surr;
     store->usage--;
-    hashtable_delete(ptr, capacity, surr);
+    store_index_delete(store, surr);
+    *ref_count = 0;
   }
   else
-    ref_counts[surr] = count - 1;
+    *ref_count = count - amount;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
 OBJ lookup_surrogate(VALUE_STORE *store, int64 surr) {
-  OBJ value = slot_array(store->ptr)[surr];
+  if (store->type == INT_VALUE_STORE)
+    return make_int(*int_store_value(store, surr));
+  if (store->type == SYMB_VALUE_STORE)
+    return make_symb(surr);
+  OBJ value = *store_slot(store, surr);
   add_ref(value);
   return value;
 }
 
 int64 lookup_value(VALUE_STORE *store, OBJ value) {
-  return hashtable_lookup(store->ptr, store->capacity, value, compute_hash_code(value));
+  if (store->type == INT_VALUE_STORE)
+    return is_int(value) ? int_store_lookup(store, get_int(value)) : -1;
+  if (store->type == SYMB_VALUE_STORE)
+    return symb_store_lookup(store, value);
+  return store_lookup(store, value, compute_hash_code(value));
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
 int64 lookup_value_ex(VALUE_STORE *store, VALUE_STORE_UPDATES *updates, OBJ value) {
+  if (store->type == INT_VALUE_STORE)
+    return is_int(value) ? int_store_lookup_ex(store, updates, get_int(value)) : -1;
+  // Inserting a symbol again is harmless, so there's no need to look at the updates
+  if (store->type == SYMB_VALUE_STORE)
+    return symb_store_lookup(store, value);
+
   uint32 hash_code = compute_hash_code(value);
-  int64 surr = hashtable_lookup(store->ptr, store->capacity, value, hash_code);
+  int64 surr = store_lookup(store, value, hash_code);
   if (surr != -1)
     return surr;
   uint32 capacity = updates->capacity;
@@ -347,8 +1161,71 @@ int64 lookup_value_ex(VALUE_STORE *store, VALUE_STORE_UPDATES *updates, OBJ valu
   return -1;
 }
 
+static void hashtable_prefetch(void *ptr, uint32 capacity, uint32 hash_code) {
+  uint32 groups_mask = 2 * capacity / GROUP_SIZE - 1;
+  uint32 group = first_group(scramble(hash_code), groups_mask);
+  __builtin_prefetch(control_array(ptr, capacity) + group * GROUP_SIZE);
+  __builtin_prefetch(bucket_array(ptr, capacity) + group * GROUP_SIZE);
+}
+
+// Stores in <surrs> the surrogates of all the values in <values>, inserting the missing ones
+// into <updates>. Inserted values are add_ref'd, as the store keeps a reference to them.
+// Values are processed in batches: all their hash codes are computed and the relevant parts
+// of the hash indexes are prefetched first, so that the cache misses of different lookups overlap
+void value_store_lookup_or_insert_batch(VALUE_STORE *store, VALUE_STORE_UPDATES *updates, OBJ *values, uint32 count, uint32 *surrs) {
+  if (store->type == INT_VALUE_STORE) {
+    int_store_lookup_or_insert_batch(store, updates, values, count, surrs);
+    return;
+  }
+
+  if (store->type == SYMB_VALUE_STORE) {
+    for (uint32 i=0 ; i < count ; i++)
+      surrs[i] = symb_store_insert(updates, values[i]);
+    return;
+  }
+
+  const uint32 BATCH_SIZE = 64;
+  uint32 hash_codes[BATCH_SIZE];
+
+  for (uint32 offset=0 ; offset < count ; offset += BATCH_SIZE) {
+    uint32 batch_size = std::min(count - offset, BATCH_SIZE);
+    OBJ *batch = values + offset;
+
+    void *ptr = store->ptr;
+    uint32 capacity = store->capacity;
+    for (uint32 i=0 ; i < batch_size ; i++) {
+      uint32 hash_code = compute_hash_code(batch[i]);
+      hash_codes[i] = hash_code;
+      hashtable_prefetch(ptr, capacity, hash_code);
+    }
+
+    for (uint32 i=0 ; i < batch_size ; i++) {
+      OBJ value = batch[i];
+      uint32 hash_code = hash_codes[i];
+      int64 surr = store_lookup(store, value, hash_code);
+      if (surr == -1 && updates->capacity > 0) {
+        void *updates_ptr = updates->ptr;
+        uint32 updates_capacity = updates->capacity;
+        int64 index = hashtable_lookup(updates_ptr, updates_capacity, value, hash_code);
+        if (index >= 0)
+          surr = surr_array(updates_ptr, updates_capacity)[index];
+      }
+      if (surr == -1) {
+        add_ref(value);
+        surr = value_store_insert(store, updates, value, hash_code);
+      }
+      surrs[offset + i] = surr;
+    }
+  }
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
+// The slots are accessed directly, so they must all be in the current block and initialized
 OBJ *value_store_slot_array(VALUE_STORE *store) {
+  assert(store->type == GENERIC_VALUE_STORE);
+  if (store->old_ptr != NULL)
+    store_migrate(store, 0xFFFFFFFFU);
+  touch_all_slots(store);
   return slot_array(store->ptr);
 }
@@ -1,7 +1,26 @@
 #include "os_interface.h"
 
 #include "windows.h"
+#include <malloc.h>
 
 uint64 get_tick_count() {
   return GetTickCount();
 }
+
+void trim_os_heap() {
+  _heapmin();
+}
+
+// Large pages require a privilege that processes usually don't have, so they're not requested
+
+void *map_mem_pages(uint64 byte_size, bool huge_pages) {
+  return VirtualAlloc(NULL, byte_size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+}
+
+void unmap_mem_pages(void *ptr, uint64 byte_size) {
+  VirtualFree(ptr, 0, MEM_RELEASE);
+}
+
+void *remap_mem_pages(void *ptr, uint64 byte_size, uint64 new_byte_size, bool huge_pages) {
+  return NULL;
+}